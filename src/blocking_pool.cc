@@ -0,0 +1,100 @@
+#include "blocking_pool.h"
+#include "fiber_mutex.h"
+#include "log.h"
+#include "scheduler.h"
+
+#include <exception>
+
+namespace sylar {
+
+BlockingPool::BlockingPool(size_t threads, const std::string& name)
+    : max_threads_(threads ? threads : 1)
+    , name_(name) {
+}
+
+BlockingPool::~BlockingPool() {
+    std::vector<Thread::ptr> threads;
+    {
+        MutexType::Lock lock(mutex_);
+        stopping_ = true;
+        threads = threads_;
+    }
+    ConditionBlock::Block block(cond_);
+    block.broadcast();
+    for (auto& thread : threads)
+        thread->join();
+}
+
+void BlockingPool::submit(std::function<void()> task) {
+    Thread::ptr thread;
+    {
+        MutexType::Lock lock(mutex_);
+        tasks_.push_back(std::move(task));
+        // start one more only when every thread is busy
+        if (idle_ < tasks_.size() && threads_.size() < max_threads_) {
+            // index is kept in 15 chars of kernel name
+            std::string suffix = "_" + std::to_string(threads_.size());
+            thread.reset(new Thread(std::bind(&BlockingPool::run, this), name_.substr(0, 15 - suffix.size()) + suffix));
+            threads_.push_back(thread);
+        }
+    }
+    if (thread) {
+        thread->run();
+        return;
+    }
+    ConditionBlock::Block block(cond_);
+    block.signal();
+}
+
+void BlockingPool::await(const std::function<void()>& fn) {
+    // no fiber to switch from, caller block itself
+    if (!Scheduler::get_this()) {
+        fn();
+        return;
+    }
+    FiberWaiter waiter;
+    std::exception_ptr error;
+    Mutex mutex;
+    mutex.lock();
+    submit([&fn, &waiter, &error, &mutex]() {
+        try {
+            fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // waiter hold mutex until it is switched out
+        mutex.lock();
+        mutex.unlock();
+        waiter.wake();
+    });
+    waiter.park(mutex);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+size_t BlockingPool::get_thread_count() {
+    MutexType::Lock lock(mutex_);
+    return threads_.size();
+}
+
+void BlockingPool::run() {
+    SYLAR_FMT_DEBUG("blocking pool thread run, pool name: %s", name_.c_str());
+    while (true) {
+        std::function<void()> task;
+        {
+            MutexType::Lock lock(mutex_);
+            idle_++;
+            while (tasks_.empty() && !stopping_)
+                cond_.wait();
+            idle_--;
+            // queue is drained before stop
+            if (tasks_.empty())
+                return;
+            task.swap(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+}
@@ -0,0 +1,111 @@
+#ifndef __SYLAR_SRC_BLOCKING_POOL_H__
+#define __SYLAR_SRC_BLOCKING_POOL_H__
+
+#include "mutex.h"
+#include "noncopyable.h"
+#include "singleton.h"
+#include "thread.h"
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+
+/**
+ * @brief threads running blocking calls away from io workers
+ * @details file io never wait in epoll and cpu heavy work never yield, on
+ *          io worker both stall every socket of it. fiber hand such call
+ *          to pool and is scheduled back when it is done. threads are
+ *          started on demand, at most max threads
+ */
+class BlockingPool : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief Construct a new Blocking Pool object, no thread until used
+     * @param[in] threads max threads
+     * @param[in] name thread name prefix
+     */
+    explicit BlockingPool(size_t threads = 4, const std::string& name = "blocking");
+
+    /**
+     * @brief Destroy the Blocking Pool object, queued tasks are run first
+     */
+    ~BlockingPool();
+
+    /**
+     * @brief run task on pool, do not wait
+     * @param[in] task task
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief run fn on pool, current fiber yield until it is done
+     * @details fiber is scheduled back to its scheduler. outside scheduler
+     *          fn is run by caller. exception of fn is thrown again here
+     * @param[in] fn blocking call
+     */
+    void await(const std::function<void()>& fn);
+
+    /**
+     * @brief Get the thread count object, threads started
+     */
+    size_t get_thread_count();
+
+private:
+    /**
+     * @brief pool thread loop
+     */
+    void run();
+
+private:
+    /// max threads
+    size_t max_threads_ {0};
+    /// thread name prefix
+    std::string name_ {""};
+    /// started threads
+    std::vector<Thread::ptr> threads_ {};
+    /// queued tasks
+    std::deque<std::function<void()>> tasks_ {};
+    /// threads waiting for task
+    size_t idle_ {0};
+    /// destroying
+    bool stopping_ {false};
+    /// mutex
+    MutexType mutex_ {};
+    /// task queued or stopping
+    ConditionBlock cond_ {mutex_};
+};
+
+typedef Singleton<BlockingPool> BlockingPoolMgr;
+
+/**
+ * @brief run fn on blocking pool, current fiber yield until it return
+ * @details for file io and cpu heavy work inside io worker, such as servlet
+ *          compressing body. fn must not use fiber api, it run on a plain
+ *          thread
+ * @param[in] fn blocking call
+ * @return result of fn
+ */
+template<typename F>
+auto await_blocking(F&& fn) -> std::invoke_result_t<F&> {
+    typedef std::invoke_result_t<F&> Result;
+    if constexpr (std::is_void_v<Result>) {
+        BlockingPoolMgr::get_instance()->await([&fn]() { fn(); });
+    } else {
+        std::optional<Result> result;
+        BlockingPoolMgr::get_instance()->await([&fn, &result]() { result.emplace(fn()); });
+        return std::move(*result);
+    }
+}
+
+}
+
+#endif
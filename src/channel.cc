@@ -0,0 +1,144 @@
+#include "channel.h"
+#include "scheduler.h"
+#include "timer.h"
+
+namespace sylar {
+
+/// waiter trying its cases again, its own op could notify it
+static thread_local ChannelWaiter* t_checking = nullptr;
+
+bool ChannelWaiter::fire() {
+    if (t_checking == this)
+        return false;
+    if (fired.exchange(true))
+        return false;
+    // waiter hold mutex until it is switched out
+    mutex.lock();
+    mutex.unlock();
+    waiter.wake();
+    return true;
+}
+
+void ChannelBase::close() {
+    if (closed_.exchange(true))
+        return;
+    std::deque<ChannelWaiter::ptr> waiters[2];
+    mutex_.lock();
+    for (int i = 0; i < 2; i++) {
+        waiters[i].swap(waiters_[i]);
+        waiting_[i].store(0);
+    }
+    mutex_.unlock();
+    for (int i = 0; i < 2; i++) {
+        for (auto& waiter : waiters[i])
+            waiter->fire();
+    }
+}
+
+void ChannelBase::wake_one(Side side) {
+    while (true) {
+        ChannelWaiter::ptr waiter;
+        mutex_.lock();
+        if (waiters_[side].empty()) {
+            mutex_.unlock();
+            return;
+        }
+        waiter = waiters_[side].front();
+        waiters_[side].pop_front();
+        waiting_[side].fetch_sub(1);
+        mutex_.unlock();
+        // woken by other channel of its select, try next
+        if (waiter->fire())
+            return;
+    }
+}
+
+void ChannelBase::add_waiter(Side side, ChannelWaiter::ptr waiter) {
+    Mutex::Lock lock(mutex_);
+    waiters_[side].push_back(waiter);
+    waiting_[side].fetch_add(1);
+}
+
+void ChannelBase::remove_waiter(Side side, ChannelWaiter::ptr waiter) {
+    Mutex::Lock lock(mutex_);
+    auto& waiters = waiters_[side];
+    for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        if (*it == waiter) {
+            waiters.erase(it);
+            waiting_[side].fetch_sub(1);
+            return;
+        }
+    }
+}
+
+int ChannelBase::wait_any(const std::vector<Case>& cases, uint64_t timeout) {
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (cases[i].op())
+            return i;
+    }
+    if (timeout == 0)
+        return -1;
+    ChannelWaiter::ptr waiter = std::make_shared<ChannelWaiter>();
+    Timer::ptr timer;
+    TimerManager* timers = dynamic_cast<TimerManager*>(Scheduler::get_this());
+    if (timeout != ~0ull && timers) {
+        std::weak_ptr<ChannelWaiter> weak(waiter);
+        timer = timers->add_timer(timeout, false, [weak]() {
+            ChannelWaiter::ptr waiter = weak.lock();
+            if (!waiter)
+                return;
+            waiter->timeout.store(true);
+            waiter->fire();
+        }, "channel wait");
+    }
+    int done = -1;
+    bool woken = false;
+    while (true) {
+        waiter->mutex.lock();
+        waiter->fired.store(false);
+        waiter->waiter.woken.store(false, std::memory_order_relaxed);
+        for (auto& c : cases)
+            c.channel->add_waiter(c.side, waiter);
+        // registered before trying again, item made after this see waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        t_checking = waiter.get();
+        for (size_t i = 0; i < cases.size(); i++) {
+            if (cases[i].op()) {
+                done = i;
+                break;
+            }
+        }
+        t_checking = nullptr;
+        if ((done >= 0 || waiter->timeout.load()) && !waiter->fired.exchange(true)) {
+            waiter->mutex.unlock();
+        } else {
+            // nothing ready, or a waker is on its way and its wake is taken here
+            waiter->waiter.park(waiter->mutex);
+            woken = true;
+        }
+        for (auto& c : cases)
+            c.channel->remove_waiter(c.side, waiter);
+        if (done >= 0 || waiter->timeout.load())
+            break;
+        for (size_t i = 0; i < cases.size(); i++) {
+            if (cases[i].op()) {
+                done = i;
+                break;
+            }
+        }
+        if (done >= 0)
+            break;
+    }
+    if (timer)
+        timer->cancel();
+    // wake could be meant for a case not done, pass it on
+    if (woken && (done < 0 || cases.size() > 1)) {
+        for (size_t i = 0; i < cases.size(); i++) {
+            if ((int)i != done)
+                cases[i].channel->notify(cases[i].side);
+        }
+    }
+    return done;
+}
+
+}
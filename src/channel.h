@@ -0,0 +1,446 @@
+#ifndef __SYLAR_SRC_CHANNEL_H__
+#define __SYLAR_SRC_CHANNEL_H__
+
+#include "fiber_mutex.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+
+/**
+ * @brief fiber waiting on one or more channels
+ * @details woken once per round, by first ready channel, close or timer.
+ *          shared by wait queues of all channels it wait on, so a stale
+ *          entry popped by waker stay valid
+ */
+struct ChannelWaiter {
+    /// share pointer
+    typedef std::shared_ptr<ChannelWaiter> ptr;
+
+    /**
+     * @brief wake waiter if nobody did in this round
+     * @return false if already woken
+     */
+    bool fire();
+
+    /// parked fiber
+    FiberWaiter waiter {};
+    /// hold by waiter until it is switched out
+    Mutex mutex {};
+    /// woken in this round
+    std::atomic<bool> fired {false};
+    /// timer fired
+    std::atomic<bool> timeout {false};
+};
+
+/**
+ * @brief wait queues and close state of a channel, not typed
+ */
+class ChannelBase : Noncopyable {
+public:
+    /// wait queue side
+    enum Side {
+        /// fibers wait for item
+        RECV = 0,
+        /// fibers wait for room
+        SEND = 1,
+    };
+
+    /**
+     * @brief a case of wait, tried again whenever waiter is woken
+     */
+    struct Case {
+        /// channel
+        ChannelBase* channel;
+        /// queue to wait in
+        Side side;
+        /// try without waiting, true if done or channel closed
+        std::function<bool()> op;
+    };
+
+    /**
+     * @brief Destroy the Channel Base object
+     */
+    virtual ~ChannelBase() {}
+
+    /**
+     * @brief close channel, all waiters are woken
+     * @details send fail after close, recv drain buffered items then fail
+     */
+    void close();
+
+    /**
+     * @brief channel is closed
+     */
+    bool is_closed() { return closed_.load(std::memory_order_acquire); }
+
+    /**
+     * @brief wait until one case is done
+     * @details case are tried in order, the first done one win
+     * @param[in] cases cases
+     * @param[in] timeout ms, ~0ull wait forever. timer of current IOManager
+     *            is used, no timeout outside IOManager
+     * @return index of done case, -1 if timeout
+     */
+    static int wait_any(const std::vector<Case>& cases, uint64_t timeout = ~0ull);
+
+protected:
+    /**
+     * @brief wake one waiter of side if any
+     * @details cheap when nobody wait, call after item or room is made
+     */
+    void notify(Side side) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_[side].load(std::memory_order_relaxed) > 0)
+            wake_one(side);
+    }
+
+protected:
+    /// closed
+    std::atomic<bool> closed_ {false};
+
+private:
+    /**
+     * @brief wake first waiter not woken by others
+     */
+    void wake_one(Side side);
+
+    /**
+     * @brief add waiter to side
+     */
+    void add_waiter(Side side, ChannelWaiter::ptr waiter);
+
+    /**
+     * @brief remove waiter from side if it is still there
+     */
+    void remove_waiter(Side side, ChannelWaiter::ptr waiter);
+
+private:
+    /// waiters of each side
+    std::atomic<uint32_t> waiting_[2] {{0}, {0}};
+    /// wait queue mutex
+    Mutex mutex_ {};
+    /// parked waiters of each side, in arrival order
+    std::deque<ChannelWaiter::ptr> waiters_[2] {};
+};
+
+/**
+ * @brief go style channel passing items between fibers
+ * @details bounded channel keep items in a lock free ring (Vyukov MPMC
+ *          queue), unbounded one in a deque with short mutex section.
+ *          wait queues are only locked when someone is parked, send park
+ *          while full and recv park while empty. outside scheduler caller
+ *          spin with yield instead
+ */
+template<typename T>
+class Channel : public ChannelBase {
+public:
+    /// share pointer
+    typedef std::shared_ptr<Channel> ptr;
+
+    /**
+     * @brief Construct a new Channel object
+     * @param[in] capacity buffered items, rounded up to power of 2. 0 for
+     *            unbounded, send never park
+     */
+    explicit Channel(size_t capacity = 0) {
+        if (capacity == 0)
+            return;
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        mask_ = size - 1;
+    }
+
+    /**
+     * @brief Destroy the Channel object, items left are destroyed
+     */
+    ~Channel() {
+        if (!cells_)
+            return;
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        for (size_t pos = head_.load(std::memory_order_relaxed); pos != tail; pos++)
+            reinterpret_cast<T*>(&cells_[pos & mask_].storage)->~T();
+    }
+
+    /**
+     * @brief send item, park while channel is full
+     * @param[in] item item, moved only when sent
+     * @param[in] timeout ms, ~0ull wait forever
+     * @return false if closed or timeout
+     */
+    template<typename U>
+    bool send(U&& item, uint64_t timeout = ~0ull) {
+        if (try_send(std::forward<U>(item)))
+            return true;
+        if (is_closed())
+            return false;
+        bool ok = false;
+        std::vector<Case> cases {{this, SEND, [this, &item, &ok]() {
+            ok = try_send(std::forward<U>(item));
+            return ok || is_closed();
+        }}};
+        wait_any(cases, timeout);
+        return ok;
+    }
+
+    /**
+     * @brief send item without waiting
+     * @param[in] item item, moved only when sent
+     * @return false if full or closed
+     */
+    template<typename U>
+    bool try_send(U&& item) {
+        if (is_closed())
+            return false;
+        if (cells_) {
+            if (!enqueue(std::forward<U>(item)))
+                return false;
+        } else {
+            Mutex::Lock lock(items_mutex_);
+            items_.emplace_back(std::forward<U>(item));
+        }
+        notify(RECV);
+        return true;
+    }
+
+    /**
+     * @brief receive item, park while channel is empty
+     * @param[out] item received item
+     * @param[in] timeout ms, ~0ull wait forever
+     * @return false if closed and drained, or timeout
+     */
+    bool recv(T& item, uint64_t timeout = ~0ull) {
+        bool ok = false;
+        if (try_recv(item, ok))
+            return ok;
+        std::vector<Case> cases {{this, RECV, [this, &item, &ok]() {
+            return try_recv(item, ok);
+        }}};
+        wait_any(cases, timeout);
+        return ok;
+    }
+
+    /**
+     * @brief receive item without waiting
+     * @param[out] item received item
+     * @return false if empty
+     */
+    bool try_recv(T& item) {
+        bool ok = false;
+        try_recv(item, ok);
+        return ok;
+    }
+
+    /**
+     * @brief receive item or see channel drained
+     * @param[out] item received item
+     * @param[out] ok item is received
+     * @return false if empty and not closed, recv need wait
+     */
+    bool try_recv(T& item, bool& ok) {
+        ok = pop(item);
+        if (ok)
+            return true;
+        if (!is_closed())
+            return false;
+        // item sent just before close
+        ok = pop(item);
+        return true;
+    }
+
+    /**
+     * @brief buffered items, approximate under concurrency
+     */
+    size_t size() {
+        if (!cells_) {
+            Mutex::Lock lock(items_mutex_);
+            return items_.size();
+        }
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * @brief Get the capacity object, 0 if unbounded
+     */
+    size_t get_capacity() { return cells_ ? mask_ + 1 : 0; }
+
+private:
+    /**
+     * @brief take one item, room made is notified
+     */
+    bool pop(T& item) {
+        if (cells_) {
+            if (!dequeue(item))
+                return false;
+            notify(SEND);
+            return true;
+        }
+        Mutex::Lock lock(items_mutex_);
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        return true;
+    }
+
+    /**
+     * @brief put item into ring
+     * @return false if full
+     */
+    template<typename U>
+    bool enqueue(U&& item) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // slot not consumed since last lap
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage) T(std::forward<U>(item));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief take item from ring
+     * @return false if empty
+     */
+    bool dequeue(T& item) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // slot not filled yet
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        T* value = reinterpret_cast<T*>(&cell->storage);
+        item = std::move(*value);
+        value->~T();
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    /**
+     * @brief ring slot, seq tell which lap could use it
+     */
+    struct Cell {
+        /// pos + 1 when filled, pos + size when free for next lap
+        std::atomic<size_t> seq {0};
+        /// item
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    /// ring of bounded channel, nullptr if unbounded
+    std::unique_ptr<Cell[]> cells_ {};
+    /// ring size - 1
+    size_t mask_ {0};
+    /// next pos to send, own cache line
+    alignas(64) std::atomic<size_t> tail_ {0};
+    /// next pos to recv, own cache line
+    alignas(64) std::atomic<size_t> head_ {0};
+    /// items of unbounded channel
+    std::deque<T> items_ {};
+    /// items mutex
+    Mutex items_mutex_ {};
+};
+
+/**
+ * @brief wait on several channels at once, like go select
+ * @details add cases, then wait. cases are tried in order added, the first
+ *          ready one is done and others are left untouched
+ */
+class ChannelSelect {
+public:
+    /**
+     * @brief add receive case
+     * @param[in] channel channel
+     * @param[out] item received item
+     * @param[out] ok false if channel is closed and drained, optional
+     */
+    template<typename T>
+    ChannelSelect& recv(std::shared_ptr<Channel<T>> channel, T& item, bool* ok = nullptr) {
+        Channel<T>* ch = channel.get();
+        cases_.push_back({ch, ChannelBase::RECV, [ch, &item, ok]() {
+            bool received = false;
+            if (!ch->try_recv(item, received))
+                return false;
+            if (ok)
+                *ok = received;
+            return true;
+        }});
+        return *this;
+    }
+
+    /**
+     * @brief add send case
+     * @param[in] channel channel
+     * @param[in] item item, kept by select until sent
+     * @param[out] ok false if channel is closed, optional
+     */
+    template<typename T>
+    ChannelSelect& send(std::shared_ptr<Channel<T>> channel, T item, bool* ok = nullptr) {
+        Channel<T>* ch = channel.get();
+        auto value = std::make_shared<T>(std::move(item));
+        cases_.push_back({ch, ChannelBase::SEND, [ch, value, ok]() {
+            bool sent = ch->try_send(std::move(*value));
+            if (!sent && !ch->is_closed())
+                return false;
+            if (ok)
+                *ok = sent;
+            return true;
+        }});
+        return *this;
+    }
+
+    /**
+     * @brief wait until one case is done
+     * @details channels must outlive select
+     * @param[in] timeout ms, ~0ull wait forever
+     * @return index of done case in order added, -1 if timeout
+     */
+    int wait(uint64_t timeout = ~0ull) { return ChannelBase::wait_any(cases_, timeout); }
+
+private:
+    /// cases
+    std::vector<ChannelBase::Case> cases_ {};
+};
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "epoch.h"
+#include "mutex.h"
+
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+
+/// retire count before trying to free
+static const size_t s_reclaim_batch = 64;
+/// quiescent states between tries to free
+static const uint32_t s_quiescent_batch = 64;
+
+namespace {
+
+/**
+ * @brief retired entry
+ */
+struct Retired {
+    /// entry
+    void* ptr;
+    /// deleter
+    Epoch::Deleter deleter;
+    /// global epoch when retired
+    uint64_t epoch;
+};
+
+/**
+ * @brief epoch state of one thread
+ */
+struct EpochRecord {
+    /// epoch observed, 0 if holding nothing
+    alignas(64) std::atomic<uint64_t> epoch {0};
+    /// announce quiescent states
+    bool online {false};
+    /// guard nesting
+    uint32_t depth {0};
+    /// quiescent states since last try to free
+    uint32_t quiescent {0};
+    /// retired, not freed yet
+    std::vector<Retired> limbo {};
+};
+
+/**
+ * @brief global state, never freed, threads may exit after static destruction
+ */
+struct EpochState {
+    /// global epoch, starts from 1, 0 means offline
+    alignas(64) std::atomic<uint64_t> epoch {1};
+    /// registry mutex
+    Spinlock mutex {};
+    /// records of all threads, reused after thread exit
+    std::vector<EpochRecord*> records {};
+    /// free records
+    std::vector<EpochRecord*> free_records {};
+    /// entries left by exited threads
+    std::vector<Retired> orphans {};
+};
+
+EpochState* get_state() {
+    static EpochState* s_state = new EpochState;
+    return s_state;
+}
+
+/**
+ * @brief own record of thread, registered on first use
+ */
+struct LocalRecord {
+    LocalRecord() {
+        EpochState* state = get_state();
+        Spinlock::Lock lock(state->mutex);
+        if (!state->free_records.empty()) {
+            record = state->free_records.back();
+            state->free_records.pop_back();
+        } else {
+            record = new EpochRecord;
+            state->records.push_back(record);
+        }
+    }
+
+    ~LocalRecord() {
+        EpochState* state = get_state();
+        record->epoch.store(0, std::memory_order_release);
+        record->online = false;
+        record->depth = 0;
+        Spinlock::Lock lock(state->mutex);
+        state->orphans.insert(state->orphans.end(), record->limbo.begin(), record->limbo.end());
+        record->limbo.clear();
+        state->free_records.push_back(record);
+    }
+
+    /// record
+    EpochRecord* record {nullptr};
+};
+
+EpochRecord* get_record() {
+    static thread_local LocalRecord t_local;
+    return t_local.record;
+}
+
+/**
+ * @brief move global epoch if every thread holding reference has seen it
+ * @return global epoch after try
+ */
+uint64_t try_advance(EpochState* state) {
+    std::vector<Retired> freed;
+    uint64_t epoch = state->epoch.load();
+    {
+        Spinlock::Lock lock(state->mutex);
+        for (auto record : state->records) {
+            uint64_t seen = record->epoch.load();
+            if (seen != 0 && seen != epoch)
+                return epoch;
+        }
+        if (state->epoch.compare_exchange_strong(epoch, epoch + 1))
+            epoch++;
+        // orphans are freed outside lock
+        auto& orphans = state->orphans;
+        size_t kept = 0;
+        for (size_t i = 0; i < orphans.size(); i++) {
+            if (orphans[i].epoch + 2 <= epoch)
+                freed.push_back(orphans[i]);
+            else
+                orphans[kept++] = orphans[i];
+        }
+        orphans.resize(kept);
+    }
+    for (auto& item : freed)
+        item.deleter(item.ptr);
+    return epoch;
+}
+
+/**
+ * @brief announce global epoch and make it seen before following reads
+ */
+void announce(EpochRecord* record, EpochState* state) {
+    record->epoch.store(state->epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+}
+
+void Epoch::enter() {
+    EpochRecord* record = get_record();
+    // online thread is protected until next quiescent state
+    if (record->depth++ == 0 && !record->online)
+        announce(record, get_state());
+}
+
+void Epoch::exit() {
+    EpochRecord* record = get_record();
+    if (--record->depth == 0 && !record->online)
+        record->epoch.store(0, std::memory_order_release);
+}
+
+void Epoch::online() {
+    EpochRecord* record = get_record();
+    record->online = true;
+    announce(record, get_state());
+}
+
+void Epoch::offline() {
+    EpochRecord* record = get_record();
+    record->online = false;
+    if (record->depth == 0)
+        record->epoch.store(0, std::memory_order_release);
+}
+
+void Epoch::quiescent() {
+    EpochRecord* record = get_record();
+    if (!record->online)
+        return;
+    // value seen late only hold epoch back, no fence needed
+    uint64_t epoch = get_state()->epoch.load(std::memory_order_relaxed);
+    if (record->epoch.load(std::memory_order_relaxed) != epoch)
+        record->epoch.store(epoch, std::memory_order_release);
+    if (++record->quiescent < s_quiescent_batch || record->limbo.empty())
+        return;
+    record->quiescent = 0;
+    reclaim();
+}
+
+void Epoch::retire(void* ptr, Deleter deleter) {
+    EpochRecord* record = get_record();
+    record->limbo.push_back({ptr, deleter, get_state()->epoch.load()});
+    if (record->limbo.size() % s_reclaim_batch == 0)
+        reclaim();
+}
+
+size_t Epoch::reclaim() {
+    EpochRecord* record = get_record();
+    // own epoch is not refreshed, task calling this may still hold reference
+    uint64_t epoch = try_advance(get_state());
+    std::vector<Retired> freed;
+    auto& limbo = record->limbo;
+    size_t kept = 0;
+    for (size_t i = 0; i < limbo.size(); i++) {
+        if (limbo[i].epoch + 2 <= epoch)
+            freed.push_back(limbo[i]);
+        else
+            limbo[kept++] = limbo[i];
+    }
+    limbo.resize(kept);
+    // deleter may retire again
+    for (auto& item : freed)
+        item.deleter(item.ptr);
+    return record->limbo.size();
+}
+
+uint64_t Epoch::get_epoch() {
+    return get_state()->epoch.load(std::memory_order_relaxed);
+}
+
+}
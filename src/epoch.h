@@ -0,0 +1,104 @@
+#ifndef __SYLAR_SRC_EPOCH_H__
+#define __SYLAR_SRC_EPOCH_H__
+
+#include "noncopyable.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+/**
+ * @brief epoch based reclamation for lock free readers
+ * @details writer unlink entry, then retire it instead of delete. entry is
+ *          freed once global epoch moved twice after retire, so every
+ *          thread has passed a point holding no old reference.
+ *
+ *          scheduler workers are online: they are treated as reading all
+ *          the time and announce quiescent state between tasks, read side
+ *          cost nothing. other threads read inside EpochGuard. worker
+ *          sleeping in idle go offline, so it never hold epoch back.
+ *
+ *          reference must not be kept across fiber yield, another task may
+ *          run on the thread and announce quiescent state. copy what is
+ *          needed, such as shared_ptr, before yield
+ */
+class Epoch {
+public:
+    /// deleter of retired entry
+    typedef void (*Deleter)(void*);
+
+    /**
+     * @brief enter read section, nested is allowed
+     */
+    static void enter();
+
+    /**
+     * @brief leave read section
+     */
+    static void exit();
+
+    /**
+     * @brief current thread start announcing quiescent states
+     */
+    static void online();
+
+    /**
+     * @brief current thread hold no reference until online again
+     */
+    static void offline();
+
+    /**
+     * @brief current online thread hold no reference now
+     * @details called by scheduler between tasks, free retired entries
+     *          from time to time
+     */
+    static void quiescent();
+
+    /**
+     * @brief free entry once no thread could see it
+     * @param[in] ptr unlinked entry
+     * @param[in] deleter deleter
+     */
+    static void retire(void* ptr, Deleter deleter);
+
+    /**
+     * @brief free entry by delete once no thread could see it
+     * @param[in] ptr unlinked entry
+     */
+    template<typename T>
+    static void retire(T* ptr) {
+        retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    /**
+     * @brief try to move epoch, then free retired entries which are safe
+     * @return entries of current thread still waiting
+     */
+    static size_t reclaim();
+
+    /**
+     * @brief Get the epoch object, global epoch
+     */
+    static uint64_t get_epoch();
+};
+
+/**
+ * @brief scoped epoch read section
+ */
+class EpochGuard : Noncopyable {
+public:
+    /**
+     * @brief Construct a new Epoch Guard object, enter
+     */
+    EpochGuard() { Epoch::enter(); }
+
+    /**
+     * @brief Destroy the Epoch Guard object, exit
+     */
+    ~EpochGuard() { Epoch::exit(); }
+};
+
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "fdmanager.h"
+#include "epoch.h"
 #include "log.h"
 
 
@@ -6,7 +7,6 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
-#include <algorithm>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -25,8 +25,7 @@ FdCtx::FdCtx(int fd): fd_(fd) {
 
 
 FdCtx::~FdCtx() {
-    if (fd_ != 0)
-        close(fd_);
+    // fd is closed by owner, context may be freed late when number is reused
     SYLAR_FMT_DEBUG("fd obj has been destoried, fd: %d", fd_);
 }
 
@@ -39,6 +38,7 @@ void FdCtx::init() {
     }
     // check if fule is socket
     is_socket_ = S_ISSOCK(file_stat.st_mode);
+    is_file_ = S_ISREG(file_stat.st_mode) || S_ISBLK(file_stat.st_mode);
     // if fd is socket type, need set non-block state
     if (is_socket_) {
         set_nonblock(true);
@@ -47,14 +47,15 @@ void FdCtx::init() {
 
 // set fd non block state
 void FdCtx::set_nonblock(bool nonblock) {
-    int flags = fcntl(fd_, F_GETFD);
+    // O_NONBLOCK is a file status flag, not a descriptor flag
+    int flags = fcntl(fd_, F_GETFL);
     if (flags == -1) {
         SYLAR_FMT_ERR("get fd stat failed, fd: %d, err: %s", fd_, strerror(errno));
         return;
     }
     // set nonblock
-    flags = nonblock ? (flags|O_NONBLOCK) : (flags&O_NONBLOCK);
-    if (fcntl(fd_, F_SETFD, flags) == -1) {
+    flags = nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (fcntl(fd_, F_SETFL, flags) == -1) {
         SYLAR_FMT_ERR("set fd stat failed, fd: %d, err: %s", fd_, strerror(errno));
         return;        
     }
@@ -89,49 +90,80 @@ void FdCtx::set_timeout(int timeout) {
 }
 
 
-FdManager::FdManager() {
-    // resize to 64 
-    fd_vec_.reserve(64);
+FdManager::Table::Table(size_t n)
+    : size(n)
+    , slots(new std::atomic<FdCtx::ptr*>[n]) {
+    for (size_t i = 0; i < n; i++)
+        slots[i].store(nullptr, std::memory_order_relaxed);
+}
+
+FdManager::FdManager()
+    : table_(new Table(64)) {
 }
 
 FdManager::~FdManager() {
-    fd_vec_.clear();
+    Table* table = table_.load();
+    for (size_t i = 0; i < table->size; i++)
+        delete table->slots[i].load();
+    delete table;
 }
 
 // add fd
-void FdManager::add_fdctx(int fd) {
-    if (get_fdctx(fd) != nullptr) {
+void FdManager::add_fdctx(int fd, bool replace) {
+    if (fd < 0)
+        return;
+    MutexType::Lock lock(mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (!replace && (size_t)fd < table->size && table->slots[fd].load(std::memory_order_relaxed) != nullptr) {
         SYLAR_FMT_DEBUG("dont need to add fd, already exist, fd: %d", fd);
         return;
     }
-    // mutex 
-    MutexType::WriteLock lock(mutex_);
-    fd_vec_.emplace_back(new FdCtx(fd));
+    if ((size_t)fd >= table->size) {
+        size_t size = table->size;
+        while (size <= (size_t)fd)
+            size <<= 1;
+        // entries are shared, old table is freed after readers left it
+        Table* bigger = new Table(size);
+        for (size_t i = 0; i < table->size; i++)
+            bigger->slots[i].store(table->slots[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        table_.store(bigger, std::memory_order_release);
+        Epoch::retire(table);
+        table = bigger;
+    }
+    // context of fd closed without hook is dropped
+    FdCtx::ptr* old = table->slots[fd].exchange(new FdCtx::ptr(new FdCtx(fd)), std::memory_order_release);
+    if (old)
+        Epoch::retire(old);
     SYLAR_FMT_DEBUG("add fd to manager success: %d", fd);
 }
 
 // delete fd context
 void FdManager::del_fdctx(int fd) {
-    // remove context
-    MutexType::WriteLock lock(mutex_);
-    auto pos = std::remove_if(fd_vec_.begin(), fd_vec_.end(), [fd](FdCtx::ptr ctx) {
-        return ctx->get_fd() == fd;
-    });
-    fd_vec_.erase(pos, fd_vec_.end());
+    if (fd < 0)
+        return;
+    MutexType::Lock lock(mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    if ((size_t)fd >= table->size)
+        return;
+    FdCtx::ptr* ctx = table->slots[fd].exchange(nullptr, std::memory_order_relaxed);
+    if (ctx)
+        Epoch::retire(ctx);
 }
 
 FdCtx::ptr FdManager::get_fdctx(int fd) {
-    MutexType::ReadLock lock(mutex_);
-    auto pos = std::find_if(fd_vec_.begin(), fd_vec_.end(), [fd](FdCtx::ptr ctx) {
-        return ctx->get_fd() == fd;
-    });
-    // not found
-    if (pos == fd_vec_.end()) {
-        SYLAR_FMT_WARN("fd cannnot be found in manager, fd: %d", fd);
-        return nullptr;
+    FdCtx::ptr found;
+    if (fd >= 0) {
+        // lock free, entry is copied before guard is left
+        EpochGuard guard;
+        Table* table = table_.load(std::memory_order_acquire);
+        FdCtx::ptr* ctx = (size_t)fd < table->size ? table->slots[fd].load(std::memory_order_acquire) : nullptr;
+        if (ctx)
+            found = *ctx;
     }
-    // found
-    return *pos;
+    // not found, hooks probe fds they never saw on purpose
+    if (!found)
+        SYLAR_FMT_DEBUG("fd cannot be found in manager, fd: %d", fd);
+    return found;
 }
 
-}
\ No newline at end of file
+}
@@ -3,9 +3,10 @@
 
 #include "mutex.h"
 #include "singleton.h"
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <vector>
 
 namespace sylar {
 
@@ -46,6 +47,11 @@ public:
      */
     bool is_socket() { return is_socket_; }
 
+    /**
+     * @brief if current fd is regular file or block device
+     */
+    bool is_file() { return is_file_; }
+
     /**
      * @brief if current fd is nonblock
      */
@@ -67,6 +73,8 @@ private:
     int fd_ {0};
     /// if fd is socket
     bool is_socket_ {false};
+    /// if fd is regular file or block device, never wait in epoll
+    bool is_file_ {false};
     /// if id is nonblock
     bool is_nonblock_ {false};
     /// timeout
@@ -74,10 +82,15 @@ private:
 };
 
 
+/**
+ * @brief fd contexts indexed by fd
+ * @details lookup is lock free, table and removed entries are freed by
+ *          epoch reclamation. writers are serialized by mutex
+ */
 class FdManager : public std::enable_shared_from_this<FdManager> {
 public:
     typedef std::shared_ptr<FdManager> ptr;
-    typedef RWMutex MutexType;
+    typedef Mutex MutexType;
 
     /**
      * @brief Construct a new Fd Manager object
@@ -92,8 +105,10 @@ public:
     /**
      * @brief add fd to vec
      * @param[in] fd add fd
+     * @param[in] replace fd is just created, context left by closed fd of
+     *            same number is replaced
      */
-    void add_fdctx(int fd);
+    void add_fdctx(int fd, bool replace = false);
 
     /**
      * @brief delete fd from vector
@@ -108,10 +123,26 @@ public:
     FdCtx::ptr get_fdctx(int fd);
 
 private:
-    /// read write lock
-    MutexType mutex_;
-    /// fd context vector
-    std::vector<FdCtx::ptr> fd_vec_;
+    /**
+     * @brief slots of fd, replaced by a bigger one when fd is out of range
+     */
+    struct Table {
+        /**
+         * @brief Construct a new Table object, all slots empty
+         * @param[in] n slot count
+         */
+        Table(size_t n);
+
+        /// slot count
+        size_t size {0};
+        /// context of fd, nullptr if not added
+        std::unique_ptr<std::atomic<FdCtx::ptr*>[]> slots {};
+    };
+
+    /// writer mutex
+    MutexType mutex_ {};
+    /// current table
+    std::atomic<Table*> table_ {nullptr};
 };
 
 typedef Singleton<FdManager> FdMgr;
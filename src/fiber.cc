@@ -32,10 +32,12 @@ static std::atomic<uint64_t> global_fiber_count {0};
 static thread_local Fiber::ptr t_fiber = nullptr;
 // main fiber
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
+// mutex released once yielding fiber is switched out
+static thread_local Mutex* t_yield_unlock = nullptr;
 
 // 
-Fiber::Fiber(std::function<void()>cb, size_t stack_size, bool run_scheduler, const std::string name) : 
-    id_(global_fiber_id++), cb_(cb), run_scheduler_(run_scheduler), name_(name) {
+Fiber::Fiber(Task cb, size_t stack_size, bool run_scheduler, const std::string name) : 
+    id_(global_fiber_id++), cb_(std::move(cb)), run_scheduler_(run_scheduler), name_(name) {
     global_fiber_count++;
     stack_size_ = stack_size ? stack_size : 128 * 1024;
     stack_ = StackAllocator::Alloc(stack_size_);
@@ -77,9 +79,9 @@ Fiber::~Fiber() {
     }
 }
 
-void Fiber::reset(std::function<void ()> cb) {
+void Fiber::reset(Task cb) {
     SYLAR_ASSERT(state_ == State::Term);
-    cb_ = cb;
+    cb_ = std::move(cb);
     if (getcontext(&ctx_)) {
         SYLAR_ASSERT(false);
     }
@@ -120,7 +122,7 @@ Fiber::ptr Fiber::get_this() {
     return t_fiber;
 }
 
-void Fiber::resume() {
+Fiber::State Fiber::resume() {
     set_this(shared_from_this());
     // mark this fiber to running
     state_ = State::Running;
@@ -132,11 +134,21 @@ void Fiber::resume() {
         SYLAR_FMT_DEBUG("resume thread fiber, fiber name: %s, fiber id: %d", name_.c_str(), id_);
         swapcontext(&t_thread_fiber->ctx_, &ctx_);
     }
+    State state = state_;
+    // fiber is switched out, its waker may resume it from now
+    if (t_yield_unlock) {
+        Mutex* mutex = t_yield_unlock;
+        t_yield_unlock = nullptr;
+        mutex->unlock();
+    }
+    return state;
 }
 
 void Fiber::yield() {
     SYLAR_ASSERT(state_ == State::Running || state_ == State::Term);
-    state_ = State::Ready;
+    // finished fiber keep term, so it could be reset
+    if (state_ != State::Term)
+        state_ = State::Ready;
 
     if (run_scheduler_ && Scheduler::is_scheduler_fiber()) {
         set_this(Scheduler::get_schedule_fiber());
@@ -149,5 +161,10 @@ void Fiber::yield() {
     }
 }
 
+void Fiber::yield_unlock(Mutex& mutex) {
+    t_yield_unlock = &mutex;
+    yield();
+}
 
-}
\ No newline at end of file
+
+}
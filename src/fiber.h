@@ -2,6 +2,9 @@
 #define __SYLAR_SRC_FIBER_H__
 
 
+#include "mutex.h"
+#include "task.h"
+
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -23,7 +26,7 @@ public:
      * @param[in] stack_size 
      * @param[in] run_scheduler 
      */
-    Fiber(std::function<void()>cb, size_t stack_size = 0, bool run_scheduler = true, const std::string name = "child");
+    Fiber(Task cb, size_t stack_size = 0, bool run_scheduler = true, const std::string name = "child");
 
     /**
      * @brief Destroy the virtual Fiber object
@@ -31,21 +34,31 @@ public:
     virtual~Fiber();
 
     /**
-     * @brief 
+     * @brief reuse stack of finished fiber for another callback
      * @param[in] cb 
      */
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
 
     /**
      * @brief 
+     * @return state when it switched back, read before its waker could
+     *         resume it again. Term means finished and safe to reset
      */
-    void resume();
+    State resume();
 
     /**
      * @brief 
      */
     void yield();
 
+    /**
+     * @brief yield, mutex is unlocked after this fiber is switched out
+     * @details waker could resume fiber as soon as mutex is released, so it
+     *          must be released after context is saved
+     * @param[in] mutex locked mutex protecting wait queue
+     */
+    void yield_unlock(Mutex& mutex);
+
     /**
      * @brief Get the state object 
      */
@@ -56,6 +69,17 @@ public:
      */
     uint64_t get_id() { return id_; }
 
+    /**
+     * @brief Get the priority object, scheduling class, see Scheduler::Priority
+     */
+    int get_priority() { return priority_; }
+
+    /**
+     * @brief Set the priority object, used when it is scheduled next time
+     * @param[in] priority scheduling class
+     */
+    void set_priority(int priority) { priority_ = priority; }
+
 public:
     /**
      * @brief Set the this object
@@ -101,9 +125,11 @@ private:
     /// stack
     void* stack_ {nullptr};
     /// function
-    std::function<void()> cb_ {nullptr};
+    Task cb_ {};
     /// run scheduler
     bool run_scheduler_ {false};
+    /// scheduling class, normal by default
+    int priority_ {1};
     /// fiber name
     std::string name_ {""};
 };
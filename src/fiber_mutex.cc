@@ -0,0 +1,228 @@
+#include "fiber_mutex.h"
+#include "log.h"
+#include "utils.h"
+
+#include <sched.h>
+
+namespace sylar {
+
+/// tries before parking, lock is usually held for a short time
+static const uint32_t s_spin_count = 64;
+
+FiberWaiter::FiberWaiter()
+    : scheduler(Scheduler::get_this()) {
+    if (scheduler)
+        fiber = Fiber::get_this();
+}
+
+void FiberWaiter::park(Mutex& mutex) {
+    if (scheduler) {
+        fiber->yield_unlock(mutex);
+        return;
+    }
+    mutex.unlock();
+    while (!woken.load(std::memory_order_acquire))
+        sched_yield();
+}
+
+void FiberWaiter::wake() {
+    if (scheduler) {
+        // fiber is switched out, wait queue mutex is released after that
+        scheduler->schedule(fiber);
+        return;
+    }
+    woken.store(true, std::memory_order_release);
+}
+
+bool FiberMutex::try_lock() {
+    // newcomer could not cut in line of starving waiters
+    if (starving_.load())
+        return false;
+    bool locked = false;
+    return locked_.compare_exchange_strong(locked, true, std::memory_order_acquire);
+}
+
+void FiberMutex::lock() {
+    if (try_lock())
+        return;
+    for (uint32_t i = 0; i < s_spin_count; i++) {
+        cpu_relax();
+        if (!locked_.load(std::memory_order_relaxed) && try_lock())
+            return;
+    }
+    FiberWaiter waiter;
+    waiter.since = SystemInfo::get_elapsed();
+    bool requeue = false;
+    mutex_.lock();
+    while (true) {
+        // counted before lock is checked, unlock see it or lock is seen free
+        waiting_.fetch_add(1);
+        bool locked = false;
+        if ((!starving_.load() || requeue) && locked_.compare_exchange_strong(locked, true)) {
+            waiting_.fetch_sub(1);
+            if (requeue)
+                woken_ = false;
+            mutex_.unlock();
+            return;
+        }
+        if (requeue) {
+            // lost to running fiber, keep place at front
+            woken_ = false;
+            if (SystemInfo::get_elapsed() - waiter.since >= 1)
+                starving_.store(true);
+            waiters_.push_front(&waiter);
+        } else {
+            waiters_.push_back(&waiter);
+        }
+        waiter.woken.store(false, std::memory_order_relaxed);
+        waiter.park(mutex_);
+        // owner already in handoff mode
+        if (waiter.handoff)
+            return;
+        requeue = true;
+        mutex_.lock();
+    }
+}
+
+void FiberMutex::unlock() {
+    if (starving_.load()) {
+        mutex_.lock();
+        if (!waiters_.empty()) {
+            FiberWaiter* waiter = waiters_.front();
+            waiters_.pop_front();
+            waiting_.fetch_sub(1);
+            waiter->handoff = true;
+            // back to normal mode once queue is served in time
+            if (waiters_.empty() || SystemInfo::get_elapsed() - waiter->since < 1)
+                starving_.store(false);
+            mutex_.unlock();
+            waiter->wake();
+            return;
+        }
+        starving_.store(false);
+        mutex_.unlock();
+    }
+    locked_.store(false);
+    if (waiting_.load() == 0)
+        return;
+    mutex_.lock();
+    // one woken waiter at a time, it wake next if it fail again
+    if (woken_ || waiters_.empty()) {
+        mutex_.unlock();
+        return;
+    }
+    FiberWaiter* waiter = waiters_.front();
+    waiters_.pop_front();
+    waiting_.fetch_sub(1);
+    woken_ = true;
+    mutex_.unlock();
+    waiter->wake();
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+    FiberWaiter waiter;
+    mutex_.lock();
+    waiters_.push_back(&waiter);
+    // signal after this need queue mutex, so it is not lost
+    mutex.unlock();
+    waiter.park(mutex_);
+    mutex.lock();
+}
+
+void FiberCondition::signal() {
+    mutex_.lock();
+    if (waiters_.empty()) {
+        mutex_.unlock();
+        return;
+    }
+    FiberWaiter* waiter = waiters_.front();
+    waiters_.pop_front();
+    mutex_.unlock();
+    waiter->wake();
+}
+
+void FiberCondition::broadcast() {
+    std::deque<FiberWaiter*> waiters;
+    mutex_.lock();
+    waiters.swap(waiters_);
+    mutex_.unlock();
+    for (auto waiter : waiters)
+        waiter->wake();
+}
+
+bool FiberSemaphore::try_wait() {
+    uint32_t count = count_.load(std::memory_order_relaxed);
+    while (count > 0) {
+        if (count_.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+            return true;
+    }
+    return false;
+}
+
+void FiberSemaphore::wait() {
+    if (try_wait())
+        return;
+    for (uint32_t i = 0; i < s_spin_count; i++) {
+        cpu_relax();
+        if (count_.load(std::memory_order_relaxed) > 0 && try_wait())
+            return;
+    }
+    FiberWaiter waiter;
+    mutex_.lock();
+    // notify add permit only when nobody wait, check again in lock
+    if (try_wait()) {
+        mutex_.unlock();
+        return;
+    }
+    waiters_.push_back(&waiter);
+    // permit is handed over by notify
+    waiter.park(mutex_);
+}
+
+void FiberSemaphore::notify(uint32_t count) {
+    std::deque<FiberWaiter*> woken;
+    mutex_.lock();
+    while (count > 0 && !waiters_.empty()) {
+        woken.push_back(waiters_.front());
+        waiters_.pop_front();
+        count--;
+    }
+    if (count > 0)
+        count_.fetch_add(count, std::memory_order_release);
+    mutex_.unlock();
+    for (auto waiter : woken)
+        waiter->wake();
+}
+
+void WaitGroup::done() {
+    uint32_t count = count_.fetch_sub(1, std::memory_order_acq_rel);
+    if (count == 0) {
+        SYLAR_ERR("wait group done is called more than add");
+        count_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (count > 1)
+        return;
+    std::deque<FiberWaiter*> waiters;
+    mutex_.lock();
+    waiters.swap(waiters_);
+    mutex_.unlock();
+    for (auto waiter : waiters)
+        waiter->wake();
+}
+
+void WaitGroup::wait() {
+    if (count_.load(std::memory_order_acquire) == 0)
+        return;
+    FiberWaiter waiter;
+    mutex_.lock();
+    // last done take mutex before waking, so it see this waiter
+    if (count_.load(std::memory_order_acquire) == 0) {
+        mutex_.unlock();
+        return;
+    }
+    waiters_.push_back(&waiter);
+    waiter.park(mutex_);
+}
+
+}
@@ -0,0 +1,200 @@
+#ifndef __SYLAR_SRC_FIBER_MUTEX_H__
+#define __SYLAR_SRC_FIBER_MUTEX_H__
+
+#include "fiber.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+
+namespace sylar {
+
+/**
+ * @brief fiber parked in a wait queue
+ * @details lives on the stack of waiting fiber. outside scheduler thread
+ *          caller spin with yield instead, there is no fiber to switch from
+ */
+struct FiberWaiter {
+    /**
+     * @brief Construct a new Fiber Waiter object, for current fiber
+     */
+    FiberWaiter();
+
+    /**
+     * @brief wait until woken
+     * @param[in] mutex locked wait queue mutex, unlocked after switch
+     */
+    void park(Mutex& mutex);
+
+    /**
+     * @brief schedule waiting fiber again, call once
+     */
+    void wake();
+
+    /// waiting fiber
+    Fiber::ptr fiber {};
+    /// scheduler to resume on
+    Scheduler* scheduler {nullptr};
+    /// woken, for waiter without scheduler
+    std::atomic<bool> woken {false};
+    /// lock is handed over by waker
+    bool handoff {false};
+    /// first park time in ms
+    uint64_t since {0};
+};
+
+/**
+ * @brief mutex suspend only calling fiber
+ * @details spin briefly, then park in fifo queue. unlock wake first waiter
+ *          to compete with running fibers, which keep lock busy. waiter
+ *          failed for more than 1ms switch mutex to handoff mode, unlock then
+ *          pass lock to first waiter directly until queue is served
+ */
+class FiberMutex : Noncopyable {
+public:
+    /// scoped lock
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    /**
+     * @brief lock, park fiber if it is held
+     */
+    void lock();
+
+    /**
+     * @brief try lock without waiting, fail in handoff mode
+     */
+    bool try_lock();
+
+    /**
+     * @brief unlock, wake or hand over to first waiter
+     */
+    void unlock();
+
+private:
+    /// locked
+    std::atomic<bool> locked_ {false};
+    /// handoff mode, changed with wait queue mutex hold
+    std::atomic<bool> starving_ {false};
+    /// parked fibers, changed with wait queue mutex hold
+    std::atomic<uint32_t> waiting_ {0};
+    /// a woken waiter is on its way, lock must be hold
+    bool woken_ {false};
+    /// wait queue mutex
+    Mutex mutex_ {};
+    /// parked fibers in arrival order
+    std::deque<FiberWaiter*> waiters_ {};
+};
+
+/**
+ * @brief condition variable of FiberMutex
+ */
+class FiberCondition : Noncopyable {
+public:
+    /**
+     * @brief wait for signal, mutex is released while waiting
+     * @details could wake spuriously, check condition in loop
+     * @param[in] mutex locked fiber mutex, locked again when return
+     */
+    void wait(FiberMutex& mutex);
+
+    /**
+     * @brief wake one waiter
+     */
+    void signal();
+
+    /**
+     * @brief wake all waiters
+     */
+    void broadcast();
+
+private:
+    /// wait queue mutex
+    Mutex mutex_ {};
+    /// parked fibers in arrival order
+    std::deque<FiberWaiter*> waiters_ {};
+};
+
+/**
+ * @brief counting semaphore suspend only calling fiber
+ * @details permit is handed to first waiter by notify, waiters are served
+ *          in arrival order
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    /**
+     * @brief Construct a new Fiber Semaphore object
+     * @param[in] count initial permits
+     */
+    FiberSemaphore(uint32_t count = 0) : count_(count) {}
+
+    /**
+     * @brief take one permit, park if none
+     */
+    void wait();
+
+    /**
+     * @brief take one permit without waiting
+     */
+    bool try_wait();
+
+    /**
+     * @brief release permits
+     * @param[in] count permits
+     */
+    void notify(uint32_t count = 1);
+
+    /**
+     * @brief Get the count object, permits not taken
+     */
+    uint32_t get_count() { return count_.load(std::memory_order_relaxed); }
+
+private:
+    /// permits
+    std::atomic<uint32_t> count_ {0};
+    /// wait queue mutex
+    Mutex mutex_ {};
+    /// parked fibers in arrival order
+    std::deque<FiberWaiter*> waiters_ {};
+};
+
+/**
+ * @brief wait for a group of tasks to finish
+ */
+class WaitGroup : Noncopyable {
+public:
+    /**
+     * @brief add tasks
+     * @param[in] count tasks
+     */
+    void add(uint32_t count = 1) { count_.fetch_add(count, std::memory_order_relaxed); }
+
+    /**
+     * @brief one task is done, waiters are woken by the last one
+     */
+    void done();
+
+    /**
+     * @brief wait until all tasks are done
+     */
+    void wait();
+
+    /**
+     * @brief Get the count object, tasks not done
+     */
+    uint32_t get_count() { return count_.load(std::memory_order_acquire); }
+
+private:
+    /// tasks not done
+    std::atomic<uint32_t> count_ {0};
+    /// wait queue mutex
+    Mutex mutex_ {};
+    /// parked fibers
+    std::deque<FiberWaiter*> waiters_ {};
+};
+
+}
+
+#endif
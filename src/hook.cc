@@ -1,11 +1,15 @@
 #include "hook.h"
+#include "blocking_pool.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "log.h"
 #include "timer.h"
 #include "utils.h"
 #include "fdmanager.h"
+#include "fiber_mutex.h"
+#include "mutex.h"
 
+#include <atomic>
 #include <cerrno>
 #include <cstddef>
 #include <cstdio>
@@ -14,8 +18,10 @@
 #include <string>
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 
 #define HOOK_FUNC(XX) \
@@ -34,85 +40,210 @@
     XX(send)    \
     XX(sendto)  \
     XX(sendmsg) \
+    XX(sendfile) \
     XX(close)
 
 
+extern "C" {
+#define XX(name) name##_func name##_f = nullptr;
+    HOOK_FUNC(XX)
+#undef XX
+}
+
 void hook_init() {
 #define XX(name) name##_f = (name##_func)dlsym(RTLD_NEXT, #name);
     HOOK_FUNC(XX)
 #undef XX
 }
 
+/**
+ * @brief load origin funcs before any other static init could call them
+ */
+struct HookIniter {
+    HookIniter() {
+        hook_init();
+    }
+};
+
+static HookIniter s_hook_initer __attribute__((init_priority(101)));
+
 struct timer_info {
+    /// set by first of event and timer, the other one does nothing
+    std::atomic<bool> fired {false};
+    /// woken by timer
     bool cancelled {false};
 };
 
+/**
+ * @brief errno of current thread
+ * @details errno address is cached by compiler, but parked fiber may
+ *          resume on other thread. access errno by it after parking
+ */
+static __attribute__((noipa)) int& thread_errno() {
+    return errno;
+}
+
+/**
+ * @brief io manager to park current fiber in
+ * @return nullptr if thread is not io worker
+ */
+static sylar::IOManager* get_io_manager() {
+    return dynamic_cast<sylar::IOManager*>(sylar::Scheduler::get_this());
+}
+
+/**
+ * @brief get fd context, fd not opened by hooked call such as open is added
+ * @return nullptr if fd is invalid
+ */
+static sylar::FdCtx::ptr get_fdctx(int fd) {
+    auto ctx = sylar::FdMgr::get_instance()->get_fdctx(fd);
+    if (ctx == nullptr && fcntl(fd, F_GETFD) != -1) {
+        sylar::FdMgr::get_instance()->add_fdctx(fd);
+        ctx = sylar::FdMgr::get_instance()->get_fdctx(fd);
+    }
+    return ctx;
+}
+
+/**
+ * @brief timeout of socket set by SO_RCVTIMEO or SO_SNDTIMEO
+ * @return ms, 0 if wait forever
+ */
+static uint64_t get_sock_timeout(int fd, sylar::IOManager::Event event) {
+    struct timeval val = {0, 0};
+    socklen_t len = sizeof(val);
+    int opt = event == sylar::IOManager::Event::READ ? SO_RCVTIMEO : SO_SNDTIMEO;
+    if (getsockopt(fd, SOL_SOCKET, opt, &val, &len) == -1)
+        return 0;
+    return val.tv_sec * 1000 + (val.tv_usec + 999) / 1000;
+}
+
+/**
+ * @brief park current fiber until fd is ready or timeout
+ * @param[in] iom io manager of current thread
+ * @param[in] fd socket fd
+ * @param[in] event READ or WRITE
+ * @param[in] timeout ms, 0 means wait forever
+ * @param[in] hook_name hooked func name
+ * @return 0 if woken by event, ETIMEDOUT if timeout, EBUSY if fd could not be waited
+ */
+static int wait_fd(sylar::IOManager* iom, int fd, sylar::IOManager::Event event, uint64_t timeout,
+    const char* hook_name) {
+    std::shared_ptr<timer_info> info(new timer_info);
+    sylar::FiberWaiter waiter;
+    sylar::Mutex mutex;
+    // stack of parked fiber is only touched by the first waker
+    auto wake = [&waiter, &mutex]() {
+        // waiter hold mutex until it is switched out
+        mutex.lock();
+        mutex.unlock();
+        waiter.wake();
+    };
+    mutex.lock();
+    if (!iom->add_oneshot_event(fd, event, [info, wake]() {
+        if (!info->fired.exchange(true))
+            wake();
+    })) {
+        mutex.unlock();
+        SYLAR_FMT_ERR("wait fd event failed, fd: %d, event: %d, func name: %s", fd, event, hook_name);
+        return EBUSY;
+    }
+    sylar::Timer::ptr timer;
+    if (timeout > 0) {
+        timer = iom->add_condition_timer(timeout, false, info, [info, iom, fd, event, wake]() {
+            if (info->fired.exchange(true))
+                return;
+            info->cancelled = true;
+            iom->cancel_fd_event(fd, event);
+            wake();
+        }, hook_name);
+    }
+    waiter.park(mutex);
+    if (timer)
+        timer->cancel();
+    if (info->cancelled) {
+        SYLAR_FMT_DEBUG("wait fd event timeout, fd: %d, event: %d, func name: %s", fd, event, hook_name);
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
 template<typename OriginFunc, typename... Args>
-static ssize_t do_io(int fd, OriginFunc func, sylar::IOManager::Event event, const std::string& hook_name, Args&&... args) {
+static ssize_t do_io(int fd, OriginFunc func, sylar::IOManager::Event event, const char* hook_name, Args... args) {
     // check if need hook
     if (!sylar::SystemInfo::get_hook_enabled()) {
-        SYLAR_FMT_DEBUG("do io op dont use hook, fd: %d, func name: %s", fd, hook_name.c_str());
-        return func(fd, std::forward<Args>(args)...);
+        SYLAR_FMT_DEBUG("do io op dont use hook, fd: %d, func name: %s", fd, hook_name);
+        return func(fd, args...);
     }
-    // try to add fd, make sure fd exist
-    // sylar::FdMgr::get_instance()->add_fdctx(fd);
-    auto ctx = sylar::FdMgr::get_instance()->get_fdctx(fd);
+    auto ctx = get_fdctx(fd);
     // must not be empty
     if (ctx == nullptr) {
         SYLAR_FMT_ERR("do io op failed, fd is not yet created, fd: %d", fd);
         errno = EBADF;
         return -1;
     }
+    // file never wait in epoll, read it on blocking pool so worker keep serving sockets
+    if (ctx->is_file()) {
+        SYLAR_FMT_DEBUG("use hook, file io on blocking pool, fd: %d, func name: %s", fd, hook_name);
+        int err = 0;
+        ssize_t count = sylar::await_blocking([&]() {
+            ssize_t count = func(fd, args...);
+            err = errno;
+            return count;
+        });
+        thread_errno() = err;
+        return count;
+    }
     // fd is not socket, or it is block, directly block here
     if (!ctx->is_socket() || !ctx->is_nonblock()) {
         SYLAR_FMT_DEBUG("use hook, but dont need to handle, fd: %d, socket: %d, nonblock: %d, func name: %s",
-            fd, ctx->is_socket(), ctx->is_nonblock(), hook_name.c_str());
-        return func(fd, std::forward<Args>(args)...);
-    }
-    // try to execute
-    ssize_t count;
-    do {
-        count = func(fd, std::forward<Args>(args)...);
-    } while(count == -1 && errno == EINTR);
-    // socket is ready or some unexpected error happens
-    if (count != -1 || errno != EAGAIN) {
-        SYLAR_FMT_DEBUG("do io op has finished, fd: %d, count: %d, errno: %d, func name: %s",
-            fd, count, errno, hook_name.c_str());
-        return count;
-    }
-    // timer info 
-    std::shared_ptr<timer_info> info_ptr(new timer_info);
-    // timer
-    sylar::Timer::ptr timer;
-    // get timeout
-    int timeout = ctx->get_timeout();
-    // has timeout
-    if (timeout != -1) {
-        // add timer
-        timer = sylar::IOMgr::get_instance()->add_condition_timer(timeout, false, info_ptr, [info_ptr, fd, event]() {
-            // timeout already cancelled
-            // that means io op has been execute successfully
-            if (!info_ptr || info_ptr->cancelled)
-                return;
-            // delete event
-            sylar::IOMgr::get_instance()->del_fd_event(fd, event);
-        }, hook_name);
+            fd, ctx->is_socket(), ctx->is_nonblock(), hook_name);
+        return func(fd, args...);
     }
-    // TODO: callback, should optimize code here
-    sylar::IOMgr::get_instance()->add_fd_event(fd, event, [fd, func, hook_name, &args...]() {
-        // use to execute found
-        ssize_t count = func(fd, std::forward<Args>(args)...);
-        // continue wait
-        if (count == -1 && errno == EINTR) 
-            return;
-        // some error happens
-        if (count == -1) {
-            SYLAR_FMT_DEBUG("io event callback is failed, fd: %d, func name: %s, err: %s", fd, hook_name.c_str(), strerror(errno));
-            return;
+    sylar::IOManager* iom = nullptr;
+    while (true) {
+        ssize_t count;
+        do {
+            count = func(fd, args...);
+        } while (count == -1 && thread_errno() == EINTR);
+        // socket is ready or some unexpected error happens
+        if (count != -1 || thread_errno() != EAGAIN) {
+            SYLAR_FMT_DEBUG("do io op has finished, fd: %d, count: %d, errno: %d, func name: %s",
+                fd, count, thread_errno(), hook_name);
+            return count;
         }
-        SYLAR_FMT_DEBUG("io event callback success, fd: %d, func name: %s", fd, hook_name.c_str());
-    });
-};
+        // no epoll to wait in, behave as nonblock
+        if (!iom && !(iom = get_io_manager()))
+            return -1;
+        int err = wait_fd(iom, fd, event, get_sock_timeout(fd, event), hook_name);
+        if (err != 0) {
+            // same as timeout of blocking socket
+            thread_errno() = err == ETIMEDOUT ? EAGAIN : err;
+            return -1;
+        }
+        // closed by other fiber while waiting
+        if (sylar::FdMgr::get_instance()->get_fdctx(fd) != ctx) {
+            thread_errno() = EBADF;
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief park current fiber for ms
+ */
+static void sleep_ms(uint64_t ms) {
+    sylar::IOManager* iom = get_io_manager();
+    sylar::FiberWaiter waiter;
+    sylar::Mutex mutex;
+    mutex.lock();
+    iom->add_timer(ms, false, [&waiter, &mutex]() {
+        // waiter hold mutex until it is switched out
+        mutex.lock();
+        mutex.unlock();
+        waiter.wake();
+    }, "sleep");
+    waiter.park(mutex);
+}
 
 
 // extern c
@@ -120,32 +251,17 @@ extern "C" {
 
 unsigned int sleep(unsigned int seconds) {
     // check if need use hook
-    if (!sylar::SystemInfo::get_hook_enabled())
+    if (!sylar::SystemInfo::get_hook_enabled() || !get_io_manager())
         return sleep_f(seconds);
-    // get current fiber
-    auto fiber = sylar::Fiber::get_this();
-    sylar::IOMgr::get_instance()->add_timer(seconds * 1000, false, [fiber](){
-        // wake up here
-        fiber->resume();
-    }, "sleep");
-    // yield current to sleep
-    fiber->yield();
+    sleep_ms(seconds * 1000);
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
-    if (!sylar::SystemInfo::get_hook_enabled()) 
+    if (!sylar::SystemInfo::get_hook_enabled() || !get_io_manager())
         return nanosleep_f(req, rem);
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
-    // get current fiber
-    auto fiber = sylar::Fiber::get_this();
-    sylar::IOMgr::get_instance()->add_timer(timeout_ms, false, [fiber](){
-        // wake up here
-        fiber->resume();
-    }, "sleep");
-    // yield current to sleep
-    fiber->yield();
-    return 0;    
+    sleep_ms(req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000);
+    return 0;
 }
 
 
@@ -158,25 +274,44 @@ int socket(int domain, int type, int protocol) {
         return -1;
     }
     // add to fd manager
-    sylar::FdMgr::get_instance()->add_fdctx(fd);
+    sylar::FdMgr::get_instance()->add_fdctx(fd, true);
     SYLAR_FMT_DEBUG("socket add to fd manager successfully, fd: %d", fd);
     return fd;
 }
 
 int connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
     SYLAR_FMT_DEBUG("connect, fd: %d", fd);
-    return connect_f(fd, addr, addrlen);
+    if (!sylar::SystemInfo::get_hook_enabled())
+        return connect_f(fd, addr, addrlen);
+    sylar::IOManager* iom = get_io_manager();
+    auto ctx = get_fdctx(fd);
+    if (!iom || !ctx || !ctx->is_socket() || !ctx->is_nonblock())
+        return connect_f(fd, addr, addrlen);
+    int result = connect_f(fd, addr, addrlen);
+    if (result == 0 || errno != EINPROGRESS)
+        return result;
+    // blocking connect is bounded by send timeout on linux
+    int error = wait_fd(iom, fd, sylar::IOManager::Event::WRITE,
+        get_sock_timeout(fd, sylar::IOManager::Event::WRITE), "connect");
+    socklen_t len = sizeof(error);
+    if (error == 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        error = thread_errno();
+    if (error != 0) {
+        thread_errno() = error;
+        return -1;
+    }
+    return 0;
 }
 
 int accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
     int accept_fd = do_io(fd, accept_f, sylar::IOManager::Event::READ, "accept", addr, addrlen);
     if (accept_fd == -1) {
-        SYLAR_FMT_ERR("accept failed, fd: %d, err: %s", fd, strerror(errno));
+        SYLAR_FMT_ERR("accept failed, fd: %d, err: %s", fd, strerror(thread_errno()));
         return -1;
     }
     // need to hook
     if (sylar::SystemInfo::get_hook_enabled()) {
-        sylar::FdMgr::get_instance()->add_fdctx(accept_fd);
+        sylar::FdMgr::get_instance()->add_fdctx(accept_fd, true);
         SYLAR_FMT_DEBUG("accept add to fd manager successfully, fd: %d, accept fd: %d", fd, accept_fd);
     }
     return accept_fd;
@@ -187,15 +322,18 @@ ssize_t read(int fd, void *buf, size_t bytes) {
 }
 
 int close(int fd) {
-    // check if need use hook here
-    if (!sylar::SystemInfo::get_hook_enabled()) {
-        SYLAR_FMT_DEBUG("close dont need use hook, fd: %d", fd);
-        return close_f(fd);
+    // removed first on every thread, fd number could be reused right after close
+    sylar::FdMgr::get_instance()->del_fdctx(fd);
+    // parked io see its context is gone and fail
+    sylar::IOManager* iom = sylar::SystemInfo::get_hook_enabled() ? get_io_manager() : nullptr;
+    if (iom) {
+        iom->wake_fd_event(fd, sylar::IOManager::Event::READ);
+        iom->wake_fd_event(fd, sylar::IOManager::Event::WRITE);
     }
     int result = close_f(fd);
     if (result == -1)
         SYLAR_FMT_ERR("hook close fd failed, fd: %d, err: %s", fd, strerror(errno));
-    sylar::FdMgr::get_instance()->del_fdctx(fd);
+    return result;
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
@@ -203,15 +341,22 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    // caller ask for nonblock io
+    if (flags & MSG_DONTWAIT)
+        return recv_f(fd, buf, len, flags);
     return do_io(fd, recv_f, sylar::IOManager::Event::READ, "recv", buf, len, flags);
 }
 
 ssize_t recvfrom(int fd, void * buf, size_t len, int flags, struct sockaddr * addr, socklen_t *addrlen) {
+    if (flags & MSG_DONTWAIT)
+        return recvfrom_f(fd, buf, len, flags, addr, addrlen);
     return do_io(fd, recvfrom_f, sylar::IOManager::Event::READ, "recvfrom", buf, len, 
         flags, addr, addrlen);
 }
 
 ssize_t recvmsg(int fd, struct msghdr * msg, int flags) {
+    if (flags & MSG_DONTWAIT)
+        return recvmsg_f(fd, msg, flags);
     return do_io(fd, recvmsg_f, sylar::IOManager::Event::READ, "recvmsg", msg, flags);
 }
 
@@ -224,17 +369,27 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t send(int fd, const void * buf, size_t len, int flags) {
+    if (flags & MSG_DONTWAIT)
+        return send_f(fd, buf, len, flags);
     return do_io(fd, send_f, sylar::IOManager::Event::WRITE, "send", buf, len, flags);
 }
 
 ssize_t sendto(int fd, const void * buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen) {
+    if (flags & MSG_DONTWAIT)
+        return sendto_f(fd, buf, len, flags, addr, addrlen);
     return do_io(fd, sendto_f, sylar::IOManager::Event::WRITE, "sendto", buf, len, flags, addr, addrlen);
 }
 
 ssize_t sendmsg(int fd, const struct msghdr * msg, int flags) {
+    if (flags & MSG_DONTWAIT)
+        return sendmsg_f(fd, msg, flags);
     return do_io(fd, sendmsg_f, sylar::IOManager::Event::WRITE, "sendmsg", msg, flags);
 }
 
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, sylar::IOManager::Event::WRITE, "sendfile", in_fd, offset, count);
+}
+
 
 
 }
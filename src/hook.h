@@ -7,6 +7,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 
 extern "C" {
 
@@ -55,6 +56,9 @@ extern sendto_func sendto_f;
 typedef ssize_t (*sendmsg_func)(int fd, const struct msghdr *mdg, int flags);
 extern sendmsg_func sendmsg_f;
 
+typedef ssize_t (*sendfile_func)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_func sendfile_f;
+
 typedef int (*close_func)(int fd);
 extern close_func close_f;
 
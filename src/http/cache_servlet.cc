@@ -0,0 +1,229 @@
+#include "cache_servlet.h"
+#include "../log.h"
+#include "../utils.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief get ttl from Cache-Control
+ * @return -1 if header is missing, 0 if response must not be cached
+ */
+static int64_t parse_max_age(const std::string& cache_control) {
+    if (cache_control.empty())
+        return -1;
+    if (strcasestr(cache_control.c_str(), "no-store") || strcasestr(cache_control.c_str(), "no-cache")
+        || strcasestr(cache_control.c_str(), "private"))
+        return 0;
+    const char* max_age = strcasestr(cache_control.c_str(), "max-age=");
+    if (!max_age)
+        return -1;
+    return strtoll(max_age + 8, nullptr, 10) * 1000;
+}
+
+CacheServlet::CacheServlet(Servlet::ptr servlet, uint64_t max_bytes, size_t shard_count, uint64_t default_ttl)
+    : Servlet("CacheServlet")
+    , servlet_(servlet)
+    , default_ttl_(default_ttl) {
+    if (shard_count == 0)
+        shard_count = 1;
+    shard_bytes_ = max_bytes / shard_count;
+    shards_.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; i++)
+        shards_.emplace_back(new Shard);
+    // body is handled by wrapped servlet
+    set_streaming_body(servlet_->is_streaming_body());
+    set_max_body_size(servlet_->get_max_body_size());
+}
+
+int32_t CacheServlet::handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+    HttpSession::ptr session) {
+    if (req->get_method() != HttpMethod::GET)
+        return servlet_->handle(req, resp, session);
+    std::string key = make_key(req);
+    Shard& shard = *shards_[std::hash<std::string>()(key) % shards_.size()];
+    if (is_private(req)) {
+        // never answered from cache, nor shared unless response is public
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        int32_t ret = servlet_->handle(req, resp, session);
+        if (ret != 0 || (session && session->is_streaming())
+            || !strcasestr(resp->get_header("Cache-Control").c_str(), "public"))
+            return ret;
+        Entry::ptr entry = make_entry(key, resp);
+        if (entry && entry->size <= shard_bytes_) {
+            MutexType::Lock lock(shard.mutex);
+            insert(shard, entry);
+        }
+        return ret;
+    }
+    Pending::ptr pending;
+    {
+        MutexType::Lock lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            Entry::ptr entry = *it->second;
+            if (entry->expire > SystemInfo::get_elapsed()) {
+                // move to front
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                lock.unlock();
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return reply(entry, resp, session);
+            }
+            remove(shard, it->second);
+        }
+        // someone is computing the same key, wait for it
+        auto pit = shard.pendings.find(key);
+        if (pit != shard.pendings.end()) {
+            pending = pit->second;
+            lock.unlock();
+            pending->done.wait();
+            // leader result is not cacheable, compute by self
+            if (pending->entry) {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return reply(pending->entry, resp, session);
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return servlet_->handle(req, resp, session);
+        }
+        pending.reset(new Pending);
+        pending->done.add(1);
+        shard.pendings[key] = pending;
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    int32_t ret = servlet_->handle(req, resp, session);
+    // streamed body is already sent, cant be cached
+    Entry::ptr entry = ret == 0 && !(session && session->is_streaming()) ? make_entry(key, resp) : nullptr;
+    {
+        MutexType::Lock lock(shard.mutex);
+        if (entry && entry->size <= shard_bytes_)
+            insert(shard, entry);
+        pending->entry = entry;
+        shard.pendings.erase(key);
+    }
+    // wake up waiters
+    pending->done.done();
+    return ret;
+}
+
+double CacheServlet::get_hit_ratio() {
+    uint64_t hits = get_hit_count();
+    uint64_t total = hits + get_miss_count();
+    return total ? (double)hits / total : 0;
+}
+
+size_t CacheServlet::get_entry_count() {
+    size_t count = 0;
+    for (auto& shard : shards_) {
+        MutexType::Lock lock(shard->mutex);
+        count += shard->entries.size();
+    }
+    return count;
+}
+
+void CacheServlet::clear() {
+    for (auto& shard : shards_) {
+        MutexType::Lock lock(shard->mutex);
+        bytes_.fetch_sub(shard->bytes, std::memory_order_relaxed);
+        shard->bytes = 0;
+        shard->entries.clear();
+        shard->lru.clear();
+    }
+}
+
+std::string CacheServlet::make_key(HttpRequest::ptr req) {
+    std::string_view path = req->get_path_view();
+    std::string_view query = req->get_query_view();
+    std::string key;
+    key.reserve(path.size() + query.size() + 8);
+    key.append(std::to_string((int)req->get_method())).append(" ");
+    key.append(path).append("?").append(query);
+    for (auto& header : vary_headers_)
+        key.append("\n").append(req->get_header_view(header));
+    return key;
+}
+
+bool CacheServlet::is_private(HttpRequest::ptr req) {
+    auto is_vary = [this](const char* header) {
+        for (auto& it : vary_headers_) {
+            if (strcasecmp(it.c_str(), header) == 0)
+                return true;
+        }
+        return false;
+    };
+    if (!req->get_header_view("Authorization").empty() && !is_vary("Authorization"))
+        return true;
+    if (!req->get_header_view("Cookie").empty() && !is_vary("Cookie"))
+        return true;
+    std::string cache_control(req->get_header_view("Cache-Control"));
+    return strcasestr(cache_control.c_str(), "no-cache") || strcasestr(cache_control.c_str(), "no-store");
+}
+
+CacheServlet::Entry::ptr CacheServlet::make_entry(const std::string& key, HttpResponse::ptr resp) {
+    // response with cookie is private
+    if (resp->get_status() != HttpStatus::OK || !resp->get_cookies().empty()
+        || resp->get_header_block())
+        return nullptr;
+    int64_t ttl = parse_max_age(resp->get_header("Cache-Control"));
+    if (ttl < 0)
+        ttl = default_ttl_;
+    if (ttl <= 0)
+        return nullptr;
+    Entry::ptr entry(new Entry);
+    std::string headers;
+    for (auto& it : resp->get_headers()) {
+        // decided by each response
+        if (strcasecmp(it.first.c_str(), "connection") == 0 || strcasecmp(it.first.c_str(), "content-length") == 0
+            || strcasecmp(it.first.c_str(), "date") == 0 || strcasecmp(it.first.c_str(), "transfer-encoding") == 0)
+            continue;
+        headers.append(it.first).append(": ").append(it.second).append("\r\n");
+    }
+    entry->key = key;
+    entry->status = resp->get_status();
+    entry->headers = std::make_shared<const std::string>(std::move(headers));
+    entry->body = resp->get_body();
+    entry->expire = SystemInfo::get_elapsed() + ttl;
+    entry->size = sizeof(Entry) + key.size() * 2 + entry->headers->size() + entry->body.size();
+    return entry;
+}
+
+void CacheServlet::insert(Shard& shard, Entry::ptr entry) {
+    auto it = shard.entries.find(entry->key);
+    if (it != shard.entries.end())
+        remove(shard, it->second);
+    // evict from back
+    while (!shard.lru.empty() && shard.bytes + entry->size > shard_bytes_)
+        remove(shard, std::prev(shard.lru.end()));
+    shard.lru.push_front(entry);
+    shard.entries[entry->key] = shard.lru.begin();
+    shard.bytes += entry->size;
+    bytes_.fetch_add(entry->size, std::memory_order_relaxed);
+}
+
+void CacheServlet::remove(Shard& shard, std::list<Entry::ptr>::iterator it) {
+    Entry::ptr entry = *it;
+    shard.bytes -= entry->size;
+    bytes_.fetch_sub(entry->size, std::memory_order_relaxed);
+    shard.entries.erase(entry->key);
+    shard.lru.erase(it);
+}
+
+int32_t CacheServlet::reply(Entry::ptr entry, HttpResponse::ptr resp, HttpSession::ptr session) {
+    resp->set_status(entry->status);
+    resp->set_header_block(entry->headers);
+    if (!session) {
+        resp->set_body(entry->body);
+        return 0;
+    }
+    // body is written from cache directly, never copied
+    auto writer = session->begin_response(resp, entry->body.size());
+    return writer->write(entry->body) < 0 ? -1 : 0;
+}
+
+}
+}
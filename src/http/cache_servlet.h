@@ -0,0 +1,203 @@
+#ifndef __SYLAR_SRC_CACHE_SERVLET_H__
+#define __SYLAR_SRC_CACHE_SERVLET_H__
+
+#include "servlet.h"
+#include "../fiber_mutex.h"
+#include "../mutex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief cache GET responses of wrapped servlet
+ * @details key is method, path, query and selected request headers.
+ *          response is kept as pre-serialized header block and body in
+ *          sharded lru limited by bytes. only 200 response with
+ *          Cache-Control max-age (or default ttl) is cached. concurrent
+ *          misses of one key are coalesced, only one fiber call the
+ *          wrapped servlet while others wait for its result
+ */
+class CacheServlet : public Servlet {
+public:
+    /// share pointer
+    typedef std::shared_ptr<CacheServlet> ptr;
+    /// mutex
+    typedef Mutex MutexType;
+
+    /**
+     * @brief Construct a new Cache Servlet object
+     * @param[in] servlet wrapped servlet
+     * @param[in] max_bytes memory budget, split evenly by shards
+     * @param[in] shard_count shard count
+     * @param[in] default_ttl ttl in ms when response has no max-age, 0 means dont cache
+     */
+    CacheServlet(Servlet::ptr servlet, uint64_t max_bytes = 64 * 1024 * 1024,
+        size_t shard_count = 16, uint64_t default_ttl = 0);
+
+    /**
+     * @brief handle request
+     * @param[in] req http req
+     * @param[in] resp http resp
+     * @param[in] session http session
+     */
+    virtual int32_t handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+        HttpSession::ptr session) override;
+
+    /**
+     * @brief Set the vary headers object, set before servlet is added
+     * @param[in] headers request headers become part of cache key
+     */
+    void set_vary_headers(const std::vector<std::string>& headers) { vary_headers_ = headers; }
+
+    /**
+     * @brief Get the hit count object
+     */
+    uint64_t get_hit_count() { return hits_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the miss count object
+     */
+    uint64_t get_miss_count() { return misses_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the hit ratio object
+     */
+    double get_hit_ratio();
+
+    /**
+     * @brief Get the memory usage object, bytes of cached responses
+     */
+    uint64_t get_memory_usage() { return bytes_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the entry count object
+     */
+    size_t get_entry_count();
+
+    /**
+     * @brief drop all cached responses
+     */
+    void clear();
+
+private:
+    /**
+     * @brief cached response
+     */
+    struct Entry {
+        /// share pointer
+        typedef std::shared_ptr<Entry> ptr;
+        /// cache key
+        std::string key {};
+        /// status
+        HttpStatus status {HttpStatus::OK};
+        /// pre-serialized header lines
+        std::shared_ptr<const std::string> headers {};
+        /// body
+        std::string body {};
+        /// expire time in ms
+        uint64_t expire {0};
+        /// accounted bytes
+        uint64_t size {0};
+    };
+
+    /**
+     * @brief in flight miss, waiters are waked when leader finished
+     */
+    struct Pending {
+        /// share pointer
+        typedef std::shared_ptr<Pending> ptr;
+        /// done by leader, followers wait on it
+        WaitGroup done {};
+        /// result, nullptr if response is not cacheable
+        Entry::ptr entry {};
+    };
+
+    /**
+     * @brief lru shard
+     */
+    struct Shard {
+        /// lock
+        MutexType mutex {};
+        /// most recently used at front
+        std::list<Entry::ptr> lru {};
+        /// key to lru position
+        std::unordered_map<std::string, std::list<Entry::ptr>::iterator> entries {};
+        /// in flight misses
+        std::unordered_map<std::string, Pending::ptr> pendings {};
+        /// bytes used
+        uint64_t bytes {0};
+    };
+
+    /**
+     * @brief build cache key from request
+     * @param[in] req http request
+     */
+    std::string make_key(HttpRequest::ptr req);
+
+    /**
+     * @brief request carry credentials or refuse cached response
+     * @param[in] req http request
+     */
+    bool is_private(HttpRequest::ptr req);
+
+    /**
+     * @brief build entry from response
+     * @param[in] key cache key
+     * @param[in] resp response
+     * @return nullptr if response is not cacheable
+     */
+    Entry::ptr make_entry(const std::string& key, HttpResponse::ptr resp);
+
+    /**
+     * @brief insert entry, evict least recently used until under budget
+     * @param[in] shard shard, lock must be hold
+     * @param[in] entry entry
+     */
+    void insert(Shard& shard, Entry::ptr entry);
+
+    /**
+     * @brief remove entry
+     * @param[in] shard shard, lock must be hold
+     * @param[in] it lru position
+     */
+    void remove(Shard& shard, std::list<Entry::ptr>::iterator it);
+
+    /**
+     * @brief write cached entry as response
+     * @param[in] entry cached entry
+     * @param[in] resp http resp
+     * @param[in] session http session
+     */
+    static int32_t reply(Entry::ptr entry, HttpResponse::ptr resp, HttpSession::ptr session);
+
+private:
+    /// wrapped servlet
+    Servlet::ptr servlet_ {};
+    /// bytes budget of each shard
+    uint64_t shard_bytes_ {0};
+    /// default ttl in ms
+    uint64_t default_ttl_ {0};
+    /// request headers in key
+    std::vector<std::string> vary_headers_ {};
+    /// shards
+    std::vector<std::unique_ptr<Shard>> shards_ {};
+    /// hit count
+    std::atomic<uint64_t> hits_ {0};
+    /// miss count
+    std::atomic<uint64_t> misses_ {0};
+    /// bytes of all shards
+    std::atomic<uint64_t> bytes_ {0};
+};
+
+}
+}
+
+#endif
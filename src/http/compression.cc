@@ -0,0 +1,237 @@
+#include "compression.h"
+#include "../log.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/// max idle z_stream kept by each thread for each coding
+static const size_t s_max_idle_streams = 16;
+/// output grow step of streaming compress
+static const size_t s_stream_step = 16 * 1024;
+
+/**
+ * @brief per-thread idle z_stream and output buffer
+ */
+struct CompressContext {
+    /// idle gzip and deflate streams
+    std::vector<z_stream*> idle[2];
+    /// output buffer of whole body compress
+    std::string out;
+
+    ~CompressContext() {
+        for (auto& streams : idle) {
+            for (auto stream : streams) {
+                deflateEnd(stream);
+                delete stream;
+            }
+        }
+    }
+};
+
+/**
+ * @brief get per-thread compress context
+ */
+static CompressContext& get_context() {
+    static thread_local CompressContext t_context;
+    return t_context;
+}
+
+/**
+ * @brief take z_stream from thread pool, create if empty
+ */
+static z_stream* acquire_stream(ContentCoding coding, int level) {
+    auto& idle = get_context().idle[coding == ContentCoding::GZIP ? 0 : 1];
+    if (!idle.empty()) {
+        z_stream* stream = idle.back();
+        idle.pop_back();
+        deflateReset(stream);
+        deflateParams(stream, level, Z_DEFAULT_STRATEGY);
+        return stream;
+    }
+    z_stream* stream = new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    // gzip wrapper is selected by window bits + 16
+    int bits = coding == ContentCoding::GZIP ? 15 + 16 : 15;
+    if (deflateInit2(stream, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        SYLAR_ERR("deflate init failed");
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
+
+/**
+ * @brief give back z_stream to thread pool
+ */
+static void release_stream(ContentCoding coding, z_stream* stream) {
+    if (!stream)
+        return;
+    auto& idle = get_context().idle[coding == ContentCoding::GZIP ? 0 : 1];
+    if (idle.size() < s_max_idle_streams) {
+        idle.push_back(stream);
+        return;
+    }
+    deflateEnd(stream);
+    delete stream;
+}
+
+const char* content_coding_to_string(ContentCoding coding) {
+    switch (coding) {
+    case ContentCoding::GZIP:
+        return "gzip";
+    case ContentCoding::DEFLATE:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+StreamCompressor::StreamCompressor(ContentCoding coding, int level)
+    : coding_(coding)
+    , stream_(acquire_stream(coding, level)) {
+}
+
+StreamCompressor::~StreamCompressor() {
+    release_stream(coding_, stream_);
+}
+
+bool StreamCompressor::compress(std::string_view data, std::string& out, bool finish) {
+    if (!stream_)
+        return false;
+    stream_->next_in = (Bytef*)data.data();
+    stream_->avail_in = data.size();
+    int rt;
+    do {
+        size_t size = out.size();
+        out.resize(size + s_stream_step);
+        stream_->next_out = (Bytef*)&out[size];
+        stream_->avail_out = s_stream_step;
+        rt = deflate(stream_, finish ? Z_FINISH : Z_NO_FLUSH);
+        out.resize(size + s_stream_step - stream_->avail_out);
+        if (rt == Z_STREAM_ERROR) {
+            SYLAR_ERR("deflate stream failed");
+            return false;
+        }
+    } while (stream_->avail_out == 0 || (finish && rt != Z_STREAM_END));
+    return true;
+}
+
+CompressionFilter::CompressionFilter(size_t min_size, int level)
+    : min_size_(min_size)
+    , level_(level) {
+}
+
+ContentCoding CompressionFilter::negotiate(HttpRequest::ptr req) {
+    if (is_accepted(req, ContentCoding::GZIP))
+        return ContentCoding::GZIP;
+    if (is_accepted(req, ContentCoding::DEFLATE))
+        return ContentCoding::DEFLATE;
+    return ContentCoding::IDENTITY;
+}
+
+bool CompressionFilter::should_compress(HttpResponse::ptr resp, int64_t size) {
+    // known small body
+    if (size >= 0 && (size_t)size < min_size_)
+        return false;
+    // no body or already encoded
+    HttpStatus status = resp->get_status();
+    if (status == HttpStatus::NO_CONTENT || status == HttpStatus::NOT_MODIFIED
+        || status == HttpStatus::PARTIAL_CONTENT || (uint32_t)status < 200)
+        return false;
+    if (resp->has_header("Content-Encoding") || resp->get_header_block())
+        return false;
+    std::string mime = resp->get_header("Content-Type");
+    if (is_compressible_mime(mime))
+        return true;
+    for (auto& prefix : mime_types_) {
+        if (strncasecmp(mime.c_str(), prefix.c_str(), prefix.size()) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool CompressionFilter::compress(ContentCoding coding, HttpResponse::ptr resp) {
+    if (coding == ContentCoding::IDENTITY || resp->get_body_view().empty())
+        return false;
+    z_stream* stream = acquire_stream(coding, level_);
+    if (!stream)
+        return false;
+    // output no larger than input, otherwise compress is useless
+    std::string_view body = resp->get_body_view();
+    std::string& out = get_context().out;
+    out.resize(body.size());
+    stream->next_in = (Bytef*)body.data();
+    stream->avail_in = body.size();
+    stream->next_out = (Bytef*)&out[0];
+    stream->avail_out = out.size();
+    int rt = deflate(stream, Z_FINISH);
+    size_t size = stream->total_out;
+    release_stream(coding, stream);
+    if (rt != Z_STREAM_END)
+        return false;
+    // swap buffer, old body buffer is reused by next response
+    out.resize(size);
+    resp->swap_body(out);
+    resp->set_header("Content-Encoding", content_coding_to_string(coding));
+    resp->set_header("Vary", "Accept-Encoding");
+    return true;
+}
+
+StreamCompressor::ptr CompressionFilter::create_stream(ContentCoding coding) {
+    if (coding == ContentCoding::IDENTITY)
+        return nullptr;
+    return std::make_shared<StreamCompressor>(coding, level_);
+}
+
+bool CompressionFilter::is_accepted(HttpRequest::ptr req, ContentCoding coding) {
+    std::string_view accept = req->get_header_view("accept-encoding");
+    std::string_view name = content_coding_to_string(coding);
+    bool wildcard = false;
+    while (!accept.empty()) {
+        size_t end = accept.find(',');
+        std::string_view item = accept.substr(0, end);
+        accept = end == std::string_view::npos ? std::string_view() : accept.substr(end + 1);
+        // split token and q value
+        size_t semi = item.find(';');
+        std::string_view token = item.substr(0, semi);
+        while (!token.empty() && (token.front() == ' ' || token.front() == '\t'))
+            token.remove_prefix(1);
+        while (!token.empty() && (token.back() == ' ' || token.back() == '\t'))
+            token.remove_suffix(1);
+        bool refused = false;
+        if (semi != std::string_view::npos) {
+            size_t q = item.find("q=", semi);
+            refused = q != std::string_view::npos && atof(std::string(item.substr(q + 2)).c_str()) <= 0;
+        }
+        if (token.size() == name.size() && strncasecmp(token.data(), name.data(), name.size()) == 0)
+            return !refused;
+        if (token == "*")
+            wildcard = !refused;
+    }
+    return wildcard;
+}
+
+bool CompressionFilter::is_compressible_mime(std::string_view mime) {
+    static const char* s_mime_types[] = {
+        "text/", "application/json", "application/javascript", "application/xml",
+        "application/xhtml+xml", "image/svg+xml",
+    };
+    for (auto prefix : s_mime_types) {
+        size_t len = strlen(prefix);
+        if (mime.size() >= len && strncasecmp(mime.data(), prefix, len) == 0)
+            return true;
+    }
+    // structured syntax suffix, such as application/problem+json
+    size_t end = mime.find(';');
+    std::string_view type = mime.substr(0, end);
+    return type.size() > 5 && (type.substr(type.size() - 5) == "+json" || type.substr(type.size() - 4) == "+xml");
+}
+
+}
+}
@@ -0,0 +1,152 @@
+#ifndef __SYLAR_SRC_COMPRESSION_H__
+#define __SYLAR_SRC_COMPRESSION_H__
+
+#include "http.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief response content coding
+ */
+enum class ContentCoding {
+    IDENTITY = 0,
+    GZIP = 1,
+    DEFLATE = 2,
+};
+
+/**
+ * @brief Get content coding name
+ * @param[in] coding content coding
+ */
+const char* content_coding_to_string(ContentCoding coding);
+
+/**
+ * @brief streaming compressor of one response body
+ * @details z_stream is taken from per-thread pool and given back on
+ *          destroy, so compressor state is not allocated per response
+ */
+class StreamCompressor {
+public:
+    /// share pointer
+    typedef std::shared_ptr<StreamCompressor> ptr;
+
+    /**
+     * @brief Construct a new Stream Compressor object
+     * @param[in] coding gzip or deflate
+     * @param[in] level compress level
+     */
+    StreamCompressor(ContentCoding coding, int level);
+
+    /**
+     * @brief Destroy the Stream Compressor object, give back z_stream
+     */
+    ~StreamCompressor();
+
+    /**
+     * @brief compress data
+     * @param[in] data input data
+     * @param[out] out compressed data appended to
+     * @param[in] finish last input
+     * @return false if failed
+     */
+    bool compress(std::string_view data, std::string& out, bool finish = false);
+
+private:
+    /// content coding
+    ContentCoding coding_ {ContentCoding::GZIP};
+    /// compress stream
+    z_stream* stream_ {nullptr};
+};
+
+/**
+ * @brief negotiate and apply Content-Encoding to response
+ */
+class CompressionFilter {
+public:
+    /// share pointer
+    typedef std::shared_ptr<CompressionFilter> ptr;
+
+    /**
+     * @brief Construct a new Compression Filter object
+     * @param[in] min_size body smaller than it is not compressed
+     * @param[in] level zlib compress level
+     */
+    CompressionFilter(size_t min_size = 1024, int level = 6);
+
+    /**
+     * @brief choose coding by Accept-Encoding
+     * @param[in] req http request
+     */
+    ContentCoding negotiate(HttpRequest::ptr req);
+
+    /**
+     * @brief if response could be compressed
+     * @param[in] resp http response
+     * @param[in] size body size, -1 if unknown
+     */
+    bool should_compress(HttpResponse::ptr resp, int64_t size);
+
+    /**
+     * @brief compress whole body of response
+     * @details per-thread compressor and buffer are reused. body is kept
+     *          if compressed data is not smaller
+     * @param[in] coding content coding
+     * @param[in] resp http response
+     * @return if body is compressed
+     */
+    bool compress(ContentCoding coding, HttpResponse::ptr resp);
+
+    /**
+     * @brief create streaming compressor
+     * @param[in] coding content coding
+     */
+    StreamCompressor::ptr create_stream(ContentCoding coding);
+
+    /**
+     * @brief add compressible mime type prefix
+     * @param[in] mime mime type prefix, such as "text/"
+     */
+    void add_mime_type(const std::string& mime) { mime_types_.push_back(mime); }
+
+    /**
+     * @brief Set the min size object
+     * @param[in] size min body size
+     */
+    void set_min_size(size_t size) { min_size_ = size; }
+
+    /**
+     * @brief if request accept coding
+     * @param[in] req http request
+     * @param[in] coding content coding
+     */
+    static bool is_accepted(HttpRequest::ptr req, ContentCoding coding);
+
+    /**
+     * @brief if mime type is compressible text
+     * @param[in] mime content type
+     */
+    static bool is_compressible_mime(std::string_view mime);
+
+private:
+    /// min body size
+    size_t min_size_ {1024};
+    /// compress level
+    int level_ {6};
+    /// extra compressible mime type prefix
+    std::vector<std::string> mime_types_ {};
+};
+
+}
+}
+
+#endif
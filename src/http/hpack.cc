@@ -0,0 +1,501 @@
+#include "hpack.h"
+#include "../log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief huffman code of one symbol
+ */
+struct HuffmanCode {
+    /// code, right aligned
+    uint32_t code;
+    /// bits
+    uint8_t bits;
+};
+
+/// rfc 7541 appendix B, symbol 256 is EOS
+static const HuffmanCode s_huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+/// rfc 7541 appendix A
+static const HPackHeader s_static_table[] = {
+    {":authority", ""}, {":method", "GET"},
+    {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"},
+    {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""},
+    {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""},
+    {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""},
+    {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""},
+    {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""},
+    {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""},
+    {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""},
+    {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/// static table entry count
+static const size_t s_static_count = sizeof(s_static_table) / sizeof(s_static_table[0]);
+/// rfc overhead of every dynamic entry
+static const size_t s_entry_overhead = 32;
+/// bits looked up by one table access when decoding
+static const int s_fast_bits = 8;
+
+/**
+ * @brief canonical huffman decode table
+ * @details codes are canonical, so symbols of one length have contiguous
+ *          codes. short codes are resolved by one lookup, longer codes by
+ *          comparing with first code of every length
+ */
+struct HuffmanDecodeTable {
+    /// symbol and bits of every s_fast_bits prefix, bits 0 if code is longer
+    struct {
+        uint16_t symbol;
+        uint8_t bits;
+    } fast[1 << s_fast_bits];
+    /// first code of every length
+    uint32_t first[31];
+    /// code count of every length
+    uint32_t count[31];
+    /// index into symbols of every length
+    uint32_t offset[31];
+    /// symbols sorted by code
+    uint16_t symbols[257];
+
+    HuffmanDecodeTable() {
+        memset(this, 0, sizeof(*this));
+        for (int i = 0; i < 257; i++)
+            count[s_huffman_codes[i].bits]++;
+        uint32_t index = 0;
+        for (int bits = 1; bits <= 30; bits++) {
+            offset[bits] = index;
+            index += count[bits];
+        }
+        uint32_t filled[31] = {0};
+        for (int i = 0; i < 257; i++) {
+            const HuffmanCode& code = s_huffman_codes[i];
+            if (filled[code.bits] == 0)
+                first[code.bits] = code.code;
+            symbols[offset[code.bits] + filled[code.bits]++] = i;
+            // every prefix start with short code resolve to it
+            if (code.bits <= s_fast_bits) {
+                uint32_t begin = code.code << (s_fast_bits - code.bits);
+                for (uint32_t j = 0; j < (1u << (s_fast_bits - code.bits)); j++) {
+                    fast[begin + j].symbol = i;
+                    fast[begin + j].bits = code.bits;
+                }
+            }
+        }
+    }
+};
+
+void huffman_encode(std::string_view data, std::string& out) {
+    uint64_t buffer = 0;
+    int bits = 0;
+    for (unsigned char c : data) {
+        const HuffmanCode& code = s_huffman_codes[c];
+        buffer = buffer << code.bits | code.code;
+        bits += code.bits;
+        while (bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(buffer >> bits));
+        }
+    }
+    // pad with most significant bits of EOS
+    if (bits > 0)
+        out.push_back((char)(buffer << (8 - bits) | (0xFF >> bits)));
+}
+
+size_t huffman_encoded_size(std::string_view data) {
+    size_t bits = 0;
+    for (unsigned char c : data)
+        bits += s_huffman_codes[c].bits;
+    return (bits + 7) / 8;
+}
+
+bool huffman_decode(std::string_view data, std::string& out) {
+    static const HuffmanDecodeTable s_table;
+    uint64_t buffer = 0;
+    int bits = 0;
+    size_t pos = 0;
+    while (true) {
+        // keep at least 30 bits when input left
+        while (bits <= 56 && pos < data.size()) {
+            buffer |= (uint64_t)(uint8_t)data[pos++] << (56 - bits);
+            bits += 8;
+        }
+        if (bits == 0)
+            return true;
+        auto& fast = s_table.fast[buffer >> (64 - s_fast_bits)];
+        int len = fast.bits;
+        uint32_t symbol = fast.symbol;
+        if (len == 0) {
+            for (len = s_fast_bits + 1; len <= 30; len++) {
+                uint32_t code = buffer >> (64 - len);
+                if (code - s_table.first[len] < s_table.count[len]) {
+                    symbol = s_table.symbols[s_table.offset[len] + code - s_table.first[len]];
+                    break;
+                }
+            }
+        }
+        // not enough bits for a symbol, must be padding of EOS prefix
+        if (len > bits || len > 30) {
+            return bits < 8 && (buffer >> (64 - bits)) == ((1u << bits) - 1);
+        }
+        if (symbol == 256)
+            return false;
+        out.push_back((char)symbol);
+        buffer <<= len;
+        bits -= len;
+    }
+}
+
+const HPackHeader* HPackTable::get(size_t index) const {
+    if (index == 0)
+        return nullptr;
+    if (index <= s_static_count)
+        return &s_static_table[index - 1];
+    index -= s_static_count + 1;
+    return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+void HPackTable::add(std::string_view name, std::string_view value) {
+    size_t size = name.size() + value.size() + s_entry_overhead;
+    // too large entry empty the table
+    if (size > max_size_) {
+        evict(0);
+        return;
+    }
+    evict(max_size_ - size);
+    entries_.emplace_front(std::string(name), std::string(value));
+    size_ += size;
+}
+
+size_t HPackTable::find(std::string_view name, std::string_view value, bool& matched) const {
+    // static names are contiguous, first index of every name
+    static const std::unordered_map<std::string_view, size_t> s_names = []() {
+        std::unordered_map<std::string_view, size_t> names;
+        for (size_t i = s_static_count; i > 0; i--)
+            names[s_static_table[i - 1].first] = i;
+        return names;
+    }();
+    matched = false;
+    size_t index = 0;
+    auto it = s_names.find(name);
+    if (it != s_names.end()) {
+        index = it->second;
+        for (size_t i = index; i <= s_static_count && s_static_table[i - 1].first == name; i++) {
+            if (s_static_table[i - 1].second == value) {
+                matched = true;
+                return i;
+            }
+        }
+    }
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].first != name)
+            continue;
+        if (entries_[i].second == value) {
+            matched = true;
+            return s_static_count + 1 + i;
+        }
+        if (index == 0)
+            index = s_static_count + 1 + i;
+    }
+    return index;
+}
+
+void HPackTable::set_max_size(size_t size) {
+    max_size_ = size;
+    evict(size);
+}
+
+size_t HPackTable::get_static_count() {
+    return s_static_count;
+}
+
+void HPackTable::evict(size_t size) {
+    while (size_ > size && !entries_.empty()) {
+        size_ -= entries_.back().first.size() + entries_.back().second.size() + s_entry_overhead;
+        entries_.pop_back();
+    }
+}
+
+/**
+ * @brief decode prefixed integer
+ * @param[in,out] p current position
+ * @param[in] end data end
+ * @param[in] prefix prefix bits
+ * @param[out] value value
+ */
+static bool decode_integer(const uint8_t*& p, const uint8_t* end, int prefix, uint64_t& value) {
+    if (p >= end)
+        return false;
+    uint32_t mask = (1u << prefix) - 1;
+    value = *p++ & mask;
+    if (value < mask)
+        return true;
+    for (int shift = 0; p < end && shift <= 56; shift += 7) {
+        uint8_t b = *p++;
+        value += (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief decode string literal
+ * @param[in,out] p current position
+ * @param[in] end data end
+ * @param[out] out decoded string
+ */
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out) {
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    uint64_t length;
+    if (!decode_integer(p, end, 7, length) || length > (uint64_t)(end - p))
+        return false;
+    std::string_view data((const char*)p, length);
+    p += length;
+    if (!huffman) {
+        out.assign(data);
+        return true;
+    }
+    out.clear();
+    out.reserve(length * 8 / 5);
+    return huffman_decode(data, out);
+}
+
+/**
+ * @brief encode prefixed integer
+ * @param[out] out output
+ * @param[in] flags high bits of first byte
+ * @param[in] prefix prefix bits
+ * @param[in] value value
+ */
+static void encode_integer(std::string& out, uint8_t flags, int prefix, uint64_t value) {
+    uint32_t mask = (1u << prefix) - 1;
+    if (value < mask) {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | mask));
+    value -= mask;
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+/**
+ * @brief encode string literal, huffman is used when shorter
+ */
+static void encode_string(std::string& out, std::string_view data) {
+    size_t size = huffman_encoded_size(data);
+    if (size < data.size()) {
+        encode_integer(out, 0x80, 7, size);
+        huffman_encode(data, out);
+        return;
+    }
+    encode_integer(out, 0x00, 7, data.size());
+    out.append(data);
+}
+
+HPackDecoder::HPackDecoder(size_t max_table_size)
+    : table_(max_table_size)
+    , max_table_size_(max_table_size) {
+}
+
+bool HPackDecoder::decode(const uint8_t* data, size_t length, std::vector<HPackHeader>& headers) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + length;
+    bool field_seen = false;
+    while (p < end) {
+        uint8_t b = *p;
+        uint64_t index;
+        if (b & 0x80) {
+            // indexed field
+            if (!decode_integer(p, end, 7, index))
+                return false;
+            const HPackHeader* header = table_.get(index);
+            if (!header) {
+                SYLAR_FMT_ERR("hpack index out of range: %lu", index);
+                return false;
+            }
+            headers.push_back(*header);
+            field_seen = true;
+            continue;
+        }
+        if ((b & 0xE0) == 0x20) {
+            // size update only allowed at block begin
+            if (field_seen || !decode_integer(p, end, 5, index) || index > max_table_size_)
+                return false;
+            table_.set_max_size(index);
+            continue;
+        }
+        // literal with incremental indexing, without indexing, never indexed
+        bool indexing = (b & 0xC0) == 0x40;
+        if (!decode_integer(p, end, indexing ? 6 : 4, index))
+            return false;
+        HPackHeader header;
+        if (index > 0) {
+            const HPackHeader* name = table_.get(index);
+            if (!name)
+                return false;
+            header.first = name->first;
+        } else if (!decode_string(p, end, header.first)) {
+            return false;
+        }
+        if (!decode_string(p, end, header.second))
+            return false;
+        if (indexing)
+            table_.add(header.first, header.second);
+        headers.push_back(std::move(header));
+        field_seen = true;
+    }
+    return true;
+}
+
+void HPackEncoder::encode(std::string_view name, std::string_view value, std::string& out) {
+    if (size_update_) {
+        encode_integer(out, 0x20, 5, table_.get_max_size());
+        size_update_ = false;
+    }
+    // field name must be lower case in http/2
+    char lower[64];
+    std::string lower_name;
+    if (name.size() <= sizeof(lower)) {
+        for (size_t i = 0; i < name.size(); i++)
+            lower[i] = tolower(name[i]);
+        name = std::string_view(lower, name.size());
+    } else {
+        lower_name.assign(name);
+        for (auto& c : lower_name)
+            c = tolower(c);
+        name = lower_name;
+    }
+    bool matched = false;
+    size_t index = table_.find(name, value, matched);
+    if (matched) {
+        encode_integer(out, 0x80, 7, index);
+        return;
+    }
+    // value change by every response, keep table for stable fields
+    bool indexing = name != "date" && name != "content-length" && name != "set-cookie"
+        && name != "etag" && name != "last-modified" && name != "content-range"
+        && name.size() + value.size() + s_entry_overhead <= table_.get_max_size() / 2;
+    if (indexing)
+        encode_integer(out, 0x40, 6, index);
+    else
+        encode_integer(out, 0x00, 4, index);
+    if (index == 0)
+        encode_string(out, name);
+    encode_string(out, value);
+    if (indexing)
+        table_.add(name, value);
+}
+
+void HPackEncoder::set_max_table_size(size_t size) {
+    // never grow beyond default, memory is bounded by this side
+    size = std::min<size_t>(size, 4096);
+    if (size == table_.get_max_size())
+        return;
+    table_.set_max_size(size);
+    size_update_ = true;
+}
+
+}
+}
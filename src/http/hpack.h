@@ -0,0 +1,184 @@
+#ifndef __SYLAR_SRC_HPACK_H__
+#define __SYLAR_SRC_HPACK_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/// decoded header field
+typedef std::pair<std::string, std::string> HPackHeader;
+
+/**
+ * @brief huffman encode with HPACK code table
+ * @param[in] data input data
+ * @param[out] out encoded data appended to
+ */
+void huffman_encode(std::string_view data, std::string& out);
+
+/**
+ * @brief huffman encoded size in bytes
+ * @param[in] data input data
+ */
+size_t huffman_encoded_size(std::string_view data);
+
+/**
+ * @brief huffman decode with HPACK code table
+ * @param[in] data encoded data
+ * @param[out] out decoded data appended to
+ * @return false if data is not valid, such as EOS or bad padding
+ */
+bool huffman_decode(std::string_view data, std::string& out);
+
+/**
+ * @brief HPACK static and dynamic table
+ * @details index begin with 1, static entries first then dynamic
+ *          entries from newest to oldest
+ */
+class HPackTable {
+public:
+    /**
+     * @brief Construct a new HPackTable object
+     * @param[in] max_size max dynamic table size
+     */
+    HPackTable(size_t max_size = 4096) : max_size_(max_size) {}
+
+    /**
+     * @brief get entry by index
+     * @param[in] index 1 based index
+     * @return nullptr if index is out of range
+     */
+    const HPackHeader* get(size_t index) const;
+
+    /**
+     * @brief add entry to dynamic table, old entries are evicted
+     * @param[in] name header name
+     * @param[in] value header value
+     */
+    void add(std::string_view name, std::string_view value);
+
+    /**
+     * @brief find entry
+     * @param[in] name header name
+     * @param[in] value header value
+     * @param[out] matched if value matched too
+     * @return index, 0 if name not found
+     */
+    size_t find(std::string_view name, std::string_view value, bool& matched) const;
+
+    /**
+     * @brief Set the max size object, entries are evicted to fit
+     * @param[in] size max dynamic table size
+     */
+    void set_max_size(size_t size);
+
+    /**
+     * @brief Get the max size object
+     */
+    size_t get_max_size() const { return max_size_; }
+
+    /**
+     * @brief Get the size object, rfc size of dynamic entries
+     */
+    size_t get_size() const { return size_; }
+
+    /**
+     * @brief static table entry count
+     */
+    static size_t get_static_count();
+
+private:
+    /**
+     * @brief evict oldest entries until size fit
+     * @param[in] size max size
+     */
+    void evict(size_t size);
+
+private:
+    /// dynamic entries, newest at front
+    std::deque<HPackHeader> entries_ {};
+    /// size of dynamic entries
+    size_t size_ {0};
+    /// max dynamic table size
+    size_t max_size_ {4096};
+};
+
+/**
+ * @brief HPACK header block decoder of one connection
+ */
+class HPackDecoder {
+public:
+    /// share pointer
+    typedef std::shared_ptr<HPackDecoder> ptr;
+
+    /**
+     * @brief Construct a new HPackDecoder object
+     * @param[in] max_table_size table size limit advertised to peer
+     */
+    HPackDecoder(size_t max_table_size = 4096);
+
+    /**
+     * @brief decode complete header block
+     * @param[in] data header block
+     * @param[in] length header block length
+     * @param[out] headers decoded fields appended to
+     * @return false on compression error, connection must be closed
+     */
+    bool decode(const uint8_t* data, size_t length, std::vector<HPackHeader>& headers);
+
+private:
+    /// dynamic table
+    HPackTable table_;
+    /// table size limit advertised to peer
+    size_t max_table_size_ {4096};
+};
+
+/**
+ * @brief HPACK header block encoder of one connection
+ */
+class HPackEncoder {
+public:
+    /// share pointer
+    typedef std::shared_ptr<HPackEncoder> ptr;
+
+    /**
+     * @brief Construct a new HPackEncoder object
+     * @param[in] max_table_size dynamic table size
+     */
+    HPackEncoder(size_t max_table_size = 4096) : table_(max_table_size) {}
+
+    /**
+     * @brief encode one header field
+     * @details name is lowered. fields whose value change by response,
+     *          such as date and content-length, are not indexed
+     * @param[in] name header name
+     * @param[in] value header value
+     * @param[out] out header block appended to
+     */
+    void encode(std::string_view name, std::string_view value, std::string& out);
+
+    /**
+     * @brief Set the max table size object, peer SETTINGS_HEADER_TABLE_SIZE
+     * @details size update is sent at the begin of next field
+     * @param[in] size max table size
+     */
+    void set_max_table_size(size_t size);
+
+private:
+    /// dynamic table
+    HPackTable table_;
+    /// size update should be sent
+    bool size_update_ {false};
+};
+
+}
+}
+
+#endif
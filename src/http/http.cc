@@ -2,12 +2,14 @@
 #include "../log.h"
 #include "../utils.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <ostream>
 #include <sstream>
 #include <string>
 #include <strings.h>
+#include <ctime>
 
 namespace sylar {
 namespace http {
@@ -46,13 +48,21 @@ static const char* s_method_string[] = {
 #undef XX
 };
 
-static const char* http_method_to_string(HttpMethod method) {
+const char* http_method_to_string(HttpMethod method) {
     uint32_t idx = (uint32_t)method;
     if (idx > (sizeof(s_method_string) / sizeof(s_method_string[0]))) 
         return "<unknown>";
     return s_method_string[idx];
 }
 
+HttpMethod string_to_http_method(std::string_view method) {
+    for (size_t i = 0; i < sizeof(s_method_string) / sizeof(s_method_string[0]); i++) {
+        if (method == s_method_string[i])
+            return (HttpMethod)i;
+    }
+    return HttpMethod::INVALID_METHOD;
+}
+
 static const char* http_status_to_string(HttpStatus status) {
     switch (status) {
 #define XX(code, name, msg) \
@@ -69,6 +79,17 @@ bool CaseInsensitiveLess::operator()(const std::string &lhs, const std::string &
     return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
 }
 
+bool CaseInsensitiveEqual::operator()(std::string_view lhs, std::string_view rhs) const {
+    return lhs.size() == rhs.size() && strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+// rebase view to new buffer
+static void rebase_view(std::string_view& view, const char* from, const char* to) {
+    if (view.data() == nullptr)
+        return;
+    view = std::string_view(to + (view.data() - from), view.size());
+}
+
 HttpRequest::HttpRequest(uint8_t version, bool close)
     : version_(version)
     , close_(close) {
@@ -77,7 +98,45 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
 
 const std::string HttpRequest::get_header(const std::string &key, const std::string& def) {
     auto it = headers_.find(key);
-    return it == headers_.end() ? def : it->second;
+    if (it != headers_.end())
+        return it->second;
+    // materialize from view
+    for (auto& view : header_views_) {
+        if (CaseInsensitiveEqual()(view.first, key))
+            return std::string(view.second);
+    }
+    return def;
+}
+
+std::string_view HttpRequest::get_header_view(std::string_view key, std::string_view def) {
+    // headers set by user has higher priority
+    if (!headers_.empty()) {
+        auto it = headers_.find(std::string(key));
+        if (it != headers_.end())
+            return it->second;
+    }
+    for (auto& view : header_views_) {
+        if (CaseInsensitiveEqual()(view.first, key))
+            return view.second;
+    }
+    return def;
+}
+
+const HttpRequest::MapType HttpRequest::get_headers() {
+    MapType headers(headers_);
+    // emplace dont overwrite headers set by user
+    for (auto& view : header_views_) 
+        headers.emplace(std::string(view.first), std::string(view.second));
+    return headers;
+}
+
+void HttpRequest::foreach_header(const std::function<void (std::string_view, std::string_view)>& cb) {
+    for (auto& it : headers_)
+        cb(it.first, it.second);
+    for (auto& view : header_views_) {
+        if (headers_.empty() || headers_.find(std::string(view.first)) == headers_.end())
+            cb(view.first, view.second);
+    }
 }
 
 const std::string HttpRequest::get_param(const std::string &key, const std::string& def) {
@@ -88,6 +147,11 @@ const std::string HttpRequest::get_param(const std::string &key, const std::stri
     return it == params_.end() ? def : it->second;
 }
 
+const std::string HttpRequest::get_route_param(const std::string &key, const std::string& def) {
+    auto it = route_params_.find(key);
+    return it == route_params_.end() ? def : it->second;
+}
+
 const std::string HttpRequest::get_cookie(const std::string &key, const std::string& def) {
     init_cookies();
     auto it = cookies_.find(key);
@@ -95,19 +159,24 @@ const std::string HttpRequest::get_cookie(const std::string &key, const std::str
 }
 
 void HttpRequest::set_header(const std::string &key, const std::string &value) {
-    headers_.insert(key, value);
+    headers_[key] = value;
 }
 
 void HttpRequest::set_param(const std::string &key, const std::string &value) {
-    params_.insert(key, value);
+    params_[key] = value;
 }
 
 void HttpRequest::set_cookie(const std::string &key, const std::string &value) {
-    cookies_.insert(key, value);
+    cookies_[key] = value;
 }
 
 void HttpRequest::del_header(const std::string &key) {
     headers_.erase(key);
+    // remove from views
+    auto pos = std::remove_if(header_views_.begin(), header_views_.end(), [&key](const auto& view) {
+        return CaseInsensitiveEqual()(view.first, key);
+    });
+    header_views_.erase(pos, header_views_.end());
 }
 
 void HttpRequest::del_param(const std::string &key) {
@@ -118,12 +187,72 @@ void HttpRequest::del_cookie(const std::string &key) {
     params_.erase(key);
 }
 
+void HttpRequest::append_body_view(std::string_view body) {
+    // already fallback to owned body
+    if (!body_.empty()) {
+        body_.append(body.data(), body.size());
+        return;
+    }
+    // first chunk
+    if (body_view_.data() == nullptr) {
+        body_view_ = body;
+        return;
+    }
+    // contiguous chunk, only extend view
+    if (body_view_.data() + body_view_.size() == body.data()) {
+        body_view_ = std::string_view(body_view_.data(), body_view_.size() + body.size());
+        return;
+    }
+    // chunked body is splited by chunk header, copy here
+    body_.assign(body_view_.data(), body_view_.size());
+    body_.append(body.data(), body.size());
+    body_view_ = {};
+}
+
+void HttpRequest::materialize_body() {
+    if (body_view_.data() == nullptr)
+        return;
+    body_.assign(body_view_.data(), body_view_.size());
+    body_view_ = {};
+}
+
+void HttpRequest::materialize() {
+    // check if view mode
+    if (!buffer_)
+        return;
+    if (path_view_.data())
+        set_path(std::string(path_view_));
+    if (query_view_.data())
+        set_query(std::string(query_view_));
+    if (fragment_view_.data())
+        set_fragment(std::string(fragment_view_));
+    materialize_body();
+    // header set by user has higher priority
+    for (auto& view : header_views_) 
+        headers_.emplace(std::string(view.first), std::string(view.second));
+    header_views_.clear();
+    buffer_.reset();
+    SYLAR_DEBUG("http request materialized");
+}
+
+void HttpRequest::rebase(const char* from, const char* to) {
+    rebase_view(path_view_, from, to);
+    rebase_view(query_view_, from, to);
+    rebase_view(fragment_view_, from, to);
+    rebase_view(body_view_, from, to);
+    for (auto& view : header_views_) {
+        rebase_view(view.first, from, to);
+        rebase_view(view.second, from, to);
+    }
+}
+
 std::ostream& operator << (std::ostream& os, HttpRequest& req) {
     // GET /uri HTTP/1.1
     // Host: wwww.sylar.top
+    std::string body = req.get_body();
     os << http_method_to_string(req.method_) << " "
-    << req.path_ 
-    << (req.query_.empty() ? "" : "?") 
+    << req.get_path() 
+    << (req.get_query().empty() ? "" : "?") 
     << "HTTP/" 
     << (uint32_t)(req.version_ >> 4) << 
     "." 
@@ -135,20 +264,20 @@ std::ostream& operator << (std::ostream& os, HttpRequest& req) {
         os << "connection: " << (req.close_ ? "close" : "keep-alive") << "\r\n";
 
     // headers
-    for (auto& it : req.headers_) {
+    for (auto& it : req.get_headers()) {
         // check if is websockett
         if (!req.websocket_ && strcasecmp(it.first.c_str(), "connection") == 0) 
             continue;
         // check if body is empty
-        if (!req.body_.empty() && strcasecmp(it.first.c_str(), "content-length") == 0) 
+        if (!body.empty() && strcasecmp(it.first.c_str(), "content-length") == 0) 
             continue;
         os << it.first << ": " << it.second << "\r\n";
     }
 
     // add body
-    if (!req.body_.empty())
-        os << "content-length: " << req.body_.size() << "\r\n\r\n" 
-            << req.body_;
+    if (!body.empty())
+        os << "content-length: " << body.size() << "\r\n\r\n" 
+            << body;
     else 
         os << "\r\n";
 
@@ -160,9 +289,10 @@ void HttpRequest::init_query_param() {
     if (parser_param_flags_ & 0x1) 
         return;
 
-    PARSE_PARAM(query_, params_, '&', );
+    std::string query = get_query();
+    PARSE_PARAM(query, params_, '&', );
     parser_param_flags_ |= 0x1;
-    SYLAR_FMT_DEBUG("http request query init, body: %s, param: %s", query_.c_str());
+    SYLAR_FMT_DEBUG("http request query init, body: %s, param: %s", query.c_str());
 }
 
 void HttpRequest::init_body_param() {
@@ -175,9 +305,10 @@ void HttpRequest::init_body_param() {
         parser_param_flags_ |= 0x2;
         return;
     }
-    PARSE_PARAM(body_, params_, '&', );
+    std::string body = get_body();
+    PARSE_PARAM(body, params_, '&', );
     parser_param_flags_ |= 0x2;
-    SYLAR_FMT_DEBUG("http request body init, body: %s, param: %s", body_.c_str());
+    SYLAR_FMT_DEBUG("http request body init, body: %s, param: %s", body.c_str());
 }
 
 void HttpRequest::init_cookies() {
@@ -195,12 +326,15 @@ void HttpRequest::init_cookies() {
 }
 
 void HttpRequest::init() {
-    std::string conn = get_header("connection");
+    std::string_view conn = get_header_view("connection");
     if (!conn.empty()) {
-        if (strcasecmp(conn.c_str(), "keep-alive") == 0) 
+        if (CaseInsensitiveEqual()(conn, "keep-alive")) 
             close_ = false;
         else 
             close_ = true;
+    } else {
+        // persistent by default since http/1.1
+        close_ = version_ < 0x11;
     }
 }
 
@@ -220,7 +354,7 @@ const std::string HttpResponse::get_cookie(const std::string &key, const std::st
 }
 
 void HttpResponse::set_header(const std::string& key, const std::string& value) {
-    headers_.insert(key, value);
+    headers_[key] = value;
 }
 
 void HttpResponse::set_redirect(const std::string& uri) {
@@ -243,7 +377,7 @@ void HttpResponse::set_cookie(const std::string& key, const std::string& value,
     if (secure)
         result.append(";secure");
     SYLAR_FMT_DEBUG("http response set cookie: %s", result.c_str());
-    cookies_.insert(key, result);
+    cookies_[key] = result;
 }
 
 void HttpResponse::del_header(const std::string &key) {
@@ -254,41 +388,62 @@ void HttpResponse::del_cookie(const std::string &key) {
     headers_.erase(key);
 }
 
-std::string HttpResponse::to_string() {
+void HttpResponse::write_header(std::string& out) {
     // HTTP/1.1 304 Not Modified
     // Date: Thu, 07 Jun 2012 07:21:36 GMT
     // Connection: close
-    std::stringstream os;
-    os << "HTTP/"
-    << (uint32_t)(version_ >> 4)
-    << "."
-    << (uint32_t)(version_ & 0x0F)
-    << " "
-    << (uint32_t)status_
-    << " "
-    << (reason_.empty() ? http_status_to_string(status_) : reason_)
-    << "\r\n";
+    char line[64];
+    int len = snprintf(line, sizeof(line), "HTTP/%u.%u %u ", (uint32_t)(version_ >> 4), 
+        (uint32_t)(version_ & 0x0F), (uint32_t)status_);
+    out.append(line, len);
+    out.append(reason_.empty() ? http_status_to_string(status_) : reason_);
+    out.append("\r\n");
     // add header
     for (auto& it : headers_) {
         // add connection
         if (!websocket_ && strcasecmp(it.first.c_str(), "connection") == 0)
             continue;
-        os << it.first << ": " << it.second << "\r\n";
+        // content length is decided by body
+        if (!body_.empty() && strcasecmp(it.first.c_str(), "content-length") == 0)
+            continue;
+        out.append(it.first).append(": ").append(it.second).append("\r\n");
     }
+    if (header_block_)
+        out.append(*header_block_);
     // append cookie
-    for (auto& it : cookies_) {
-        os << "Set-Cookie: " << it.first << "=" << it.second << "\r\n";
-    }
+    for (auto& it : cookies_) 
+        out.append("Set-Cookie: ").append(it.first).append("=").append(it.second).append("\r\n");
     // add close
     if (!websocket_)
-        os << "connection: " << (close_ ? "close" : "keep-alive") << "\r\n";
+        out.append("connection: ").append(close_ ? "close" : "keep-alive").append("\r\n");
+    if (!body_.empty()) {
+        len = snprintf(line, sizeof(line), "content-length: %lu\r\n", body_.size());
+        out.append(line, len);
+    }
+}
 
-    if (!body_.empty()) 
-        os << "content-length: " << body_.size() << "\r\n\r\n" 
-            << body_;
-    else 
-        os << "\r\n";
-    return os.str();
+void HttpResponse::append_date_header(std::string& out) {
+    // every thread format date at most once per second
+    static thread_local time_t t_last = 0;
+    static thread_local char t_date[64];
+    static thread_local size_t t_len = 0;
+    time_t now = time(nullptr);
+    if (now != t_last) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        t_len = strftime(t_date, sizeof(t_date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        t_last = now;
+    }
+    out.append(t_date, t_len);
+}
+
+std::string HttpResponse::to_string() {
+    std::string out;
+    out.reserve(256 + body_.size());
+    write_header(out);
+    out.append("\r\n");
+    out.append(body_);
+    return out;
 }
 
 std::ostream& operator << (std::ostream& os, HttpResponse& resp) {
@@ -2,13 +2,18 @@
 #define __SYLAR_SRC_HTTP_H__
 
 #include "http-parser/http_parser.h"
+#include "../address.h"
 
 #include <bits/types/time_t.h>
+#include <functional>
 #include <map>
 #include <memory>
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 
 namespace sylar {
@@ -29,6 +34,20 @@ enum class HttpStatus {
 #undef XX
 };
 
+/**
+ * @brief Get http method by name
+ * @param[in] method method name, case sensitive
+ * @return INVALID_METHOD if not found
+ */
+HttpMethod string_to_http_method(std::string_view method);
+
+/**
+ * @brief Get method name
+ * @param[in] method http method
+ * @return "<unknown>" if method is out of range
+ */
+const char* http_method_to_string(HttpMethod method);
+
 /**
  * @brief 忽略大小写比较仿函数
  */
@@ -39,6 +58,16 @@ struct CaseInsensitiveLess {
     bool operator()(const std::string& lhs, const std::string& rhs) const;
 };
 
+/**
+ * @brief 忽略大小写判等仿函数
+ */
+struct CaseInsensitiveEqual {
+    /**
+     * @brief 忽略大小写判断字符串是否相等
+     */
+    bool operator()(std::string_view lhs, std::string_view rhs) const;
+};
+
 class HttpResponse;
 
 class HttpRequest {
@@ -49,6 +78,9 @@ public:
     /// Map struct
     typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
 
+    /// flat header views, point into receive buffer
+    typedef std::vector<std::pair<std::string_view, std::string_view>> ViewMapType;
+
     /**
      * @brief Construct a new Http Request object
      * @param[in] version request version
@@ -75,22 +107,51 @@ public:
     /**
      * @brief Get the path object
      */
-    const std::string get_path() { return path_; }
+    const std::string get_path() { return path_view_.data() ? std::string(path_view_) : path_; }
 
     /**
      * @brief Get the query object
      */
-    const std::string get_query() { return query_; }
+    const std::string get_query() { return query_view_.data() ? std::string(query_view_) : query_; }
 
     /**
      * @brief Get the body object
      */
-    const std::string get_body() { return body_; }
+    const std::string get_body() { return body_view_.data() ? std::string(body_view_) : body_; }
 
     /**
      * @brief Get the headers object
+     * @note header views are materialized into the result map
      */
-    const MapType get_headers() { return headers_; }
+    const MapType get_headers();
+
+    /**
+     * @brief Get the path view object, valid while request is alive
+     */
+    std::string_view get_path_view() { return path_view_.data() ? path_view_ : std::string_view(path_); }
+
+    /**
+     * @brief Get the query view object, valid while request is alive
+     */
+    std::string_view get_query_view() { return query_view_.data() ? query_view_ : std::string_view(query_); }
+
+    /**
+     * @brief Get the body view object, valid while request is alive
+     */
+    std::string_view get_body_view() { return body_view_.data() ? body_view_ : std::string_view(body_); }
+
+    /**
+     * @brief Get the header views object
+     */
+    const ViewMapType& get_header_views() { return header_views_; }
+
+    /**
+     * @brief visit every header, repeated received header is kept
+     * @details headers set by user come first, received headers with
+     *          same name are skipped
+     * @param[in] cb callback of header name and value
+     */
+    void foreach_header(const std::function<void (std::string_view, std::string_view)>& cb);
 
     /**
      * @brief Get the params object
@@ -102,6 +163,11 @@ public:
      */
     const MapType get_cookies() { return cookies_;}
 
+    /**
+     * @brief Get the route params object
+     */
+    const MapType get_route_params() { return route_params_; }
+
     /**
      * @brief Get the header object
      * @param[in] key header key
@@ -109,6 +175,20 @@ public:
      */
     const std::string get_header(const std::string& key, const std::string& def = "");
 
+    /**
+     * @brief Get the route param object, captured by router
+     * @param[in] key param name
+     * @param[in] def default value
+     */
+    const std::string get_route_param(const std::string& key, const std::string& def = "");
+
+    /**
+     * @brief Get the header view object without materialize
+     * @param[in] key header key
+     * @param[in] def default value
+     */
+    std::string_view get_header_view(std::string_view key, std::string_view def = "");
+
     /**
      * @brief Get the param object
      * @param[in] key param key
@@ -166,6 +246,11 @@ public:
      */
     bool is_close() { return close_; }
 
+    /**
+     * @brief if request keep string views into receive buffer
+     */
+    bool is_zero_copy() { return buffer_ != nullptr; }
+
 public:
     /**
      * @brief Set the method object
@@ -183,25 +268,25 @@ public:
      * @brief Set the path object
      * @param[in] path http path
      */
-    void set_path(const std::string& path) { path_ = path; }
+    void set_path(const std::string& path) { path_ = path; path_view_ = {}; }
 
     /**
      * @brief Set the query object
      * @param[in] query http query
      */
-    void set_query(const std::string& query) { query_ = query; }
+    void set_query(const std::string& query) { query_ = query; query_view_ = {}; }
 
     /**
      * @brief Set the body object
      * @param[in] body http body
      */
-    void set_body(const std::string& body) { body_ = body; }
+    void set_body(const std::string& body) { body_ = body; body_view_ = {}; }
 
     /**
      * @brief Set the fragment object
      * @param[in] fragment http fragment
      */
-    void set_fragment(const std::string& fragment) { fragment_ = fragment; }
+    void set_fragment(const std::string& fragment) { fragment_ = fragment; fragment_view_ = {}; }
 
     /**
      * @brief append the body object
@@ -209,6 +294,60 @@ public:
      */
     void append_body(const std::string& body) { body_.append(body); }
 
+    /**
+     * @brief Set the receive buffer object, string views point into it
+     * @param[in] buffer receive buffer
+     */
+    void set_buffer(std::shared_ptr<char> buffer) { buffer_ = buffer; header_views_.reserve(16); }
+
+    /**
+     * @brief Set the path view object
+     * @param[in] path path view in receive buffer
+     */
+    void set_path_view(std::string_view path) { path_view_ = path; }
+
+    /**
+     * @brief Set the query view object
+     * @param[in] query query view in receive buffer
+     */
+    void set_query_view(std::string_view query) { query_view_ = query; }
+
+    /**
+     * @brief Set the fragment view object
+     * @param[in] fragment fragment view in receive buffer
+     */
+    void set_fragment_view(std::string_view fragment) { fragment_view_ = fragment; }
+
+    /**
+     * @brief add header view, dont check duplicate
+     * @param[in] key header key view
+     * @param[in] value header value view
+     */
+    void add_header_view(std::string_view key, std::string_view value) { header_views_.emplace_back(key, value); }
+
+    /**
+     * @brief append body view, contiguous chunk only extend the view
+     * @param[in] body body view in receive buffer
+     */
+    void append_body_view(std::string_view body);
+
+    /**
+     * @brief copy body view into body, receive buffer after header could be reused
+     */
+    void materialize_body();
+
+    /**
+     * @brief copy all views into owned string, release receive buffer
+     */
+    void materialize();
+
+    /**
+     * @brief receive buffer moved, rebase all views to new buffer
+     * @param[in] from old buffer base
+     * @param[in] to new buffer base
+     */
+    void rebase(const char* from, const char* to);
+
     /**
      * @brief Set the headers object
      * @param[in] header http header
@@ -254,6 +393,24 @@ public:
      */
     void set_cookie(const std::string& key, const std::string& value);
 
+    /**
+     * @brief Set the route param object
+     * @param[in] key param name
+     * @param[in] value param value
+     */
+    void set_route_param(const std::string& key, const std::string& value) { route_params_[key] = value; }
+
+    /**
+     * @brief Set the remote addr object
+     * @param[in] addr peer address of connection
+     */
+    void set_remote_addr(Address::ptr addr) { remote_addr_ = addr; }
+
+    /**
+     * @brief Get the remote addr object, nullptr if unknown
+     */
+    Address::ptr get_remote_addr() { return remote_addr_; }
+
     /**
      * @brief Set the close object
      * @param[in] close keep-alive
@@ -325,6 +482,22 @@ private:
     MapType params_ {};
     /// request cookies
     MapType cookies_ {};
+    /// route params
+    MapType route_params_ {};
+    /// receive buffer, keep alive while views are used
+    std::shared_ptr<char> buffer_ {};
+    /// request path view
+    std::string_view path_view_ {};
+    /// request query view
+    std::string_view query_view_ {};
+    /// request fragment view
+    std::string_view fragment_view_ {};
+    /// request body view
+    std::string_view body_view_ {};
+    /// request header views
+    ViewMapType header_views_ {};
+    /// peer address of connection
+    Address::ptr remote_addr_ {};
     /// websocket
     bool websocket_ {false};
     /// auto close
@@ -365,6 +538,11 @@ public:
      */
     const std::string get_body() { return body_; }
 
+    /**
+     * @brief Get the body view object, valid until body changed
+     */
+    std::string_view get_body_view() { return body_; }
+
     /**
      * @brief Get the reason object
      */
@@ -445,6 +623,12 @@ public:
      */
     void set_body(const std::string& body) { body_ = body; }
 
+    /**
+     * @brief swap body with buffer, no copy
+     * @param[in,out] body new body, get old body back
+     */
+    void swap_body(std::string& body) { body_.swap(body); }
+
     /**
      * @brief append the body object
      * @param[in] body http body
@@ -508,6 +692,36 @@ public:
      */
     void del_cookie(const std::string& key);
 
+    /**
+     * @brief if header is set
+     * @param[in] key header key
+     */
+    bool has_header(const std::string& key) { return headers_.find(key) != headers_.end(); }
+
+    /**
+     * @brief serialize status line and headers, without the blank line
+     * @param[out] out append to
+     */
+    void write_header(std::string& out);
+
+    /**
+     * @brief Set the header block object
+     * @details pre-serialized header lines, written after headers
+     * @param[in] block header lines, every line end with "\r\n"
+     */
+    void set_header_block(std::shared_ptr<const std::string> block) { header_block_ = block; }
+
+    /**
+     * @brief Get the header block object
+     */
+    std::shared_ptr<const std::string> get_header_block() { return header_block_; }
+
+    /**
+     * @brief append cached date header line, refreshed once per second
+     * @param[out] out append to
+     */
+    static void append_date_header(std::string& out);
+
     /**
      * @brief to string
      */
@@ -531,6 +745,8 @@ private:
     std::string body_ {};
     /// http reason
     std::string reason_ {};
+    /// pre-serialized header lines
+    std::shared_ptr<const std::string> header_block_ {};
     /// websocket
     bool websocket_ {false};
     /// close 
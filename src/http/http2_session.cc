@@ -0,0 +1,716 @@
+#include "http2_session.h"
+#include "../log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/uio.h>
+
+namespace sylar {
+namespace http {
+
+/// END_STREAM flag of DATA and HEADERS
+static const uint8_t s_flag_end_stream = 0x1;
+/// ACK flag of SETTINGS and PING
+static const uint8_t s_flag_ack = 0x1;
+/// END_HEADERS flag of HEADERS and CONTINUATION
+static const uint8_t s_flag_end_headers = 0x4;
+/// PADDED flag of DATA and HEADERS
+static const uint8_t s_flag_padded = 0x8;
+/// PRIORITY flag of HEADERS
+static const uint8_t s_flag_priority = 0x20;
+
+/// max frame payload accepted, never advertised larger
+static const uint32_t s_max_frame_size = 16384;
+/// max header block size of one request
+static const size_t s_max_header_block = 256 * 1024;
+/// receive buffer size, larger than one frame
+static const size_t s_buffer_size = 32 * 1024;
+/// max flow control window
+static const int64_t s_max_window = 0x7fffffff;
+
+/// settings identifier
+static const uint16_t s_settings_header_table_size = 0x1;
+static const uint16_t s_settings_enable_push = 0x2;
+static const uint16_t s_settings_max_concurrent_streams = 0x3;
+static const uint16_t s_settings_initial_window_size = 0x4;
+static const uint16_t s_settings_max_frame_size = 0x5;
+
+const std::string_view Http2Session::PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static inline uint32_t read_u32(const char* data) {
+    const uint8_t* p = (const uint8_t*)data;
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void write_u32(char* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/**
+ * @brief connection specific header, not allowed in http/2
+ */
+static bool is_connection_header(std::string_view name) {
+    CaseInsensitiveEqual equal;
+    return equal(name, "connection") || equal(name, "keep-alive") || equal(name, "proxy-connection")
+        || equal(name, "transfer-encoding") || equal(name, "upgrade");
+}
+
+void Http2FrameHeader::encode(char* out) const {
+    out[0] = length >> 16;
+    out[1] = length >> 8;
+    out[2] = length;
+    out[3] = (char)type;
+    out[4] = flags;
+    write_u32(out + 5, stream_id & 0x7fffffff);
+}
+
+void Http2FrameHeader::decode(const char* data) {
+    const uint8_t* p = (const uint8_t*)data;
+    length = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    type = (Http2FrameType)p[3];
+    flags = p[4];
+    // reserved bit is ignored
+    stream_id = read_u32(data + 5) & 0x7fffffff;
+}
+
+Http2Session::Http2Session(Socket::ptr sock, const std::string& buffered, bool owner)
+    : SocketStream(sock, owner) {
+    buffer_.resize(std::max(s_buffer_size, buffered.size()));
+    memcpy(&buffer_[0], buffered.data(), buffered.size());
+    write_pos_ = buffered.size();
+}
+
+void Http2Session::handle(ServletDispatch::ptr dispatch, Scheduler* worker) {
+    dispatch_ = dispatch;
+    worker_ = worker ? worker : Scheduler::get_this();
+    if (!worker_) {
+        SYLAR_ERR("http2 session handled outside of a scheduler");
+        return;
+    }
+    if (!fill(PREFACE.size()) || PREFACE.compare(0, PREFACE.size(), &buffer_[read_pos_], PREFACE.size()) != 0) {
+        SYLAR_ERR("http2 connection preface mismatch");
+        return;
+    }
+    read_pos_ += PREFACE.size();
+    // server preface, larger receive window let upload go without round trip
+    char settings[12];
+    settings[0] = 0;
+    settings[1] = s_settings_max_concurrent_streams;
+    write_u32(settings + 2, max_concurrent_streams_);
+    settings[6] = 0;
+    settings[7] = s_settings_initial_window_size;
+    write_u32(settings + 8, initial_window_size_);
+    send_frame(Http2FrameType::SETTINGS, 0, 0, settings, sizeof(settings));
+    if (initial_window_size_ > 65535)
+        send_window_update(0, initial_window_size_ - 65535);
+    recv_window_ = initial_window_size_;
+    Http2Error error = Http2Error::NO_ERROR;
+    while (true) {
+        {
+            MutexType::Lock lock(mutex_);
+            if (goaway_ && active_streams_ == 0)
+                break;
+        }
+        if (!fill(Http2FrameHeader::SIZE))
+            break;
+        Http2FrameHeader header;
+        header.decode(&buffer_[read_pos_]);
+        if (header.length > s_max_frame_size) {
+            error = Http2Error::FRAME_SIZE_ERROR;
+            break;
+        }
+        if (!fill(Http2FrameHeader::SIZE + header.length))
+            break;
+        // payload stay valid until next fill
+        const char* payload = &buffer_[read_pos_ + Http2FrameHeader::SIZE];
+        read_pos_ += Http2FrameHeader::SIZE + header.length;
+        error = on_frame(header, payload);
+        if (error != Http2Error::NO_ERROR)
+            break;
+    }
+    if (error != Http2Error::NO_ERROR) {
+        SYLAR_FMT_DEBUG("http2 connection error: %u", (uint32_t)error);
+        char goaway[8];
+        write_u32(goaway, last_stream_id_);
+        write_u32(goaway + 4, (uint32_t)error);
+        send_frame(Http2FrameType::GOAWAY, 0, 0, goaway, sizeof(goaway));
+    }
+    // nothing could be received any more, stop streams and wait for them
+    MutexType::Lock lock(mutex_);
+    closed_ = true;
+    window_cond_.broadcast();
+    while (active_streams_ > 0)
+        streams_done_.wait(mutex_);
+}
+
+bool Http2Session::fill(size_t length) {
+    while (write_pos_ - read_pos_ < length) {
+        // move left bytes to front, one frame never exceed buffer
+        if (read_pos_ > 0) {
+            memmove(&buffer_[0], &buffer_[read_pos_], write_pos_ - read_pos_);
+            write_pos_ -= read_pos_;
+            read_pos_ = 0;
+        }
+        int len = read(&buffer_[write_pos_], buffer_.size() - write_pos_);
+        if (len <= 0)
+            return false;
+        write_pos_ += len;
+    }
+    return true;
+}
+
+Http2Error Http2Session::on_frame(const Http2FrameHeader& header, const char* payload) {
+    // header block must not be interleaved
+    if (continued_id_ != 0 && (header.type != Http2FrameType::CONTINUATION
+        || header.stream_id != continued_id_))
+        return Http2Error::PROTOCOL_ERROR;
+    switch (header.type) {
+    case Http2FrameType::HEADERS:
+        return on_headers(header, payload);
+    case Http2FrameType::CONTINUATION:
+        return on_continuation(header, payload);
+    case Http2FrameType::DATA:
+        return on_data(header, payload);
+    case Http2FrameType::SETTINGS:
+        return on_settings(header, payload);
+    case Http2FrameType::WINDOW_UPDATE:
+        return on_window_update(header, payload);
+    case Http2FrameType::RST_STREAM:
+        return on_rst_stream(header, payload);
+    case Http2FrameType::PING:
+        if (header.stream_id != 0)
+            return Http2Error::PROTOCOL_ERROR;
+        if (header.length != 8)
+            return Http2Error::FRAME_SIZE_ERROR;
+        if (!(header.flags & s_flag_ack))
+            send_frame(Http2FrameType::PING, s_flag_ack, 0, payload, 8);
+        return Http2Error::NO_ERROR;
+    case Http2FrameType::GOAWAY:
+        if (header.stream_id != 0)
+            return Http2Error::PROTOCOL_ERROR;
+        {
+            MutexType::Lock lock(mutex_);
+            goaway_ = true;
+        }
+        return Http2Error::NO_ERROR;
+    case Http2FrameType::PRIORITY:
+        // priority is advisory, ignored
+        if (header.stream_id == 0)
+            return Http2Error::PROTOCOL_ERROR;
+        if (header.length != 5)
+            reset_stream(header.stream_id, Http2Error::FRAME_SIZE_ERROR);
+        return Http2Error::NO_ERROR;
+    case Http2FrameType::PUSH_PROMISE:
+        return Http2Error::PROTOCOL_ERROR;
+    default:
+        // unknown frame type must be ignored
+        return Http2Error::NO_ERROR;
+    }
+}
+
+Http2Error Http2Session::on_headers(const Http2FrameHeader& header, const char* payload) {
+    uint32_t id = header.stream_id;
+    if (id == 0 || (id & 1) == 0)
+        return Http2Error::PROTOCOL_ERROR;
+    size_t length = header.length;
+    size_t padding = 0;
+    if (header.flags & s_flag_padded) {
+        if (length < 1)
+            return Http2Error::FRAME_SIZE_ERROR;
+        padding = (uint8_t)*payload++;
+        length--;
+    }
+    if (header.flags & s_flag_priority) {
+        if (length < 5)
+            return Http2Error::FRAME_SIZE_ERROR;
+        payload += 5;
+        length -= 5;
+    }
+    if (padding > length)
+        return Http2Error::PROTOCOL_ERROR;
+    length -= padding;
+    bool end_stream = header.flags & s_flag_end_stream;
+    // block without stream still has to be decoded, hpack state is shared
+    Stream::ptr stream;
+    Http2Error error = Http2Error::NO_ERROR;
+    {
+        MutexType::Lock lock(mutex_);
+        auto it = streams_.find(id);
+        if (it != streams_.end()) {
+            // trailers must end request
+            if (!end_stream)
+                return Http2Error::PROTOCOL_ERROR;
+            if (it->second->remote_closed)
+                error = Http2Error::STREAM_CLOSED;
+            else
+                stream = it->second;
+        } else if (id > last_stream_id_) {
+            last_stream_id_ = id;
+            if (!goaway_ && streams_.size() < max_concurrent_streams_) {
+                stream.reset(new Stream);
+                stream->id = id;
+                stream->recv_window = initial_window_size_;
+                stream->send_window = peer_initial_window_;
+                streams_[id] = stream;
+            } else {
+                error = Http2Error::REFUSED_STREAM;
+            }
+        }
+        // else trailers of stream reset by us, ignored
+    }
+    header_block_.assign(payload, length);
+    continued_ = stream;
+    continued_id_ = id;
+    continued_end_ = end_stream;
+    continued_error_ = error;
+    if (header.flags & s_flag_end_headers)
+        return on_header_block(stream, end_stream);
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_continuation(const Http2FrameHeader& header, const char* payload) {
+    if (continued_id_ == 0)
+        return Http2Error::PROTOCOL_ERROR;
+    if (header_block_.size() + header.length > s_max_header_block)
+        return Http2Error::ENHANCE_YOUR_CALM;
+    header_block_.append(payload, header.length);
+    if (header.flags & s_flag_end_headers)
+        return on_header_block(continued_, continued_end_);
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_header_block(Stream::ptr stream, bool end_stream) {
+    uint32_t id = continued_id_;
+    continued_.reset();
+    continued_id_ = 0;
+    std::vector<HPackHeader> fields;
+    if (!decoder_.decode((const uint8_t*)header_block_.data(), header_block_.size(), fields))
+        return Http2Error::COMPRESSION_ERROR;
+    if (!stream) {
+        if (continued_error_ != Http2Error::NO_ERROR)
+            reset_stream(id, continued_error_);
+        return Http2Error::NO_ERROR;
+    }
+    if (stream->headers_complete) {
+        // trailers are kept as request headers
+        stream->headers.insert(stream->headers.end(), fields.begin(), fields.end());
+    } else {
+        stream->headers.swap(fields);
+        stream->headers_complete = true;
+    }
+    if (end_stream) {
+        stream->remote_closed = true;
+        start_stream(stream);
+    }
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_data(const Http2FrameHeader& header, const char* payload) {
+    uint32_t id = header.stream_id;
+    if (id == 0)
+        return Http2Error::PROTOCOL_ERROR;
+    size_t length = header.length;
+    size_t padding = 0;
+    if (header.flags & s_flag_padded) {
+        if (length < 1)
+            return Http2Error::FRAME_SIZE_ERROR;
+        padding = (uint8_t)*payload++;
+        length--;
+    }
+    if (padding > length)
+        return Http2Error::PROTOCOL_ERROR;
+    length -= padding;
+    // whole frame is counted by flow control, padding too
+    if (header.length > recv_window_)
+        return Http2Error::FLOW_CONTROL_ERROR;
+    recv_window_ -= header.length;
+    if (recv_window_ < initial_window_size_ / 2) {
+        send_window_update(0, initial_window_size_ - recv_window_);
+        recv_window_ = initial_window_size_;
+    }
+    Stream::ptr stream;
+    {
+        MutexType::Lock lock(mutex_);
+        auto it = streams_.find(id);
+        if (it != streams_.end())
+            stream = it->second;
+    }
+    if (!stream || stream->remote_closed) {
+        if (id > last_stream_id_)
+            return Http2Error::PROTOCOL_ERROR;
+        // frames in flight after reset are ignored
+        if (stream)
+            reset_stream(id, Http2Error::STREAM_CLOSED);
+        return Http2Error::NO_ERROR;
+    }
+    if (header.length > stream->recv_window) {
+        reset_stream(id, Http2Error::FLOW_CONTROL_ERROR);
+        return Http2Error::NO_ERROR;
+    }
+    stream->recv_window -= header.length;
+    if (max_body_size_ > 0 && stream->body.size() + length > max_body_size_) {
+        // answer before request end, then stop the upload
+        SYLAR_FMT_ERR("http2 request body too large, max: %lu", max_body_size_);
+        HttpResponse::ptr resp(new HttpResponse(0x20, false));
+        resp->set_status(HttpStatus::PAYLOAD_TOO_LARGE);
+        send_response(stream, resp, false);
+        reset_stream(id, Http2Error::NO_ERROR);
+        return Http2Error::NO_ERROR;
+    }
+    stream->body.append(payload, length);
+    if (header.flags & s_flag_end_stream) {
+        stream->remote_closed = true;
+        start_stream(stream);
+    } else if (stream->recv_window < initial_window_size_ / 2) {
+        send_window_update(id, initial_window_size_ - stream->recv_window);
+        stream->recv_window = initial_window_size_;
+    }
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_settings(const Http2FrameHeader& header, const char* payload) {
+    if (header.stream_id != 0)
+        return Http2Error::PROTOCOL_ERROR;
+    if (header.flags & s_flag_ack)
+        return header.length == 0 ? Http2Error::NO_ERROR : Http2Error::FRAME_SIZE_ERROR;
+    if (header.length % 6 != 0)
+        return Http2Error::FRAME_SIZE_ERROR;
+    MutexType::Lock lock(mutex_);
+    for (size_t i = 0; i < header.length; i += 6) {
+        uint16_t id = (uint8_t)payload[i] << 8 | (uint8_t)payload[i + 1];
+        uint32_t value = read_u32(payload + i + 2);
+        if (id == s_settings_header_table_size) {
+            encoder_.set_max_table_size(value);
+        } else if (id == s_settings_enable_push) {
+            if (value > 1)
+                return Http2Error::PROTOCOL_ERROR;
+        } else if (id == s_settings_initial_window_size) {
+            if (value > s_max_window)
+                return Http2Error::FLOW_CONTROL_ERROR;
+            // change apply to all open streams
+            int64_t delta = (int64_t)value - peer_initial_window_;
+            for (auto& it : streams_)
+                it.second->send_window += delta;
+            peer_initial_window_ = value;
+        } else if (id == s_settings_max_frame_size) {
+            if (value < 16384 || value > 16777215)
+                return Http2Error::PROTOCOL_ERROR;
+            peer_max_frame_size_ = value;
+        }
+    }
+    window_cond_.broadcast();
+    write_frame(Http2FrameType::SETTINGS, s_flag_ack, 0, nullptr, 0);
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_window_update(const Http2FrameHeader& header, const char* payload) {
+    if (header.length != 4)
+        return Http2Error::FRAME_SIZE_ERROR;
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+    uint32_t id = header.stream_id;
+    if (increment == 0) {
+        if (id == 0)
+            return Http2Error::PROTOCOL_ERROR;
+        reset_stream(id, Http2Error::PROTOCOL_ERROR);
+        return Http2Error::NO_ERROR;
+    }
+    MutexType::Lock lock(mutex_);
+    if (id == 0) {
+        send_window_ += increment;
+        if (send_window_ > s_max_window)
+            return Http2Error::FLOW_CONTROL_ERROR;
+    } else {
+        auto it = streams_.find(id);
+        if (it == streams_.end())
+            return Http2Error::NO_ERROR;
+        it->second->send_window += increment;
+        if (it->second->send_window > s_max_window) {
+            lock.unlock();
+            reset_stream(id, Http2Error::FLOW_CONTROL_ERROR);
+            return Http2Error::NO_ERROR;
+        }
+    }
+    window_cond_.broadcast();
+    return Http2Error::NO_ERROR;
+}
+
+Http2Error Http2Session::on_rst_stream(const Http2FrameHeader& header, const char* payload) {
+    if (header.stream_id == 0 || header.stream_id > last_stream_id_)
+        return Http2Error::PROTOCOL_ERROR;
+    if (header.length != 4)
+        return Http2Error::FRAME_SIZE_ERROR;
+    MutexType::Lock lock(mutex_);
+    auto it = streams_.find(header.stream_id);
+    if (it == streams_.end())
+        return Http2Error::NO_ERROR;
+    Stream::ptr stream = it->second;
+    stream->reset = true;
+    // running stream is removed by its fiber
+    if (!stream->remote_closed)
+        streams_.erase(it);
+    window_cond_.broadcast();
+    return Http2Error::NO_ERROR;
+}
+
+void Http2Session::start_stream(Stream::ptr stream) {
+    if (!build_request(stream)) {
+        reset_stream(stream->id, Http2Error::PROTOCOL_ERROR);
+        MutexType::Lock lock(mutex_);
+        streams_.erase(stream->id);
+        return;
+    }
+    {
+        MutexType::Lock lock(mutex_);
+        active_streams_++;
+    }
+    auto self = shared_from_this();
+    worker_->schedule([self, stream]() {
+        self->handle_stream(stream);
+    });
+}
+
+void Http2Session::handle_stream(Stream::ptr stream) {
+    HttpRequest::ptr req = stream->request;
+    HttpResponse::ptr resp(new HttpResponse(0x20, false));
+    // no http/1 session, servlet fill body of response
+    dispatch_->handle(req, resp, nullptr);
+    send_response(stream, resp, req->get_method() == HttpMethod::HEAD);
+    MutexType::Lock lock(mutex_);
+    streams_.erase(stream->id);
+    if (--active_streams_ == 0)
+        streams_done_.broadcast();
+}
+
+bool Http2Session::build_request(Stream::ptr stream) {
+    HttpRequest::ptr req(new HttpRequest(0x20, false));
+    req->set_remote_addr(get_socket()->get_remote_addr());
+    std::string method, path, authority, cookie;
+    bool regular = false;
+    for (auto& field : stream->headers) {
+        const std::string& name = field.first;
+        if (name.empty())
+            return false;
+        // pseudo headers come first
+        if (name[0] == ':') {
+            if (regular)
+                return false;
+            if (name == ":method")
+                method = field.second;
+            else if (name == ":path")
+                path = field.second;
+            else if (name == ":authority")
+                authority = field.second;
+            else if (name != ":scheme")
+                return false;
+            continue;
+        }
+        regular = true;
+        if (std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })
+            || is_connection_header(name) || (name == "te" && field.second != "trailers"))
+            return false;
+        if (name == "cookie") {
+            cookie.append(cookie.empty() ? "" : "; ").append(field.second);
+            continue;
+        }
+        std::string value = req->get_header(name);
+        req->set_header(name, value.empty() ? field.second : value + ", " + field.second);
+    }
+    HttpMethod http_method = string_to_http_method(method);
+    if (path.empty() || http_method == HttpMethod::INVALID_METHOD || http_method == HttpMethod::CONNECT)
+        return false;
+    req->set_method(http_method);
+    size_t pos = path.find('#');
+    if (pos != std::string::npos) {
+        req->set_fragment(path.substr(pos + 1));
+        path.resize(pos);
+    }
+    pos = path.find('?');
+    if (pos != std::string::npos) {
+        req->set_query(path.substr(pos + 1));
+        path.resize(pos);
+    }
+    req->set_path(path);
+    if (!authority.empty() && req->get_header("host").empty())
+        req->set_header("host", authority);
+    if (!cookie.empty())
+        req->set_header("cookie", cookie);
+    req->set_body(stream->body);
+    req->init();
+    stream->request = req;
+    stream->headers.clear();
+    stream->body.clear();
+    stream->body.shrink_to_fit();
+    return true;
+}
+
+int Http2Session::send_response(Stream::ptr stream, HttpResponse::ptr resp, bool head_only) {
+    std::string_view body = resp->get_body_view();
+    uint32_t status = (uint32_t)resp->get_status();
+    bool no_body = status < 200 || status == 204 || status == 304;
+    // HEAD keep length set by servlet
+    int64_t length = no_body || (head_only && body.empty()) ? -1 : body.size();
+    bool end_stream = no_body || head_only || body.empty();
+    std::string block;
+    {
+        MutexType::Lock lock(mutex_);
+        if (closed_ || stream->reset)
+            return -1;
+        encode_headers(resp, length, block);
+        // header block larger than frame continue in CONTINUATION frames
+        size_t size = std::min<size_t>(block.size(), peer_max_frame_size_);
+        uint8_t flags = (end_stream ? s_flag_end_stream : 0) | (size == block.size() ? s_flag_end_headers : 0);
+        if (write_frame(Http2FrameType::HEADERS, flags, stream->id, block.data(), size) <= 0) {
+            closed_ = true;
+            return -1;
+        }
+        for (size_t offset = size; offset < block.size(); offset += size) {
+            size = std::min<size_t>(block.size() - offset, peer_max_frame_size_);
+            flags = offset + size == block.size() ? s_flag_end_headers : 0;
+            if (write_frame(Http2FrameType::CONTINUATION, flags, stream->id, block.data() + offset, size) <= 0) {
+                closed_ = true;
+                return -1;
+            }
+        }
+        // closed once END_STREAM is sent, peer may reuse the slot at once
+        if (end_stream)
+            streams_.erase(stream->id);
+    }
+    return end_stream ? 0 : send_data(stream, body);
+}
+
+void Http2Session::encode_headers(HttpResponse::ptr resp, int64_t length, std::string& block) {
+    char status[16];
+    snprintf(status, sizeof(status), "%u", (uint32_t)resp->get_status());
+    encoder_.encode(":status", status, block);
+    CaseInsensitiveEqual equal;
+    bool has_length = false;
+    bool has_server = false;
+    bool has_date = false;
+    for (auto& it : resp->get_headers()) {
+        if (equal(it.first, "content-length")) {
+            // body decide length unless HEAD response
+            if (length >= 0)
+                continue;
+            has_length = true;
+        }
+        if (is_connection_header(it.first))
+            continue;
+        has_server |= equal(it.first, "server");
+        has_date |= equal(it.first, "date");
+        encoder_.encode(it.first, it.second, block);
+    }
+    // pre-serialized "Name: value\r\n" lines
+    if (auto header_block = resp->get_header_block()) {
+        std::string_view lines(*header_block);
+        while (!lines.empty()) {
+            size_t end = lines.find("\r\n");
+            std::string_view line = lines.substr(0, end);
+            lines = end == std::string_view::npos ? std::string_view() : lines.substr(end + 2);
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos || is_connection_header(line.substr(0, colon)))
+                continue;
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ')
+                value.remove_prefix(1);
+            encoder_.encode(line.substr(0, colon), value, block);
+        }
+    }
+    for (auto& it : resp->get_cookies())
+        encoder_.encode("set-cookie", it.first + "=" + it.second, block);
+    if (!has_server && !server_name_.empty())
+        encoder_.encode("server", server_name_, block);
+    if (!has_date) {
+        // reuse per-second cached date line
+        std::string date;
+        HttpResponse::append_date_header(date);
+        size_t begin = date.find(':') + 2;
+        encoder_.encode("date", std::string_view(date).substr(begin, date.size() - begin - 2), block);
+    }
+    if (length >= 0 && !has_length) {
+        char size[32];
+        snprintf(size, sizeof(size), "%ld", length);
+        encoder_.encode("content-length", size, block);
+    }
+}
+
+int Http2Session::send_data(Stream::ptr stream, std::string_view data) {
+    size_t offset = 0;
+    while (true) {
+        MutexType::Lock lock(mutex_);
+        if (closed_ || stream->reset)
+            return -1;
+        int64_t window = std::min(send_window_, stream->send_window);
+        if (window <= 0) {
+            // woken by WINDOW_UPDATE or SETTINGS
+            window_cond_.wait(mutex_);
+            continue;
+        }
+        size_t size = std::min<size_t>({data.size() - offset, (size_t)window, peer_max_frame_size_});
+        bool end = offset + size == data.size();
+        send_window_ -= size;
+        stream->send_window -= size;
+        if (write_frame(Http2FrameType::DATA, end ? s_flag_end_stream : 0, stream->id,
+            data.data() + offset, size) <= 0) {
+            closed_ = true;
+            return -1;
+        }
+        offset += size;
+        if (end) {
+            streams_.erase(stream->id);
+            return 0;
+        }
+    }
+}
+
+int Http2Session::write_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+    const void* data, size_t length) {
+    char head[Http2FrameHeader::SIZE];
+    Http2FrameHeader header;
+    header.length = length;
+    header.type = type;
+    header.flags = flags;
+    header.stream_id = stream_id;
+    header.encode(head);
+    iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = length;
+    return writev_fix_size(iov, length ? 2 : 1);
+}
+
+int Http2Session::send_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+    const void* data, size_t length) {
+    MutexType::Lock lock(mutex_);
+    return write_frame(type, flags, stream_id, data, length);
+}
+
+int Http2Session::send_window_update(uint32_t stream_id, uint32_t increment) {
+    char payload[4];
+    write_u32(payload, increment);
+    return send_frame(Http2FrameType::WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+void Http2Session::reset_stream(uint32_t stream_id, Http2Error error) {
+    char payload[4];
+    write_u32(payload, (uint32_t)error);
+    MutexType::Lock lock(mutex_);
+    write_frame(Http2FrameType::RST_STREAM, 0, stream_id, payload, sizeof(payload));
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return;
+    it->second->reset = true;
+    if (!it->second->remote_closed)
+        streams_.erase(it);
+    window_cond_.broadcast();
+}
+
+}
+}
@@ -0,0 +1,336 @@
+#ifndef __SYLAR_SRC_HTTP2_SESSION_H__
+#define __SYLAR_SRC_HTTP2_SESSION_H__
+
+#include "hpack.h"
+#include "http.h"
+#include "servlet.h"
+#include "../fiber.h"
+#include "../fiber_mutex.h"
+#include "../mutex.h"
+#include "../scheduler.h"
+#include "../streams/socket_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief http/2 frame type
+ */
+enum class Http2FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+};
+
+/**
+ * @brief http/2 error code
+ */
+enum class Http2Error : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    SETTINGS_TIMEOUT = 0x4,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    CONNECT_ERROR = 0xa,
+    ENHANCE_YOUR_CALM = 0xb,
+    INADEQUATE_SECURITY = 0xc,
+    HTTP_1_1_REQUIRED = 0xd,
+};
+
+/**
+ * @brief http/2 frame header
+ */
+struct Http2FrameHeader {
+    /// encoded size
+    static const size_t SIZE = 9;
+    /// payload length
+    uint32_t length {0};
+    /// frame type
+    Http2FrameType type {Http2FrameType::DATA};
+    /// flags
+    uint8_t flags {0};
+    /// stream id
+    uint32_t stream_id {0};
+
+    /**
+     * @brief encode to 9 bytes
+     * @param[out] out output buffer
+     */
+    void encode(char* out) const;
+
+    /**
+     * @brief decode from 9 bytes
+     * @param[in] data input buffer
+     */
+    void decode(const char* data);
+};
+
+/**
+ * @brief http/2 server connection (h2c with prior knowledge)
+ * @details connection fiber read and handle frames. request of every
+ *          stream is dispatched as a fiber on worker after END_STREAM,
+ *          servlet get a nullptr session and fill response body. response
+ *          is sent by stream fiber as HEADERS and DATA frames, DATA wait
+ *          for connection and stream window. frames are written under
+ *          lock, and HPACK encoding happen under the same lock so header
+ *          blocks reach peer in encoding order
+ */
+class Http2Session : public SocketStream, public std::enable_shared_from_this<Http2Session> {
+public:
+    /// share pointer
+    typedef std::shared_ptr<Http2Session> ptr;
+    /// state and send lock
+    typedef FiberMutex MutexType;
+
+    /// client connection preface
+    static const std::string_view PREFACE;
+
+    /**
+     * @brief Construct a new Http2Session object
+     * @param[in] sock socket
+     * @param[in] buffered bytes already read, begin with preface
+     * @param[in] owner if close socket on destroy
+     */
+    Http2Session(Socket::ptr sock, const std::string& buffered = "", bool owner = true);
+
+    /**
+     * @brief serve connection until closed
+     * @details return after all streams finished
+     * @param[in] dispatch servlet dispatch
+     * @param[in] worker scheduler run stream fibers, nullptr means scheduler of calling thread
+     */
+    void handle(ServletDispatch::ptr dispatch, Scheduler* worker = nullptr);
+
+    /**
+     * @brief Set the max concurrent streams object, set before handle
+     * @param[in] count max streams handled concurrently
+     */
+    void set_max_concurrent_streams(uint32_t count) { max_concurrent_streams_ = count; }
+
+    /**
+     * @brief Set the max body size object
+     * @param[in] size max request body size, 0 means unlimited
+     */
+    void set_max_body_size(uint64_t size) { max_body_size_ = size; }
+
+    /**
+     * @brief Set the initial window size object, set before handle
+     * @param[in] size receive window of connection and every stream
+     */
+    void set_initial_window_size(uint32_t size) { initial_window_size_ = size; }
+
+    /**
+     * @brief Set the server name object
+     * @param[in] name server header value
+     */
+    void set_server_name(const std::string& name) { server_name_ = name; }
+
+private:
+    /**
+     * @brief stream state
+     */
+    struct Stream {
+        /// share pointer
+        typedef std::shared_ptr<Stream> ptr;
+        /// stream id
+        uint32_t id {0};
+        /// request, built when headers complete
+        HttpRequest::ptr request {};
+        /// decoded header fields
+        std::vector<HPackHeader> headers {};
+        /// header fields are complete
+        bool headers_complete {false};
+        /// peer finished request
+        bool remote_closed {false};
+        /// stream is reset by either side
+        bool reset {false};
+        /// request body
+        std::string body {};
+        /// bytes peer could send
+        int64_t recv_window {0};
+        /// bytes could be sent to peer
+        int64_t send_window {0};
+    };
+
+    /**
+     * @brief make at least length bytes buffered
+     * @param[in] length bytes needed
+     */
+    bool fill(size_t length);
+
+    /**
+     * @brief handle one frame
+     * @param[in] header frame header
+     * @param[in] payload frame payload
+     * @return connection error, NO_ERROR to go on
+     */
+    Http2Error on_frame(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_headers(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_continuation(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_data(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_settings(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_window_update(const Http2FrameHeader& header, const char* payload);
+
+    Http2Error on_rst_stream(const Http2FrameHeader& header, const char* payload);
+
+    /**
+     * @brief decode complete header block and start stream if request ended
+     * @param[in] stream stream, nullptr if stream is refused or closed
+     * @param[in] end_stream END_STREAM flag of HEADERS
+     */
+    Http2Error on_header_block(Stream::ptr stream, bool end_stream);
+
+    /**
+     * @brief build request and schedule stream fiber
+     * @param[in] stream stream
+     */
+    void start_stream(Stream::ptr stream);
+
+    /**
+     * @brief run servlet and send response, in stream fiber
+     * @param[in] stream stream
+     */
+    void handle_stream(Stream::ptr stream);
+
+    /**
+     * @brief build request from header fields
+     * @param[in] stream stream
+     * @return false if request is malformed
+     */
+    bool build_request(Stream::ptr stream);
+
+    /**
+     * @brief send response headers and body
+     * @param[in] stream stream
+     * @param[in] resp response
+     * @param[in] head_only response of HEAD request
+     */
+    int send_response(Stream::ptr stream, HttpResponse::ptr resp, bool head_only);
+
+    /**
+     * @brief encode response header block
+     * @param[in] resp response
+     * @param[in] length content length, -1 if none
+     * @param[out] block header block
+     */
+    void encode_headers(HttpResponse::ptr resp, int64_t length, std::string& block);
+
+    /**
+     * @brief send body as DATA frames within flow control window
+     * @param[in] stream stream
+     * @param[in] data body
+     */
+    int send_data(Stream::ptr stream, std::string_view data);
+
+    /**
+     * @brief write one frame, lock must be hold
+     */
+    int write_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+        const void* data, size_t length);
+
+    /**
+     * @brief write one frame with lock
+     */
+    int send_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+        const void* data = nullptr, size_t length = 0);
+
+    /**
+     * @brief send WINDOW_UPDATE
+     */
+    int send_window_update(uint32_t stream_id, uint32_t increment);
+
+    /**
+     * @brief reset stream
+     * @param[in] stream_id stream id
+     * @param[in] error error code
+     */
+    void reset_stream(uint32_t stream_id, Http2Error error);
+
+private:
+    /// receive buffer
+    std::string buffer_ {};
+    /// begin of unparsed data
+    size_t read_pos_ {0};
+    /// end of received data
+    size_t write_pos_ {0};
+    /// state and send lock
+    MutexType mutex_ {};
+    /// servlet dispatch
+    ServletDispatch::ptr dispatch_ {};
+    /// stream fiber scheduler
+    Scheduler* worker_ {nullptr};
+    /// open streams
+    std::unordered_map<uint32_t, Stream::ptr> streams_ {};
+    /// stream whose header block is continued
+    Stream::ptr continued_ {};
+    /// stream id of continued header block
+    uint32_t continued_id_ {0};
+    /// END_STREAM flag of continued HEADERS
+    bool continued_end_ {false};
+    /// stream error of continued header block without stream
+    Http2Error continued_error_ {Http2Error::NO_ERROR};
+    /// header block buffer
+    std::string header_block_ {};
+    /// largest stream id opened by peer
+    uint32_t last_stream_id_ {0};
+    /// streams being handled
+    uint32_t active_streams_ {0};
+    /// streams waiting for send window
+    FiberCondition window_cond_ {};
+    /// connection fiber waiting for streams finish
+    FiberCondition streams_done_ {};
+    /// connection is closing, nothing could be sent
+    bool closed_ {false};
+    /// peer sent GOAWAY
+    bool goaway_ {false};
+    /// header decoder
+    HPackDecoder decoder_ {};
+    /// header encoder
+    HPackEncoder encoder_ {};
+    /// connection send window
+    int64_t send_window_ {65535};
+    /// connection receive window
+    int64_t recv_window_ {65535};
+    /// peer initial stream window
+    int64_t peer_initial_window_ {65535};
+    /// peer max frame size
+    uint32_t peer_max_frame_size_ {16384};
+    /// max concurrent streams
+    uint32_t max_concurrent_streams_ {100};
+    /// receive window of connection and every stream
+    uint32_t initial_window_size_ {1024 * 1024};
+    /// max request body size
+    uint64_t max_body_size_ {16 * 1024 * 1024};
+    /// server header value
+    std::string server_name_ {};
+};
+
+}
+}
+
+#endif
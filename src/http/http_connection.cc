@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <strings.h>
+#include <sys/socket.h>
 
 namespace sylar {
 namespace http {
@@ -29,8 +30,11 @@ std::string HttpResult::to_string() const {
 
 
 HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner) {
+    : SocketStream(sock, owner)
+    , create_time_(SystemInfo::get_elapsed())
+    , parser_(new HttpResponseParser) {
     SYLAR_DEBUG("create http connection");
+    buffer_.resize(16 * 1024);
 }
 
 HttpConnection::~HttpConnection() {
@@ -38,50 +42,79 @@ HttpConnection::~HttpConnection() {
 }
 
 HttpResponse::ptr HttpConnection::recv_response() {
-    // response parser
-    HttpResponseParser::ptr parser(new HttpResponseParser);
-    // create buf
-    int size = 4 * 1024;
-    std::shared_ptr<char> buffer(new char[size], [](char* p) {
-        delete [] p;
-    });
-    // get data
-    char* data = buffer.get();
-    int offset = 0;
-    do {
-        // read socket
-        int len = read(data + offset, size - offset);
-        if (len < 0) {
+    auto resp = recv_response_header();
+    if (!resp)
+        return nullptr;
+    // no body callback, body is kept in response
+    if (!parse(false)) {
+        close();
+        return nullptr;
+    }
+    return resp;
+}
+
+HttpResponse::ptr HttpConnection::recv_response_header(bool head) {
+    while (true) {
+        parser_->reset();
+        parser_->set_skip_body(head);
+        if (!parse(true)) {
             close();
             return nullptr;
         }
-        // current offset of data
-        // origin offset meams, data offset last time, 
-        // add len means current offset
-        len += offset;
-        // as string
-        data[len] = '\0';
-        // parse data
-        size_t parse_size = parser->execute(data, len);
-        // check if error happens
-        if (parser->is_error()) {
+        // interim response, final response follow
+        uint32_t status = (uint32_t)parser_->get_response()->get_status();
+        if (status >= 200 || status == 101)
+            break;
+        if (!parse(false)) {
             close();
-            SYLAR_ERR("http response parse failed");
             return nullptr;
         }
-        // reset offset to correct size
-        offset = len - parse_size;
-        // TODO: dont know why check size
-        if (offset == size) {
-            close();
-            return nullptr;
+    }
+    return parser_->get_response();
+}
+
+int64_t HttpConnection::read_body(const HttpResponseParser::BodyCallback& cb) {
+    uint64_t begin = parser_->get_body_size();
+    parser_->set_body_callback(cb ? cb : [](std::string_view) { return true; });
+    bool ok = parse(false);
+    parser_->set_body_callback(nullptr);
+    if (!ok) {
+        close();
+        return -1;
+    }
+    return parser_->get_body_size() - begin;
+}
+
+bool HttpConnection::is_reusable() {
+    // bytes left after response means peer is broken
+    return is_connected() && parser_->is_finished() && parser_->is_keep_alive() 
+        && read_pos_ == write_pos_;
+}
+
+bool HttpConnection::parse(bool header_only) {
+    do {
+        if (parser_->is_finished() || (header_only && parser_->is_headers_complete()))
+            return true;
+        // parse buffered data first, parser may be paused
+        if (read_pos_ < write_pos_) {
+            size_t size = parser_->execute(&buffer_[read_pos_], write_pos_ - read_pos_);
+            if (parser_->is_error())
+                return false;
+            read_pos_ += size;
+            continue;
         }
-        // parse has finished 
-        if (parser->is_finished())
-            break;
+        // parser copy what it need, buffer could be reused
+        read_pos_ = write_pos_ = 0;
+        int len = read(&buffer_[0], buffer_.size());
+        if (len < 0)
+            return false;
+        if (len == 0) {
+            // body without length end when peer close
+            parser_->execute(&buffer_[0], 0);
+            return parser_->is_finished() && !parser_->is_error();
+        }
+        write_pos_ = len;
     } while (true);
-    // parse success, should return correct response
-    return parser->get_response();
 }
 
 int HttpConnection::send_request(HttpRequest::ptr req) {
@@ -178,9 +211,11 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req, Uri::ptr uri, ui
     if (!sock)
         return HttpResult::ptr(new HttpResult((int)HttpResult::Error::CREATE_SOCKET_ERROR, 
             nullptr, "create socket failed, err: " + std::string(strerror(errno))));
-    if (!sock->connect(addr))
+    if (!sock->connect(addr, timeout))
         return HttpResult::ptr(new HttpResult((int)HttpResult::Error::CONNECT_FAIL, 
             nullptr, "connect failed, err: " + std::string(strerror(errno))));
+    sock->set_recv_timeout(timeout);
+    sock->set_send_timeout(timeout);
     HttpConnection::ptr conn(new HttpConnection(sock));
     int rt = conn->send_request(req);
     if (rt == 0) 
@@ -208,26 +243,22 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host, uint32_t port, u
     
 }
 
-HttpConnection::ptr HttpConnectionPool::get_connection() {
-    uint64_t ns = SystemInfo::get_elapsed();
-    std::vector<HttpConnection::ptr> invalid_conns;
+HttpConnection::ptr HttpConnectionPool::get_connection(uint64_t timeout) {
+    uint64_t now = SystemInfo::get_elapsed();
+    HttpConnection::ptr conn;
     MutexType::Lock lock(mutex_);
-    // remove
-    auto pos = std::remove_if(conns_.begin(), conns_.end(), [ns, this](HttpConnection::ptr conn) {
-        // check if connection is connected
-        if (!conn->is_connected())
-            return true;
-        // if connection time has expired
-        if ((conn->create_time_ + max_alive_time_) > ns) 
-            return true;
-        return false;
-    });
-    // remove
-    conns_.erase(pos, conns_.end());
-    // unlock
-    auto conn = conns_.front();
-    if (conns_.empty())
+    while (!conns_.empty()) {
+        conn = conns_.front();
         conns_.pop_front();
+        // expired, or closed by peer while idle
+        char c;
+        if ((max_alive_time_ == 0 || conn->create_time_ + max_alive_time_ > now)
+            && recv(conn->get_socket()->get_fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 
+            && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        conn->close();
+        conn.reset();
+    }
     lock.unlock();
     // if conn not exist
     if (!conn) {
@@ -245,16 +276,37 @@ HttpConnection::ptr HttpConnectionPool::get_connection() {
             return nullptr;
         }
         // connect addr
-        if (!sock->connect(addr)) {
+        if (!sock->connect(addr, timeout)) {
             SYLAR_FMT_ERR("connect addr failed, host: %s", addr->to_string().c_str());
             return nullptr;
         }
         // create conn
         conn = HttpConnection::ptr(new HttpConnection(sock));
     }
+    conn->add_request_count();
     return conn;
 }
 
+void HttpConnectionPool::release(HttpConnection::ptr conn) {
+    uint64_t now = SystemInfo::get_elapsed();
+    // zero limit means unlimited
+    if (conn->is_reusable() && (max_alive_time_ == 0 || conn->create_time_ + max_alive_time_ > now)
+        && (max_request_ == 0 || conn->request_count_ < max_request_)) {
+        MutexType::Lock lock(mutex_);
+        if (conns_.size() < max_size_) {
+            // most recent first, cold connections expire at tail
+            conns_.push_front(conn);
+            return;
+        }
+    }
+    conn->close();
+}
+
+size_t HttpConnectionPool::get_idle_count() {
+    MutexType::Lock lock(mutex_);
+    return conns_.size();
+}
+
 HttpResult::ptr HttpConnectionPool::Get(const std::string& url, uint64_t timeout, 
         const std::map<std::string, std::string>& headers, const std::string& body) {
     return Request(HttpMethod::GET, url, timeout, headers, body);
@@ -308,7 +360,27 @@ HttpResult::ptr HttpConnectionPool::Request(HttpMethod method, Uri::ptr uri, uin
 }
 
 HttpResult::ptr HttpConnectionPool::Request(HttpRequest::ptr req, Uri::ptr uri, uint64_t timeout) {
-    return HttpConnection::DoRequest(req, uri, timeout);
+    auto conn = get_connection(timeout);
+    if (!conn)
+        return HttpResult::ptr(new HttpResult((int)HttpResult::Error::POOL_GET_CONNECTION, 
+            nullptr, "pool get connection failed, host: " + host_));
+    conn->get_socket()->set_recv_timeout(timeout);
+    conn->get_socket()->set_send_timeout(timeout);
+    // connection is kept for next request
+    req->set_close(false);
+    int rt = conn->send_request(req);
+    if (rt == 0) 
+        return HttpResult::ptr(new HttpResult((int)HttpResult::Error::SEND_CLOSE_BY_PEER, 
+            nullptr, "send request by peer, err: " + std::string(strerror(errno))));
+    if (rt < 0)
+        return HttpResult::ptr(new HttpResult((int)HttpResult::Error::SEND_SOCKET_ERROR, 
+            nullptr, "send request failed, err: " + std::string(strerror(errno))));
+    auto resp = conn->recv_response();
+    if (!resp) 
+        return HttpResult::ptr(new HttpResult((int)HttpResult::Error::TIMEOUT, 
+            nullptr, "recv response failed, err: " + std::string(strerror(errno))));
+    release(conn);
+    return HttpResult::ptr(new HttpResult((int)HttpResult::Error::OK, resp, "ok"));
 }
 
 }
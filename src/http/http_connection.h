@@ -2,6 +2,7 @@
 #define __SYLAR_SRC_HTTP_CONNECTION_H__
 
 #include "http.h"
+#include "http_parser.h"
 #include "../uri.h"
 #include "../mutex.h"
 #include "../streams/socket_stream.h"
@@ -163,15 +164,82 @@ public:
      */
     HttpResponse::ptr recv_response();
 
+    /**
+     * @brief recv response header only, body is read by read_body
+     * @details interim 1xx response is skipped
+     * @param[in] head response of HEAD request, never has body
+     */
+    HttpResponse::ptr recv_response_header(bool head = false);
+
+    /**
+     * @brief read response body in chunks
+     * @param[in] cb chunk callback, nullptr to skip body
+     * @return body bytes read, -1 if failed
+     */
+    int64_t read_body(const HttpResponseParser::BodyCallback& cb);
+
+    /**
+     * @brief Get the content length object
+     * @return -1 if body length is unknown (chunked or until close)
+     */
+    int64_t get_content_length() { return parser_->get_content_length(); }
+
+    /**
+     * @brief Get the header block object, raw header lines of response
+     */
+    const std::string& get_header_block() { return parser_->get_header_block(); }
+
+    /**
+     * @brief if response body is read completely
+     */
+    bool is_body_complete() { return parser_->is_finished(); }
+
+    /**
+     * @brief if connection could be used by next request
+     */
+    bool is_reusable();
+
     /**
      * @brief Send request
      * @param[in] req send request
      */
     int send_request(HttpRequest::ptr req);
 
+    /**
+     * @brief Get the create time object
+     */
+    uint64_t get_create_time() { return create_time_; }
+
+    /**
+     * @brief Get the request count object
+     */
+    uint32_t get_request_count() { return request_count_; }
+
+    /**
+     * @brief count one request sent on connection
+     */
+    void add_request_count() { request_count_++; }
+
+private:
+    /**
+     * @brief parse buffered and received data
+     * @param[in] header_only stop when header complete
+     */
+    bool parse(bool header_only);
+
 private:
     /// create time
     uint64_t create_time_ {0};
+    /// requests sent
+    uint32_t request_count_ {0};
+    /// response parser
+    HttpResponseParser::ptr parser_ {};
+    /// receive buffer
+    std::string buffer_ {};
+    /// begin of unparsed data
+    size_t read_pos_ {0};
+    /// end of received data
+    size_t write_pos_ {0};
 };
 
 
@@ -186,17 +254,30 @@ public:
      * @brief Construct a new Http Connection Pool object
      * @param[in] host http host
      * @param[in] port htp port
-     * @param[in] max_size pool max size
-     * @param[in] max_alive_time max keep alive time
-     * @param[in] max_request max request
+     * @param[in] max_size max idle connections kept
+     * @param[in] max_alive_time max connection life time in ms, 0 means unlimited
+     * @param[in] max_request max requests of one connection, 0 means unlimited
      */
     HttpConnectionPool(const std::string& host, uint32_t port, uint32_t max_size,
         uint32_t max_alive_time, uint32_t max_request);
 
     /**
-     * @brief Get the connection object
+     * @brief Get the connection object, idle connection is reused first
+     * @param[in] timeout connect timeout in ms, 0 means system default
+     */
+    HttpConnection::ptr get_connection(uint64_t timeout = 0);
+
+    /**
+     * @brief give back connection after response is read
+     * @details connection could not be reused is closed
+     * @param[in] conn connection
+     */
+    void release(HttpConnection::ptr conn);
+
+    /**
+     * @brief Get the idle count object
      */
-    HttpConnection::ptr get_connection();
+    size_t get_idle_count();
 
     /**
      * @brief http get
@@ -279,7 +360,7 @@ private:
     uint32_t max_request_ {0};
     /// mutex
     MutexType mutex_ {};
-    /// conn list
+    /// idle conn list, most recent first
     std::list<HttpConnection::ptr> conns_ {};
     /// avaliable connection num
     std::atomic<int32_t> total_ {};
@@ -3,6 +3,7 @@
 #include "http-parser/http_parser.h"
 #include "../log.h"
 
+#include <climits>
 #include <cstddef>
 #include <cstring>
 #include <string>
@@ -15,13 +16,30 @@ static int on_request_message_begin_cb(http_parser* parser) {
     return 0;
 }
 
+// extend view if chunk is contiguous
+static void extend_view(std::string_view& view, std::string_view chunk) {
+    if (view.data() != nullptr && view.data() + view.size() == chunk.data()) {
+        view = std::string_view(view.data(), view.size() + chunk.size());
+        return;
+    }
+    view = chunk;
+}
+
 static int on_request_headers_complete_cb(http_parser* ptr) {
     SYLAR_DEBUG("on_request_headers_complete_cb");
     // convert parser
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(ptr->data);
+    parser->set_headers_complete(true);
+    // commit last header and url
+    if (parser->is_zero_copy() && parser->commit_views() != 0)
+        return 1;
     // set request version
     parser->get_request()->set_version(((ptr->http_major) << 0x4) | (ptr->http_minor));
     parser->get_request()->set_method((HttpMethod)ptr->method);
+    if (ptr->upgrade && CaseInsensitiveEqual()(parser->get_request()->get_header_view("upgrade"), "websocket"))
+        parser->get_request()->set_websocket(true);
+    // stop before body, body could be streamed after routed
+    http_parser_pause(ptr, 1);
     return 0;
 }
 
@@ -32,6 +50,8 @@ static int on_request_message_complete_cb(http_parser *ptr) {
     SYLAR_DEBUG("on_request_message_complete_cb");
     HttpRequestParser *parser = static_cast<HttpRequestParser *>(ptr->data);
     parser->set_finished(true);
+    // stop at message end, pipelined request should be parsed after reset
+    http_parser_pause(ptr, 1);
     return 0;
 }
 
@@ -55,9 +75,14 @@ static int on_request_chunk_complete_cb(http_parser *p) {
  * @brief http request url parse complete callback
  */
 static int on_request_url_cb(http_parser *p, const char *buf, size_t len) {
-    SYLAR_FMT_DEBUG("on_request_chunk_complete_cb, url: %s", std::string(buf, len).c_str());
+    SYLAR_FMT_DEBUG("on_request_url_cb, url: %.*s", (int)len, buf);
     // get parser
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(p->data);
+    // url maybe splited, parse when headers complete
+    if (parser->is_zero_copy()) {
+        parser->append_url_view(std::string_view(buf, len));
+        return 0;
+    }
     // parse url
     int ret;
     struct http_parser_url url_parser;
@@ -86,10 +111,13 @@ static int on_request_url_cb(http_parser *p, const char *buf, size_t len) {
  * @brief http request header parse complete callback
  */
 static int on_request_header_field_cb(http_parser *p, const char *buf, size_t len) {
-    std::string field(buf, len);
-    SYLAR_FMT_DEBUG("on_request_header_field_cb, field: %s", field.c_str());
+    SYLAR_FMT_DEBUG("on_request_header_field_cb, field: %.*s", (int)len, buf);
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(p->data);
-    parser->set_field(field);
+    if (parser->is_zero_copy()) {
+        parser->append_field_view(std::string_view(buf, len));
+        return 0;
+    }
+    parser->set_field(std::string(buf, len));
     return 0;
 }
 
@@ -97,10 +125,13 @@ static int on_request_header_field_cb(http_parser *p, const char *buf, size_t le
  * @brief http request header value parse callback
  */
 static int on_request_header_value_cb(http_parser *p, const char *buf, size_t len) {
-    std::string value(buf, len);
-    SYLAR_FMT_DEBUG("on_request_header_value_cb, value: %s", value.c_str());
+    SYLAR_FMT_DEBUG("on_request_header_value_cb, value: %.*s", (int)len, buf);
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(p->data);
-    parser->get_request()->set_header(parser->get_field(), value);
+    if (parser->is_zero_copy()) {
+        parser->append_value_view(std::string_view(buf, len));
+        return 0;
+    }
+    parser->get_request()->set_header(parser->get_field(), std::string(buf, len));
     return 0;
 }
 
@@ -116,10 +147,20 @@ static int on_request_status_cb(http_parser *p, const char *buf, size_t len) {
  * @brief http body chunk callback
  */
 static int on_request_body_cb(http_parser *p, const char *buf, size_t len) {
-    std::string body(buf, len);
-    SYLAR_FMT_DEBUG("on_request_body_cb, body: %s", body.c_str());
+    SYLAR_FMT_DEBUG("on_request_body_cb, body: %.*s", (int)len, buf);
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(p->data);
-    parser->get_request()->append_body(body);
+    if (!parser->add_body_size(len)) {
+        SYLAR_FMT_ERR("http request body too large, max: %lu", parser->get_max_body_size());
+        return -1;
+    }
+    // streaming body
+    if (parser->get_body_callback()) 
+        return parser->get_body_callback()(std::string_view(buf, len)) ? 0 : -1;
+    if (parser->is_zero_copy()) {
+        parser->get_request()->append_body_view(std::string_view(buf, len));
+        return 0;
+    }
+    parser->get_request()->append_body(std::string(buf, len));
     return 0;
 }
 
@@ -138,27 +179,132 @@ static http_parser_settings s_request_settings = {
 };
 
 
-HttpRequestParser::HttpRequestParser() {
+HttpRequestParser::HttpRequestParser(bool zero_copy) 
+    : zero_copy_(zero_copy) {
     // init parser as request parser
     http_parser_init(&parser_, HTTP_REQUEST);
     request_.reset(new HttpRequest);
     parser_.data = this;
-    SYLAR_DEBUG("create http request parser");
+    SYLAR_FMT_DEBUG("create http request parser, zero copy: %d", zero_copy_);
+}
+
+void HttpRequestParser::reset() {
+    http_parser_init(&parser_, HTTP_REQUEST);
+    parser_.data = this;
+    request_.reset(new HttpRequest);
+    err_code_ = 0;
+    field_.clear();
+    finished_ = false;
+    headers_complete_ = false;
+    url_view_ = {};
+    field_view_ = {};
+    value_view_ = {};
+    view_end_ = nullptr;
+    max_body_size_ = 0;
+    body_size_ = 0;
+    body_too_large_ = false;
+    body_cb_ = nullptr;
+}
+
+void HttpRequestParser::rebase(const char* from, const char* to) {
+    // pending views
+    for (auto view : {&url_view_, &field_view_, &value_view_}) {
+        if (view->data() != nullptr)
+            *view = std::string_view(to + (view->data() - from), view->size());
+    }
+    if (view_end_ != nullptr)
+        view_end_ = to + (view_end_ - from);
+    request_->rebase(from, to);
+}
+
+void HttpRequestParser::append_url_view(std::string_view url) {
+    extend_view(url_view_, url);
+    view_end_ = url.data() + url.size();
+}
+
+void HttpRequestParser::append_field_view(std::string_view field) {
+    // new field begin, commit last header
+    if (value_view_.data() != nullptr) {
+        request_->add_header_view(field_view_, value_view_);
+        field_view_ = {};
+        value_view_ = {};
+    }
+    extend_view(field_view_, field);
+    view_end_ = field.data() + field.size();
+}
+
+void HttpRequestParser::append_value_view(std::string_view value) {
+    extend_view(value_view_, value);
+    view_end_ = value.data() + value.size();
+}
+
+int HttpRequestParser::commit_views() {
+    // commit last header
+    if (field_view_.data() != nullptr) {
+        request_->add_header_view(field_view_, value_view_.data() ? value_view_ : std::string_view(""));
+        field_view_ = {};
+        value_view_ = {};
+    }
+    // parse url
+    if (url_view_.data() == nullptr)
+        return 0;
+    struct http_parser_url url_parser;
+    http_parser_url_init(&url_parser);
+    if (http_parser_parse_url(url_view_.data(), url_view_.size(), 0, &url_parser) != 0) {
+        SYLAR_ERR("parse url failed");
+        return 1;
+    }
+    // parse url path
+    if (url_parser.field_set & (1 << UF_PATH))
+        request_->set_path_view(url_view_.substr(url_parser.field_data[UF_PATH].off, 
+            url_parser.field_data[UF_PATH].len));
+    // parse url query
+    if (url_parser.field_set & (1 << UF_QUERY))
+        request_->set_query_view(url_view_.substr(url_parser.field_data[UF_QUERY].off, 
+            url_parser.field_data[UF_QUERY].len));
+    // parse url fragment
+    if (url_parser.field_set & (1 << UF_FRAGMENT))
+        request_->set_fragment_view(url_view_.substr(url_parser.field_data[UF_FRAGMENT].off, 
+            url_parser.field_data[UF_FRAGMENT].len));
+    url_view_ = {};
+    return 0;
+}
+
+int64_t HttpRequestParser::get_content_length() {
+    // chunked body or header not parsed
+    if (!headers_complete_ || (parser_.flags & F_CHUNKED))
+        return -1;
+    if (parser_.content_length == ULLONG_MAX)
+        return 0;
+    // content_length is decreased while body parsed
+    return body_size_ + parser_.content_length;
+}
+
+bool HttpRequestParser::add_body_size(size_t size) {
+    body_size_ += size;
+    if (max_body_size_ > 0 && body_size_ > max_body_size_) {
+        body_too_large_ = true;
+        return false;
+    }
+    return true;
 }
 
 size_t HttpRequestParser::execute(char *data, size_t len) {
+    // go on after paused at headers complete
+    if (HTTP_PARSER_ERRNO(&parser_) == HPE_PAUSED)
+        http_parser_pause(&parser_, 0);
     // parse execute
     size_t size = http_parser_execute(&parser_, &s_request_settings, data, len);
-    // check if need upgrade, if is need recall execute
-    if (parser_.upgrade) {
-        SYLAR_DEBUG("http parse found upgrade, ignore");
+    // upgrade request is handled by servlet, bytes after it belong to new protocol
+    if (parser_.upgrade && parser_.method == HTTP_CONNECT) {
+        SYLAR_DEBUG("http parse found connect, ignore");
         set_error_code(HPE_UNKNOWN);
-    } else if (parser_.http_errno != 0) {
+    } else if (parser_.http_errno != 0 && HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED) {
         // parse failed reasom
         SYLAR_FMT_ERR("http parse failed, err: %s", http_errno_name(HTTP_PARSER_ERRNO(&parser_)));
         set_error_code(parser_.http_errno);
-    } else {
-        // copy memory
+    } else if (!zero_copy_) {
+        // copy memory, views point into data should never be moved
         if (size < len)
             memmove(data, data + size, (len - size));
     }
@@ -181,10 +327,14 @@ static int on_response_message_begin_cb(http_parser* ptr) {
 static int on_response_headers_complete_cb(http_parser *p) { 
     SYLAR_DEBUG("on_response_headers_complete_cb");
     HttpResponseParser* parser = static_cast<HttpResponseParser*>(p->data);
+    parser->commit_header();
+    parser->set_headers_complete(true);
     // se version
     parser->get_response()->set_version(((p->http_major) << 0x4) | (p->http_minor));
     parser->get_response()->set_status((HttpStatus)p->status_code);
-    return 0;
+    // stop before body, body could be streamed
+    http_parser_pause(p, 1);
+    return parser->is_skip_body() ? 1 : 0;
 }
 
 /**
@@ -194,6 +344,8 @@ static int on_response_message_complete_cb(http_parser *p) {
     SYLAR_DEBUG("on_response_message_complete_cb");
     HttpResponseParser *parser = static_cast<HttpResponseParser *>(p->data);
     parser->set_finished(true);
+    // stop at message end, bytes after it belong to next response
+    http_parser_pause(p, 1);
     return 0;   
 }
 
@@ -225,10 +377,9 @@ static int on_response_url_cb(http_parser *p, const char *buf, size_t len) {
  * @brief http response parse header field callback
  */
 static int on_response_header_field_cb(http_parser *p, const char *buf, size_t len) {
-    std::string field(buf, len);
-    SYLAR_FMT_DEBUG("on_response_header_field_cb, field: %s", field.c_str());
+    SYLAR_FMT_DEBUG("on_response_header_field_cb, field: %.*s", (int)len, buf);
     HttpResponseParser *parser = static_cast<HttpResponseParser *>(p->data);
-    parser->set_field(field);
+    parser->append_field(std::string_view(buf, len));
     return 0;
 }
 
@@ -236,10 +387,9 @@ static int on_response_header_field_cb(http_parser *p, const char *buf, size_t l
  * @brief http response parse header value callback
  */
 static int on_response_header_value_cb(http_parser *p, const char *buf, size_t len) { 
-    std::string value(buf, len);
-    SYLAR_FMT_DEBUG("on_response_header_value_cb, value: %s", value.c_str());
+    SYLAR_FMT_DEBUG("on_response_header_value_cb, value: %.*s", (int)len, buf);
     HttpResponseParser *parser = static_cast<HttpResponseParser *>(p->data);
-    parser->get_response()->set_header(parser->get_field(), value);
+    parser->append_value(std::string_view(buf, len));
     return 0;
 }
 
@@ -257,10 +407,13 @@ static int on_response_status_cb(http_parser *p, const char *buf, size_t len) {
  * @brief http response parse body callback
  */
 static int on_response_body_cb(http_parser *p, const char *buf, size_t len) {
-    std::string body(buf, len);
-    SYLAR_FMT_DEBUG("on_response_body_cb, body: %s", body.c_str());
+    SYLAR_FMT_DEBUG("on_response_body_cb, body: %.*s", (int)len, buf);
     HttpResponseParser *parser = static_cast<HttpResponseParser *>(p->data);
-    parser->get_response()->append_body(body);
+    parser->add_body_size(len);
+    // streaming body
+    if (parser->get_body_callback())
+        return parser->get_body_callback()(std::string_view(buf, len)) ? 0 : -1;
+    parser->get_response()->append_body(std::string(buf, len));
     return 0;
 }
 
@@ -285,18 +438,74 @@ HttpResponseParser::HttpResponseParser() {
     parser_.data = this;
 }
 
+void HttpResponseParser::reset() {
+    http_parser_init(&parser_, HTTP_RESPONSE);
+    parser_.data = this;
+    response_.reset(new HttpResponse);
+    err_code_ = 0;
+    field_.clear();
+    value_.clear();
+    in_value_ = false;
+    header_block_.clear();
+    finished_ = false;
+    headers_complete_ = false;
+    skip_body_ = false;
+    body_size_ = 0;
+    body_cb_ = nullptr;
+}
+
+void HttpResponseParser::append_field(std::string_view field) {
+    // new field begin, commit last header
+    if (in_value_)
+        commit_header();
+    field_.append(field);
+}
+
+void HttpResponseParser::append_value(std::string_view value) {
+    in_value_ = true;
+    value_.append(value);
+}
+
+void HttpResponseParser::commit_header() {
+    if (field_.empty())
+        return;
+    // repeated header is folded in map, kept as is in block
+    std::string old = response_->get_header(field_);
+    response_->set_header(field_, old.empty() ? value_ : old + ", " + value_);
+    header_block_.append(field_).append(": ").append(value_).append("\r\n");
+    field_.clear();
+    value_.clear();
+    in_value_ = false;
+}
+
+bool HttpResponseParser::is_keep_alive() {
+    return http_should_keep_alive(&parser_) != 0;
+}
+
+int64_t HttpResponseParser::get_content_length() {
+    // chunked body, until close or header not parsed
+    if (!headers_complete_ || (parser_.flags & F_CHUNKED))
+        return -1;
+    if (skip_body_ || (parser_.flags & F_SKIPBODY))
+        return 0;
+    if (parser_.content_length == ULLONG_MAX)
+        return finished_ ? body_size_ : -1;
+    // content_length is decreased while body parsed
+    return body_size_ + parser_.content_length;
+}
+
 size_t HttpResponseParser::execute(char *data, size_t len) {
+    // go on after paused at headers complete
+    if (HTTP_PARSER_ERRNO(&parser_) == HPE_PAUSED)
+        http_parser_pause(&parser_, 0);
     size_t size = http_parser_execute(&parser_, &s_response_settings, data, len);
-    if (parser_.http_errno != 0) {
+    if (parser_.http_errno != 0 && HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED) {
         // parse failed reasom
         SYLAR_FMT_ERR("http parse failed, err: %s", http_errno_name(HTTP_PARSER_ERRNO(&parser_)));
         set_error_code(parser_.http_errno);
-    } else {
-        if (size < len)
-            memmove(data, data + size, len - size);
     }
     return size;
 }
 
 }
-}
\ No newline at end of file
+}
@@ -5,8 +5,11 @@
 #include "http-parser/http_parser.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 namespace sylar {
 
 namespace http {
@@ -14,19 +17,65 @@ namespace http {
 class HttpRequestParser {
 public:
     typedef std::shared_ptr<HttpRequestParser> ptr;
+    /// body chunk callback, return false to abort parsing
+    typedef std::function<bool (std::string_view chunk)> BodyCallback;
 
     /**
      * @brief Construct a new Http Request Parser object
+     * @param[in] zero_copy request keep string views into receive buffer,
+     *            caller should never move parsed data without rebase
      */
-    HttpRequestParser();
+    HttpRequestParser(bool zero_copy = false);
 
     /**
      * @brief parse protocol
+     * @details parser stop at headers complete and message complete,
+     *          call execute again to go on
      * @param[in] data parse data
      * @param[in] len data len
      */
     size_t execute(char* data, size_t len);
 
+    /**
+     * @brief reset parser to parse next request, a new request is created
+     */
+    void reset();
+
+    /**
+     * @brief drop current request, parser must be reset before next use
+     */
+    void release() { request_.reset(); }
+
+    /**
+     * @brief receive buffer moved, rebase all views to new buffer
+     * @param[in] from old buffer base
+     * @param[in] to new buffer base
+     */
+    void rebase(const char* from, const char* to);
+
+    /**
+     * @brief append url view, parsed when headers complete
+     * @param[in] url url view
+     */
+    void append_url_view(std::string_view url);
+
+    /**
+     * @brief append header field view
+     * @param[in] field field view
+     */
+    void append_field_view(std::string_view field);
+
+    /**
+     * @brief append header value view
+     * @param[in] value value view
+     */
+    void append_value_view(std::string_view value);
+
+    /**
+     * @brief commit pending views into request
+     */
+    int commit_views();
+
     /**
      * @brief Get the parser object
      */
@@ -47,6 +96,22 @@ public:
      */
     bool is_finished() { return finished_; } 
 
+    /**
+     * @brief get headers complete state
+     */
+    bool is_headers_complete() { return headers_complete_; }
+
+    /**
+     * @brief if parse in zero copy mode
+     */
+    bool is_zero_copy() { return zero_copy_; }
+
+    /**
+     * @brief Get the view end object, data after it could be reused
+     *        once body is materialized
+     */
+    const char* get_view_end() { return view_end_; }
+
     /**
      * @brief is error
      */
@@ -58,6 +123,53 @@ public:
      */
     void set_error_code(int err_code) { err_code_ = err_code; }
 
+    /**
+     * @brief Get the content length object
+     * @return -1 if body length is unknown (chunked)
+     */
+    int64_t get_content_length();
+
+    /**
+     * @brief Set the max body size object
+     * @param[in] size max body size, 0 means unlimited
+     */
+    void set_max_body_size(uint64_t size) { max_body_size_ = size; }
+
+    /**
+     * @brief Get the max body size object
+     */
+    uint64_t get_max_body_size() { return max_body_size_; }
+
+    /**
+     * @brief Get the body size object, body bytes parsed
+     */
+    uint64_t get_body_size() { return body_size_; }
+
+    /**
+     * @brief add parsed body size
+     * @param[in] size chunk size
+     * @return false if body exceed max size
+     */
+    bool add_body_size(size_t size);
+
+    /**
+     * @brief if body exceed max size
+     */
+    bool is_body_too_large() { return body_too_large_; }
+
+    /**
+     * @brief Set the body callback object
+     * @details body chunk is passed to callback instead of request,
+     *          chunk is only valid during callback
+     * @param[in] cb callback, nullptr to keep body in request
+     */
+    void set_body_callback(const BodyCallback& cb) { body_cb_ = cb; }
+
+    /**
+     * @brief Get the body callback object
+     */
+    const BodyCallback& get_body_callback() { return body_cb_; }
+
     /**
      * @brief Set the field object
      * @param[in] field field
@@ -70,6 +182,12 @@ public:
      */
     void set_finished(bool finished) { finished_ = finished; }
 
+    /**
+     * @brief Set the headers complete object
+     * @param[in] complete headers complete state
+     */
+    void set_headers_complete(bool complete) { headers_complete_ = complete; }
+
 private:
     /// parse error code
     int err_code_ {0};
@@ -81,12 +199,34 @@ private:
     std::string field_ {};
     /// finishestate
     bool finished_ {false};
+    /// headers complete state
+    bool headers_complete_ {false};
+    /// zero copy mode
+    bool zero_copy_ {false};
+    /// pending url view
+    std::string_view url_view_ {};
+    /// pending field view
+    std::string_view field_view_ {};
+    /// pending value view
+    std::string_view value_view_ {};
+    /// end of url and header views
+    const char* view_end_ {nullptr};
+    /// max body size, 0 means unlimited
+    uint64_t max_body_size_ {0};
+    /// body bytes parsed
+    uint64_t body_size_ {0};
+    /// body exceed max size
+    bool body_too_large_ {false};
+    /// streaming body callback
+    BodyCallback body_cb_ {};
 };
 
 
 class HttpResponseParser {
 public:
     typedef std::shared_ptr<HttpResponseParser> ptr;
+    /// body chunk callback, return false to abort parsing
+    typedef std::function<bool (std::string_view chunk)> BodyCallback;
 
     /**
      * @brief Construct a new Http Response Parser object
@@ -95,11 +235,36 @@ public:
 
     /**
      * @brief parse protocol
+     * @details parser stop at headers complete and message complete,
+     *          call execute again to go on. len 0 means peer closed,
+     *          body without length end there
      * @param[in] data parse data
      * @param[in] len data len
      */
     size_t execute(char* data, size_t len);
 
+    /**
+     * @brief reset parser to parse next response on same connection
+     */
+    void reset();
+
+    /**
+     * @brief header field callback, field may be splited
+     * @param[in] field field data
+     */
+    void append_field(std::string_view field);
+
+    /**
+     * @brief header value callback, value may be splited
+     * @param[in] value value data
+     */
+    void append_value(std::string_view value);
+
+    /**
+     * @brief commit last header into response
+     */
+    void commit_header();
+
     /**
      * @brief Get the parser object
      */
@@ -111,9 +276,11 @@ public:
     HttpResponse::ptr get_response() { return response_; }
 
     /**
-     * @brief Get the field object
+     * @brief Get the header block object
+     * @return raw "Name: value\r\n" lines in received order, repeated
+     *         header such as Set-Cookie is kept
      */
-    const std::string get_field() { return field_; }
+    const std::string& get_header_block() { return header_block_; }
 
     /**
      * @brief is error
@@ -126,16 +293,61 @@ public:
     bool is_finished() { return finished_; }
 
     /**
-     * @brief Set the error code object
-     * @param[in] err_code error code
+     * @brief get headers complete state
      */
-    void set_error_code(int err_code) { err_code_ = err_code; }
+    bool is_headers_complete() { return headers_complete_; }
 
     /**
-     * @brief Set the field object
-     * @param[in] field field
+     * @brief if connection could be reused after message complete
      */
-    void set_field(const std::string& field) { field_ = field; }
+    bool is_keep_alive();
+
+    /**
+     * @brief Get the content length object
+     * @return -1 if body length is unknown (chunked or until close)
+     */
+    int64_t get_content_length();
+
+    /**
+     * @brief Get the body size object, body bytes parsed
+     */
+    uint64_t get_body_size() { return body_size_; }
+
+    /**
+     * @brief add parsed body size
+     * @param[in] size chunk size
+     */
+    void add_body_size(size_t size) { body_size_ += size; }
+
+    /**
+     * @brief Set the skip body object, response of HEAD has no body
+     * @param[in] skip if skip body
+     */
+    void set_skip_body(bool skip) { skip_body_ = skip; }
+
+    /**
+     * @brief if response has no body
+     */
+    bool is_skip_body() { return skip_body_; }
+
+    /**
+     * @brief Set the body callback object
+     * @details body chunk is passed to callback instead of response,
+     *          chunk is only valid during callback
+     * @param[in] cb callback, nullptr to keep body in response
+     */
+    void set_body_callback(const BodyCallback& cb) { body_cb_ = cb; }
+
+    /**
+     * @brief Get the body callback object
+     */
+    const BodyCallback& get_body_callback() { return body_cb_; }
+
+    /**
+     * @brief Set the error code object
+     * @param[in] err_code error code
+     */
+    void set_error_code(int err_code) { err_code_ = err_code; }
 
     /**
      * @brief Set the finished object
@@ -143,6 +355,12 @@ public:
      */
     void set_finished(bool finish) { finished_ = finish; }
 
+    /**
+     * @brief Set the headers complete object
+     * @param[in] complete headers complete state
+     */
+    void set_headers_complete(bool complete) { headers_complete_ = complete; }
+
 private:
     /// parse error code
     int err_code_ {0};
@@ -152,8 +370,22 @@ private:
     http_parser parser_ {};
     /// head field
     std::string field_ {};
+    /// head value
+    std::string value_ {};
+    /// value of current field is being received
+    bool in_value_ {false};
+    /// raw header lines
+    std::string header_block_ {};
     /// finish state
     bool finished_ {false};
+    /// headers complete state
+    bool headers_complete_ {false};
+    /// response has no body
+    bool skip_body_ {false};
+    /// body bytes parsed
+    uint64_t body_size_ {0};
+    /// streaming body callback
+    BodyCallback body_cb_ {};
 };
 
 
@@ -1,10 +1,16 @@
 #include "http_server.h"
 #include "http.h"
 #include "http_session.h"
+#include "http2_session.h"
 #include "servlet.h"
 #include "../log.h"
 
 #include <memory>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 namespace sylar {
 namespace http {
@@ -12,7 +18,8 @@ namespace http {
 HttpServer::HttpServer(bool keepalive, IOManager::ptr worker, IOManager::ptr io_worker, 
     IOManager::ptr accept_worker) 
     : TcpServer(io_worker, accept_worker)
-    , keep_alive(keepalive) {
+    , keep_alive(keepalive)
+    , worker_(worker) {
     dispatch_.reset(new ServletDispatch);
 }
 
@@ -21,25 +28,221 @@ void HttpServer::set_name(const std::string &name) {
     dispatch_->set_default(std::make_shared<NotFoundServlet>(name));
 }
 
+void HttpServer::Connection::shutdown_read() {
+    MutexType::Lock lock(mutex);
+    if (!closed)
+        sock->shutdown(SHUT_RD);
+}
+
+void HttpServer::Connection::close() {
+    MutexType::Lock lock(mutex);
+    closed = true;
+}
+
+size_t HttpServer::get_connection_count() {
+    Mutex::Lock lock(mutex_);
+    return connections_.size();
+}
+
+bool HttpServer::stop() {
+    // set before idle connections are collected, see wait_request and park
+    stopping_.store(true);
+    bool rt = TcpServer::stop();
+    std::vector<Connection::ptr> idles;
+    {
+        Mutex::Lock lock(mutex_);
+        for (auto& conn : connections_) {
+            if (conn->idle.load() || conn->parked.load())
+                idles.push_back(conn);
+        }
+    }
+    SYLAR_FMT_DEBUG("http server stop, idle connections: %zu", idles.size());
+    for (auto& conn : idles) {
+        if (conn->parked.load())
+            close_parked(conn, 0);
+        else
+            conn->shutdown_read();
+    }
+    return rt;
+}
+
+Timer::ptr HttpServer::arm_timeout(Connection::ptr conn, uint64_t ms) {
+    auto io_worker = get_io_worker();
+    if (ms == 0 || !io_worker)
+        return nullptr;
+    // blocked read wake up with eof, connection is closed by its own fiber
+    std::weak_ptr<Connection> weak(conn);
+    return io_worker->add_timer(ms, false, [weak]() {
+        auto conn = weak.lock();
+        if (conn)
+            conn->shutdown_read();
+    });
+}
+
+bool HttpServer::wait_request(Connection::ptr conn, bool first) {
+    auto& session = conn->session;
+    if (session->has_buffered())
+        return !stopping_.load();
+    conn->idle.store(true);
+    // stop either see this connection idle, or it is seen stopping here
+    if (stopping_.load()) {
+        conn->idle.store(false);
+        return false;
+    }
+    // first request is not kept alive yet, it is limited by header timeout
+    auto timer = arm_timeout(conn, first ? header_timeout_ : keepalive_timeout_);
+    bool ok = session->wait_request();
+    conn->idle.store(false);
+    // timer fired, read side is or will be shut down
+    if (timer && !timer->cancel())
+        return false;
+    return ok;
+}
+
 void HttpServer::handle_client(Socket::ptr client) {
+    // response of pipelined request is not held back by nagle
+    int nodelay = 1;
+    setsockopt(client->get_fd(), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     // create session
     HttpSession::ptr session(new HttpSession(client));
-    do {
-        // recv request from socket
-        auto req = session->recv_request();
-        if (!req) {
-            SYLAR_ERR("cant recv request");
+    session->set_max_header_size(max_header_size_);
+    session->set_max_body_size(max_body_size_);
+    session->set_compression_filter(filter_);
+    session->set_server_name(get_name());
+    Connection::ptr conn(new Connection(session));
+    {
+        Mutex::Lock lock(mutex_);
+        connections_.insert(conn);
+    }
+    if (!wait_request(conn, true)) {
+        finish(conn);
+        return;
+    }
+    if (h2c_ && session->detect_preface(Http2Session::PREFACE)) {
+        // streams are multiplexed, every stream run as a fiber on worker
+        std::string buffered;
+        session->take_buffered(buffered);
+        Http2Session::ptr h2(new Http2Session(client, buffered, false));
+        h2->set_max_body_size(max_body_size_);
+        h2->set_server_name(get_name());
+        h2->handle(dispatch_, worker_.get());
+        finish(conn);
+        return;
+    }
+    serve(conn);
+}
+
+void HttpServer::serve(Connection::ptr conn) {
+    // pipelined request is handled one by one, so response is in order
+    while (handle_request(conn)) {
+        if (conn->session->has_buffered())
+            continue;
+        // fiber is released, serve continue on a new one
+        if (park(conn))
+            return;
+        if (!wait_request(conn, false))
             break;
+    }
+    finish(conn);
+}
+
+bool HttpServer::handle_request(Connection::ptr conn) {
+    auto& session = conn->session;
+    // recv request from socket
+    // body is received by dispatch, or streamed by servlet
+    auto timer = arm_timeout(conn, header_timeout_);
+    auto req = session->recv_request_header();
+    if (timer && !timer->cancel()) {
+        SYLAR_ERR("request header timeout");
+        return false;
+    }
+    if (!req) {
+        SYLAR_ERR("cant recv request");
+        return false;
+    }
+    bool last = max_requests_ > 0 && ++conn->requests >= max_requests_;
+    HttpResponse::ptr resp(new HttpResponse(req->get_version(), req->is_close() || !keep_alive || last));
+    dispatch_->handle(req, resp, session);
+    // skip body left by servlet, so next request could be parsed
+    if (!resp->is_close() && !session->is_body_complete() && session->read_body(nullptr) < 0)
+        resp->set_close(true);
+    // client is told before connection is closed
+    if (stopping_.load())
+        resp->set_close(true);
+    if (session->send_response(resp) < 0)
+        return false;
+    return keep_alive && !req->is_close() && !resp->is_close();
+}
+
+bool HttpServer::park(Connection::ptr conn) {
+    auto io_worker = get_io_worker();
+    if (!io_worker)
+        return false;
+    conn->session->shrink();
+    Connection::MutexType::Lock lock(conn->mutex);
+    conn->parked.store(true);
+    // stop either see this connection parked, or it is seen stopping here
+    if (stopping_.load()) {
+        conn->parked.store(false);
+        lock.unlock();
+        finish(conn);
+        return true;
+    }
+    // event fiber wait for the lock, so timer is set before it run
+    bool ok = io_worker->add_oneshot_event(conn->sock->get_fd(), IOManager::Event::READ, [this, conn]() {
+        Timer::ptr timer;
+        {
+            Connection::MutexType::Lock lock(conn->mutex);
+            conn->parked.store(false);
+            conn->park_gen++;
+            timer.swap(conn->timer);
         }
-        HttpResponse::ptr resp(new HttpResponse(req->get_version(), req->is_close() || !keep_alive));
-        resp->set_header("Server", get_name());
-        dispatch_->handle(req, resp, session);
-        session->send_response(resp);
-        if (!keep_alive || req->is_close()) 
-            break;
-    } while (true);
+        if (timer)
+            timer->cancel();
+        serve(conn);
+    });
+    if (!ok) {
+        conn->parked.store(false);
+        return false;
+    }
+    uint64_t gen = ++conn->park_gen;
+    if (keepalive_timeout_ > 0) {
+        std::weak_ptr<Connection> weak(conn);
+        conn->timer = io_worker->add_timer(keepalive_timeout_, false, [this, weak, gen]() {
+            auto conn = weak.lock();
+            if (conn)
+                close_parked(conn, gen);
+        });
+    }
+    return true;
+}
+
+void HttpServer::close_parked(Connection::ptr conn, uint64_t gen) {
+    auto io_worker = get_io_worker();
+    Timer::ptr timer;
+    {
+        Connection::MutexType::Lock lock(conn->mutex);
+        if (!conn->parked.load() || (gen != 0 && conn->park_gen != gen))
+            return;
+        // event may fire meanwhile, only one of them take connection
+        if (!io_worker->cancel_fd_event(conn->sock->get_fd(), IOManager::Event::READ))
+            return;
+        conn->parked.store(false);
+        timer.swap(conn->timer);
+    }
+    if (timer)
+        timer->cancel();
+    finish(conn);
+}
+
+void HttpServer::finish(Connection::ptr conn) {
+    {
+        Mutex::Lock lock(mutex_);
+        connections_.erase(conn);
+    }
     // close session
-    session->close();
+    conn->close();
+    conn->session->close();
 }
 
 }
@@ -2,9 +2,14 @@
 #define __SYLAR_SRC_HTTP_SERVER_H__
 
 #include "../tcp_server.h"
+#include "../mutex.h"
+#include "../timer.h"
+#include "compression.h"
 #include "servlet.h"
+#include <atomic>
 #include <memory>
 #include <string>
+#include <unordered_set>
 
 namespace sylar {
 namespace http {
@@ -41,6 +46,66 @@ public:
      */
     void set_name(const std::string& name) override;
 
+    /**
+     * @brief Set the max header size object
+     * @param[in] size max request header size
+     */
+    void set_max_header_size(size_t size) { max_header_size_ = size; }
+
+    /**
+     * @brief Set the max body size object
+     * @param[in] size default max request body size, servlet could override
+     */
+    void set_max_body_size(uint64_t size) { max_body_size_ = size; }
+
+    /**
+     * @brief Set the compression filter object
+     * @param[in] filter response compression filter, nullptr to disable
+     */
+    void set_compression_filter(CompressionFilter::ptr filter) { filter_ = filter; }
+
+    /**
+     * @brief Set the h2c object
+     * @details connection begin with http/2 preface is served as http/2
+     *          (prior knowledge), others are http/1 as before
+     * @param[in] v if accept h2c
+     */
+    void set_h2c(bool v) { h2c_ = v; }
+
+    /**
+     * @brief Set the keepalive timeout object
+     * @details connection waiting for next request longer than it is closed
+     * @param[in] ms timeout in ms, 0 means never
+     */
+    void set_keepalive_timeout(uint64_t ms) { keepalive_timeout_ = ms; }
+
+    /**
+     * @brief Set the header timeout object
+     * @details request header must be received in time since its first
+     *          byte, or since connect for the first request
+     * @param[in] ms timeout in ms, 0 means never
+     */
+    void set_header_timeout(uint64_t ms) { header_timeout_ = ms; }
+
+    /**
+     * @brief Set the max requests object
+     * @details last response carry Connection: close
+     * @param[in] count max requests per connection, 0 means unlimited
+     */
+    void set_max_requests(uint32_t count) { max_requests_ = count; }
+
+    /**
+     * @brief Get the connection count object
+     */
+    size_t get_connection_count();
+
+    /**
+     * @brief stop server gracefully
+     * @details idle connections are closed at once, busy ones finish current
+     *          request and respond with Connection: close
+     */
+    bool stop() override;
+
 protected:
     /**
      * @brief handle connect socket
@@ -48,11 +113,131 @@ protected:
      */
     virtual void handle_client(Socket::ptr client) override;    
 
+private:
+    /**
+     * @brief connection state shared with timers and stop
+     * @details idle keep-alive connection is parked as this state plus a
+     *          oneshot read event, no fiber is held until next request arrive
+     */
+    struct Connection {
+        /// share pointer
+        typedef std::shared_ptr<Connection> ptr;
+        /// mutex type
+        typedef Mutex MutexType;
+
+        /**
+         * @brief Construct a new Connection object
+         * @param[in] s http session
+         */
+        Connection(HttpSession::ptr s) : session(s), sock(s->get_socket()) {}
+
+        /**
+         * @brief shutdown read side, blocked read of session return
+         */
+        void shutdown_read();
+
+        /**
+         * @brief mark socket closed, it is never shut down later
+         */
+        void close();
+
+        /// http session
+        HttpSession::ptr session {};
+        /// client socket
+        Socket::ptr sock {};
+        /// mutex, socket fd is not reused while shutting down
+        MutexType mutex {};
+        /// socket is closed
+        bool closed {false};
+        /// fiber is blocked waiting for first request
+        std::atomic<bool> idle {false};
+        /// parked in io manager, the one cancel read event own it
+        std::atomic<bool> parked {false};
+        /// park generation, timer of earlier park is ignored
+        uint64_t park_gen {0};
+        /// keep-alive timer of parked connection
+        Timer::ptr timer {};
+        /// requests served
+        uint32_t requests {0};
+    };
+
+    /**
+     * @brief start timeout of reading
+     * @param[in] conn connection
+     * @param[in] ms timeout in ms
+     * @return nullptr if timeout is disabled
+     */
+    Timer::ptr arm_timeout(Connection::ptr conn, uint64_t ms);
+
+    /**
+     * @brief wait for next request in timeout, fiber is blocked
+     * @param[in] conn connection
+     * @param[in] first if it is the first request
+     * @return false if connection should be closed
+     */
+    bool wait_request(Connection::ptr conn, bool first);
+
+    /**
+     * @brief handle one http/1 request
+     * @param[in] conn connection
+     * @return false if connection should be closed
+     */
+    bool handle_request(Connection::ptr conn);
+
+    /**
+     * @brief serve http/1 requests until connection is closed or parked
+     * @param[in] conn connection
+     */
+    void serve(Connection::ptr conn);
+
+    /**
+     * @brief park idle connection until next request arrive
+     * @details session buffer is released, serve is continued by a new fiber
+     * @param[in] conn connection
+     * @return false if not parked, caller should wait itself
+     */
+    bool park(Connection::ptr conn);
+
+    /**
+     * @brief close parked connection if it is still parked
+     * @param[in] conn connection
+     * @param[in] gen park generation, 0 for any
+     */
+    void close_parked(Connection::ptr conn, uint64_t gen);
+
+    /**
+     * @brief close connection and forget it
+     * @param[in] conn connection
+     */
+    void finish(Connection::ptr conn);
+
 private:
     /// if support alive
     bool keep_alive {false};
     /// servlet dispatch
     ServletDispatch::ptr dispatch_ {};
+    /// http/2 stream worker
+    IOManager::ptr worker_ {};
+    /// max request header size
+    size_t max_header_size_ {64 * 1024};
+    /// default max request body size
+    uint64_t max_body_size_ {16 * 1024 * 1024};
+    /// response compression filter
+    CompressionFilter::ptr filter_ {};
+    /// if accept h2c
+    bool h2c_ {false};
+    /// keep-alive idle timeout in ms
+    uint64_t keepalive_timeout_ {75 * 1000};
+    /// request header timeout in ms
+    uint64_t header_timeout_ {60 * 1000};
+    /// max requests per connection
+    uint32_t max_requests_ {0};
+    /// server is stopping
+    std::atomic<bool> stopping_ {false};
+    /// mutex of connections
+    Mutex mutex_ {};
+    /// live connections
+    std::unordered_set<Connection::ptr> connections_ {};
 };
 
 
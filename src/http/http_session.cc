@@ -1,7 +1,14 @@
 #include "http.h"
 #include "http_parser.h"
 #include "http_session.h"
+#include "../log.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <unistd.h>
 #include <memory>
 #include <string>
 
@@ -10,51 +17,401 @@ namespace sylar {
 namespace http {
 
 HttpSession::HttpSession(Socket::ptr sock, bool owner) : 
-    SocketStream(sock, owner) {
-
+    SocketStream(sock, owner),
+    parser_(new HttpRequestParser(true)) {
+    header_buf_.reserve(512);
 }
 
 HttpRequest::ptr HttpSession::recv_request() {
-    // create parser
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    // create buffer
-    int size = 4 * 1024;
-    std::shared_ptr<char> buffer(new char[size], [](char* p){
-        delete [] p;
-    });
-    char* data = buffer.get();
-    int offset = 0;
+    auto req = recv_request_header();
+    if (!req)
+        return nullptr;
+    if (!set_body_limit(0) || !recv_body(req)) {
+        close();
+        return nullptr;
+    }
+    return req;
+}
+
+HttpRequest::ptr HttpSession::recv_request_header() {
+    // reuse parser, request keep string views into buffer
+    if (!parser_reset_)
+        parser_->reset();
+    parser_reset_ = false;
+    prepare_buffer();
+    auto req = parser_->get_request();
+    req->set_buffer(buffer_);
+    parser_->set_max_body_size(max_body_size_);
+    if (!parse(true)) {
+        close();
+        return nullptr;
+    }
+    req->init();
+    req->set_remote_addr(get_socket()->get_remote_addr());
+    coding_ = filter_ ? filter_->negotiate(req) : ContentCoding::IDENTITY;
+    return req;
+}
+
+bool HttpSession::wait_request() {
+    if (read_pos_ < write_pos_)
+        return true;
+    // drop last request, buffer is reused if nobody else hold it
+    parser_->reset();
+    parser_reset_ = true;
+    prepare_buffer();
+    int len = read(buffer_.get() + write_pos_, buffer_size_ - write_pos_);
+    if (len <= 0)
+        return false;
+    write_pos_ += len;
+    return true;
+}
+
+void HttpSession::shrink() {
+    if (read_pos_ < write_pos_)
+        return;
+    // next request is created by next receive
+    parser_->release();
+    parser_reset_ = false;
+    // request views may still hold buffer, it is freed by the last one
+    buffer_.reset();
+    read_pos_ = write_pos_ = 0;
+    std::string().swap(header_buf_);
+}
+
+bool HttpSession::set_body_limit(uint64_t limit) {
+    parser_->set_max_body_size(limit ? limit : max_body_size_);
+    // reject early, dont read any body
+    int64_t length = parser_->get_content_length();
+    if (parser_->get_max_body_size() > 0 && length > 0 
+        && (uint64_t)length > parser_->get_max_body_size()) {
+        SYLAR_FMT_ERR("http request body too large, length: %ld, max: %lu", 
+            length, parser_->get_max_body_size());
+        return false;
+    }
+    return true;
+}
+
+bool HttpSession::recv_body(HttpRequest::ptr req) {
+    return parse(false);
+}
+
+int64_t HttpSession::read_body(const BodyCallback& cb) {
+    uint64_t begin = parser_->get_body_size();
+    parser_->set_body_callback(cb ? cb : [](std::string_view) { return true; });
+    bool ok = parse(false);
+    parser_->set_body_callback(nullptr);
+    return ok ? parser_->get_body_size() - begin : -1;
+}
+
+bool HttpSession::parse(bool header_only) {
     do {
-        int len = read(data + offset, size - offset);
-        if (len < 0) {
-            close();
-            return nullptr;
-        }
-        len += offset;
-        // parse 
-        size_t parse_size = parser->execute(data, len);
-        // check if is success
-        if (parser->is_error()) {
-            close();
-            return nullptr;
+        if (parser_->is_finished() || (header_only && parser_->is_headers_complete()))
+            return true;
+        // parse buffered data first, maybe pipelined request
+        if (read_pos_ < write_pos_) {
+            size_t size = parser_->execute(buffer_.get() + read_pos_, write_pos_ - read_pos_);
+            // check if is success
+            if (parser_->is_error())
+                return false;
+            read_pos_ += size;
+            // parser paused, check state before parse left data
+            continue;
         }
-        offset = len - parse_size;
-        if (offset == size) {
-            close();
-            return nullptr;
+        // buffer is full
+        if (write_pos_ == buffer_size_ && !make_room()) {
+            SYLAR_FMT_ERR("http request header too large, max: %lu", max_header_size_);
+            return false;
         }
-        // parser has finished
-        if (parser->is_finished())
-            break;
+        int len = read(buffer_.get() + write_pos_, buffer_size_ - write_pos_);
+        if (len <= 0) 
+            return false;
+        write_pos_ += len;
     } while (true);
-    auto req = parser->get_request();
-    req->init();
-    return req;
+}
+
+void HttpSession::prepare_buffer() {
+    size_t left = write_pos_ - read_pos_;
+    // views of last request still in use, switch to a new buffer
+    if (!buffer_ || buffer_.use_count() > 1) {
+        std::shared_ptr<char> buffer(new char[buffer_size_], [](char* p){
+            delete [] p;
+        });
+        if (left > 0)
+            memcpy(buffer.get(), buffer_.get() + read_pos_, left);
+        buffer_ = buffer;
+    } else if (left > 0 && read_pos_ > 0) {
+        memmove(buffer_.get(), buffer_.get() + read_pos_, left);
+    }
+    read_pos_ = 0;
+    write_pos_ = left;
+}
+
+bool HttpSession::make_room() {
+    char* data = buffer_.get();
+    // views before body still in use, body could be copied
+    if (parser_->is_headers_complete()) {
+        parser_->get_request()->materialize_body();
+        read_pos_ = write_pos_ = parser_->get_view_end() - data;
+        if (write_pos_ < buffer_size_)
+            return true;
+    } else if (buffer_size_ >= max_header_size_) {
+        return false;
+    }
+    // grow buffer, session keep the larger one
+    size_t size = buffer_size_ * 2;
+    std::shared_ptr<char> buffer(new char[size], [](char* p){
+        delete [] p;
+    });
+    memcpy(buffer.get(), data, write_pos_);
+    // views should point into new buffer
+    parser_->rebase(data, buffer.get());
+    parser_->get_request()->set_buffer(buffer);
+    buffer_ = buffer;
+    buffer_size_ = size;
+    return true;
+}
+
+HttpResponseWriter::HttpResponseWriter(HttpSession* session, HttpResponse::ptr resp, int64_t length) :
+    session_(session),
+    resp_(resp),
+    length_(length) {
+    // body is sent by writer, header must not count it
+    resp_->set_body("");
+    uint32_t status = (uint32_t)resp_->get_status();
+    if (status < 200 || status == 204 || status == 304) {
+        // no body allowed, such as 101 switching protocols
+        length_ = 0;
+    } else if (length_ >= 0) {
+        resp_->set_header("Content-Length", std::to_string(length_));
+    } else if (resp_->get_version() >= 0x11) {
+        chunked_ = true;
+        resp_->set_header("Transfer-Encoding", "chunked");
+        // only chunked body could be compressed on the fly
+        compressor_ = session_->create_compressor(resp_);
+    } else {
+        // HTTP/1.0 peer, body end when connection close
+        resp_->set_close(true);
+    }
+}
+
+bool HttpResponseWriter::check_write(size_t length) {
+    if (finished_) {
+        SYLAR_ERR("write response body after finished");
+        return false;
+    }
+    if (length_ >= 0 && written_ + length > (uint64_t)length_) {
+        SYLAR_FMT_ERR("write response body exceed content length: %ld", length_);
+        return false;
+    }
+    return true;
+}
+
+size_t HttpResponseWriter::begin_chunk(iovec* iov, char* size_line, size_t size, size_t length) {
+    size_t count = 0;
+    if (!header_sent_) {
+        session_->build_header(resp_);
+        iov[count].iov_base = (void*)session_->header_buf_.data();
+        iov[count++].iov_len = session_->header_buf_.size();
+        header_sent_ = true;
+    }
+    if (chunked_ && length > 0) {
+        iov[count].iov_base = size_line;
+        iov[count++].iov_len = snprintf(size_line, size, "%lx\r\n", length);
+    }
+    return count;
+}
+
+int HttpResponseWriter::write(const void* data, size_t length) {
+    if (!compressor_)
+        return write_chunk(data, length);
+    if (!check_write(length))
+        return -1;
+    zbuf_.clear();
+    if (!compressor_->compress(std::string_view((const char*)data, length), zbuf_)) {
+        finished_ = true;
+        return -1;
+    }
+    // zlib may keep small input, nothing to send yet
+    if ((!zbuf_.empty() || !header_sent_) && write_chunk(zbuf_.data(), zbuf_.size()) < 0)
+        return -1;
+    return length;
+}
+
+int HttpResponseWriter::write_chunk(const void* data, size_t length) {
+    if (!check_write(length))
+        return -1;
+    if (length == 0 && header_sent_)
+        return 0;
+    // header, chunk size, data, chunk end
+    iovec iov[4];
+    char size_line[32];
+    size_t count = begin_chunk(iov, size_line, sizeof(size_line), length);
+    if (length > 0) {
+        iov[count].iov_base = (void*)data;
+        iov[count++].iov_len = length;
+    }
+    if (chunked_ && length > 0) {
+        iov[count].iov_base = (void*)"\r\n";
+        iov[count++].iov_len = 2;
+    }
+    int rt = session_->writev_fix_size(iov, count);
+    if (rt <= 0) {
+        finished_ = true;
+        return rt;
+    }
+    written_ += length;
+    return length;
+}
+
+int64_t HttpResponseWriter::send_file(int fd, off_t offset, size_t length) {
+    if (!check_write(length))
+        return -1;
+    if (length == 0)
+        return write(nullptr, 0);
+    // content must pass compressor, read it into user space
+    if (compressor_) {
+        char buf[16 * 1024];
+        size_t left = length;
+        while (left > 0) {
+            ssize_t size = ::pread(fd, buf, std::min(left, sizeof(buf)), offset);
+            if (size <= 0 || write(buf, size) < 0) {
+                finished_ = true;
+                return -1;
+            }
+            offset += size;
+            left -= size;
+        }
+        return length;
+    }
+    // header and chunk size first, then file content
+    iovec iov[2];
+    char size_line[32];
+    size_t count = begin_chunk(iov, size_line, sizeof(size_line), length);
+    if (count > 0 && session_->writev_fix_size(iov, count) <= 0) {
+        finished_ = true;
+        return -1;
+    }
+    if (session_->sendfile_fix_size(fd, offset, length) <= 0) {
+        finished_ = true;
+        return -1;
+    }
+    if (chunked_ && session_->write_fix_size("\r\n", 2) <= 0) {
+        finished_ = true;
+        return -1;
+    }
+    written_ += length;
+    return length;
+}
+
+int HttpResponseWriter::finish() {
+    if (finished_)
+        return 0;
+    // flush compressor
+    if (compressor_) {
+        zbuf_.clear();
+        if (!compressor_->compress(std::string_view(), zbuf_, true) 
+            || write_chunk(zbuf_.data(), zbuf_.size()) < 0)
+            return -1;
+        compressor_.reset();
+    }
+    // header only response
+    if (!header_sent_ && write_chunk(nullptr, 0) < 0)
+        return -1;
+    finished_ = true;
+    if (chunked_) {
+        iovec iov;
+        iov.iov_base = (void*)"0\r\n\r\n";
+        iov.iov_len = 5;
+        if (session_->writev_fix_size(&iov, 1) <= 0)
+            return -1;
+    }
+    // peer is waiting for missing bytes, cant keep alive
+    if (length_ >= 0 && written_ != (uint64_t)length_) {
+        SYLAR_FMT_ERR("response body shorter than content length, written: %lu, length: %ld",
+            written_, length_);
+        return -1;
+    }
+    return 0;
+}
+
+StreamCompressor::ptr HttpSession::create_compressor(HttpResponse::ptr resp) {
+    if (!filter_ || coding_ == ContentCoding::IDENTITY || !filter_->should_compress(resp, -1))
+        return nullptr;
+    auto compressor = filter_->create_stream(coding_);
+    resp->set_header("Content-Encoding", content_coding_to_string(coding_));
+    resp->set_header("Vary", "Accept-Encoding");
+    return compressor;
+}
+
+HttpResponseWriter::ptr HttpSession::begin_response(HttpResponse::ptr resp, int64_t length) {
+    writer_.reset(new HttpResponseWriter(this, resp, length));
+    return writer_;
+}
+
+void HttpSession::build_header(HttpResponse::ptr resp) {
+    // serialize header into session buffer, capacity is kept
+    header_buf_.clear();
+    resp->write_header(header_buf_);
+    if (!server_line_.empty() && !resp->has_header("Server"))
+        header_buf_.append(server_line_);
+    if (!resp->has_header("Date"))
+        HttpResponse::append_date_header(header_buf_);
+    header_buf_.append("\r\n");
 }
 
 int HttpSession::send_response(HttpResponse::ptr resp) {
-    std::string msg = resp->to_string();
-    return write_fix_size(msg.c_str(), msg.size());
+    // body is streamed by writer
+    if (writer_) {
+        int rt = writer_->finish();
+        writer_.reset();
+        return rt;
+    }
+    // compress whole body
+    if (filter_ && coding_ != ContentCoding::IDENTITY 
+        && filter_->should_compress(resp, resp->get_body_view().size()))
+        filter_->compress(coding_, resp);
+    std::string_view body = resp->get_body_view();
+    // empty body still need framing, or keep-alive peer wait for close
+    uint32_t status = (uint32_t)resp->get_status();
+    if (body.empty() && status >= 200 && status != 204 && status != 304
+        && !resp->has_header("Content-Length") && !resp->has_header("Transfer-Encoding"))
+        resp->set_header("Content-Length", "0");
+    build_header(resp);
+    // header and body are sent together, body is never copied
+    iovec iov[2];
+    iov[0].iov_base = (void*)header_buf_.data();
+    iov[0].iov_len = header_buf_.size();
+    iov[1].iov_base = (void*)body.data();
+    iov[1].iov_len = body.size();
+    return writev_fix_size(iov, body.empty() ? 1 : 2);
+}
+
+bool HttpSession::detect_preface(std::string_view preface) {
+    prepare_buffer();
+    while (true) {
+        std::string_view data(buffer_.get() + read_pos_, write_pos_ - read_pos_);
+        size_t size = std::min(data.size(), preface.size());
+        // mismatch is known as soon as first different byte arrive
+        if (data.compare(0, size, preface.substr(0, size)) != 0)
+            return false;
+        if (size == preface.size())
+            return true;
+        int len = read(buffer_.get() + write_pos_, buffer_size_ - write_pos_);
+        if (len <= 0)
+            return false;
+        write_pos_ += len;
+    }
+}
+
+size_t HttpSession::take_buffered(std::string& out) {
+    size_t left = write_pos_ - read_pos_;
+    out.append(buffer_.get() + read_pos_, left);
+    read_pos_ = write_pos_;
+    return left;
+}
+
+void HttpSession::set_server_name(const std::string& name) {
+    server_line_ = name.empty() ? "" : "Server: " + name + "\r\n";
 }
 
 }
@@ -2,18 +2,143 @@
 #define __SYLAR_SRC_HTTP_SESSION_H__
 
 
+#include "compression.h"
 #include "http.h"
+#include "http_parser.h"
 #include "../streams/socket_stream.h"
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <string_view>
 
 
 namespace sylar {
 namespace http {
 
+class HttpSession;
+
+/**
+ * @brief streaming response body writer
+ * @details header is sent with the first write. body is sent with
+ *          known content-length, or chunked transfer-encoding when length
+ *          is unknown (HTTP/1.0 falls back to close delimited body).
+ *          data is written straight to socket without buffering. on io
+ *          manager worker socket is nonblock and a slow peer parks the
+ *          writing fiber in hooked write, so memory stay flat whatever
+ *          body size is.
+ *          writer is bound to session, dont keep it after servlet return
+ */
+class HttpResponseWriter {
+public:
+    /// share pointer
+    typedef std::shared_ptr<HttpResponseWriter> ptr;
+
+    /**
+     * @brief Construct a new Http Response Writer object
+     * @param[in] session http session
+     * @param[in] resp response, header is taken from it
+     * @param[in] length content length, -1 means unknown, ignored when status has no body
+     */
+    HttpResponseWriter(HttpSession* session, HttpResponse::ptr resp, int64_t length = -1);
+
+    /**
+     * @brief write body data
+     * @param[in] data data
+     * @param[in] length data length
+     * @return data length, or <= 0 when failed
+     */
+    int write(const void* data, size_t length);
+
+    /**
+     * @brief write body data
+     * @param[in] data data
+     */
+    int write(std::string_view data) { return write(data.data(), data.size()); }
+
+    /**
+     * @brief write file content as body by sendfile
+     * @details on io manager worker fiber is parked while socket buffer is
+     *          full, elsewhere thread block in sendfile
+     * @param[in] fd file fd
+     * @param[in] offset file offset
+     * @param[in] length send length
+     * @return length, or <= 0 when failed
+     */
+    int64_t send_file(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief finish body, send last chunk when chunked
+     * @return < 0 if failed or body is shorter than content length
+     */
+    int finish();
+
+    /**
+     * @brief if body is chunked
+     */
+    bool is_chunked() { return chunked_; }
+
+    /**
+     * @brief if body is finished
+     */
+    bool is_finished() { return finished_; }
+
+    /**
+     * @brief Get the written object, body bytes written
+     */
+    uint64_t get_written() { return written_; }
+
+private:
+    /**
+     * @brief check if length could be written
+     * @param[in] length data length
+     */
+    bool check_write(size_t length);
+
+    /**
+     * @brief write data as one chunk, data is already compressed
+     * @param[in] data data
+     * @param[in] length data length
+     */
+    int write_chunk(const void* data, size_t length);
+
+    /**
+     * @brief fill header and chunk size line into iov
+     * @param[out] iov iovec array, at least 2
+     * @param[out] size_line chunk size line buffer
+     * @param[in] size size line buffer size
+     * @param[in] length data length
+     * @return iovec count
+     */
+    size_t begin_chunk(iovec* iov, char* size_line, size_t size, size_t length);
+
+private:
+    /// session
+    HttpSession* session_ {nullptr};
+    /// response
+    HttpResponse::ptr resp_ {};
+    /// content length, -1 means unknown
+    int64_t length_ {-1};
+    /// body bytes written
+    uint64_t written_ {0};
+    /// chunked
+    bool chunked_ {false};
+    /// header is sent
+    bool header_sent_ {false};
+    /// body is finished
+    bool finished_ {false};
+    /// compressor of chunked body
+    StreamCompressor::ptr compressor_ {};
+    /// compressed data buffer
+    std::string zbuf_ {};
+};
+
 
 class HttpSession : public SocketStream {
 public:
     typedef std::shared_ptr<HttpSession> ptr;
+    /// body chunk callback, return false to abort
+    typedef HttpRequestParser::BodyCallback BodyCallback;
 
     /**
      * @brief Construct a new Http Session object
@@ -24,17 +149,214 @@ public:
 
     /**
      * @brief receive request
+     * @details bytes after current request are kept in session buffer,
+     *          pipelined request is parsed by next call
      */
     HttpRequest::ptr recv_request();
 
+    /**
+     * @brief receive request header only, body is left in socket
+     * @details call recv_body or read_body to receive body
+     */
+    HttpRequest::ptr recv_request_header();
+
+    /**
+     * @brief wait until first byte of next request arrive
+     * @details views of last request are released before waiting, so idle
+     *          connection keep no request. return at once if pipelined
+     *          request is buffered
+     * @return false if connection is closed or read failed
+     */
+    bool wait_request();
+
+    /**
+     * @brief release last request and receive buffer while connection is idle
+     * @details nothing is released if bytes of next request are buffered.
+     *          buffer is allocated again by next receive
+     */
+    void shrink();
+
+    /**
+     * @brief set body size limit of current request
+     * @param[in] limit max body size, 0 means session default
+     * @return false if declared content length already exceed limit
+     */
+    bool set_body_limit(uint64_t limit);
+
+    /**
+     * @brief receive the rest body into request
+     * @return false if failed, is_body_too_large tell the reason
+     */
+    bool recv_body(HttpRequest::ptr req);
+
+    /**
+     * @brief read the rest body chunk by chunk, body is not kept
+     * @details memory is bounded by session buffer whatever body size is
+     * @param[in] cb body chunk callback, chunk only valid during callback,
+     *            nullptr to discard body
+     * @return body bytes read, -1 if failed
+     */
+    int64_t read_body(const BodyCallback& cb);
+
+    /**
+     * @brief Get the content length object of current request
+     * @return -1 if length is unknown (chunked)
+     */
+    int64_t get_content_length() { return parser_->get_content_length(); }
+
+    /**
+     * @brief if body of current request is all received
+     */
+    bool is_body_complete() { return parser_->is_finished(); }
+
+    /**
+     * @brief if body of current request exceed limit
+     */
+    bool is_body_too_large() { return parser_->is_body_too_large(); }
+
+    /**
+     * @brief Set the max body size object
+     * @param[in] size default max body size, 0 means unlimited
+     */
+    void set_max_body_size(uint64_t size) { max_body_size_ = size; }
+
+    /**
+     * @brief Get the max body size object
+     */
+    uint64_t get_max_body_size() { return max_body_size_; }
+
     /**
      * @brief send response
+     * @details finish streaming body instead if response is streamed
      * @param[in] resp response
      */
     int send_response(HttpResponse::ptr resp);
+
+    /**
+     * @brief begin streaming response body
+     * @details resp body is ignored, write body by returned writer.
+     *          send_response will finish the body if servlet dont
+     * @param[in] resp response
+     * @param[in] length content length, -1 means unknown
+     */
+    HttpResponseWriter::ptr begin_response(HttpResponse::ptr resp, int64_t length = -1);
+
+    /**
+     * @brief if current response is streamed
+     */
+    bool is_streaming() { return writer_ != nullptr; }
+
+    /**
+     * @brief Set the server name object, cached as header line
+     * @param[in] name server name
+     */
+    void set_server_name(const std::string& name);
+
+    /**
+     * @brief Set the compression filter object
+     * @param[in] filter response compression filter, nullptr to disable
+     */
+    void set_compression_filter(CompressionFilter::ptr filter) { filter_ = filter; }
+
+    /**
+     * @brief Get the content coding object negotiated for current request
+     */
+    ContentCoding get_content_coding() { return coding_; }
+
+    /**
+     * @brief if pipelined data is already buffered
+     */
+    bool has_buffered() { return read_pos_ < write_pos_; }
+
+    /**
+     * @brief check if connection begin with preface, such as http/2 prior knowledge
+     * @details read until preface could be decided, bytes are kept in buffer
+     * @param[in] preface expected preface
+     */
+    bool detect_preface(std::string_view preface);
+
+    /**
+     * @brief move bytes buffered after current request out of session
+     * @details used when connection is upgraded to other protocol
+     * @param[out] out bytes appended to
+     * @return bytes count
+     */
+    size_t take_buffered(std::string& out);
+
+    /**
+     * @brief Set the max header size object
+     * @param[in] size max header size, larger request will close session
+     */
+    void set_max_header_size(size_t size) { max_header_size_ = size; }
+
+    /**
+     * @brief Get the max header size object
+     */
+    size_t get_max_header_size() { return max_header_size_; }
+
+private:
+    friend class HttpResponseWriter;
+
+    /**
+     * @brief parse until headers complete or message complete
+     * @param[in] header_only stop at headers complete
+     */
+    bool parse(bool header_only);
+
+    /**
+     * @brief create compressor for streaming body
+     * @param[in] resp response, encoding header is set
+     * @return nullptr if body should not be compressed
+     */
+    StreamCompressor::ptr create_compressor(HttpResponse::ptr resp);
+
+    /**
+     * @brief serialize response header block into header_buf_
+     * @param[in] resp response
+     */
+    void build_header(HttpResponse::ptr resp);
+
+    /**
+     * @brief prepare buffer for next request, keep unparsed bytes
+     */
+    void prepare_buffer();
+
+    /**
+     * @brief make room when buffer is full
+     * @return false if header exceed max size
+     */
+    bool make_room();
+
+private:
+    /// request parser, reset for every request
+    HttpRequestParser::ptr parser_ {};
+    /// parser is reset by wait_request already
+    bool parser_reset_ {false};
+    /// receive buffer, shared with request views
+    std::shared_ptr<char> buffer_ {};
+    /// buffer size
+    size_t buffer_size_ {4 * 1024};
+    /// begin of unparsed data
+    size_t read_pos_ {0};
+    /// end of received data
+    size_t write_pos_ {0};
+    /// max header size
+    size_t max_header_size_ {64 * 1024};
+    /// default max body size
+    uint64_t max_body_size_ {16 * 1024 * 1024};
+    /// response header block, reused by every response
+    std::string header_buf_ {};
+    /// cached server header line
+    std::string server_line_ {};
+    /// streaming writer of current response
+    HttpResponseWriter::ptr writer_ {};
+    /// response compression filter
+    CompressionFilter::ptr filter_ {};
+    /// content coding of current response
+    ContentCoding coding_ {ContentCoding::IDENTITY};
 };
 
 
 }
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,209 @@
+#include "load_shedder.h"
+#include "../log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+#include <netinet/in.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief mix bits of key, so near addresses spread over slots
+ */
+static uint64_t mix_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/**
+ * @brief hash ip of address, port is ignored
+ * @return 0 if not ip address
+ */
+static uint64_t client_key(Address::ptr addr) {
+    if (!addr)
+        return 0;
+    const sockaddr* sa = addr->get_sockaddr();
+    if (sa->sa_family == AF_INET)
+        return mix_key(((const sockaddr_in*)sa)->sin_addr.s_addr | (1ULL << 32));
+    if (sa->sa_family == AF_INET6) {
+        uint64_t parts[2];
+        memcpy(parts, &((const sockaddr_in6*)sa)->sin6_addr, sizeof(parts));
+        return mix_key(parts[0] ^ mix_key(parts[1]));
+    }
+    return 0;
+}
+
+TokenBucket::TokenBucket(double rate, uint32_t burst)
+    : interval_(rate > 0 ? (uint64_t)(1000000 / rate) : 0)
+    , tolerance_(interval_ * std::max<uint32_t>(burst, 1)) {
+}
+
+bool TokenBucket::try_acquire(std::atomic<uint64_t>& tat, uint64_t now, uint64_t interval, uint64_t tolerance) {
+    uint64_t old = tat.load(std::memory_order_relaxed);
+    do {
+        // arrival time after this token, bucket is full when it is in the past
+        uint64_t next = std::max(old, now) + interval;
+        if (next - now > tolerance)
+            return false;
+        if (tat.compare_exchange_weak(old, next, std::memory_order_relaxed))
+            return true;
+    } while (true);
+}
+
+KeyedRateLimiter::KeyedRateLimiter(double rate, uint32_t burst, size_t slots)
+    : interval_(rate > 0 ? (uint64_t)(1000000 / rate) : 0)
+    , tolerance_(interval_ * std::max<uint32_t>(burst, 1)) {
+    size_t size = 1;
+    while (size < slots)
+        size <<= 1;
+    slots_.reset(new std::atomic<uint64_t>[size]);
+    for (size_t i = 0; i < size; i++)
+        slots_[i].store(0, std::memory_order_relaxed);
+    mask_ = size - 1;
+}
+
+bool KeyedRateLimiter::try_acquire(uint64_t key, uint64_t now) {
+    return TokenBucket::try_acquire(slots_[key & mask_], now, interval_, tolerance_);
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(uint32_t initial, uint32_t min_limit, uint32_t max_limit)
+    : limit_(initial)
+    , estimated_(initial)
+    , min_limit_(min_limit)
+    , max_limit_(max_limit) {
+}
+
+bool ConcurrencyLimiter::try_acquire() {
+    uint32_t inflight = inflight_.load(std::memory_order_relaxed);
+    do {
+        if (inflight >= limit_.load(std::memory_order_relaxed))
+            return false;
+    } while (!inflight_.compare_exchange_weak(inflight, inflight + 1, std::memory_order_relaxed));
+    // record peak, tell if limit is really used
+    uint32_t peak = window_inflight_.load(std::memory_order_relaxed);
+    while (inflight + 1 > peak
+        && !window_inflight_.compare_exchange_weak(peak, inflight + 1, std::memory_order_relaxed));
+    return true;
+}
+
+void ConcurrencyLimiter::release(uint64_t latency, bool dropped) {
+    inflight_.fetch_sub(1, std::memory_order_relaxed);
+    window_sum_.fetch_add(latency, std::memory_order_relaxed);
+    if (dropped)
+        window_drops_.fetch_add(1, std::memory_order_relaxed);
+    if (window_count_.fetch_add(1, std::memory_order_relaxed) + 1 < window_size_)
+        return;
+    // one thread close window, others keep sampling into next one
+    if (updating_.exchange(true, std::memory_order_acquire))
+        return;
+    uint32_t count = window_count_.exchange(0, std::memory_order_relaxed);
+    uint64_t sum = window_sum_.exchange(0, std::memory_order_relaxed);
+    uint32_t drops = window_drops_.exchange(0, std::memory_order_relaxed);
+    uint32_t peak = window_inflight_.exchange(0, std::memory_order_relaxed);
+    if (count > 0)
+        update((double)sum / count, peak, drops);
+    updating_.store(false, std::memory_order_release);
+}
+
+void ConcurrencyLimiter::update(double latency, uint32_t max_inflight, uint32_t drops) {
+    if (latency < 1)
+        latency = 1;
+    // no load latency, creep up slowly so real slowdown is accepted in time
+    if (min_latency_ == 0 || latency < min_latency_)
+        min_latency_ = latency;
+    else
+        min_latency_ += (latency - min_latency_) * 0.01;
+    double estimated = estimated_;
+    if (drops > 0) {
+        estimated *= 0.9;
+    } else if (max_inflight * 2 >= estimated) {
+        // latency 1.5x of no load is tolerated
+        double gradient = std::max(0.5, std::min(1.0, 1.5 * min_latency_ / latency));
+        double target = estimated * gradient + std::sqrt(estimated);
+        estimated = estimated * 0.8 + target * 0.2;
+    }
+    estimated_ = std::max((double)min_limit_, std::min((double)max_limit_, estimated));
+    uint32_t limit = (uint32_t)estimated_;
+    if (limit != limit_.load(std::memory_order_relaxed)) {
+        SYLAR_FMT_DEBUG("concurrency limit changed, limit: %u, latency: %.0f, min latency: %.0f, drops: %u",
+            limit, latency, min_latency_, drops);
+        limit_.store(limit, std::memory_order_relaxed);
+    }
+}
+
+void LoadShedder::set_client_limit(double rate, uint32_t burst, size_t slots) {
+    clients_.reset(new KeyedRateLimiter(rate, burst, slots));
+}
+
+bool LoadShedder::admit(HttpRequest::ptr req, HttpResponse::ptr resp, HttpSession::ptr session,
+    TokenBucket* route, uint64_t& start) {
+    start = 0;
+    uint64_t now = LoadShedder::now();
+    if (route && !route->try_acquire(now)) {
+        route_limited_.fetch_add(1, std::memory_order_relaxed);
+        reject(resp, session, HttpStatus::TOO_MANY_REQUESTS);
+        return false;
+    }
+    if (clients_) {
+        uint64_t key = client_key(req->get_remote_addr());
+        if (key != 0 && !clients_->try_acquire(key, now)) {
+            client_limited_.fetch_add(1, std::memory_order_relaxed);
+            reject(resp, session, HttpStatus::TOO_MANY_REQUESTS);
+            return false;
+        }
+    }
+    if (limiter_ && !req->is_websocket()) {
+        if (!limiter_->try_acquire()) {
+            shed_.fetch_add(1, std::memory_order_relaxed);
+            reject(resp, session, HttpStatus::SERVICE_UNAVAILABLE);
+            return false;
+        }
+        start = now;
+    }
+    admitted_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void LoadShedder::release(uint64_t start, bool dropped) {
+    if (start == 0 || !limiter_)
+        return;
+    limiter_->release(LoadShedder::now() - start, dropped);
+}
+
+uint64_t LoadShedder::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+std::string LoadShedder::to_string() {
+    std::string out;
+    out.append("admitted ").append(std::to_string(get_admitted_count())).append("\n");
+    out.append("route_limited ").append(std::to_string(get_route_limited_count())).append("\n");
+    out.append("client_limited ").append(std::to_string(get_client_limited_count())).append("\n");
+    out.append("shed ").append(std::to_string(get_shed_count())).append("\n");
+    if (limiter_) {
+        out.append("concurrency_limit ").append(std::to_string(limiter_->get_limit())).append("\n");
+        out.append("inflight ").append(std::to_string(limiter_->get_inflight())).append("\n");
+    }
+    return out;
+}
+
+void LoadShedder::reject(HttpResponse::ptr resp, HttpSession::ptr session, HttpStatus status) {
+    resp->set_status(status);
+    resp->set_header("Retry-After", "1");
+    // body left unread cost more than a new connection
+    if (session && !session->is_body_complete())
+        resp->set_close(true);
+}
+
+}
+}
@@ -0,0 +1,287 @@
+#ifndef __SYLAR_SRC_LOAD_SHEDDER_H__
+#define __SYLAR_SRC_LOAD_SHEDDER_H__
+
+#include "http.h"
+#include "http_session.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief token bucket kept as theoretical arrival time (GCRA)
+ * @details state is one atomic word updated by CAS, never lock
+ */
+class TokenBucket {
+public:
+    /// share pointer
+    typedef std::shared_ptr<TokenBucket> ptr;
+
+    /**
+     * @brief Construct a new Token Bucket object
+     * @param[in] rate tokens per second
+     * @param[in] burst bucket size
+     */
+    TokenBucket(double rate, uint32_t burst);
+
+    /**
+     * @brief take one token
+     * @param[in] now monotonic time in us
+     * @return false if bucket is empty
+     */
+    bool try_acquire(uint64_t now) { return try_acquire(tat_, now, interval_, tolerance_); }
+
+    /**
+     * @brief take one token of bucket state
+     * @param[in] tat theoretical arrival time of bucket
+     * @param[in] now monotonic time in us
+     * @param[in] interval us per token
+     * @param[in] tolerance us of burst
+     */
+    static bool try_acquire(std::atomic<uint64_t>& tat, uint64_t now, uint64_t interval, uint64_t tolerance);
+
+private:
+    /// theoretical arrival time in us
+    std::atomic<uint64_t> tat_ {0};
+    /// us per token
+    uint64_t interval_ {0};
+    /// us of burst
+    uint64_t tolerance_ {0};
+};
+
+/**
+ * @brief token buckets of many keys, such as client ip
+ * @details buckets live in a fixed table indexed by key hash, so memory is
+ *          bounded and nothing is evicted. keys colliding in one slot share
+ *          bucket, limit is only stricter for them
+ */
+class KeyedRateLimiter {
+public:
+    /// share pointer
+    typedef std::shared_ptr<KeyedRateLimiter> ptr;
+
+    /**
+     * @brief Construct a new Keyed Rate Limiter object
+     * @param[in] rate tokens per second of every key
+     * @param[in] burst bucket size of every key
+     * @param[in] slots table size, rounded up to power of 2
+     */
+    KeyedRateLimiter(double rate, uint32_t burst, size_t slots = 16384);
+
+    /**
+     * @brief take one token of key
+     * @param[in] key hashed key
+     * @param[in] now monotonic time in us
+     */
+    bool try_acquire(uint64_t key, uint64_t now);
+
+private:
+    /// bucket slots
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_ {};
+    /// slot count - 1
+    size_t mask_ {0};
+    /// us per token
+    uint64_t interval_ {0};
+    /// us of burst
+    uint64_t tolerance_ {0};
+};
+
+/**
+ * @brief concurrency limit sized by observed latency
+ * @details latency is sampled by window. limit grow by sqrt(limit) while
+ *          window latency stay near no load latency, and shrink by
+ *          gradient no load / window when queue build up. failed requests in
+ *          window cut limit multiplicatively. limit is not grown when less
+ *          than half of it is used
+ */
+class ConcurrencyLimiter {
+public:
+    /// share pointer
+    typedef std::shared_ptr<ConcurrencyLimiter> ptr;
+
+    /**
+     * @brief Construct a new Concurrency Limiter object
+     * @param[in] initial initial limit
+     * @param[in] min_limit min limit
+     * @param[in] max_limit max limit
+     */
+    ConcurrencyLimiter(uint32_t initial = 32, uint32_t min_limit = 4, uint32_t max_limit = 1000);
+
+    /**
+     * @brief enter if below limit
+     */
+    bool try_acquire();
+
+    /**
+     * @brief leave and sample latency
+     * @param[in] latency request latency in us
+     * @param[in] dropped request failed or timeout
+     */
+    void release(uint64_t latency, bool dropped);
+
+    /**
+     * @brief Get the limit object
+     */
+    uint32_t get_limit() { return limit_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the inflight object
+     */
+    uint32_t get_inflight() { return inflight_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Set the window size object
+     * @param[in] size samples per limit update
+     */
+    void set_window_size(uint32_t size) { window_size_ = size; }
+
+private:
+    /**
+     * @brief update limit by window, only one thread at a time
+     * @param[in] latency average latency of window
+     * @param[in] max_inflight max inflight in window
+     * @param[in] drops failed requests in window
+     */
+    void update(double latency, uint32_t max_inflight, uint32_t drops);
+
+private:
+    /// current limit
+    std::atomic<uint32_t> limit_ {32};
+    /// requests in flight
+    std::atomic<uint32_t> inflight_ {0};
+    /// latency sum of window
+    std::atomic<uint64_t> window_sum_ {0};
+    /// samples of window
+    std::atomic<uint32_t> window_count_ {0};
+    /// failed requests of window
+    std::atomic<uint32_t> window_drops_ {0};
+    /// max inflight of window
+    std::atomic<uint32_t> window_inflight_ {0};
+    /// limit is being updated
+    std::atomic<bool> updating_ {false};
+    /// samples per update
+    uint32_t window_size_ {64};
+    /// limit estimation, owned by updater
+    double estimated_ {32};
+    /// no load latency estimation, owned by updater
+    double min_latency_ {0};
+    /// min limit
+    uint32_t min_limit_ {4};
+    /// max limit
+    uint32_t max_limit_ {1000};
+};
+
+/**
+ * @brief admission control around servlet dispatch
+ * @details request is checked by route bucket, client ip bucket, then
+ *          concurrency limit. rejected request get 429 or 503 without
+ *          servlet work. all parts are optional, set them before serving
+ */
+class LoadShedder {
+public:
+    /// share pointer
+    typedef std::shared_ptr<LoadShedder> ptr;
+
+    /**
+     * @brief Set the client limit object, per client ip
+     * @param[in] rate requests per second
+     * @param[in] burst burst requests
+     * @param[in] slots bucket table size
+     */
+    void set_client_limit(double rate, uint32_t burst, size_t slots = 16384);
+
+    /**
+     * @brief Set the concurrency limiter object
+     * @param[in] limiter adaptive limiter, nullptr to disable
+     */
+    void set_concurrency_limiter(ConcurrencyLimiter::ptr limiter) { limiter_ = limiter; }
+
+    /**
+     * @brief Get the concurrency limiter object
+     */
+    ConcurrencyLimiter::ptr get_concurrency_limiter() { return limiter_; }
+
+    /**
+     * @brief check request before servlet
+     * @details status is set to 429 or 503 when rejected. websocket is not
+     *          counted by concurrency limit, it live too long to sample
+     * @param[in] req http request
+     * @param[in] resp http response
+     * @param[in] session http session, nullptr for http/2 stream
+     * @param[in] route bucket of matched route, nullptr if none
+     * @param[out] start admit time passed to release, 0 if not counted
+     * @return false if rejected
+     */
+    bool admit(HttpRequest::ptr req, HttpResponse::ptr resp, HttpSession::ptr session,
+        TokenBucket* route, uint64_t& start);
+
+    /**
+     * @brief request handled
+     * @param[in] start start from admit
+     * @param[in] dropped servlet failed
+     */
+    void release(uint64_t start, bool dropped);
+
+    /**
+     * @brief monotonic time in us
+     */
+    static uint64_t now();
+
+    /**
+     * @brief Get the admitted count object
+     */
+    uint64_t get_admitted_count() { return admitted_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the route limited count object, 429 by route bucket
+     */
+    uint64_t get_route_limited_count() { return route_limited_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the client limited count object, 429 by client bucket
+     */
+    uint64_t get_client_limited_count() { return client_limited_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the shed count object, 503 by concurrency limit
+     */
+    uint64_t get_shed_count() { return shed_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief counters as "name value" lines
+     */
+    std::string to_string();
+
+private:
+    /**
+     * @brief reject request
+     * @param[in] resp http response
+     * @param[in] session http session
+     * @param[in] status 429 or 503
+     */
+    void reject(HttpResponse::ptr resp, HttpSession::ptr session, HttpStatus status);
+
+private:
+    /// per client ip buckets
+    KeyedRateLimiter::ptr clients_ {};
+    /// concurrency limiter
+    ConcurrencyLimiter::ptr limiter_ {};
+    /// admitted requests
+    std::atomic<uint64_t> admitted_ {0};
+    /// rejected by route bucket
+    std::atomic<uint64_t> route_limited_ {0};
+    /// rejected by client bucket
+    std::atomic<uint64_t> client_limited_ {0};
+    /// rejected by concurrency limit
+    std::atomic<uint64_t> shed_ {0};
+};
+
+}
+}
+
+#endif
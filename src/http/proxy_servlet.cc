@@ -0,0 +1,332 @@
+#include "proxy_servlet.h"
+#include "http_session.h"
+#include "../log.h"
+#include "../utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/uio.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief hop-by-hop header, never forwarded
+ */
+static bool is_hop_header(std::string_view name) {
+    CaseInsensitiveEqual equal;
+    return equal(name, "connection") || equal(name, "keep-alive") || equal(name, "proxy-connection")
+        || equal(name, "transfer-encoding") || equal(name, "te") || equal(name, "trailer")
+        || equal(name, "upgrade") || equal(name, "content-length") || equal(name, "expect");
+}
+
+Upstream::Upstream(const std::string& host, uint32_t port, uint32_t max_idle)
+    : name_(host + ":" + std::to_string(port))
+    , pool_(new HttpConnectionPool(host, port, max_idle, 0, 0)) {
+}
+
+HttpConnection::ptr Upstream::get_connection(uint64_t timeout) {
+    return pool_->get_connection(timeout);
+}
+
+void Upstream::on_success() {
+    if (fails_.load(std::memory_order_relaxed) != 0)
+        fails_.store(0, std::memory_order_relaxed);
+}
+
+void Upstream::on_failure() {
+    if (fails_.fetch_add(1, std::memory_order_relaxed) + 1 >= max_fails_) {
+        SYLAR_FMT_ERR("upstream is down, name: %s, fails: %u", name_.c_str(), fails_.load());
+        down_until_.store(SystemInfo::get_elapsed() + fail_timeout_, std::memory_order_relaxed);
+    }
+}
+
+void UpstreamGroup::add(Upstream::ptr upstream) {
+    MutexType::WriteLock lock(mutex_);
+    upstreams_.push_back(upstream);
+}
+
+void UpstreamGroup::remove(const std::string& name) {
+    MutexType::WriteLock lock(mutex_);
+    upstreams_.erase(std::remove_if(upstreams_.begin(), upstreams_.end(), [&name](Upstream::ptr upstream) {
+        return upstream->get_name() == name;
+    }), upstreams_.end());
+}
+
+Upstream::ptr UpstreamGroup::select(Upstream::ptr exclude) {
+    uint64_t now = SystemInfo::get_elapsed();
+    MutexType::ReadLock lock(mutex_);
+    size_t count = upstreams_.size();
+    if (count == 0)
+        return nullptr;
+    // rotate start, ties of least outstanding are spread too
+    size_t begin = next_.fetch_add(1, std::memory_order_relaxed) % count;
+    Upstream::ptr selected;
+    for (size_t i = 0; i < count; i++) {
+        auto& upstream = upstreams_[(begin + i) % count];
+        if (upstream == exclude || !upstream->is_available(now))
+            continue;
+        if (policy_ == Policy::ROUND_ROBIN)
+            return upstream;
+        if (!selected || upstream->get_outstanding() < selected->get_outstanding())
+            selected = upstream;
+    }
+    // failed one is better than nothing
+    if (!selected && exclude && exclude->is_available(now))
+        selected = exclude;
+    return selected;
+}
+
+std::vector<Upstream::ptr> UpstreamGroup::get_upstreams() {
+    MutexType::ReadLock lock(mutex_);
+    return upstreams_;
+}
+
+ProxyServlet::ProxyServlet(UpstreamGroup::ptr group)
+    : Servlet("ProxyServlet")
+    , group_(group) {
+    // body is forwarded while it is received
+    set_streaming_body(true);
+}
+
+int32_t ProxyServlet::handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+    HttpSession::ptr session) {
+    bool streaming = session && !session->is_body_complete();
+    // chunked request body is forwarded as chunked
+    int64_t length = streaming ? session->get_content_length() : (int64_t)req->get_body_view().size();
+    std::string head;
+    build_request(req, length, head);
+    // client wait for 100 before sending body
+    if (streaming && length != 0 && CaseInsensitiveEqual()(req->get_header_view("expect"), "100-continue")) {
+        static const std::string s_continue = "HTTP/1.1 100 Continue\r\n\r\n";
+        session->write_fix_size(s_continue.data(), s_continue.size());
+    }
+    bool head_only = req->get_method() == HttpMethod::HEAD;
+    HttpStatus status = HttpStatus::SERVICE_UNAVAILABLE;
+    Upstream::ptr upstream;
+    for (uint32_t attempt = 0; attempt <= retries_; attempt++) {
+        upstream = group_->select(upstream);
+        if (!upstream)
+            break;
+        upstream->begin_request();
+        auto conn = upstream->get_connection(connect_timeout_);
+        if (!conn) {
+            // nothing sent, always safe to retry
+            upstream->end_request();
+            upstream->on_failure();
+            status = HttpStatus::BAD_GATEWAY;
+            continue;
+        }
+        bool reused = conn->get_request_count() > 1;
+        conn->get_socket()->set_recv_timeout(read_timeout_);
+        conn->get_socket()->set_send_timeout(read_timeout_);
+        bool upstream_error = false;
+        if (conn->write_fix_size(head.data(), head.size()) <= 0) {
+            // pooled connection closed by upstream is not its failure
+            conn->close();
+            upstream->end_request();
+            if (!reused)
+                upstream->on_failure();
+            status = HttpStatus::BAD_GATEWAY;
+            continue;
+        }
+        if (!send_body(req, session, conn, length < 0, upstream_error)) {
+            conn->close();
+            upstream->end_request();
+            if (!upstream_error) {
+                // client is gone or sent broken body
+                resp->set_status(HttpStatus::BAD_REQUEST);
+                resp->set_close(true);
+                return -1;
+            }
+            upstream->on_failure();
+            status = HttpStatus::BAD_GATEWAY;
+            // part of body may be consumed, could not be sent again
+            if (streaming && length != 0)
+                break;
+            continue;
+        }
+        auto upstream_resp = conn->recv_response_header(head_only);
+        if (!upstream_resp) {
+            bool timeout = errno == EAGAIN || errno == EWOULDBLOCK;
+            upstream->end_request();
+            if (!reused || timeout)
+                upstream->on_failure();
+            status = timeout ? HttpStatus::GATEWAY_TIMEOUT : HttpStatus::BAD_GATEWAY;
+            // upstream may have processed it, only idempotent request is retried
+            HttpMethod method = req->get_method();
+            if ((streaming && length != 0) || timeout || (method != HttpMethod::GET
+                && method != HttpMethod::HEAD && method != HttpMethod::OPTIONS))
+                break;
+            continue;
+        }
+        int32_t rt = relay_response(req, resp, session, conn, upstream, upstream_resp);
+        upstream->end_request();
+        return rt;
+    }
+    SYLAR_FMT_ERR("proxy request failed, path: %s, status: %u",
+        std::string(req->get_path_view()).c_str(), (uint32_t)status);
+    resp->set_status(status);
+    // left body make connection unusable
+    if (streaming && !session->is_body_complete())
+        resp->set_close(true);
+    return 0;
+}
+
+void ProxyServlet::build_request(HttpRequest::ptr req, int64_t length, std::string& out) {
+    out.reserve(512);
+    out.append(http_method_to_string(req->get_method())).append(" ");
+    std::string_view path = req->get_path_view();
+    out.append(path.empty() ? "/" : path);
+    std::string_view query = req->get_query_view();
+    if (!query.empty())
+        out.append("?").append(query);
+    out.append(" HTTP/1.1\r\n");
+    CaseInsensitiveEqual equal;
+    bool has_host = false;
+    req->foreach_header([&](std::string_view name, std::string_view value) {
+        if (is_hop_header(name))
+            return;
+        if (equal(name, "host")) {
+            if (!host_.empty() || has_host)
+                return;
+            has_host = true;
+        }
+        out.append(name).append(": ").append(value).append("\r\n");
+    });
+    if (!host_.empty() || !has_host)
+        out.append("Host: ").append(host_).append("\r\n");
+    if (length < 0) {
+        out.append("Transfer-Encoding: chunked\r\n");
+    } else if (length > 0) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "Content-Length: %ld\r\n", length);
+        out.append(line, len);
+    }
+    out.append("Connection: keep-alive\r\n\r\n");
+}
+
+bool ProxyServlet::send_body(HttpRequest::ptr req, HttpSession::ptr session,
+    HttpConnection::ptr conn, bool chunked, bool& upstream_error) {
+    if (!session || session->is_body_complete()) {
+        std::string_view body = req->get_body_view();
+        if (!body.empty() && conn->write_fix_size(body.data(), body.size()) <= 0) {
+            upstream_error = true;
+            return false;
+        }
+        return true;
+    }
+    // every received chunk is written before next is read
+    int64_t rt = session->read_body([&](std::string_view chunk) {
+        if (chunk.empty())
+            return true;
+        int len = 0;
+        if (!chunked) {
+            len = conn->write_fix_size(chunk.data(), chunk.size());
+        } else {
+            char size_line[32];
+            iovec iov[3];
+            iov[0].iov_base = size_line;
+            iov[0].iov_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", chunk.size());
+            iov[1].iov_base = (void*)chunk.data();
+            iov[1].iov_len = chunk.size();
+            iov[2].iov_base = (void*)"\r\n";
+            iov[2].iov_len = 2;
+            len = conn->writev_fix_size(iov, 3);
+        }
+        if (len <= 0) {
+            upstream_error = true;
+            return false;
+        }
+        return true;
+    });
+    if (rt < 0)
+        return false;
+    if (chunked && conn->write_fix_size("0\r\n\r\n", 5) <= 0) {
+        upstream_error = true;
+        return false;
+    }
+    return true;
+}
+
+int32_t ProxyServlet::relay_response(HttpRequest::ptr req, HttpResponse::ptr resp,
+    HttpSession::ptr session, HttpConnection::ptr conn, Upstream::ptr upstream,
+    HttpResponse::ptr upstream_resp) {
+    resp->set_status(upstream_resp->get_status());
+    // repeated headers such as Set-Cookie are kept by raw lines
+    std::string block;
+    std::string_view lines(conn->get_header_block());
+    CaseInsensitiveEqual equal;
+    while (!lines.empty()) {
+        size_t end = lines.find("\r\n");
+        std::string_view line = lines.substr(0, end);
+        lines = end == std::string_view::npos ? std::string_view() : lines.substr(end + 2);
+        std::string_view name = line.substr(0, line.find(':'));
+        if (is_hop_header(name))
+            continue;
+        // session add its own unless they are set
+        if (equal(name, "date") || equal(name, "server")) {
+            resp->set_header(std::string(name), upstream_resp->get_header(std::string(name)));
+            continue;
+        }
+        block.append(line).append("\r\n");
+    }
+    if (!block.empty())
+        resp->set_header_block(std::make_shared<const std::string>(std::move(block)));
+    int64_t length = conn->get_content_length();
+    uint32_t status = (uint32_t)upstream_resp->get_status();
+    if (req->get_method() == HttpMethod::HEAD || status < 200 || status == 204 || status == 304) {
+        // length of HEAD is what GET would send
+        std::string content_length = upstream_resp->get_header("content-length");
+        if (req->get_method() == HttpMethod::HEAD && !content_length.empty())
+            resp->set_header("Content-Length", content_length);
+        upstream->on_success();
+        upstream->release(conn);
+        return 0;
+    }
+    if (!session) {
+        // http/2 stream, response is sent as a whole
+        std::string body;
+        if (conn->read_body([&body](std::string_view chunk) {
+            body.append(chunk);
+            return true;
+        }) < 0) {
+            upstream->on_failure();
+            resp->set_status(HttpStatus::BAD_GATEWAY);
+            return 0;
+        }
+        resp->set_body(body);
+        upstream->on_success();
+        upstream->release(conn);
+        return 0;
+    }
+    auto writer = session->begin_response(resp, length);
+    bool client_error = false;
+    int64_t rt = conn->read_body([&](std::string_view chunk) {
+        if (writer->write(chunk) < 0) {
+            client_error = true;
+            return false;
+        }
+        return true;
+    });
+    if (rt < 0) {
+        // header is sent, only closing tell client body is broken
+        if (!client_error)
+            upstream->on_failure();
+        SYLAR_FMT_ERR("proxy relay response failed, upstream: %s", upstream->get_name().c_str());
+        resp->set_close(true);
+        session->close();
+        return -1;
+    }
+    upstream->on_success();
+    upstream->release(conn);
+    return 0;
+}
+
+}
+}
@@ -0,0 +1,275 @@
+#ifndef __SYLAR_SRC_PROXY_SERVLET_H__
+#define __SYLAR_SRC_PROXY_SERVLET_H__
+
+#include "http_connection.h"
+#include "servlet.h"
+#include "../mutex.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief upstream server of proxy
+ * @details keep-alive connections are pooled per upstream. failures are
+ *          checked passively: after max fails in a row upstream is skipped
+ *          for fail timeout, then it get traffic again and one more
+ *          failure take it down at once
+ */
+class Upstream {
+public:
+    /// share pointer
+    typedef std::shared_ptr<Upstream> ptr;
+
+    /**
+     * @brief Construct a new Upstream object
+     * @param[in] host upstream host
+     * @param[in] port upstream port
+     * @param[in] max_idle max idle connections kept
+     */
+    Upstream(const std::string& host, uint32_t port, uint32_t max_idle = 32);
+
+    /**
+     * @brief Get the connection object
+     * @param[in] timeout connect timeout in ms
+     */
+    HttpConnection::ptr get_connection(uint64_t timeout);
+
+    /**
+     * @brief give back connection, pooled if reusable
+     * @param[in] conn connection
+     */
+    void release(HttpConnection::ptr conn) { pool_->release(conn); }
+
+    /**
+     * @brief if upstream could be selected
+     * @param[in] now elapsed time in ms
+     */
+    bool is_available(uint64_t now) { return down_until_.load(std::memory_order_relaxed) <= now; }
+
+    /**
+     * @brief request completed by upstream
+     */
+    void on_success();
+
+    /**
+     * @brief connect, send or receive failed, or timeout
+     */
+    void on_failure();
+
+    /**
+     * @brief request begin, counted until end_request
+     */
+    void begin_request() { outstanding_.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief request end
+     */
+    void end_request() { outstanding_.fetch_sub(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the outstanding object, requests in flight
+     */
+    uint32_t get_outstanding() { return outstanding_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the name object, host:port
+     */
+    const std::string& get_name() { return name_; }
+
+    /**
+     * @brief Get the pool object
+     */
+    HttpConnectionPool::ptr get_pool() { return pool_; }
+
+    /**
+     * @brief Set the max fails object
+     * @param[in] count failures in a row take upstream down
+     */
+    void set_max_fails(uint32_t count) { max_fails_ = count; }
+
+    /**
+     * @brief Set the fail timeout object
+     * @param[in] timeout down time in ms
+     */
+    void set_fail_timeout(uint64_t timeout) { fail_timeout_ = timeout; }
+
+private:
+    /// host:port
+    std::string name_ {};
+    /// keep-alive connections
+    HttpConnectionPool::ptr pool_ {};
+    /// requests in flight
+    std::atomic<uint32_t> outstanding_ {0};
+    /// failures in a row
+    std::atomic<uint32_t> fails_ {0};
+    /// skipped until, elapsed ms
+    std::atomic<uint64_t> down_until_ {0};
+    /// failures in a row take upstream down
+    uint32_t max_fails_ {3};
+    /// down time in ms
+    uint64_t fail_timeout_ {10 * 1000};
+};
+
+/**
+ * @brief upstream group, select one upstream for every request
+ */
+class UpstreamGroup {
+public:
+    /// share pointer
+    typedef std::shared_ptr<UpstreamGroup> ptr;
+    /// upstream list lock
+    typedef PerCpuRWMutex MutexType;
+
+    /**
+     * @brief balance policy
+     */
+    enum class Policy {
+        /// one by one
+        ROUND_ROBIN = 0,
+        /// fewest requests in flight
+        LEAST_OUTSTANDING = 1,
+    };
+
+    /**
+     * @brief Construct a new Upstream Group object
+     * @param[in] policy balance policy
+     */
+    UpstreamGroup(Policy policy = Policy::ROUND_ROBIN) : policy_(policy) {}
+
+    /**
+     * @brief add upstream
+     * @param[in] upstream upstream
+     */
+    void add(Upstream::ptr upstream);
+
+    /**
+     * @brief remove upstream, requests in flight go on
+     * @param[in] name host:port
+     */
+    void remove(const std::string& name);
+
+    /**
+     * @brief select upstream by policy, down upstream is skipped
+     * @param[in] exclude upstream failed last time, used only if no other
+     * @return nullptr if all upstreams are down
+     */
+    Upstream::ptr select(Upstream::ptr exclude = nullptr);
+
+    /**
+     * @brief Get the upstreams object
+     */
+    std::vector<Upstream::ptr> get_upstreams();
+
+private:
+    /// upstream list lock
+    MutexType mutex_ {};
+    /// upstreams
+    std::vector<Upstream::ptr> upstreams_ {};
+    /// balance policy
+    Policy policy_ {Policy::ROUND_ROBIN};
+    /// next round robin position
+    std::atomic<uint32_t> next_ {0};
+};
+
+/**
+ * @brief reverse proxy servlet
+ * @details request and response bodies are streamed, at most one chunk
+ *          is held in memory. a request is retried on another upstream
+ *          only when nothing of its body was consumed yet
+ */
+class ProxyServlet : public Servlet {
+public:
+    /// share pointer
+    typedef std::shared_ptr<ProxyServlet> ptr;
+
+    /**
+     * @brief Construct a new Proxy Servlet object
+     * @param[in] group upstream group
+     */
+    ProxyServlet(UpstreamGroup::ptr group);
+
+    /**
+     * @brief forward request to upstream and relay response
+     * @param[in] req http req
+     * @param[in] resp http resp
+     * @param[in] session http session, nullptr for http/2 stream
+     */
+    virtual int32_t handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+        HttpSession::ptr session) override;
+
+    /**
+     * @brief Set the connect timeout object
+     * @param[in] timeout connect timeout in ms
+     */
+    void set_connect_timeout(uint64_t timeout) { connect_timeout_ = timeout; }
+
+    /**
+     * @brief Set the read timeout object
+     * @param[in] timeout send and receive timeout in ms
+     */
+    void set_read_timeout(uint64_t timeout) { read_timeout_ = timeout; }
+
+    /**
+     * @brief Set the retries object
+     * @param[in] count retries on other upstreams
+     */
+    void set_retries(uint32_t count) { retries_ = count; }
+
+    /**
+     * @brief Set the host object
+     * @param[in] host Host header sent to upstream, empty to keep client's
+     */
+    void set_host(const std::string& host) { host_ = host; }
+
+private:
+    /**
+     * @brief serialize request header for upstream
+     * @param[in] req http req
+     * @param[in] length body length, -1 for chunked
+     * @param[out] out request header
+     */
+    void build_request(HttpRequest::ptr req, int64_t length, std::string& out);
+
+    /**
+     * @brief send request body to upstream
+     * @param[in] req http req
+     * @param[in] session http session
+     * @param[in] conn upstream connection
+     * @param[in] chunked send as chunked body
+     * @param[out] upstream_error failed by upstream, not client
+     */
+    bool send_body(HttpRequest::ptr req, HttpSession::ptr session, HttpConnection::ptr conn,
+        bool chunked, bool& upstream_error);
+
+    /**
+     * @brief relay upstream response to client
+     * @param[in] upstream_resp upstream response header
+     * @return -1 if response is broken after header sent
+     */
+    int32_t relay_response(HttpRequest::ptr req, HttpResponse::ptr resp, HttpSession::ptr session,
+        HttpConnection::ptr conn, Upstream::ptr upstream, HttpResponse::ptr upstream_resp);
+
+private:
+    /// upstream group
+    UpstreamGroup::ptr group_ {};
+    /// connect timeout in ms
+    uint64_t connect_timeout_ {1000};
+    /// send and receive timeout in ms
+    uint64_t read_timeout_ {30 * 1000};
+    /// retries on other upstreams
+    uint32_t retries_ {1};
+    /// Host header sent to upstream
+    std::string host_ {};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,173 @@
+#include "router.h"
+#include "../log.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace sylar {
+namespace http {
+
+Router::Router()
+    : root_(new Node) {
+}
+
+Router::~Router() {
+}
+
+bool Router::add(const std::string& pattern, CreatorPtr creator) {
+    Node* node = root_.get();
+    size_t pos = 0;
+    while (pos < pattern.size()) {
+        // ':' and '*' are special only at start of segment
+        bool segment_start = pos == 0 || pattern[pos - 1] == '/';
+        // param segment, capture until next '/'
+        if (segment_start && pattern[pos] == ':') {
+            size_t end = pattern.find('/', pos);
+            if (end == std::string::npos)
+                end = pattern.size();
+            std::string name = pattern.substr(pos + 1, end - pos - 1);
+            if (name.empty() || name.find_first_of(":*\\") != std::string::npos) {
+                SYLAR_FMT_ERR("router add failed, bad param name, pattern: %s", pattern.c_str());
+                return false;
+            }
+            // one position only allow one param name
+            if (!node->param_child) {
+                node->param_child.reset(new Node);
+                node->param_name = name;
+            } else if (node->param_name != name) {
+                SYLAR_FMT_ERR("router add failed, param conflict with :%s, pattern: %s",
+                    node->param_name.c_str(), pattern.c_str());
+                return false;
+            }
+            node = node->param_child.get();
+            pos = end;
+            continue;
+        }
+        // wildcard must be the last segment
+        if (segment_start && pattern[pos] == '*') {
+            std::string name = pattern.substr(pos + 1);
+            if (name.find_first_of("/:*\\") != std::string::npos) {
+                SYLAR_FMT_ERR("router add failed, wildcard must be trailing, pattern: %s", pattern.c_str());
+                return false;
+            }
+            if (!node->wildcard_creator)
+                size_++;
+            node->wildcard_name = name.empty() ? "*" : name;
+            node->wildcard_creator = creator;
+            return true;
+        }
+        // static segment, "\:" "\*" "\\" are literal, bare ':' '*' inside segment is ambiguous
+        std::string literal;
+        while (pos < pattern.size()) {
+            char c = pattern[pos];
+            if (c == '\\' && pos + 1 < pattern.size() && strchr(":*\\", pattern[pos + 1])) {
+                literal.push_back(pattern[pos + 1]);
+                pos += 2;
+                continue;
+            }
+            if (c == ':' || c == '*') {
+                if (pattern[pos - 1] == '/')
+                    break;
+                SYLAR_FMT_ERR("router add failed, '%c' inside segment, escape it as \\%c, pattern: %s",
+                    c, c, pattern.c_str());
+                return false;
+            }
+            literal.push_back(c);
+            pos++;
+        }
+        node = insert_static(node, literal);
+    }
+    if (!node->creator)
+        size_++;
+    node->creator = creator;
+    return true;
+}
+
+Router::CreatorPtr Router::match(std::string_view path, Params* params) const {
+    auto creator = match(root_.get(), path, params);
+    return creator ? *creator : nullptr;
+}
+
+Router::Node* Router::insert_static(Node* node, std::string_view str) {
+    while (!str.empty()) {
+        // try to find child has same first char
+        size_t idx = node->indices.find(str[0]);
+        if (idx == std::string::npos) {
+            Node* child = new Node;
+            child->prefix = std::string(str);
+            node->indices.push_back(str[0]);
+            node->children.emplace_back(child);
+            return child;
+        }
+        Node* child = node->children[idx].get();
+        // longest common prefix
+        size_t common = 0;
+        while (common < child->prefix.size() && common < str.size()
+            && child->prefix[common] == str[common])
+            common++;
+        // split child, common prefix become the middle node
+        if (common < child->prefix.size()) {
+            std::unique_ptr<Node> mid(new Node);
+            mid->prefix = child->prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            mid->indices.push_back(child->prefix[0]);
+            mid->children.push_back(std::move(node->children[idx]));
+            node->children[idx] = std::move(mid);
+            child = node->children[idx].get();
+        }
+        node = child;
+        str.remove_prefix(common);
+    }
+    return node;
+}
+
+const Router::CreatorPtr* Router::match(const Node* node, std::string_view path, Params* params) {
+    // path end at this node
+    if (path.empty()) {
+        if (node->creator)
+            return &node->creator;
+        // wildcard could match empty rest
+        if (node->wildcard_creator) {
+            if (params)
+                params->emplace_back(node->wildcard_name, path);
+            return &node->wildcard_creator;
+        }
+        return nullptr;
+    }
+    // static child has the highest priority
+    size_t idx = node->indices.find(path[0]);
+    if (idx != std::string::npos) {
+        const Node* child = node->children[idx].get();
+        if (path.compare(0, child->prefix.size(), child->prefix) == 0) {
+            auto found = match(child, path.substr(child->prefix.size()), params);
+            if (found)
+                return found;
+        }
+    }
+    // param child capture one segment
+    if (node->param_child) {
+        std::string_view value = path.substr(0, path.find('/'));
+        if (!value.empty()) {
+            size_t mark = params ? params->size() : 0;
+            if (params)
+                params->emplace_back(node->param_name, value);
+            auto found = match(node->param_child.get(), path.substr(value.size()), params);
+            if (found)
+                return found;
+            // backtrack
+            if (params)
+                params->resize(mark);
+        }
+    }
+    // wildcard capture the rest
+    if (node->wildcard_creator) {
+        if (params)
+            params->emplace_back(node->wildcard_name, path);
+        return &node->wildcard_creator;
+    }
+    return nullptr;
+}
+
+}
+}
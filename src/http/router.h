@@ -0,0 +1,114 @@
+#ifndef __SYLAR_SRC_ROUTER_H__
+#define __SYLAR_SRC_ROUTER_H__
+
+#include "../noncopyable.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+class IServletCreator;
+
+/**
+ * @brief compressed radix tree router
+ * @details pattern support static segment, ":name" capture one segment,
+ *          trailing "*" or "*name" capture the rest of path. ':' and '*'
+ *          are special only at start of segment, inside segment they must
+ *          be escaped as "\:" and "\*" to match literally.
+ *          match priority: static > param > wildcard.
+ *          router is immutable once built, readers share it without lock
+ */
+class Router : Noncopyable {
+public:
+    /// share pointer
+    typedef std::shared_ptr<Router> ptr;
+    /// creator pointer
+    typedef std::shared_ptr<IServletCreator> CreatorPtr;
+    /// captured params, name and value point into router and path
+    typedef std::vector<std::pair<std::string_view, std::string_view>> Params;
+
+    /**
+     * @brief Construct a new Router object
+     */
+    Router();
+
+    /**
+     * @brief Destroy the Router object
+     */
+    ~Router();
+
+    /**
+     * @brief add route, same pattern overwrite origin
+     * @param[in] pattern route pattern
+     * @param[in] creator servlet creator
+     * @return false if pattern is invalid or conflict with added one
+     */
+    bool add(const std::string& pattern, CreatorPtr creator);
+
+    /**
+     * @brief match path
+     * @param[in] path request path
+     * @param[out] params captured params, could be nullptr
+     */
+    CreatorPtr match(std::string_view path, Params* params = nullptr) const;
+
+    /**
+     * @brief Get the size object
+     */
+    size_t get_size() const { return size_; }
+
+private:
+    /**
+     * @brief tree node
+     */
+    struct Node {
+        /// compressed static prefix
+        std::string prefix {};
+        /// first char of static children
+        std::string indices {};
+        /// static children
+        std::vector<std::unique_ptr<Node>> children {};
+        /// param child
+        std::unique_ptr<Node> param_child {};
+        /// param name
+        std::string param_name {};
+        /// wildcard name
+        std::string wildcard_name {};
+        /// creator when path end at this node
+        CreatorPtr creator {};
+        /// creator when wildcard match the rest
+        CreatorPtr wildcard_creator {};
+    };
+
+    /**
+     * @brief insert static string under node
+     * @param[in] node parent node
+     * @param[in] str static string
+     * @return node where string end
+     */
+    static Node* insert_static(Node* node, std::string_view str);
+
+    /**
+     * @brief match path under node, node prefix is already consumed
+     * @param[in] node current node
+     * @param[in] path rest path
+     * @param[out] params captured params
+     */
+    static const CreatorPtr* match(const Node* node, std::string_view path, Params* params);
+
+private:
+    /// root node
+    std::unique_ptr<Node> root_ {};
+    /// route count
+    size_t size_ {0};
+};
+
+}
+}
+
+#endif
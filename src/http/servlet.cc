@@ -1,13 +1,111 @@
 #include "servlet.h"
 #include "http.h"
+#include "../epoch.h"
+#include "../log.h"
 
+#include <atomic>
 #include <cstdint>
 #include <utility>
 #include <algorithm>
+#include <iterator>
+#include <vector>
 
 namespace sylar {
 namespace http {
 
+namespace {
+
+/**
+ * @brief servlet caches of one thread, indexed by creator slot
+ */
+struct ThreadCaches {
+    ThreadCaches();
+    ~ThreadCaches();
+
+    /// hold by owner only to resize, by others to clear a dead slot
+    Spinlock mutex {};
+    /// caches of each slot
+    std::vector<std::vector<Servlet::ptr>> caches {};
+};
+
+/**
+ * @brief slots and thread caches of all creators, never freed
+ */
+struct CacheRegistry {
+    /// mutex, taken before thread cache mutex
+    Mutex mutex {};
+    /// caches of living threads
+    std::vector<ThreadCaches*> threads {};
+    /// slots of destroyed creators
+    std::vector<size_t> free_slots {};
+    /// next new slot
+    size_t next_slot {0};
+};
+
+CacheRegistry* get_registry() {
+    static CacheRegistry* s_registry = new CacheRegistry;
+    return s_registry;
+}
+
+ThreadCaches::ThreadCaches() {
+    CacheRegistry* registry = get_registry();
+    Mutex::Lock lock(registry->mutex);
+    registry->threads.push_back(this);
+}
+
+ThreadCaches::~ThreadCaches() {
+    CacheRegistry* registry = get_registry();
+    Mutex::Lock lock(registry->mutex);
+    auto& threads = registry->threads;
+    threads.erase(std::find(threads.begin(), threads.end(), this));
+}
+
+}
+
+Servlet::~Servlet() {
+}
+
+IServletCreator::IServletCreator() {
+    CacheRegistry* registry = get_registry();
+    Mutex::Lock lock(registry->mutex);
+    if (registry->free_slots.empty()) {
+        slot_ = registry->next_slot++;
+    } else {
+        slot_ = registry->free_slots.back();
+        registry->free_slots.pop_back();
+    }
+}
+
+IServletCreator::~IServletCreator() {
+    // servlets are destroyed after locks are released
+    std::vector<Servlet::ptr> dropped;
+    CacheRegistry* registry = get_registry();
+    Mutex::Lock lock(registry->mutex);
+    // nobody use this creator now, its slot is only touched here
+    for (auto thread : registry->threads) {
+        Spinlock::Lock cache_lock(thread->mutex);
+        if (slot_ >= thread->caches.size())
+            continue;
+        auto& cache = thread->caches[slot_];
+        std::move(cache.begin(), cache.end(), std::back_inserter(dropped));
+        cache.clear();
+    }
+    registry->free_slots.push_back(slot_);
+}
+
+std::vector<Servlet::ptr>& IServletCreator::get_thread_cache() const {
+    // every creator own one slot in thread caches
+    static thread_local ThreadCaches t_caches;
+    if (slot_ >= t_caches.caches.size()) {
+        Spinlock::Lock lock(t_caches.mutex);
+        t_caches.caches.resize(slot_ + 1);
+    }
+    auto& cache = t_caches.caches[slot_];
+    if (cache.capacity() < s_thread_cache_size)
+        cache.reserve(s_thread_cache_size);
+    return cache;
+}
+
 FunctionServlet::FunctionServlet(callback cb) 
     : Servlet("FunctionServlet")
     , cb_(cb) {}
@@ -19,75 +117,156 @@ int32_t FunctionServlet::handle(HttpRequest::ptr req, HttpResponse::ptr resp,
 
 
 ServletDispatch::ServletDispatch()
-    : Servlet("ServletDispatch") {
+    : Servlet("ServletDispatch")
+    , router_(new Router) {
     default_servlet_.reset(new NotFoundServlet("sylar/1.0"));
 }
 
+ServletDispatch::~ServletDispatch() {
+    delete router_.load();
+}
+
 int32_t ServletDispatch::handle(HttpRequest::ptr req, HttpResponse::ptr resp, 
     HttpSession::ptr session) {
-    // get servlet
-    auto servlet = get_matched_servlet(req->get_path());
-    if (servlet) 
-        return servlet->handle(req, resp, session);
-    return -1;
+    // get servlet creator
+    IServletCreator::ptr creator;
+    {
+        // param names point into router, keep it until they are copied
+        EpochGuard guard;
+        Router::Params params;
+        creator = get_matched_creator(req->get_path_view(), &params);
+        // export route params
+        for (auto& param : params) 
+            req->set_route_param(std::string(param.first), std::string(param.second));
+    }
+    if (!creator && !default_servlet_)
+        return -1;
+    if (!shedder_)
+        return dispatch(req, resp, session, creator);
+    // rejected before body is read and servlet run
+    uint64_t start = 0;
+    if (!shedder_->admit(req, resp, session, creator ? creator->get_rate_limit() : nullptr, start))
+        return 0;
+    int32_t ret = dispatch(req, resp, session, creator);
+    shedder_->release(start, ret < 0 || resp->get_status() >= HttpStatus::INTERNAL_SERVER_ERROR);
+    return ret;
+}
+
+int32_t ServletDispatch::dispatch(HttpRequest::ptr req, HttpResponse::ptr resp, 
+    HttpSession::ptr session, IServletCreator::ptr creator) {
+    if (creator) {
+        creator->add_request_count();
+        if (!prepare_body(req, resp, session, creator->is_streaming_body(), creator->get_max_body_size()))
+            return -1;
+        auto servlet = creator->get();
+        int32_t ret = servlet->handle(req, resp, session);
+        // give back for reuse
+        creator->release(servlet);
+        return ret;
+    }
+    if (!prepare_body(req, resp, session, default_servlet_->is_streaming_body(), 
+        default_servlet_->get_max_body_size()))
+        return -1;
+    return default_servlet_->handle(req, resp, session);
 }
 
-void ServletDispatch::add_servlet(const std::string& uri, Servlet::ptr slt) {
-    add_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(slt)));
+bool ServletDispatch::prepare_body(HttpRequest::ptr req, HttpResponse::ptr resp, 
+    HttpSession::ptr session, bool streaming, uint64_t max_body_size) {
+    // body already received
+    if (!session || session->is_body_complete())
+        return true;
+    // declared length too large, reply before body is read
+    if (!session->set_body_limit(max_body_size)) {
+        resp->set_status(HttpStatus::PAYLOAD_TOO_LARGE);
+        resp->set_close(true);
+        return false;
+    }
+    if (streaming || session->recv_body(req))
+        return true;
+    resp->set_status(session->is_body_too_large() ? HttpStatus::PAYLOAD_TOO_LARGE : HttpStatus::BAD_REQUEST);
+    resp->set_close(true);
+    return false;
 }
 
-void ServletDispatch::add_servlet(const std::string& uri, FunctionServlet::callback cb) {
+bool ServletDispatch::add_servlet(const std::string& uri, Servlet::ptr slt) {
+    return add_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(slt)));
+}
+
+bool ServletDispatch::add_servlet(const std::string& uri, FunctionServlet::callback cb) {
     FunctionServlet::ptr func_servlet(new FunctionServlet(cb));
-    add_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(func_servlet)));
+    return add_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(func_servlet)));
 }
 
-void ServletDispatch::add_global_servlet(const std::string& uri, Servlet::ptr slt) {
+bool ServletDispatch::add_global_servlet(const std::string& uri, Servlet::ptr slt) {
+    return add_global_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(slt)));
+}
+
+bool ServletDispatch::add_global_servlet(const std::string& uri, FunctionServlet::callback cb) {
+    FunctionServlet::ptr func_servlet(new FunctionServlet(cb));
+    return add_global_servlet_creator(uri, HoldServletCreator::ptr(new HoldServletCreator(func_servlet)));
+}
+
+bool ServletDispatch::add_servlet_creator(const std::string& uri, IServletCreator::ptr creator) {
     MutexType::WriteLock lock(mutex_);
-    // try to find the pos
-    auto pos = std::find_if(global_creators_.cbegin(), global_creators_.cend(), 
-        [&uri](const auto& elem) {
-        if (uri == elem.first) 
-            return true;
-        return false;
-    });
-    // remove old creator
-    if (pos != global_creators_.cend()) 
-        global_creators_.erase(pos);
-    // append to vec end
-    global_creators_.push_back(std::make_pair(uri, HoldServletCreator::ptr(new HoldServletCreator(slt))));
+    auto pos = creators_.find(uri);
+    IServletCreator::ptr old = pos == creators_.end() ? nullptr : pos->second;
+    creators_[uri] = creator;
+    if (rebuild_router())
+        return true;
+    // rejected by router, restore origin
+    if (old)
+        creators_[uri] = old;
+    else
+        creators_.erase(uri);
+    return false;
 }
 
-void ServletDispatch::add_global_servlet(const std::string& uri, FunctionServlet::callback cb) {
+bool ServletDispatch::add_global_servlet_creator(const std::string& uri, IServletCreator::ptr creator) {
     MutexType::WriteLock lock(mutex_);
     // try to find the pos
-    auto pos = std::find_if(global_creators_.cbegin(), global_creators_.cend(), 
+    auto pos = std::find_if(global_creators_.begin(), global_creators_.end(),
         [&uri](const auto& elem) {
-        if (uri == elem.first) 
+        if (uri == elem.first)
             return true;
         return false;
     });
-    // remove old creator
-    if (pos != global_creators_.cend()) 
-        global_creators_.erase(pos);
-    // func servlet
-    FunctionServlet::ptr func_servlet(new FunctionServlet(cb));
-    global_creators_.push_back(std::make_pair(uri, HoldServletCreator::ptr(new HoldServletCreator(func_servlet))));
-}
-
-void ServletDispatch::add_servlet_creator(const std::string& uri, IServletCreator::ptr creator) {
-    MutexType::WriteLock lock(mutex_);
-    creators_.emplace(uri, creator);
+    // replace old creator in place, otherwise append to vec end
+    if (pos != global_creators_.end()) {
+        IServletCreator::ptr old = pos->second;
+        pos->second = creator;
+        if (rebuild_router())
+            return true;
+        pos->second = old;
+        return false;
+    }
+    global_creators_.push_back(std::make_pair(uri, creator));
+    if (rebuild_router())
+        return true;
+    global_creators_.pop_back();
+    return false;
 }
 
-void ServletDispatch::add_global_servlet_creator(const std::string& uri, IServletCreator::ptr creator) {
-    // push back
+bool ServletDispatch::set_route_limit(const std::string& uri, double rate, uint32_t burst) {
     MutexType::WriteLock lock(mutex_);
-    global_creators_.push_back(std::make_pair(uri, creator));
+    TokenBucket::ptr bucket(new TokenBucket(rate, burst));
+    auto it = creators_.find(uri);
+    if (it != creators_.end()) {
+        it->second->set_rate_limit(bucket);
+        return true;
+    }
+    for (auto& global : global_creators_) {
+        if (global.first == uri) {
+            global.second->set_rate_limit(bucket);
+            return true;
+        }
+    }
+    return false;
 }
 
 void ServletDispatch::del_servlet(const std::string &uri) {
     MutexType::WriteLock lock(mutex_);
     creators_.erase(uri);
+    rebuild_router();
 }
 
 void ServletDispatch::del_global_servlet(const std::string &uri) {
@@ -99,6 +278,7 @@ void ServletDispatch::del_global_servlet(const std::string &uri) {
     });
     // remove
     global_creators_.erase(pos, global_creators_.end());
+    rebuild_router();
 }
 
 Servlet::ptr ServletDispatch::get_servlet(const std::string &uri) {
@@ -124,8 +304,48 @@ Servlet::ptr ServletDispatch::get_global_servlet(const std::string &uri) {
 }
 
 Servlet::ptr ServletDispatch::get_matched_servlet(const std::string &uri) {
-    auto servlet = get_servlet(uri);
-    return servlet != nullptr ? servlet : get_global_servlet(uri);
+    auto creator = get_matched_creator(uri, nullptr);
+    return creator ? creator->get() : nullptr;
+}
+
+IServletCreator::ptr ServletDispatch::get_matched_creator(std::string_view uri, Router::Params* params) {
+    // lock free, params point into router, copy them inside guard
+    EpochGuard guard;
+    return router_.load(std::memory_order_acquire)->match(uri, params);
+}
+
+std::map<std::string, uint64_t> ServletDispatch::get_request_counts() {
+    std::map<std::string, uint64_t> counts;
+    MutexType::ReadLock lock(mutex_);
+    for (auto& item : global_creators_)
+        counts[item.first] = item.second->get_request_count();
+    for (auto& item : creators_)
+        counts[item.first] = item.second->get_request_count();
+    return counts;
+}
+
+bool ServletDispatch::rebuild_router() {
+    Router* router = new Router;
+    // global servlet first, servlet with same uri has higher priority
+    const std::string* rejected = nullptr;
+    for (auto& item : global_creators_) {
+        if (!rejected && !router->add(item.first, item.second))
+            rejected = &item.first;
+    }
+    for (auto& item : creators_) {
+        if (!rejected && !router->add(item.first, item.second))
+            rejected = &item.first;
+    }
+    if (rejected) {
+        // keep serving the published snapshot
+        SYLAR_FMT_ERR("servlet dispatch route rejected, pattern: %s", rejected->c_str());
+        delete router;
+        return false;
+    }
+    // publish new snapshot, old one freed after readers left it
+    Epoch::retire(router_.exchange(router, std::memory_order_acq_rel));
+    SYLAR_FMT_DEBUG("servlet dispatch router rebuilt, routes: %lu", router->get_size());
+    return true;
 }
 
 NotFoundServlet::NotFoundServlet(const std::string& name) 
@@ -3,9 +3,13 @@
 
 #include "http.h"
 #include "http_session.h"
+#include "load_shedder.h"
+#include "router.h"
 #include "../mutex.h"
 
+#include <atomic>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 #include <functional>
@@ -46,9 +50,37 @@ public:
      */
     const std::string get_name() { return name_; }
 
+    /**
+     * @brief if servlet read request body by itself
+     * @details body is not received before handle, servlet should call
+     *          HttpSession::read_body, unread body is discarded
+     */
+    bool is_streaming_body() const { return streaming_body_; }
+
+    /**
+     * @brief Set the streaming body object, set before servlet is added
+     * @param[in] streaming read body in handle
+     */
+    void set_streaming_body(bool streaming) { streaming_body_ = streaming; }
+
+    /**
+     * @brief Get the max body size object
+     */
+    uint64_t get_max_body_size() const { return max_body_size_; }
+
+    /**
+     * @brief Set the max body size object, set before servlet is added
+     * @param[in] size max body size, 0 means session default
+     */
+    void set_max_body_size(uint64_t size) { max_body_size_ = size; }
+
 protected:
     /// servlet name
     std::string name_ {""};
+    /// read body in handle
+    bool streaming_body_ {false};
+    /// max body size, 0 means session default
+    uint64_t max_body_size_ {0};
 };
 
 class FunctionServlet : public Servlet {
@@ -78,6 +110,23 @@ public:
     /// share pointer
     typedef std::shared_ptr<IServletCreator> ptr;
 
+    /**
+     * @brief servlet lifecycle
+     */
+    enum class Lifecycle {
+        /// one instance shared by all request
+        SINGLETON = 0,
+        /// one instance per thread
+        THREAD = 1,
+        /// instances reused through pool, idle instances limited by cap
+        POOL = 2,
+    };
+
+    /**
+     * @brief Construct a new I Servlet Creator object
+     */
+    IServletCreator();
+
     /**
      * @brief Destroy the virtual I Servlet Creator object
      */
@@ -88,10 +137,81 @@ public:
      */
     virtual Servlet::ptr get() const = 0;
 
+    /**
+     * @brief give back servlet after request handled
+     * @param[in] slt servlet from get
+     */
+    virtual void release(Servlet::ptr slt) const {}
+
     /**
      * @brief Get the name object
      */
     virtual std::string get_name() const = 0;
+
+    /**
+     * @brief add request count
+     */
+    void add_request_count() const { count_.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the request count object
+     */
+    uint64_t get_request_count() const { return count_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief if servlet read request body by itself
+     */
+    bool is_streaming_body() const { return streaming_body_; }
+
+    /**
+     * @brief Get the max body size object, 0 means session default
+     */
+    uint64_t get_max_body_size() const { return max_body_size_; }
+
+    /**
+     * @brief Get the rate limit object, nullptr if route is not limited
+     */
+    TokenBucket* get_rate_limit() const { return rate_limit_.get(); }
+
+    /**
+     * @brief Set the rate limit object, set before serving
+     * @param[in] bucket route bucket shared by all requests of route
+     */
+    void set_rate_limit(TokenBucket::ptr bucket) { rate_limit_ = bucket; }
+
+protected:
+    /**
+     * @brief take body policy from servlet, all instances share it
+     * @param[in] slt servlet
+     */
+    void set_body_policy(const Servlet::ptr& slt) {
+        streaming_body_ = slt->is_streaming_body();
+        max_body_size_ = slt->get_max_body_size();
+    }
+
+    /**
+     * @brief Get the thread cache object of this creator
+     * @details slot is reused after creator is destroyed, servlets cached
+     *          in every thread are dropped then
+     * @note capacity is reserved on first use, push and pop never allocate
+     */
+    std::vector<Servlet::ptr>& get_thread_cache() const;
+
+protected:
+    /// max idle servlet cached by each thread
+    static const size_t s_thread_cache_size = 4;
+
+private:
+    /// thread cache slot
+    size_t slot_ {0};
+    /// request count
+    mutable std::atomic<uint64_t> count_ {0};
+    /// read body in handle
+    bool streaming_body_ {false};
+    /// max body size
+    uint64_t max_body_size_ {0};
+    /// route bucket
+    TokenBucket::ptr rate_limit_ {};
 };
 
 class HoldServletCreator : public IServletCreator {
@@ -100,7 +220,7 @@ public:
      * @brief Construct a new Hold Servlet Creator object
      * @param[in] slt servlet
      */
-    HoldServletCreator(Servlet::ptr slt): servlet_(slt) {}
+    HoldServletCreator(Servlet::ptr slt): servlet_(slt) { set_body_policy(slt); }
 
     Servlet::ptr get() const override {
         return servlet_;
@@ -119,29 +239,131 @@ template<typename T>
 class ServletCreator : public IServletCreator {
 public:
     /// share pointer
-    typedef std::shared_ptr<Servlet> ptr;
+    typedef std::shared_ptr<ServletCreator> ptr;
+    /// mutex
+    typedef Mutex MutexType;
 
     /**
      * @brief Construct a new Servlet Creator object
+     * @param[in] lifecycle servlet lifecycle
+     * @param[in] pool_cap max idle servlet kept by pool
      */
-    ServletCreator() {}
+    ServletCreator(Lifecycle lifecycle = Lifecycle::SINGLETON, size_t pool_cap = 16)
+        : lifecycle_(lifecycle)
+        , pool_cap_(pool_cap) {
+        // first instance provide name, thread instances are created on first get
+        Servlet::ptr slt(new T);
+        name_ = slt->get_name();
+        set_body_policy(slt);
+        switch (lifecycle_) {
+        case Lifecycle::SINGLETON:
+            servlet_ = slt;
+            break;
+        case Lifecycle::THREAD:
+            break;
+        case Lifecycle::POOL:
+            // shared pool, any thread could take it
+            pool_.reserve(pool_cap_);
+            if (pool_cap_ > 0) {
+                pool_.push_back(slt);
+                idle_.store(1, std::memory_order_relaxed);
+            }
+            break;
+        }
+    }
 
     virtual Servlet::ptr get() const override {
-        return Servlet::ptr(new T);
+        switch (lifecycle_) {
+        case Lifecycle::SINGLETON:
+            return servlet_;
+        case Lifecycle::THREAD: {
+            // create once for every thread
+            auto& cache = get_thread_cache();
+            if (cache.empty())
+                cache.push_back(Servlet::ptr(new T));
+            return cache.front();
+        }
+        case Lifecycle::POOL:
+            return acquire();
+        }
+        return nullptr;
+    }
+
+    virtual void release(Servlet::ptr slt) const override {
+        if (lifecycle_ != Lifecycle::POOL || !slt)
+            return;
+        // pool is full, drop servlet
+        if (idle_.fetch_add(1, std::memory_order_relaxed) >= pool_cap_) {
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        // thread cache first
+        auto& cache = get_thread_cache();
+        if (cache.size() < s_thread_cache_size) {
+            cache.push_back(slt);
+            return;
+        }
+        MutexType::Lock lock(mutex_);
+        pool_.push_back(slt);
     }
 
     virtual std::string get_name() const override {
-        T t;
-        return t.get_name();
+        return name_;
+    }
+
+private:
+    /**
+     * @brief get servlet from thread cache or pool, create if both empty
+     */
+    Servlet::ptr acquire() const {
+        Servlet::ptr slt;
+        auto& cache = get_thread_cache();
+        if (!cache.empty()) {
+            slt = cache.back();
+            cache.pop_back();
+        } else {
+            MutexType::Lock lock(mutex_);
+            if (!pool_.empty()) {
+                slt = pool_.back();
+                pool_.pop_back();
+            }
+        }
+        if (slt) {
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            return slt;
+        }
+        return Servlet::ptr(new T);
     }
+
+private:
+    /// lifecycle
+    Lifecycle lifecycle_ {Lifecycle::SINGLETON};
+    /// servlet name
+    std::string name_ {""};
+    /// singleton servlet
+    Servlet::ptr servlet_ {};
+    /// max idle servlet
+    size_t pool_cap_ {0};
+    /// idle servlet count, include thread cache
+    mutable std::atomic<size_t> idle_ {0};
+    /// pool mutex
+    mutable MutexType mutex_ {};
+    /// shared idle servlet
+    mutable std::vector<Servlet::ptr> pool_ {};
 };
 
+/**
+ * @brief servlet dispatch
+ * @details servlet uri and global uri are compiled into radix tree router,
+ *          router is rebuilt when servlet changed and swapped atomically,
+ *          so dispatch never take lock
+ */
 class ServletDispatch : public Servlet {
 public:
     // share pointer
     typedef std::shared_ptr<ServletDispatch> ptr;
-    /// mutex
-    typedef RWMutex MutexType;
+    /// mutex, only protect writer
+    typedef PerCpuRWMutex MutexType;
 
     /**
      * @brief Construct a new Servlet Dispatch object
@@ -149,6 +371,11 @@ public:
      */
     ServletDispatch();
 
+    /**
+     * @brief Destroy the Servlet Dispatch object
+     */
+    ~ServletDispatch();
+
     /**
      * @brief handle http 
      * @param[in] req http request
@@ -162,52 +389,76 @@ public:
      * @brief add servlet
      * @param[in] uri uri 
      * @param[in] slt servlet
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_servlet(const std::string& uri, Servlet::ptr slt);
+    bool add_servlet(const std::string& uri, Servlet::ptr slt);
 
     /**
      * @brief add servlet 
      * @param[in] uri uri 
      * @param[in] cb callback
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_servlet(const std::string& uri, FunctionServlet::callback cb);
+    bool add_servlet(const std::string& uri, FunctionServlet::callback cb);
 
     /**
      * @brief add global servlet
      * @param[in] uri uri 
      * @param[in] slt servlet
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_global_servlet(const std::string& uri, Servlet::ptr slt);
+    bool add_global_servlet(const std::string& uri, Servlet::ptr slt);
 
     /**
      * @brief add servlet 
      * @param[in] uri uri 
      * @param[in] cb callback
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_global_servlet(const std::string& uri, FunctionServlet::callback cb);
+    bool add_global_servlet(const std::string& uri, FunctionServlet::callback cb);
 
     /**
      * @brief add servlet creator
      * @param[in] uri uri 
      * @param[in] creator creator
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_servlet_creator(const std::string& uri, IServletCreator::ptr creator);
+    bool add_servlet_creator(const std::string& uri, IServletCreator::ptr creator);
 
     /**
      * @brief add servlet creator
      * @param[in] uri uri 
      * @param[in] creator creator
+     * @return false if uri pattern is invalid or conflict, nothing changed
      */
-    void add_global_servlet_creator(const std::string& uri, IServletCreator::ptr creator);
+    bool add_global_servlet_creator(const std::string& uri, IServletCreator::ptr creator);
 
+    /**
+     * @brief add servlet creator
+     * @tparam T servlet type
+     * @param[in] uri uri
+     * @param[in] lifecycle servlet lifecycle
+     * @param[in] pool_cap max idle servlet when use pool
+     * @return false if uri pattern is invalid or conflict, nothing changed
+     */
     template<typename T> 
-    void add_servlet_creator(const std::string& uri) {
-        add_servlet_creator(uri, ServletCreator<T>::ptr(new T));
+    bool add_servlet_creator(const std::string& uri, 
+        IServletCreator::Lifecycle lifecycle = IServletCreator::Lifecycle::SINGLETON, size_t pool_cap = 16) {
+        return add_servlet_creator(uri, IServletCreator::ptr(new ServletCreator<T>(lifecycle, pool_cap)));
     }
 
+    /**
+     * @brief add global servlet creator
+     * @tparam T servlet type
+     * @param[in] uri uri
+     * @param[in] lifecycle servlet lifecycle
+     * @param[in] pool_cap max idle servlet when use pool
+     * @return false if uri pattern is invalid or conflict, nothing changed
+     */
     template<typename T>
-    void add_global_servlet_creator(const std::string& uri) {
-        add_global_servlet_creator(uri, ServletCreator<T>::ptr(new T));
+    bool add_global_servlet_creator(const std::string& uri,
+        IServletCreator::Lifecycle lifecycle = IServletCreator::Lifecycle::SINGLETON, size_t pool_cap = 16) {
+        return add_global_servlet_creator(uri, IServletCreator::ptr(new ServletCreator<T>(lifecycle, pool_cap)));
     }
 
     /**
@@ -233,6 +484,26 @@ public:
      */
     void set_default(Servlet::ptr slv) { default_servlet_ = slv; }
 
+    /**
+     * @brief Set the load shedder object, set before serving
+     * @param[in] shedder admission control, nullptr to disable
+     */
+    void set_load_shedder(LoadShedder::ptr shedder) { shedder_ = shedder; }
+
+    /**
+     * @brief Get the load shedder object
+     */
+    LoadShedder::ptr get_load_shedder() { return shedder_; }
+
+    /**
+     * @brief limit requests of route, checked only with load shedder
+     * @param[in] uri uri servlet added with
+     * @param[in] rate requests per second
+     * @param[in] burst burst requests
+     * @return false if route not found
+     */
+    bool set_route_limit(const std::string& uri, double rate, uint32_t burst);
+
 public:
     /**
      * @brief Get the servlet object
@@ -252,15 +523,60 @@ public:
      */
     Servlet::ptr get_matched_servlet(const std::string& uri);
 
+    /**
+     * @brief Get the matched creator object
+     * @param[in] uri uri
+     * @param[out] params captured route params
+     */
+    IServletCreator::ptr get_matched_creator(std::string_view uri, Router::Params* params);
+
+    /**
+     * @brief Get the request count of every route
+     */
+    std::map<std::string, uint64_t> get_request_counts();
+
+private:
+    /**
+     * @brief rebuild router from creators and publish, must hold write lock
+     * @return false if some pattern rejected, old router kept
+     */
+    bool rebuild_router();
+
+    /**
+     * @brief apply body limit and receive body unless servlet stream it
+     * @details status is set to 413 or 400 when failed
+     * @param[in] req http request
+     * @param[in] resp http response
+     * @param[in] session http session
+     * @param[in] streaming servlet read body by itself
+     * @param[in] max_body_size max body size, 0 means session default
+     */
+    bool prepare_body(HttpRequest::ptr req, HttpResponse::ptr resp, 
+        HttpSession::ptr session, bool streaming, uint64_t max_body_size);
+
+    /**
+     * @brief receive body and run matched servlet
+     * @param[in] req http request
+     * @param[in] resp http response
+     * @param[in] session http session
+     * @param[in] creator matched creator, nullptr to use default servlet
+     */
+    int32_t dispatch(HttpRequest::ptr req, HttpResponse::ptr resp, 
+        HttpSession::ptr session, IServletCreator::ptr creator);
+
 private:
     /// read write lock
     MutexType mutex_ {};
+    /// router snapshot, replaced one is freed by epoch reclamation
+    std::atomic<Router*> router_ {nullptr};
     /// creator map
     std::unordered_map<std::string, IServletCreator::ptr> creators_ {};
     /// global creator map
     std::vector<std::pair<std::string, IServletCreator::ptr>> global_creators_ {};
     /// default servlet
     Servlet::ptr default_servlet_ {};
+    /// admission control
+    LoadShedder::ptr shedder_ {};
 };
 
 class NotFoundServlet : public Servlet {
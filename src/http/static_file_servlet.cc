@@ -0,0 +1,310 @@
+#include "static_file_servlet.h"
+#include "compression.h"
+#include "../log.h"
+#include "../utils.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief if decoded path try to leave root
+ */
+static bool is_unsafe_path(std::string_view path) {
+    if (path.find('\0') != std::string_view::npos)
+        return true;
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string_view::npos)
+            end = path.size();
+        if (path.substr(pos, end - pos) == "..")
+            return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+StaticFileServlet::FileInfo::~FileInfo() {
+    if (fd != -1)
+        ::close(fd);
+}
+
+StaticFileServlet::StaticFileServlet(const std::string& root, const std::string& prefix, uint64_t ttl)
+    : Servlet("StaticFileServlet")
+    , root_(root)
+    , prefix_(prefix)
+    , ttl_(ttl) {
+    // path always begin with '/'
+    while (!root_.empty() && root_.back() == '/')
+        root_.pop_back();
+}
+
+int32_t StaticFileServlet::handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+    HttpSession::ptr session) {
+    bool head = req->get_method() == HttpMethod::HEAD;
+    if (!head && req->get_method() != HttpMethod::GET) {
+        resp->set_status(HttpStatus::METHOD_NOT_ALLOWED);
+        resp->set_header("Allow", "GET, HEAD");
+        return 0;
+    }
+    // strip uri prefix
+    std::string_view uri = req->get_path_view();
+    if (uri.compare(0, prefix_.size(), prefix_) == 0)
+        uri.remove_prefix(prefix_.size());
+    std::string path = StringUtils::url_decode(std::string(uri), false);
+    if (is_unsafe_path(path)) {
+        resp->set_status(HttpStatus::FORBIDDEN);
+        return 0;
+    }
+    if (path.empty() || path[0] != '/')
+        path.insert(0, "/");
+    if (path.back() == '/')
+        path.append("index.html");
+    auto file = get_file(root_ + path);
+    if (!file) {
+        resp->set_status(HttpStatus::NOT_FOUND);
+        return 0;
+    }
+    resp->set_header("Content-Type", *file->mime);
+    // precompressed sibling is served as gzip encoded body
+    if (CompressionFilter::is_compressible_mime(*file->mime)) {
+        resp->set_header("Vary", "Accept-Encoding");
+        if (CompressionFilter::is_accepted(req, ContentCoding::GZIP)) {
+            auto gz = get_file(root_ + path + ".gz");
+            if (gz && gz->mtime >= file->mtime) {
+                file = gz;
+                resp->set_header("Content-Encoding", "gzip");
+            }
+        }
+    }
+    resp->set_header("Last-Modified", file->last_modified);
+    resp->set_header("ETag", file->etag);
+    resp->set_header("Accept-Ranges", "bytes");
+    if (is_not_modified(req, file)) {
+        resp->set_status(HttpStatus::NOT_MODIFIED);
+        return 0;
+    }
+    // range request
+    uint64_t begin = 0;
+    uint64_t end = file->size ? file->size - 1 : 0;
+    std::string_view range = req->get_header_view("range");
+    int rt = range.empty() ? 0 : parse_range(range, file->size, begin, end);
+    if (rt < 0) {
+        resp->set_status(HttpStatus::RANGE_NOT_SATISFIABLE);
+        resp->set_header("Content-Range", "bytes */" + std::to_string(file->size));
+        return 0;
+    }
+    uint64_t length = file->size ? end - begin + 1 : 0;
+    if (rt > 0) {
+        char content_range[96];
+        snprintf(content_range, sizeof(content_range), "bytes %lu-%lu/%lu", begin, end, file->size);
+        resp->set_status(HttpStatus::PARTIAL_CONTENT);
+        resp->set_header("Content-Range", content_range);
+    }
+    // header only
+    if (head) {
+        resp->set_header("Content-Length", std::to_string(length));
+        return 0;
+    }
+    // no connection to sendfile to, such as http/2 stream, read into body
+    if (!session) {
+        std::string body(length, '\0');
+        for (uint64_t offset = 0; offset < length; ) {
+            ssize_t n = pread(file->fd, &body[offset], length - offset, begin + offset);
+            if (n <= 0) {
+                SYLAR_FMT_ERR("read file failed, path: %s", path.c_str());
+                return -1;
+            }
+            offset += n;
+        }
+        resp->set_body(body);
+        return 0;
+    }
+    auto writer = session->begin_response(resp, length);
+    if (writer->send_file(file->fd, begin, length) < 0 && length > 0) {
+        SYLAR_FMT_ERR("send file failed, path: %s", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+size_t StaticFileServlet::get_cached_count() {
+    MutexType::ReadLock lock(mutex_);
+    return files_.size();
+}
+
+const std::string& StaticFileServlet::get_mime_type(std::string_view path) {
+    // build once, extension is lower case
+    static const std::unordered_map<std::string_view, std::string> s_mime_types = {
+        {"html", "text/html; charset=utf-8"},
+        {"htm", "text/html; charset=utf-8"},
+        {"css", "text/css; charset=utf-8"},
+        {"js", "application/javascript; charset=utf-8"},
+        {"json", "application/json"},
+        {"xml", "application/xml"},
+        {"txt", "text/plain; charset=utf-8"},
+        {"md", "text/markdown; charset=utf-8"},
+        {"csv", "text/csv"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"svg", "image/svg+xml"},
+        {"ico", "image/x-icon"},
+        {"webp", "image/webp"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"ttf", "font/ttf"},
+        {"mp3", "audio/mpeg"},
+        {"mp4", "video/mp4"},
+        {"webm", "video/webm"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"zip", "application/zip"},
+        {"gz", "application/gzip"},
+        {"tar", "application/x-tar"},
+    };
+    static const std::string s_default = "application/octet-stream";
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash))
+        return s_default;
+    std::string_view ext = path.substr(dot + 1);
+    char lower[16];
+    if (ext.size() >= sizeof(lower))
+        return s_default;
+    for (size_t i = 0; i < ext.size(); i++)
+        lower[i] = tolower(ext[i]);
+    auto it = s_mime_types.find(std::string_view(lower, ext.size()));
+    return it == s_mime_types.end() ? s_default : it->second;
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::get_file(const std::string& path) {
+    uint64_t now = SystemInfo::get_elapsed();
+    FileInfo::ptr file;
+    {
+        MutexType::ReadLock lock(mutex_);
+        auto it = files_.find(path);
+        if (it != files_.end())
+            file = it->second;
+    }
+    // cached and fresh, missing file is cached too
+    if (file && now - file->checked < ttl_)
+        return file->fd == -1 ? nullptr : file;
+    // check metadata again, reuse fd if file not changed
+    struct stat st;
+    int rt = file ? ::stat(path.c_str(), &st) : -1;
+    if (file && file->fd == -1 && rt != 0) {
+        file->checked = now;
+        return nullptr;
+    }
+    if (file && file->fd != -1 && rt == 0 && st.st_ino == file->ino
+        && st.st_mtime == file->mtime && (uint64_t)st.st_size == file->size) {
+        file->checked = now;
+        return file;
+    }
+    auto new_file = open_file(path);
+    if (!new_file)
+        new_file.reset(new FileInfo);
+    new_file->checked = now;
+    MutexType::WriteLock lock(mutex_);
+    // cache is full, drop any one, in flight response still hold it
+    if (files_.size() >= max_cached_ && files_.find(path) == files_.end())
+        files_.erase(files_.begin());
+    files_[path] = new_file;
+    return new_file->fd == -1 ? nullptr : new_file;
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::open_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        SYLAR_FMT_DEBUG("open static file failed, path: %s, err: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    FileInfo::ptr file(new FileInfo);
+    file->fd = fd;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return nullptr;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+    // metadata is formatted once per open
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (uint64_t)st.st_mtime, (uint64_t)st.st_size);
+    file->etag = buf;
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    file->last_modified.assign(buf, strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+    file->mime = &get_mime_type(path);
+    return file;
+}
+
+int StaticFileServlet::parse_range(std::string_view range, uint64_t size, uint64_t& begin, uint64_t& end) {
+    // only single byte range is supported, others get full content
+    if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != std::string_view::npos)
+        return 0;
+    range.remove_prefix(6);
+    size_t dash = range.find('-');
+    if (dash == std::string_view::npos)
+        return 0;
+    std::string first(range.substr(0, dash));
+    std::string last(range.substr(dash + 1));
+    char* stop = nullptr;
+    if (first.empty()) {
+        // suffix range, last n bytes
+        uint64_t n = strtoull(last.c_str(), &stop, 10);
+        if (last.empty() || *stop != '\0')
+            return 0;
+        if (n == 0 || size == 0)
+            return -1;
+        begin = n >= size ? 0 : size - n;
+        end = size - 1;
+        return 1;
+    }
+    begin = strtoull(first.c_str(), &stop, 10);
+    if (*stop != '\0')
+        return 0;
+    end = size - 1;
+    if (!last.empty()) {
+        end = strtoull(last.c_str(), &stop, 10);
+        if (*stop != '\0' || end < begin)
+            return 0;
+        if (end >= size)
+            end = size - 1;
+    }
+    return begin < size ? 1 : -1;
+}
+
+bool StaticFileServlet::is_not_modified(HttpRequest::ptr req, const FileInfo::ptr& file) {
+    // etag take precedence over modify time
+    std::string_view none_match = req->get_header_view("if-none-match");
+    if (!none_match.empty())
+        return none_match == "*" || none_match.find(file->etag) != std::string_view::npos;
+    std::string_view since = req->get_header_view("if-modified-since");
+    if (since.empty())
+        return false;
+    if (since == file->last_modified)
+        return true;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    std::string value(since);
+    if (strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == nullptr)
+        return false;
+    return file->mtime <= timegm(&tm);
+}
+
+}
+}
@@ -0,0 +1,150 @@
+#ifndef __SYLAR_SRC_STATIC_FILE_SERVLET_H__
+#define __SYLAR_SRC_STATIC_FILE_SERVLET_H__
+
+#include "servlet.h"
+#include "../mutex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief serve files under root directory
+ * @details file content is sent by sendfile. opened fd and stat metadata
+ *          are cached, entry is checked by stat again once ttl expired.
+ *          support Range, If-None-Match and If-Modified-Since.
+ *          "name.gz" is served instead of "name" if client accept gzip
+ *          and it is not older than "name"
+ */
+class StaticFileServlet : public Servlet {
+public:
+    /// share pointer
+    typedef std::shared_ptr<StaticFileServlet> ptr;
+    /// read write lock
+    typedef PerCpuRWMutex MutexType;
+
+    /**
+     * @brief Construct a new Static File Servlet object
+     * @param[in] root root directory
+     * @param[in] prefix uri prefix stripped from request path
+     * @param[in] ttl cache entry check interval in ms
+     */
+    StaticFileServlet(const std::string& root, const std::string& prefix = "", uint64_t ttl = 2000);
+
+    /**
+     * @brief handle request
+     * @param[in] req http req
+     * @param[in] resp http resp
+     * @param[in] session http session
+     */
+    virtual int32_t handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+        HttpSession::ptr session) override;
+
+    /**
+     * @brief Set the max cached object
+     * @param[in] count max cached files, each one hold a fd
+     */
+    void set_max_cached(size_t count) { max_cached_ = count; }
+
+    /**
+     * @brief Get the cached count object
+     */
+    size_t get_cached_count();
+
+    /**
+     * @brief Get the mime type object by file extension
+     * @param[in] path file path
+     */
+    static const std::string& get_mime_type(std::string_view path);
+
+private:
+    /**
+     * @brief cached file
+     */
+    struct FileInfo {
+        /// share pointer, in flight response keep fd open
+        typedef std::shared_ptr<FileInfo> ptr;
+
+        /**
+         * @brief Destroy the File Info object, close fd
+         */
+        ~FileInfo();
+
+        /// file fd
+        int fd {-1};
+        /// file size
+        uint64_t size {0};
+        /// modify time
+        time_t mtime {0};
+        /// inode
+        ino_t ino {0};
+        /// etag
+        std::string etag {};
+        /// last modified
+        std::string last_modified {};
+        /// mime type
+        const std::string* mime {nullptr};
+        /// last check time in ms
+        std::atomic<uint64_t> checked {0};
+    };
+
+    /**
+     * @brief get file from cache, open it if missing or changed
+     * @details missing file is cached as fd -1, so absent ".gz"
+     *          sibling is not opened for every request
+     * @param[in] path file path
+     * @return nullptr if file is missing
+     */
+    FileInfo::ptr get_file(const std::string& path);
+
+    /**
+     * @brief open file and read metadata
+     * @param[in] path file path
+     * @return nullptr if not regular file
+     */
+    static FileInfo::ptr open_file(const std::string& path);
+
+    /**
+     * @brief parse single range header
+     * @param[in] range range header value
+     * @param[in] size file size
+     * @param[out] begin first byte
+     * @param[out] end last byte, inclusive
+     * @return 1 if satisfiable, 0 if range is ignored, -1 if unsatisfiable
+     */
+    static int parse_range(std::string_view range, uint64_t size, uint64_t& begin, uint64_t& end);
+
+    /**
+     * @brief if file is not modified since client cached it
+     * @param[in] req http request
+     * @param[in] file file info
+     */
+    static bool is_not_modified(HttpRequest::ptr req, const FileInfo::ptr& file);
+
+private:
+    /// root directory
+    std::string root_ {};
+    /// uri prefix
+    std::string prefix_ {};
+    /// cache check interval in ms
+    uint64_t ttl_ {2000};
+    /// max cached files
+    size_t max_cached_ {1024};
+    /// cache lock
+    MutexType mutex_ {};
+    /// cached files
+    std::unordered_map<std::string, FileInfo::ptr> files_ {};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "ws_servlet.h"
+#include "../log.h"
+#include "../utils.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/// magic guid of accept key
+static const char* s_websocket_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/**
+ * @brief if comma separated header value contain token
+ */
+static bool has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t end = value.find(',');
+        std::string_view item = value.substr(0, end);
+        value = end == std::string_view::npos ? std::string_view() : value.substr(end + 1);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+        if (CaseInsensitiveEqual()(item, token))
+            return true;
+    }
+    return false;
+}
+
+WSServlet::WSServlet(const std::string& name)
+    : Servlet(name) {
+}
+
+int32_t WSServlet::handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+    HttpSession::ptr session) {
+    if (!handshake(req, resp)) {
+        resp->set_close(true);
+        return 0;
+    }
+    // finish upgrade request, bytes after it are frames
+    if (!session || (!session->is_body_complete() && !session->recv_body(req))) {
+        resp->set_close(true);
+        return -1;
+    }
+    // 101 without body, sent before any frame
+    if (session->begin_response(resp, 0)->finish() < 0) {
+        resp->set_close(true);
+        return -1;
+    }
+    std::string buffered;
+    session->take_buffered(buffered);
+    WSSession::ptr ws(new WSSession(session->get_socket(), buffered, false));
+    ws->set_max_message_size(max_message_size_);
+    {
+        MutexType::WriteLock lock(mutex_);
+        sessions_.insert(ws);
+    }
+    if (keepalive_interval_ > 0)
+        ws->start_keepalive(keepalive_interval_);
+    if (on_connect(req, ws) == 0) {
+        while (auto msg = ws->recv_message()) {
+            if (on_message(req, msg, ws) != 0)
+                break;
+        }
+    }
+    ws->start_keepalive(0);
+    {
+        MutexType::WriteLock lock(mutex_);
+        sessions_.erase(ws);
+    }
+    on_close(req, ws);
+    // connection is not http any more
+    resp->set_close(true);
+    return 0;
+}
+
+size_t WSServlet::broadcast(WSOpcode opcode, std::string_view data) {
+    std::string frame = WSSession::encode_frame(opcode, data);
+    std::vector<WSSession::ptr> sessions;
+    {
+        MutexType::ReadLock lock(mutex_);
+        sessions.assign(sessions_.begin(), sessions_.end());
+    }
+    // send without lock, slow session dont block register and unregister
+    size_t count = 0;
+    for (auto& session : sessions) {
+        if (session->send_frame(frame) > 0)
+            count++;
+    }
+    return count;
+}
+
+size_t WSServlet::get_session_count() {
+    MutexType::ReadLock lock(mutex_);
+    return sessions_.size();
+}
+
+bool WSServlet::handshake(HttpRequest::ptr req, HttpResponse::ptr resp) {
+    std::string_view key = req->get_header_view("sec-websocket-key");
+    if (req->get_method() != HttpMethod::GET || req->get_version() < 0x11 || !req->is_websocket()
+        || !has_token(req->get_header_view("connection"), "upgrade") || key.empty()) {
+        resp->set_status(HttpStatus::BAD_REQUEST);
+        return false;
+    }
+    if (req->get_header_view("sec-websocket-version") != "13") {
+        resp->set_status(HttpStatus::BAD_REQUEST);
+        resp->set_header("Sec-WebSocket-Version", "13");
+        return false;
+    }
+    std::string digest = StringUtils::sha1(std::string(key) + s_websocket_guid);
+    resp->set_status(HttpStatus::SWITCHING_PROTOCOLS);
+    resp->set_websocket(true);
+    resp->set_header("Upgrade", "websocket");
+    resp->set_header("Connection", "Upgrade");
+    resp->set_header("Sec-WebSocket-Accept", StringUtils::base64_encode(digest.data(), digest.size()));
+    return true;
+}
+
+FunctionWSServlet::FunctionWSServlet(on_message_cb message_cb, on_connect_cb connect_cb,
+    on_connect_cb close_cb)
+    : WSServlet("FunctionWSServlet")
+    , message_cb_(message_cb)
+    , connect_cb_(connect_cb)
+    , close_cb_(close_cb) {
+}
+
+int32_t FunctionWSServlet::on_connect(HttpRequest::ptr req, WSSession::ptr session) {
+    return connect_cb_ ? connect_cb_(req, session) : 0;
+}
+
+int32_t FunctionWSServlet::on_close(HttpRequest::ptr req, WSSession::ptr session) {
+    return close_cb_ ? close_cb_(req, session) : 0;
+}
+
+int32_t FunctionWSServlet::on_message(HttpRequest::ptr req, WSMessage::ptr msg, WSSession::ptr session) {
+    return message_cb_(req, msg, session);
+}
+
+}
+}
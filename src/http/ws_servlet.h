@@ -0,0 +1,154 @@
+#ifndef __SYLAR_SRC_WS_SERVLET_H__
+#define __SYLAR_SRC_WS_SERVLET_H__
+
+#include "servlet.h"
+#include "ws_session.h"
+#include "../mutex.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief websocket servlet
+ * @details handle validate upgrade request and answer 101 with
+ *          Sec-WebSocket-Accept, then the handling fiber keep receiving
+ *          messages until connection closed. connected sessions are kept
+ *          for broadcast, so servlet should be added as singleton
+ */
+class WSServlet : public Servlet {
+public:
+    /// share pointer
+    typedef std::shared_ptr<WSServlet> ptr;
+    /// session set lock
+    typedef RWMutex MutexType;
+
+    /**
+     * @brief Construct a new WSServlet object
+     * @param[in] name servlet name
+     */
+    WSServlet(const std::string& name);
+
+    /**
+     * @brief handshake and receive messages until closed
+     * @param[in] req http req
+     * @param[in] resp http resp
+     * @param[in] session http session
+     */
+    virtual int32_t handle(HttpRequest::ptr req, HttpResponse::ptr resp,
+        HttpSession::ptr session) override;
+
+    /**
+     * @brief called after handshake
+     * @param[in] req upgrade request
+     * @param[in] session websocket session
+     * @return none zero to close connection
+     */
+    virtual int32_t on_connect(HttpRequest::ptr req, WSSession::ptr session) { return 0; }
+
+    /**
+     * @brief called after connection closed
+     * @param[in] req upgrade request
+     * @param[in] session websocket session
+     */
+    virtual int32_t on_close(HttpRequest::ptr req, WSSession::ptr session) { return 0; }
+
+    /**
+     * @brief called for every data message
+     * @param[in] req upgrade request
+     * @param[in] msg message
+     * @param[in] session websocket session
+     * @return none zero to close connection
+     */
+    virtual int32_t on_message(HttpRequest::ptr req, WSMessage::ptr msg, WSSession::ptr session) = 0;
+
+    /**
+     * @brief send message to all connected sessions
+     * @details frame is encoded once and shared by all sessions
+     * @param[in] opcode opcode
+     * @param[in] data payload
+     * @return sessions sent successfully
+     */
+    size_t broadcast(WSOpcode opcode, std::string_view data);
+
+    /**
+     * @brief Get the session count object
+     */
+    size_t get_session_count();
+
+    /**
+     * @brief Set the keepalive interval object
+     * @param[in] interval ping interval in ms, 0 to disable
+     */
+    void set_keepalive_interval(uint64_t interval) { keepalive_interval_ = interval; }
+
+    /**
+     * @brief Set the max message size object
+     * @param[in] size max message size, 0 means unlimited
+     */
+    void set_max_message_size(uint64_t size) { max_message_size_ = size; }
+
+    /**
+     * @brief check upgrade request and fill 101 response
+     * @param[in] req http req
+     * @param[in] resp http resp, 400 with reason when failed
+     * @return false if request is not valid websocket upgrade
+     */
+    static bool handshake(HttpRequest::ptr req, HttpResponse::ptr resp);
+
+private:
+    /// session set lock
+    MutexType mutex_ {};
+    /// connected sessions
+    std::unordered_set<WSSession::ptr> sessions_ {};
+    /// keepalive interval in ms
+    uint64_t keepalive_interval_ {30 * 1000};
+    /// max message size
+    uint64_t max_message_size_ {16 * 1024 * 1024};
+};
+
+class FunctionWSServlet : public WSServlet {
+public:
+    /// share pointer
+    typedef std::shared_ptr<FunctionWSServlet> ptr;
+    /// connect and close callback
+    typedef std::function<int32_t (HttpRequest::ptr req, WSSession::ptr session)> on_connect_cb;
+    /// message callback
+    typedef std::function<int32_t (HttpRequest::ptr req, WSMessage::ptr msg,
+        WSSession::ptr session)> on_message_cb;
+
+    /**
+     * @brief Construct a new Function WSServlet object
+     * @param[in] message_cb message callback
+     * @param[in] connect_cb connect callback
+     * @param[in] close_cb close callback
+     */
+    FunctionWSServlet(on_message_cb message_cb, on_connect_cb connect_cb = nullptr,
+        on_connect_cb close_cb = nullptr);
+
+    virtual int32_t on_connect(HttpRequest::ptr req, WSSession::ptr session) override;
+
+    virtual int32_t on_close(HttpRequest::ptr req, WSSession::ptr session) override;
+
+    virtual int32_t on_message(HttpRequest::ptr req, WSMessage::ptr msg, WSSession::ptr session) override;
+
+private:
+    /// message callback
+    on_message_cb message_cb_ {nullptr};
+    /// connect callback
+    on_connect_cb connect_cb_ {nullptr};
+    /// close callback
+    on_connect_cb close_cb_ {nullptr};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,333 @@
+#include "ws_session.h"
+#include "../iomanager.h"
+#include "../log.h"
+#include "../utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace sylar {
+namespace http {
+
+/// receive buffer size
+static const size_t s_buffer_size = 4 * 1024;
+/// max payload of control frame
+static const size_t s_max_control_size = 125;
+/// max message size when it is not limited by session
+static const uint64_t s_max_message_size = 1ull << 30;
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief mask 32 bytes per step, compiled for avx2 whatever build flags are
+ * @return bytes masked
+ */
+__attribute__((target("avx2")))
+static size_t mask_avx2(uint8_t* data, size_t length, uint32_t key) {
+    __m256i mask = _mm256_set1_epi32((int)key);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(block, mask));
+    }
+    return i;
+}
+
+/**
+ * @brief mask 16 bytes per step
+ * @return bytes masked
+ */
+__attribute__((target("sse2")))
+static size_t mask_sse2(uint8_t* data, size_t length, uint32_t key) {
+    __m128i mask = _mm_set1_epi32((int)key);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(block, mask));
+    }
+    return i;
+}
+#endif
+
+void ws_mask(char* data, size_t length, uint32_t key) {
+    uint8_t* p = (uint8_t*)data;
+    size_t i = 0;
+    // every step is multiple of 4, so key keeps aligned to payload offset
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool s_avx2 = __builtin_cpu_supports("avx2");
+    if (length >= 32 && s_avx2)
+        i = mask_avx2(p, length, key);
+    if (length - i >= 16)
+        i += mask_sse2(p + i, length - i, key);
+#endif
+    uint64_t mask = (uint64_t)key << 32 | key;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t block;
+        memcpy(&block, p + i, 8);
+        block ^= mask;
+        memcpy(p + i, &block, 8);
+    }
+    const uint8_t* bytes = (const uint8_t*)&key;
+    for (; i < length; i++)
+        p[i] ^= bytes[i & 3];
+}
+
+WSSession::WSSession(Socket::ptr sock, const std::string& buffered, bool owner)
+    : SocketStream(sock, owner) {
+    buffer_.resize(std::max(s_buffer_size, buffered.size()));
+    memcpy(&buffer_[0], buffered.data(), buffered.size());
+    write_pos_ = buffered.size();
+    last_active_ = SystemInfo::get_elapsed();
+}
+
+WSSession::~WSSession() {
+    if (keepalive_timer_)
+        keepalive_timer_->cancel();
+}
+
+WSMessage::ptr WSSession::recv_message() {
+    WSMessage::ptr msg;
+    while (true) {
+        if (!fill(2)) {
+            if (close_code_ == WSCloseCode::NO_STATUS)
+                close_code_ = WSCloseCode::ABNORMAL;
+            return nullptr;
+        }
+        uint8_t b0 = buffer_[read_pos_];
+        uint8_t b1 = buffer_[read_pos_ + 1];
+        bool fin = b0 & 0x80;
+        WSOpcode opcode = (WSOpcode)(b0 & 0x0F);
+        uint64_t length = b1 & 0x7F;
+        size_t ext = length == 126 ? 2 : (length == 127 ? 8 : 0);
+        // no extension is negotiated, client frame must be masked
+        if ((b0 & 0x70) || !(b1 & 0x80)) {
+            fail(WSCloseCode::PROTOCOL_ERROR);
+            return nullptr;
+        }
+        if (!fill(2 + ext + 4)) {
+            close_code_ = WSCloseCode::ABNORMAL;
+            return nullptr;
+        }
+        if (ext) {
+            length = 0;
+            for (size_t i = 0; i < ext; i++)
+                length = length << 8 | (uint8_t)buffer_[read_pos_ + 2 + i];
+            // most significant bit of 64 bits length must be 0
+            if (length >> 63) {
+                fail(WSCloseCode::PROTOCOL_ERROR);
+                return nullptr;
+            }
+        }
+        uint32_t key;
+        memcpy(&key, &buffer_[read_pos_ + 2 + ext], 4);
+        read_pos_ += 2 + ext + 4;
+        // control frame may be interleaved with fragments
+        if ((uint8_t)opcode & 0x08) {
+            if (!fin || length > s_max_control_size || (opcode != WSOpcode::CLOSE
+                && opcode != WSOpcode::PING && opcode != WSOpcode::PONG)) {
+                fail(WSCloseCode::PROTOCOL_ERROR);
+                return nullptr;
+            }
+            std::string payload;
+            if (!read_payload(payload, length)) {
+                close_code_ = WSCloseCode::ABNORMAL;
+                return nullptr;
+            }
+            ws_mask(&payload[0], payload.size(), key);
+            last_active_ = SystemInfo::get_elapsed();
+            if (opcode == WSOpcode::PING) {
+                send_message(WSOpcode::PONG, payload);
+                continue;
+            }
+            if (opcode == WSOpcode::PONG)
+                continue;
+            // echo close, then connection could be closed
+            close_code_ = payload.size() >= 2
+                ? (WSCloseCode)((uint8_t)payload[0] << 8 | (uint8_t)payload[1]) : WSCloseCode::NO_STATUS;
+            send_close(close_code_ == WSCloseCode::NO_STATUS ? WSCloseCode::NORMAL : close_code_);
+            return nullptr;
+        }
+        if (opcode == WSOpcode::CONTINUE) {
+            if (!msg) {
+                fail(WSCloseCode::PROTOCOL_ERROR);
+                return nullptr;
+            }
+        } else if (opcode == WSOpcode::TEXT || opcode == WSOpcode::BINARY) {
+            // new message before last one finished
+            if (msg) {
+                fail(WSCloseCode::PROTOCOL_ERROR);
+                return nullptr;
+            }
+            msg = std::make_shared<WSMessage>(opcode);
+        } else {
+            fail(WSCloseCode::PROTOCOL_ERROR);
+            return nullptr;
+        }
+        std::string& data = msg->get_data();
+        uint64_t max_size = max_message_size_ > 0 ? max_message_size_ : s_max_message_size;
+        // compare without adding, length is given by peer
+        if (data.size() > max_size || length > max_size - data.size()) {
+            SYLAR_FMT_ERR("websocket message too large, size: %lu, length: %lu, max: %lu",
+                data.size(), length, max_size);
+            fail(WSCloseCode::MESSAGE_TOO_BIG);
+            return nullptr;
+        }
+        size_t offset = data.size();
+        if (!read_payload(data, length)) {
+            close_code_ = WSCloseCode::ABNORMAL;
+            return nullptr;
+        }
+        // unmask in place, each fragment has its own key
+        ws_mask(&data[offset], length, key);
+        last_active_ = SystemInfo::get_elapsed();
+        if (fin)
+            return msg;
+    }
+}
+
+int WSSession::send_message(WSOpcode opcode, std::string_view data, bool fin) {
+    if (((uint8_t)opcode & 0x08) && data.size() > s_max_control_size) {
+        SYLAR_FMT_ERR("websocket control frame too large, size: %lu", data.size());
+        return -1;
+    }
+    char head[10];
+    iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = encode_head(head, opcode, data.size(), fin);
+    iov[1].iov_base = (void*)data.data();
+    iov[1].iov_len = data.size();
+    MutexType::Lock lock(mutex_);
+    // nothing could be sent after close
+    if (close_sent_ && opcode != WSOpcode::CLOSE)
+        return -1;
+    int rt = writev_fix_size(iov, data.empty() ? 1 : 2);
+    return rt <= 0 ? rt : data.size();
+}
+
+int WSSession::send_frame(std::string_view frame) {
+    MutexType::Lock lock(mutex_);
+    if (close_sent_)
+        return -1;
+    return write_fix_size(frame.data(), frame.size());
+}
+
+int WSSession::send_close(WSCloseCode code, std::string_view reason) {
+    if (close_sent_.exchange(true))
+        return 0;
+    char payload[s_max_control_size];
+    payload[0] = (uint16_t)code >> 8;
+    payload[1] = (uint16_t)code & 0xFF;
+    size_t size = std::min(reason.size(), sizeof(payload) - 2);
+    memcpy(payload + 2, reason.data(), size);
+    return send_message(WSOpcode::CLOSE, std::string_view(payload, size + 2));
+}
+
+void WSSession::start_keepalive(uint64_t interval) {
+    if (keepalive_timer_) {
+        keepalive_timer_->cancel();
+        keepalive_timer_.reset();
+    }
+    keepalive_interval_ = interval;
+    if (interval == 0)
+        return;
+    // timer fire in io manager serving this session
+    IOManager* iom = dynamic_cast<IOManager*>(Scheduler::get_this());
+    if (!iom) {
+        SYLAR_FMT_ERR("websocket keepalive need io manager, fd: %d", get_socket()->get_fd());
+        return;
+    }
+    last_active_ = SystemInfo::get_elapsed();
+    // condition keep session alive during callback, released session skip it
+    keepalive_timer_ = iom->add_condition_timer(interval, true,
+        shared_from_this(), [this]() { on_keepalive(); }, "websocket keepalive");
+}
+
+std::string WSSession::encode_frame(WSOpcode opcode, std::string_view data, bool fin) {
+    char head[10];
+    size_t size = encode_head(head, opcode, data.size(), fin);
+    std::string frame;
+    frame.reserve(size + data.size());
+    frame.append(head, size).append(data);
+    return frame;
+}
+
+bool WSSession::fill(size_t length) {
+    while (write_pos_ - read_pos_ < length) {
+        // move left bytes to front, frame header never exceed buffer
+        if (read_pos_ > 0) {
+            memmove(&buffer_[0], &buffer_[read_pos_], write_pos_ - read_pos_);
+            write_pos_ -= read_pos_;
+            read_pos_ = 0;
+        }
+        int len = read(&buffer_[write_pos_], buffer_.size() - write_pos_);
+        if (len <= 0)
+            return false;
+        write_pos_ += len;
+    }
+    return true;
+}
+
+bool WSSession::read_payload(std::string& out, size_t length) {
+    size_t buffered = std::min(length, write_pos_ - read_pos_);
+    out.append(&buffer_[read_pos_], buffered);
+    read_pos_ += buffered;
+    // large payload is read into message directly
+    size_t offset = out.size();
+    size_t left = length - buffered;
+    out.resize(offset + left);
+    while (left > 0) {
+        int len = read(&out[offset], left);
+        if (len <= 0)
+            return false;
+        offset += len;
+        left -= len;
+    }
+    return true;
+}
+
+size_t WSSession::encode_head(char* head, WSOpcode opcode, size_t length, bool fin) {
+    head[0] = (fin ? 0x80 : 0x00) | (uint8_t)opcode;
+    if (length < 126) {
+        head[1] = length;
+        return 2;
+    }
+    if (length <= 0xFFFF) {
+        head[1] = 126;
+        head[2] = length >> 8;
+        head[3] = length & 0xFF;
+        return 4;
+    }
+    head[1] = 127;
+    for (int i = 0; i < 8; i++)
+        head[2 + i] = (uint64_t)length >> ((7 - i) * 8);
+    return 10;
+}
+
+void WSSession::fail(WSCloseCode code) {
+    SYLAR_FMT_DEBUG("websocket session failed, code: %u", (uint32_t)code);
+    close_code_ = code;
+    send_close(code);
+}
+
+void WSSession::on_keepalive() {
+    uint64_t now = SystemInfo::get_elapsed();
+    if (now - last_active_ > keepalive_interval_ * 2) {
+        // wake up receiving fiber, fd is closed by its owner
+        SYLAR_FMT_DEBUG("websocket keepalive timeout, fd: %d", get_socket()->get_fd());
+        close_code_ = WSCloseCode::GOING_AWAY;
+        ::shutdown(get_socket()->get_fd(), SHUT_RDWR);
+        return;
+    }
+    ping();
+}
+
+}
+}
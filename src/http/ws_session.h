@@ -0,0 +1,258 @@
+#ifndef __SYLAR_SRC_WS_SESSION_H__
+#define __SYLAR_SRC_WS_SESSION_H__
+
+#include "../fiber_mutex.h"
+#include "../timer.h"
+#include "../streams/socket_stream.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief websocket frame opcode
+ */
+enum class WSOpcode : uint8_t {
+    CONTINUE = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA,
+};
+
+/**
+ * @brief websocket close status code
+ */
+enum class WSCloseCode : uint16_t {
+    NORMAL = 1000,
+    GOING_AWAY = 1001,
+    PROTOCOL_ERROR = 1002,
+    UNSUPPORTED_DATA = 1003,
+    NO_STATUS = 1005,
+    ABNORMAL = 1006,
+    INVALID_DATA = 1007,
+    POLICY_VIOLATION = 1008,
+    MESSAGE_TOO_BIG = 1009,
+    INTERNAL_ERROR = 1011,
+};
+
+/**
+ * @brief xor data with 4 bytes websocket mask key in place
+ * @details 32/16 bytes per step with AVX2/SSE2 when cpu support it
+ * @param[in,out] data data
+ * @param[in] length data length
+ * @param[in] key mask key, bytes in wire order
+ */
+void ws_mask(char* data, size_t length, uint32_t key);
+
+/**
+ * @brief complete websocket message, fragments are joined
+ */
+class WSMessage {
+public:
+    /// share pointer
+    typedef std::shared_ptr<WSMessage> ptr;
+
+    /**
+     * @brief Construct a new WSMessage object
+     * @param[in] opcode TEXT or BINARY
+     * @param[in] data payload
+     */
+    WSMessage(WSOpcode opcode = WSOpcode::TEXT, const std::string& data = "")
+        : opcode_(opcode), data_(data) {}
+
+    /**
+     * @brief Get the opcode object
+     */
+    WSOpcode get_opcode() const { return opcode_; }
+
+    /**
+     * @brief Set the opcode object
+     * @param[in] opcode opcode
+     */
+    void set_opcode(WSOpcode opcode) { opcode_ = opcode; }
+
+    /**
+     * @brief Get the data object
+     */
+    const std::string& get_data() const { return data_; }
+
+    /**
+     * @brief Get the data object, could be modified
+     */
+    std::string& get_data() { return data_; }
+
+private:
+    /// opcode of first frame
+    WSOpcode opcode_ {WSOpcode::TEXT};
+    /// payload
+    std::string data_ {};
+};
+
+/**
+ * @brief server side websocket connection
+ * @details built on socket of upgraded http session. frames from client
+ *          must be masked, frames to client are never masked. control
+ *          frames are answered inside recv_message, so only data messages
+ *          are returned. send is serialized by lock, so broadcast and
+ *          keepalive could send from other fibers
+ */
+class WSSession : public SocketStream, public std::enable_shared_from_this<WSSession> {
+public:
+    /// share pointer
+    typedef std::shared_ptr<WSSession> ptr;
+    /// send lock
+    typedef FiberMutex MutexType;
+
+    /**
+     * @brief Construct a new WSSession object
+     * @param[in] sock socket of upgraded connection
+     * @param[in] buffered bytes already read after handshake request
+     * @param[in] owner if close socket on destroy
+     */
+    WSSession(Socket::ptr sock, const std::string& buffered = "", bool owner = false);
+
+    /**
+     * @brief Destroy the WSSession object, keepalive timer is cancelled
+     */
+    ~WSSession();
+
+    /**
+     * @brief receive one data message
+     * @details ping is answered, pong refresh activity, close is echoed
+     * @return nullptr when closed or failed, get_close_code tell the reason
+     */
+    WSMessage::ptr recv_message();
+
+    /**
+     * @brief send message as one frame
+     * @param[in] opcode opcode
+     * @param[in] data payload, sent without copy
+     * @param[in] fin last frame of message
+     * @return payload length, or <= 0 when failed
+     */
+    int send_message(WSOpcode opcode, std::string_view data, bool fin = true);
+
+    /**
+     * @brief send message
+     * @param[in] msg message
+     */
+    int send_message(WSMessage::ptr msg) { return send_message(msg->get_opcode(), msg->get_data()); }
+
+    /**
+     * @brief send frame built by encode_frame, used to share one frame by many sessions
+     * @param[in] frame encoded frame
+     */
+    int send_frame(std::string_view frame);
+
+    /**
+     * @brief send ping
+     * @param[in] data ping payload, no more than 125 bytes
+     */
+    int ping(std::string_view data = "") { return send_message(WSOpcode::PING, data); }
+
+    /**
+     * @brief send close frame, socket is closed after peer echo
+     * @param[in] code close code
+     * @param[in] reason close reason
+     */
+    int send_close(WSCloseCode code = WSCloseCode::NORMAL, std::string_view reason = "");
+
+    /**
+     * @brief ping peer every interval, close connection when nothing
+     *        received in two intervals. timer run in io manager of
+     *        calling thread, nothing is started outside io manager
+     * @param[in] interval ping interval in ms, 0 to stop
+     */
+    void start_keepalive(uint64_t interval);
+
+    /**
+     * @brief Set the max message size object
+     * @param[in] size max joined message size, 0 means hard limit of 1 GiB
+     */
+    void set_max_message_size(uint64_t size) { max_message_size_ = size; }
+
+    /**
+     * @brief Get the max message size object
+     */
+    uint64_t get_max_message_size() { return max_message_size_; }
+
+    /**
+     * @brief Get the close code object, code received or sent
+     */
+    WSCloseCode get_close_code() { return close_code_; }
+
+    /**
+     * @brief encode unmasked server frame
+     * @param[in] opcode opcode
+     * @param[in] data payload
+     * @param[in] fin last frame of message
+     */
+    static std::string encode_frame(WSOpcode opcode, std::string_view data, bool fin = true);
+
+private:
+    /**
+     * @brief make at least length bytes buffered
+     * @param[in] length bytes needed
+     */
+    bool fill(size_t length);
+
+    /**
+     * @brief read payload, buffered bytes first then socket
+     * @param[out] out payload appended to
+     * @param[in] length payload length
+     */
+    bool read_payload(std::string& out, size_t length);
+
+    /**
+     * @brief fill frame header into buffer
+     * @param[out] head header buffer, at least 10 bytes
+     * @return header length
+     */
+    static size_t encode_head(char* head, WSOpcode opcode, size_t length, bool fin);
+
+    /**
+     * @brief send close with code and stop receiving
+     * @param[in] code close code
+     */
+    void fail(WSCloseCode code);
+
+    /**
+     * @brief keepalive timer callback
+     */
+    void on_keepalive();
+
+private:
+    /// receive buffer
+    std::string buffer_ {};
+    /// begin of unparsed data
+    size_t read_pos_ {0};
+    /// end of received data
+    size_t write_pos_ {0};
+    /// send lock
+    MutexType mutex_ {};
+    /// max message size
+    uint64_t max_message_size_ {16 * 1024 * 1024};
+    /// close code
+    WSCloseCode close_code_ {WSCloseCode::NO_STATUS};
+    /// close frame is sent
+    std::atomic<bool> close_sent_ {false};
+    /// ms of last received frame
+    std::atomic<uint64_t> last_active_ {0};
+    /// keepalive interval in ms
+    uint64_t keepalive_interval_ {0};
+    /// keepalive timer
+    Timer::ptr keepalive_timer_ {};
+};
+
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "iomanager.h"
+#include "epoch.h"
 #include "fiber.h"
 #include "log.h"
 #include "macro.h"
@@ -9,12 +10,15 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 #include <memory>
 #include <utility>
 #include <exception>
 
 
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <sys/epoll.h>
 
@@ -23,14 +27,24 @@ namespace sylar {
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name): 
 Scheduler(threads, use_caller, name) {
     SYLAR_INFO("io manager create");
+    // hooked io wait in epoll of this manager
+    hook_enabled_ = true;
     // create epoll fd
     epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    // tickle fd has no fd context, data ptr is null
+    tickle_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ep;
+    ep.events = EPOLLIN | EPOLLET;
+    ep.data.ptr = nullptr;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, tickle_fd_, &ep) == -1)
+        SYLAR_FMT_ERR("epoll add tickle fd failed, err: %s", strerror(errno));
 }
 
 IOManager::~IOManager() {
     SYLAR_INFO("io manager destoried");
     // close epoll fd
     close(epfd_);
+    close(tickle_fd_);
 }
 
 IOManager::ptr IOManager::get_scheduler() {
@@ -52,8 +66,17 @@ void IOManager::idle() {
     // wait
     SYLAR_DEBUG("prepare to epoll wait");
     
-    int count = epoll_wait(epfd_, events, MAX_EVENTS, 5 * 1000);
+    // wake for next timer at least
+    uint64_t timeout = std::min<uint64_t>(get_next_timer(), 5 * 1000);
+    // sleeping worker must not hold epoch back
+    Epoch::offline();
+    int count = epoll_wait(epfd_, events, MAX_EVENTS, (int)timeout);
+    Epoch::online();
     SYLAR_DEBUG("end to epoll wait");
+    // expired timers run as tasks, same as io callbacks
+    std::vector<std::function<void()>> cbs;
+    list_expired_cb(cbs);
+    schedule_batch(cbs);
     // check wait result
     // if errno is signal interrupt, ignore
     if (count < 0 && errno == EINTR) {
@@ -64,30 +87,59 @@ void IOManager::idle() {
         SYLAR_FMT_ERR("epoll wait failed, err: %s", strerror(errno));
         return;
     }
+    // fired callbacks of each class, scheduled with one lock per class
+    std::vector<Task> ready[INHERIT];
     // read filescriptor
     for (int index = 0; index < count; index++) {
         epoll_event& event = events[index];
         // fd context
         FdContext* fd_ctx = static_cast<FdContext*>(event.data.ptr);
+        // tickled, drain counter. eventfd_read is not hooked
         if (fd_ctx == nullptr) {
-            SYLAR_ERR("fd context convert failed");
+            eventfd_t value;
+            eventfd_read(tickle_fd_, &value);
             continue;
         }
-        fd_ctx->trigger_event(epoll_to_event(event.events));
+        // reader and writer may both wait on fd
+        Event fired = epoll_to_event(event.events);
+        bool unwatch = false;
+        if ((int)fired & (int)Event::READ)
+            unwatch = fd_ctx->trigger_event(Event::READ, this, ready);
+        if ((int)fired & (int)Event::WRITE)
+            unwatch = fd_ctx->trigger_event(Event::WRITE, this, ready) || unwatch;
+        // fired oneshot event was the last one, stop watching fd
+        if (unwatch) {
+            MutexType::Lock lock(mutex_);
+            auto pos = fd_ctxs_.find(fd_ctx->fd);
+            if (pos != fd_ctxs_.end())
+                unwatch_fd(pos->second);
+        }
+    }
+    for (int priority = HIGH; priority < INHERIT; priority++) {
+        if (!ready[priority].empty())
+            schedule_batch(ready[priority], (Priority)priority);
     }
 
     SYLAR_INFO("io manager idle end");
 }  
 
+void IOManager::tickle() {
+    if (eventfd_write(tickle_fd_, 1) != 0)
+        SYLAR_FMT_ERR("tickle io manager failed, err: %s", strerror(errno));
+}
+
+void IOManager::on_timer_inserted_at_front() {
+    tickle();
+}
+
 IOManager::Event IOManager::epoll_to_event(uint32_t ep_events) {
     int events = 0;
-    if (ep_events & EPOLLIN) {
-        return Event::READ;
-    } 
-    if (ep_events & EPOLLOUT ) {
-        return Event::WRITE;
-    }
-    return Event::NONE;
+    // error and hang up are seen by next read or write
+    if (ep_events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        events |= (int)Event::READ;
+    if (ep_events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+        events |= (int)Event::WRITE;
+    return (Event)events;
 }
 
 uint32_t IOManager::event_to_epoll(IOManager::Event events) {
@@ -115,22 +167,17 @@ int IOManager::get_backend_fd() {
 
 // add fd event
 void IOManager::add_fd_event(int fd, Event event, std::function<void ()> cb) {
-    // TODO: use vector as container has costs loss, should optimize here
     // TODO: also func void() is too simplify to cover all situation, should use template later
     // lock fd
     MutexType::Lock lock(mutex_);
-    FdContext::ptr ctx;
-    // try to find origin fd context
-    for (int index = 0; index < fd_ctxs_.size(); index++) {
-        if (fd_ctxs_[index]->fd == fd) {
-            ctx = fd_ctxs_[index];
-            break;
-        }
-    }
-    // epoll op
-    int op = EPOLL_CTL_MOD;
+    FdContext::ptr& ctx = fd_ctxs_[fd];
     // if not exist, create one
     if (ctx == nullptr) {
+        // set fd context
+        ctx = FdContext::ptr(new FdContext);
+        ctx->fd = fd;
+    }
+    if (!ctx->registered) {
         // set non-block
         int flags = fcntl(fd, F_GETFL);
         flags |= O_NONBLOCK;
@@ -138,12 +185,9 @@ void IOManager::add_fd_event(int fd, Event event, std::function<void ()> cb) {
         if (err == -1) {
             SYLAR_FMT_ERR("set fd non-block failed, fd: %d, err: %s", fd, strerror(errno));
         }
-        // set fd context
-        ctx = FdContext::ptr(new FdContext);
-        ctx->fd = fd;
-        fd_ctxs_.push_back(ctx);
-        op = EPOLL_CTL_ADD;
     }
+    // epoll op
+    int op = ctx->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
     // add fd event to io manager
     ctx->add_event(event, Scheduler::shared_from_this(), cb);
     // operate epoll 
@@ -151,6 +195,11 @@ void IOManager::add_fd_event(int fd, Event event, std::function<void ()> cb) {
     ep.events = EPOLLIN | EPOLLET;
     ep.data.ptr = ctx.get();
     int err = epoll_ctl(epfd_, op, fd, &ep);
+    // closed fd is removed from epoll by kernel, add it again
+    if (err == -1 && errno == ENOENT) {
+        op = EPOLL_CTL_ADD;
+        err = epoll_ctl(epfd_, op, fd, &ep);
+    }
     // it is ok, because signal will interrupt
     if (err == -1 && errno == EINTR) {
         return;
@@ -160,23 +209,18 @@ void IOManager::add_fd_event(int fd, Event event, std::function<void ()> cb) {
         SYLAR_FMT_ERR("epoll add fd event failed, fd: %d, op: %d, event: %d, err: %s", fd, op, event, strerror(errno));
         return;
     }
+    ctx->registered = true;
     // success
     SYLAR_FMT_DEBUG("epoll add fd event successfully, fd: %d, op: %d, event: %d", fd, op, event);
 }
 
 void IOManager::del_fd_event(int fd, Event event) {
     MutexType::Lock lock(mutex_);
-    FdContext::ptr ctx;
     // try to find origin fd context
-    auto pos = fd_ctxs_.cbegin();
-    for (; pos != fd_ctxs_.cend(); pos++) {
-        if (pos->get()->fd == fd) {
-            ctx = *pos;
-            break;
-        }
-    }
+    auto pos = fd_ctxs_.find(fd);
+    FdContext::ptr ctx = pos == fd_ctxs_.end() ? nullptr : pos->second;
     // check if context is exist
-    if (ctx == nullptr) {
+    if (ctx == nullptr || !ctx->registered) {
         SYLAR_FMT_DEBUG("fd dont need to be deleted, not exist, fd: %d", fd);
         return;
     }
@@ -211,20 +255,95 @@ void IOManager::del_fd_event(int fd, Event event) {
     SYLAR_FMT_DEBUG("epoll del fd event successully, fd: %d, op: %d, event: %d", fd, op, event);
 }
 
+bool IOManager::add_oneshot_event(int fd, Event event, std::function<void()> cb) {
+    MutexType::Lock lock(mutex_);
+    FdContext::ptr& ctx = fd_ctxs_[fd];
+    if (ctx == nullptr) {
+        ctx = FdContext::ptr(new FdContext);
+        ctx->fd = fd;
+    }
+    if (!ctx->add_event(event, Scheduler::shared_from_this(), cb, true))
+        return false;
+    int op = ctx->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    struct epoll_event ep;
+    // keep watching events of other waiters
+    ep.events = EPOLLET | event_to_epoll(ctx->get_events());
+    ep.data.ptr = ctx.get();
+    int err = epoll_ctl(epfd_, op, fd, &ep);
+    // closed fd is removed from epoll by kernel, add it again
+    if (err == -1 && errno == ENOENT) {
+        op = EPOLL_CTL_ADD;
+        err = epoll_ctl(epfd_, op, fd, &ep);
+    }
+    if (err == -1) {
+        SYLAR_FMT_ERR("epoll add oneshot event failed, fd: %d, op: %d, event: %d, err: %s", fd, op, event, strerror(errno));
+        ctx->del_event(event);
+        return false;
+    }
+    ctx->registered = true;
+    return true;
+}
+
+bool IOManager::cancel_fd_event(int fd, Event event) {
+    MutexType::Lock lock(mutex_);
+    auto pos = fd_ctxs_.find(fd);
+    if (pos == fd_ctxs_.end())
+        return false;
+    FdContext::ptr ctx = pos->second;
+    {
+        FdContext::MutexType::Lock ctx_lock(ctx->mutex_);
+        // fired oneshot event is already removed
+        if (ctx->dispatcher.erase(event) == 0)
+            return false;
+    }
+    unwatch_fd(ctx);
+    return true;
+}
+
+bool IOManager::wake_fd_event(int fd, Event event) {
+    MutexType::Lock lock(mutex_);
+    auto pos = fd_ctxs_.find(fd);
+    if (pos == fd_ctxs_.end())
+        return false;
+    FdContext::ptr ctx = pos->second;
+    {
+        FdContext::MutexType::Lock ctx_lock(ctx->mutex_);
+        if (ctx->dispatcher.find(event) == ctx->dispatcher.end())
+            return false;
+    }
+    // run as if fd is ready, not by owner so it is scheduled directly
+    if (ctx->trigger_event(event, nullptr, nullptr))
+        unwatch_fd(ctx);
+    return true;
+}
+
+void IOManager::unwatch_fd(FdContext::ptr ctx) {
+    // lock order is same as add, event may be added again meanwhile
+    if (!ctx->registered || ctx->get_events() != Event::NONE)
+        return;
+    struct epoll_event ep;
+    ep.events = 0;
+    ep.data.ptr = ctx.get();
+    if (epoll_ctl(epfd_, EPOLL_CTL_DEL, ctx->fd, &ep) == -1 && errno != ENOENT && errno != EBADF)
+        SYLAR_FMT_ERR("epoll del fd failed, fd: %d, err: %s", ctx->fd, strerror(errno));
+    ctx->registered = false;
+}
+
 
 // add event and callback to fd 
-void IOManager::FdContext::add_event(Event event, Scheduler::ptr sched, std::function<void()> cb) {
+bool IOManager::FdContext::add_event(Event event, Scheduler::ptr sched, std::function<void()> cb, bool oneshot) {
     // mutex
     MutexType::Lock lock(mutex_);
     // check if already exist
     auto pos = dispatcher.find(event);
     if (pos != dispatcher.end()) {
         SYLAR_FMT_DEBUG("event callback dont need to added, already exist, fd: %d, event: %d", fd, event);
-        return;
+        return false;
     }
     // add event dispatcher
-    dispatcher.insert(std::make_pair(event, EventContext::ptr(new EventContext(sched, cb))));
+    dispatcher.insert(std::make_pair(event, EventContext::ptr(new EventContext(sched, cb, oneshot))));
     SYLAR_FMT_DEBUG("event callback add successfully, fd: %d, event: %d", fd, event);
+    return true;
 }
 
 void IOManager::FdContext::del_event(Event event) {
@@ -246,29 +365,42 @@ IOManager::Event IOManager::FdContext::get_events() {
     // mutex
     MutexType::Lock lock(mutex_);
     // append events
-    int events;
-    // TODO: here should consider all events
-    for (auto& item : dispatcher) {
-        return item.first;
-    }
-    return Event::NONE;
+    int events = 0;
+    for (auto& item : dispatcher)
+        events |= (int)item.first;
+    return (Event)events;
 }
 
 // trigger event to call callback
-void IOManager::FdContext::trigger_event(Event event) {
-    // mutex
-    MutexType::Lock lock(mutex_);
-    try {
-        // try to get context
-        auto ctx = dispatcher.at(event);
-        auto scheduler = ctx->scheduler.lock();
-        if (scheduler) {
-            Fiber::ptr fiber(new Fiber(ctx->cb, 0, is_scheduler_fiber(), "fd fiber"));
-            scheduler->schedule(fiber);
+bool IOManager::FdContext::trigger_event(Event event, Scheduler* owner, std::vector<Task>* ready) {
+    EventContext::ptr ctx;
+    bool unwatch = false;
+    {
+        // spinlock, fiber is created and scheduled after it
+        MutexType::Lock lock(mutex_);
+        auto pos = dispatcher.find(event);
+        // error and hang up fire both events, only waiting one is run
+        if (pos == dispatcher.end()) {
+            lock.unlock();
+            SYLAR_FMT_DEBUG("no one wait for triggered event, fd: %d, event: %d", fd, event);
+            return false;
+        }
+        ctx = pos->second;
+        if (ctx->oneshot) {
+            dispatcher.erase(pos);
+            unwatch = dispatcher.empty();
         }
-    } catch (std::exception& e) {
-        SYLAR_FMT_ERR("unexpected event is triggered, fd: %d, event: %d", fd, event);
     }
+    auto scheduler = ctx->scheduler.lock();
+    if (!scheduler)
+        return unwatch;
+    // removed oneshot context is only held here, its callback is moved
+    Task cb = ctx->oneshot ? Task(std::move(ctx->cb)) : Task(ctx->cb);
+    if (scheduler.get() == owner)
+        ready[ctx->priority].push_back(std::move(cb));
+    else
+        scheduler->schedule(std::move(cb), -1, ctx->priority);
+    return unwatch;
 }
 
 // clear all event
@@ -10,6 +10,7 @@
 #include <list>
 #include <memory>
 #include <functional>
+#include <unordered_map>
 #include <sys/epoll.h>
 
 namespace sylar {
@@ -40,6 +41,16 @@ protected:
      */
     virtual void idle() override;
 
+    /**
+     * @brief wake thread blocked in epoll wait
+     */
+    virtual void tickle() override;
+
+    /**
+     * @brief earlier timer is added, epoll wait timeout must be recomputed
+     */
+    virtual void on_timer_inserted_at_front() override;
+
 public:
     /**
      * @brief epoll event
@@ -93,13 +104,42 @@ public:
      */
     void del_fd_event(int fd, Event events);
 
+    /**
+     * @brief run callback once when fd is ready
+     * @details no fiber wait for the event, callback run in a new fiber when
+     *          it fire. event is removed before that, fd flags are not changed
+     *          and fd is never closed by it
+     * @param[in] fd fd
+     * @param[in] event READ or WRITE
+     * @param[in] cb callback
+     * @return false if event already exist or fd could not be watched
+     */
+    bool add_oneshot_event(int fd, Event event, std::function<void()> cb);
+
+    /**
+     * @brief cancel event without firing it, fd is kept open
+     * @param[in] fd fd
+     * @param[in] event event
+     * @return false if event is not waiting, such as already fired
+     */
+    bool cancel_fd_event(int fd, Event event);
+
+    /**
+     * @brief fire waiting event now, as if fd is ready
+     * @details parked io is retried by its fiber, closed fd make it fail
+     * @param[in] fd fd
+     * @param[in] event event
+     * @return false if event is not waiting
+     */
+    bool wake_fd_event(int fd, Event event);
+
 private:
     /**
      * @brief fd context
      * @details every fd context store all event and their callback
      */
     struct FdContext {
-        typedef Mutex MutexType;
+        typedef Spinlock MutexType;
         typedef std::shared_ptr<FdContext> ptr;
 
         /**
@@ -107,7 +147,7 @@ private:
          * @param event add event index
          * @param callback event callback
          */
-        void add_event(Event event, Scheduler::ptr sched, std::function<void()> callback);
+        bool add_event(Event event, Scheduler::ptr sched, std::function<void()> callback, bool oneshot = false);
         
         /**
          * @brief del event from dispatcher
@@ -123,8 +163,11 @@ private:
         /**
          * @brief trigger event and call callback func
          * @param event triger event index
+         * @param owner io manager polling fd
+         * @param ready callbacks for owner by class, scheduled in batch by caller
+         * @return true if oneshot event is removed and no event left
          */
-        void trigger_event(Event event);
+        bool trigger_event(Event event, Scheduler* owner, std::vector<Task>* ready);
 
         /**
          * @brief clear all event and dispatch
@@ -137,29 +180,46 @@ private:
          *          need to use context to store event callback
          */
         struct EventContext {
-            EventContext(Scheduler::ptr sched, std::function<void()> f) {
+            EventContext(Scheduler::ptr sched, std::function<void()> f, bool once = false) {
                 scheduler = sched;
                 cb = f;
+                oneshot = once;
+                priority = Scheduler::get_current_priority();
             }
             typedef std::shared_ptr<EventContext> ptr;
             /// event scheduler
             Scheduler::weak_ptr scheduler;
             // callback func
             std::function<void()> cb;
+            /// removed when fired
+            bool oneshot {false};
+            /// class of task adding event, callback run in it
+            Scheduler::Priority priority {Scheduler::NORMAL};
         };
         /// event fd
         int fd {0};
+        /// fd is added to epoll
+        bool registered {false};
         // dispatcher mutex
         MutexType mutex_ {};
         /// event dispatch
         std::map<Event, EventContext::ptr> dispatcher;
     };
 
+    /**
+     * @brief stop watching fd if no event left, context is kept for reuse
+     * @details lock must be hold
+     * @param[in] ctx fd context
+     */
+    void unwatch_fd(FdContext::ptr ctx);
+
 private:
     /// epoll create fd
     int epfd_ {0};
-    /// fd context list
-    std::vector<FdContext::ptr> fd_ctxs_;
+    /// eventfd to wake epoll wait
+    int tickle_fd_ {-1};
+    /// fd contexts by fd
+    std::unordered_map<int, FdContext::ptr> fd_ctxs_;
     /// fd mutex
     MutexType mutex_ {};
 };
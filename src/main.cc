@@ -1,17 +1,27 @@
+#include "address.h"
 #include "bytearray.h"
+#include "epoch.h"
+#include "fdmanager.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "scheduler.h"
 #include "log.h"
 #include "singleton.h"
+#include "http/http_server.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <thread>
+#include <cstdio>
 #include <cstring>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 
 void test() {
@@ -107,6 +117,378 @@ void byte_array_test() {
     SYLAR_FMT_DEBUG("byte array to string: %s", arr->to_string().c_str());
 }
 
+// resident memory of process in KiB
+size_t get_rss_kb() {
+    long pages = 0, resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// both ends of every loopback connection live in this process
+bool raise_fd_limit(size_t count) {
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur >= count)
+        return true;
+    limit.rlim_cur = count;
+    limit.rlim_max = std::max<rlim_t>(limit.rlim_max, count);
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        SYLAR_FMT_ERR("raise fd limit failed, count: %lu, err: %s", count, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// start keep-alive http server on loopback ports [port, port + ports)
+sylar::http::HttpServer::ptr start_http_server(sylar::IOManager::ptr manager, uint16_t port, size_t ports) {
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true, manager, manager, manager));
+    server->get_servlet_dispatch()->add_servlet("/test", [](sylar::http::HttpRequest::ptr req, 
+        sylar::http::HttpResponse::ptr resp, sylar::http::HttpSession::ptr session) {
+        resp->set_body("ok");
+        return 0;
+    });
+    server->get_servlet_dispatch()->add_servlet("/echo", [](sylar::http::HttpRequest::ptr req, 
+        sylar::http::HttpResponse::ptr resp, sylar::http::HttpSession::ptr session) {
+        resp->set_body(req->get_query());
+        return 0;
+    });
+    std::vector<sylar::Address::ptr> addrs, fails;
+    for (size_t index = 0; index < ports; index++)
+        addrs.emplace_back(new sylar::IPv4Address(htonl(INADDR_LOOPBACK), htons(port + index)));
+    if (!server->bind(addrs, fails) || !server->start()) {
+        SYLAR_FMT_ERR("start http server failed, port: %d", port);
+        return nullptr;
+    }
+    return server;
+}
+
+// send request and wait whole "ok" response
+bool request_once(int fd, const std::string& request) {
+    if (send(fd, request.data(), request.size(), 0) != (ssize_t)request.size())
+        return false;
+    std::string response;
+    char buf[512];
+    while (response.find("\r\n\r\nok") == std::string::npos) {
+        ssize_t count = recv(fd, buf, sizeof(buf), 0);
+        if (count <= 0)
+            return false;
+        response.append(buf, count);
+    }
+    return true;
+}
+
+// connect clients round robin over ports, each served one request then left idle
+bool open_idle_clients(uint16_t port, size_t ports, size_t count, std::vector<int>& fds) {
+    const std::string request = "GET /test HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (size_t index = 0; index < count; index++) {
+        sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        server_addr.sin_port = htons(port + index % ports);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            SYLAR_FMT_ERR("connect idle client failed, index: %lu, err: %s", index, strerror(errno));
+            if (fd != -1)
+                close(fd);
+            return false;
+        }
+        fds.push_back(fd);
+        if (!request_once(fd, request)) {
+            SYLAR_FMT_ERR("idle client request failed, index: %lu", index);
+            return false;
+        }
+    }
+    return true;
+}
+
+void idle_connection_test(size_t count = 100000) {
+    // one client address reach one port from ~28k ephemeral ports
+    const uint16_t port = 12350;
+    const size_t ports = (count + 19999) / 20000;
+    if (!raise_fd_limit(count * 2 + 1024))
+        return;
+    sylar::IOManager::ptr manager(new sylar::IOManager(2, false, "Idle Test"));
+    std::thread([manager]() { manager->start(); }).detach();
+    auto server = start_http_server(manager, port, ports);
+    if (!server)
+        return;
+    // idle connections must stay through measure
+    server->set_keepalive_timeout(0);
+    std::vector<int> fds;
+    fds.reserve(count + 1);
+    // warm up fiber pool and allocator before baseline
+    if (!open_idle_clients(port, 1, 1, fds))
+        return;
+    sleep(1);
+    size_t before = get_rss_kb();
+    if (!open_idle_clients(port, ports, count, fds))
+        return;
+    // let last connection be parked
+    sleep(1);
+    size_t after = get_rss_kb();
+    size_t per_conn = after > before ? (after - before) * 1024 / count : 0;
+    SYLAR_FMT_INFO("idle connections: %lu, rss: %lu KiB -> %lu KiB, per connection: %lu bytes",
+        server->get_connection_count(), before, after, per_conn);
+    if (server->get_connection_count() != count + 1 || per_conn >= 2048)
+        SYLAR_ERR("idle connection test failed, expect every idle connection under 2 KiB");
+    else
+        SYLAR_INFO("idle connection test passed");
+    // client close first, port is not held by TIME_WAIT of server side
+    for (int fd : fds)
+        close(fd);
+    sleep(1);
+    server->stop();
+}
+
+void keepalive_timeout_test(size_t count = 10000) {
+    const uint16_t port = 12360;
+    const size_t ports = (count + 19999) / 20000;
+    const uint64_t timeout_ms = 5000;
+    if (!raise_fd_limit(count * 2 + 1024))
+        return;
+    sylar::IOManager::ptr manager(new sylar::IOManager(2, false, "Keepalive Test"));
+    std::thread([manager]() { manager->start(); }).detach();
+    auto server = start_http_server(manager, port, ports);
+    if (!server)
+        return;
+    server->set_keepalive_timeout(timeout_ms);
+    std::vector<int> fds;
+    fds.reserve(count);
+    size_t before = get_rss_kb();
+    if (!open_idle_clients(port, ports, count, fds))
+        return;
+    size_t idle = server->get_connection_count();
+    size_t after = get_rss_kb();
+    size_t per_conn = after > before ? (after - before) * 1024 / count : 0;
+    SYLAR_FMT_INFO("idle connections: %lu, rss: %lu KiB -> %lu KiB, per connection: %lu bytes",
+        idle, before, after, per_conn);
+    // idle connections are closed by server after timeout
+    sleep(timeout_ms / 1000 + 2);
+    size_t closed = 0;
+    char buf[64];
+    for (int fd : fds) {
+        if (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == 0)
+            closed++;
+        close(fd);
+    }
+    SYLAR_FMT_INFO("after keepalive timeout, closed by server: %lu, left: %lu, rss: %lu KiB",
+        closed, server->get_connection_count(), get_rss_kb());
+    if (idle != count || closed != count || server->get_connection_count() != 0)
+        SYLAR_ERR("keepalive timeout test failed, idle connection is not closed in time");
+    else
+        SYLAR_INFO("keepalive timeout test passed");
+    server->stop();
+}
+
+// entry published to readers, canary is wiped when freed
+struct EpochNode {
+    ~EpochNode() { canary = 0; }
+    uint64_t canary {0x600d};
+};
+
+// freed entries, deleter of epoch cannot capture
+std::atomic<uint64_t> epoch_freed {0};
+
+// build with -fsanitize=thread, every reader must only see live entries
+void epoch_stress_test(int milliseconds = 2000) {
+    std::atomic<EpochNode*> shared {new EpochNode};
+    std::atomic<bool> stop {false};
+    std::atomic<uint64_t> reads {0}, bad {0}, retired {0};
+    auto check = [&](EpochNode* node) {
+        if (node->canary != 0x600d)
+            bad++;
+        reads++;
+    };
+    std::vector<std::thread> threads;
+    // plain thread read inside guard
+    for (int index = 0; index < 2; index++) {
+        threads.emplace_back([&]() {
+            while (!stop) {
+                sylar::EpochGuard guard;
+                check(shared.load(std::memory_order_acquire));
+            }
+        });
+    }
+    // writer unlink entry and retire it
+    threads.emplace_back([&]() {
+        while (!stop) {
+            EpochNode* old = shared.exchange(new EpochNode, std::memory_order_acq_rel);
+            sylar::Epoch::retire(old, [](void* ptr) {
+                delete static_cast<EpochNode*>(ptr);
+                epoch_freed++;
+            });
+            retired++;
+        }
+        while (sylar::Epoch::reclaim() > 0)
+            usleep(100);
+    });
+    // scheduler worker read without guard, quiescent between tasks
+    sylar::IOManager::ptr manager(new sylar::IOManager(2, false, "Epoch Test"));
+    std::thread([manager]() { manager->start(); }).detach();
+    std::atomic<int> inflight {0};
+    threads.emplace_back([&]() {
+        while (!stop) {
+            if (inflight >= 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            inflight++;
+            manager->schedule([&]() {
+                for (int index = 0; index < 100; index++)
+                    check(shared.load(std::memory_order_acquire));
+                inflight--;
+            });
+        }
+    });
+    // fd table churn on real fds, high fds grow table under readers
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        SYLAR_FMT_ERR("create pipe failed, err: %s", strerror(errno));
+        return;
+    }
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    int max_fd = std::min<rlim_t>(limit.rlim_cur, 65536) - 1;
+    std::vector<int> owned[2];
+    for (int fd = 1000; fd < max_fd; fd += 7) {
+        if (dup2(pipe_fds[0], fd) != -1)
+            owned[fd / 7 % 2].push_back(fd);
+    }
+    for (int index = 0; index < 2; index++) {
+        threads.emplace_back([&, index]() {
+            auto fd_manager = sylar::FdMgr::get_instance();
+            for (bool replace = false; !stop; replace = !replace) {
+                for (int fd : owned[index]) {
+                    fd_manager->add_fdctx(fd, replace);
+                    auto ctx = fd_manager->get_fdctx(fd);
+                    if (!ctx || ctx->get_fd() != fd)
+                        bad++;
+                    if (!replace)
+                        fd_manager->del_fdctx(fd);
+                }
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        auto fd_manager = sylar::FdMgr::get_instance();
+        while (!stop) {
+            for (int fd = 1000; fd < max_fd; fd += 7) {
+                auto ctx = fd_manager->get_fdctx(fd);
+                if (ctx && ctx->get_fd() != fd)
+                    bad++;
+            }
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop = true;
+    for (auto& thread : threads)
+        thread.join();
+    while (inflight > 0)
+        usleep(1000);
+    for (auto& fds : owned) {
+        for (int fd : fds)
+            close(fd);
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    SYLAR_FMT_INFO("epoch stress reads: %lu, bad: %lu, retired: %lu, freed: %lu, epoch: %lu",
+        reads.load(), bad.load(), retired.load(), epoch_freed.load(), sylar::Epoch::get_epoch());
+    if (bad != 0 || epoch_freed != retired)
+        SYLAR_ERR("epoch stress test failed");
+    else
+        SYLAR_INFO("epoch stress test passed");
+}
+
+// read one response with content length, rest bytes are kept in buf
+bool read_response(int fd, std::string& buf, std::string& body) {
+    char data[16 * 1024];
+    size_t end = 0;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t count = recv(fd, data, sizeof(data), 0);
+        if (count <= 0)
+            return false;
+        buf.append(data, count);
+    }
+    std::string header = buf.substr(0, end);
+    std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+    size_t pos = header.find("content-length:");
+    size_t length = pos == std::string::npos ? 0 : strtoul(header.c_str() + pos + 15, nullptr, 10);
+    while (buf.size() < end + 4 + length) {
+        ssize_t count = recv(fd, data, sizeof(data), 0);
+        if (count <= 0)
+            return false;
+        buf.append(data, count);
+    }
+    body = buf.substr(end + 4, length);
+    buf.erase(0, end + 4 + length);
+    return true;
+}
+
+void pipelined_load_test(size_t clients = 8, size_t depth = 16, int seconds = 5) {
+    const uint16_t port = 12370;
+    sylar::IOManager::ptr manager(new sylar::IOManager(2, false, "Pipeline Test"));
+    std::thread([manager]() { manager->start(); }).detach();
+    auto server = start_http_server(manager, port, 1);
+    if (!server)
+        return;
+    std::atomic<uint64_t> responses {0}, bad {0};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    std::vector<std::thread> threads;
+    for (size_t index = 0; index < clients; index++) {
+        threads.emplace_back([&]() {
+            std::vector<int> fds;
+            if (!open_idle_clients(port, 1, 1, fds)) {
+                bad++;
+                return;
+            }
+            int fd = fds[0];
+            std::string buf, body;
+            uint64_t seq = 0;
+            while (std::chrono::steady_clock::now() < deadline) {
+                // whole batch in one write, responses must come back in order
+                std::string batch;
+                for (size_t count = 0; count < depth; count++) {
+                    batch += "GET /echo?" + std::to_string(seq + count) 
+                        + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+                }
+                if (send(fd, batch.data(), batch.size(), 0) != (ssize_t)batch.size()) {
+                    bad++;
+                    break;
+                }
+                for (size_t count = 0; count < depth; count++, seq++) {
+                    if (!read_response(fd, buf, body)) {
+                        bad++;
+                        close(fd);
+                        return;
+                    }
+                    if (body != std::to_string(seq))
+                        bad++;
+                    responses++;
+                }
+            }
+            close(fd);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    SYLAR_FMT_INFO("pipelined clients: %lu, depth: %lu, responses: %lu, bad: %lu, requests per second: %lu",
+        clients, depth, responses.load(), bad.load(), responses.load() / seconds);
+    if (bad != 0 || responses == 0)
+        SYLAR_ERR("pipelined load test failed");
+    else
+        SYLAR_INFO("pipelined load test passed");
+    server->stop();
+}
+
 int main () {
     // init log
     sylar::Singleton<sylar::Logger>::get_instance()->init_default();
@@ -114,6 +496,10 @@ int main () {
     // scheduler_thread_test();
     // scheduler_test();
     // io_manager_test();
+    // idle_connection_test();
+    // keepalive_timeout_test();
+    // epoch_stress_test();
+    // pipelined_load_test();
     byte_array_test();
 
     return 1;
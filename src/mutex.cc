@@ -1,33 +1,58 @@
 #include "mutex.h"
 #include "log.h"
 
-#include <iostream>
-#include <exception>
-
+#include <algorithm>
+#include <climits>
 
 #include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 
 namespace sylar {
 
-Mutex::Mutex() {
-    pthread_mutex_init(&mutex_, nullptr);
+/// spin limit of mutex, about a few us
+static const int s_max_spins = 200;
+
+/**
+ * @brief sleep while word still equals value
+ */
+static void futex_wait(void* addr, int value) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
 }
 
-Mutex::~Mutex() {
-    pthread_mutex_destroy(&mutex_);
+/**
+ * @brief wake sleepers of word
+ */
+static void futex_wake(void* addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
 }
 
-void Mutex::lock() {
-    try {
-        pthread_mutex_lock(&mutex_);
-    } catch (std::exception& e) {
-        std::cout << "lock failed " << e.what() << std::endl;
+void Mutex::lock_slow() {
+    int spins = spins_.load(std::memory_order_relaxed);
+    int limit = std::min(s_max_spins, spins * 2 + 10);
+    int count = 0;
+    for (; count < limit; count++) {
+        cpu_relax();
+        if (state_.load(std::memory_order_relaxed) == 0 && try_lock())
+            break;
     }
+    // owner of lock keep the average, race is harmless
+    spins_.store(spins + (count - spins) / 8, std::memory_order_relaxed);
+    if (count < limit)
+        return;
+    lock_contended();
+}
+
+void Mutex::lock_contended() {
+    while (state_.exchange(2, std::memory_order_acquire) != 0)
+        futex_wait(&state_, 2);
 }
 
-void Mutex::unlock() {
-    pthread_mutex_unlock(&mutex_);
+void Mutex::wake() {
+    futex_wake(&state_, 1);
 }
 
 RWMutex::RWMutex() {
@@ -50,38 +75,76 @@ void RWMutex::unlock() {
     pthread_rwlock_unlock(&lock_);
 }
 
-ConditionBlock::ConditionBlock(Mutex& mutex) {
-    // init condition
-    pthread_cond_init(&cond_, nullptr);
-    // init mutex
-    mutex_ = mutex.mutex_;
+PerCpuRWMutex::PerCpuRWMutex() {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    uint32_t size = 1;
+    while (size < cpus && size < 64)
+        size <<= 1;
+    slots_.reset(new Slot[size]);
+    mask_ = size - 1;
+}
+
+uint32_t PerCpuRWMutex::init_slot() {
+    static std::atomic<uint32_t> s_next {0};
+    int cpu = sched_getcpu();
+    // cpu unknown, spread threads round robin
+    if (cpu < 0)
+        return s_next.fetch_add(1, std::memory_order_relaxed);
+    return cpu;
 }
 
-ConditionBlock::~ConditionBlock() {
-    // destory condition
-    pthread_cond_destroy(&cond_);
+void PerCpuRWMutex::rdlock_slow(Slot& slot) {
+    do {
+        slot.readers.fetch_sub(1, std::memory_order_release);
+        for (int spins = 0; writer_.load(std::memory_order_acquire) != 0; spins++) {
+            if (spins < 100)
+                cpu_relax();
+            else
+                futex_wait(&writer_, 1);
+        }
+        slot.readers.fetch_add(1);
+    } while (writer_.load() != 0);
+}
+
+void PerCpuRWMutex::wrlock() {
+    writer_mutex_.lock();
+    writer_.store(1);
+    // store above must not pass loads below, readers do the reverse
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // readers back off once they see writer, only current ones are waited
+    for (uint32_t i = 0; i <= mask_; i++) {
+        for (int spins = 0; slots_[i].readers.load(std::memory_order_seq_cst) != 0; spins++) {
+            if (spins < 128)
+                cpu_relax();
+            else
+                sched_yield();
+        }
+    }
+}
+
+void PerCpuRWMutex::wrunlock() {
+    writer_.store(0, std::memory_order_release);
+    futex_wake(&writer_, INT_MAX);
+    writer_mutex_.unlock();
 }
 
 void ConditionBlock::signal() {
-    if (!blocked_) 
-        return;
-    blocked_ = false;
-    // signal once
-    pthread_cond_signal(&cond_);
+    seq_.fetch_add(1, std::memory_order_release);
+    futex_wake(&seq_, 1);
 }
 
 void ConditionBlock::broadcast() {
-    if (!blocked_) 
-        return;
-    blocked_ = false;
-    pthread_cond_broadcast(&cond_);
+    seq_.fetch_add(1, std::memory_order_release);
+    futex_wake(&seq_, INT_MAX);
 }
 
 void ConditionBlock::wait() {
-    blocked_ = true;
-    pthread_mutex_lock(&mutex_);
-    pthread_cond_wait(&cond_, &mutex_);
-    pthread_mutex_unlock(&mutex_);
+    // read with mutex hold, signal after condition change bump it
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    mutex_.unlock();
+    futex_wait(&seq_, (int)seq);
+    // other waiters may sleep on mutex, unlock must wake them
+    mutex_.lock_contended();
 }
 
-}
\ No newline at end of file
+}
@@ -3,10 +3,26 @@
 
 #include "noncopyable.h"
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
 #include <pthread.h>
+#include <sched.h>
 
 namespace sylar {
 
+/**
+ * @brief hint cpu inside spin loop
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
 
 template<typename T>
 class ScopedLockImpl {
@@ -81,7 +97,7 @@ public:
         if (!locked_)
             return;
         locked_ = false;
-        lock_.unlock();           
+        lock_.rdunlock();           
     }
 
 private:
@@ -116,7 +132,7 @@ public:
         if (!locked_)
             return;
         locked_ = false;
-        lock_.unlock();           
+        lock_.wrunlock();           
     }
 
 private:
@@ -167,8 +183,6 @@ public:
 private:
     /// condition variant
     T& con_;
-    /// condition is blocked
-    bool blocked_ {false};
 };
 
 class ConditionBlock;
@@ -198,6 +212,16 @@ public:
      */
     void unlock();
 
+    /**
+     * @brief unlock read lock
+     */
+    void rdunlock() { unlock(); }
+
+    /**
+     * @brief unlock write lock
+     */
+    void wrunlock() { unlock(); }
+
     /**
      * @brief Destroy the RWMutex object
      */
@@ -207,74 +231,266 @@ private:
 };
 
 
+/**
+ * @brief futex mutex with adaptive spinning
+ * @details state is 0 unlocked, 1 locked, 2 locked and maybe waited. lock
+ *          spin about twice as long as it took to get lock recently, then
+ *          sleep on futex. unlock only enter kernel when someone may sleep
+ */
 class Mutex : Noncopyable {
 public:
     friend class ConditionBlock;
     typedef ScopedLockImpl<Mutex> Lock;
+
     /**
-     * @brief Construct a new Mutex object
+     * @brief lock 
      */
-    Mutex();
+    void lock() {
+        int state = 0;
+        if (!state_.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            lock_slow();
+    }
 
     /**
-     * @brief Destroy the Mutex object
+     * @brief try lock without waiting
      */
-    ~Mutex();
+    bool try_lock() {
+        int state = 0;
+        return state_.compare_exchange_strong(state, 1, std::memory_order_acquire);
+    }
 
     /**
-     * @brief lock 
+     * @brief unlock
+     */
+    void unlock() {
+        if (state_.exchange(0, std::memory_order_release) == 2)
+            wake();
+    }
+
+private:
+    /**
+     * @brief spin then sleep until lock is taken
+     */
+    void lock_slow();
+
+    /**
+     * @brief take lock as waited, so unlock wake next sleeper
+     */
+    void lock_contended();
+
+    /**
+     * @brief wake one sleeper
      */
-    void lock();
+    void wake();
+
+private:
+    /// lock state
+    std::atomic<int> state_ {0};
+    /// average spins to get lock, guide next spin
+    std::atomic<int> spins_ {0};
+};
+
+/**
+ * @brief test and test-and-set spinlock
+ * @details for tiny sections never block. waiter spin on plain load, so
+ *          cache line is not bounced until lock looks free, and yield cpu
+ *          when owner is preempted
+ */
+class Spinlock : Noncopyable {
+public:
+    typedef ScopedLockImpl<Spinlock> Lock;
+
+    /**
+     * @brief lock
+     */
+    void lock() {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            uint32_t spins = 0;
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (++spins < 128)
+                    cpu_relax();
+                else
+                    sched_yield();
+            }
+        }
+    }
+
+    /**
+     * @brief try lock without waiting
+     */
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+    }
 
     /**
      * @brief unlock
      */
-    void unlock();
+    void unlock() { locked_.store(false, std::memory_order_release); }
 
 private:
-    /// pthread mutex
-    pthread_mutex_t mutex_;
+    /// locked
+    std::atomic<bool> locked_ {false};
 };
 
-class ConditionBlock : Noncopyable {
+/**
+ * @brief reader biased rwlock with per cpu reader slots
+ * @details reader count itself in slot of cpu its thread first ran on, so
+ *          read locks on different cores share no cache line. writer stop
+ *          new readers, then wait until every slot is drained. write is
+ *          slow, use it for tables read on every request and rarely changed.
+ *          read section must not yield, writer spins until it ends
+ */
+class PerCpuRWMutex : Noncopyable {
 public:
-    typedef ConditionImpl<ConditionBlock> Block;
     /**
-     * @brief Construct a new Condition Block object
+     * @brief scoped read lock, release the slot it locked
      */
-    
-    ConditionBlock(Mutex& mutex);
+    class ReadLock {
+    public:
+        ReadLock(PerCpuRWMutex& lck): lock_(lck) {
+            lock();
+        }
+
+        ~ReadLock() {
+            unlock();
+        }
+
+        void lock() {
+            if (locked_)
+                return;
+            locked_ = true;
+            slot_ = lock_.rdlock();
+        }
+
+        void unlock() {
+            if (!locked_)
+                return;
+            locked_ = false;
+            lock_.rdunlock(slot_);
+        }
+
+    private:
+        /// lock member
+        PerCpuRWMutex& lock_;
+        /// slot counted in
+        uint32_t slot_ {0};
+        /// lock state
+        bool locked_ {false};
+    };
+    typedef WriteScopeLockImpl<PerCpuRWMutex> WriteLock;
 
     /**
-     * @brief Destroy the Condition Block object
+     * @brief Construct a new Per Cpu RWMutex object, one slot per cpu
      */
-    ~ConditionBlock();
+    PerCpuRWMutex();
 
     /**
-     * @brief emit signal
+     * @brief add read lock
+     * @return slot counted in, pass it to rdunlock
      */
-    void signal();
+    uint32_t rdlock() {
+        uint32_t index = get_slot() & mask_;
+        Slot& slot = slots_[index];
+        // pairs with writer, it see this reader or reader see it
+        slot.readers.fetch_add(1);
+        if (writer_.load() != 0)
+            rdlock_slow(slot);
+        return index;
+    }
 
     /**
-     * @brief broadcast signal
+     * @brief unlock read lock
+     * @param[in] slot returned by rdlock, not the one of current thread
      */
-    void broadcast();
+    void rdunlock(uint32_t slot) {
+        slots_[slot].readers.fetch_sub(1, std::memory_order_release);
+    }
 
     /**
-     * @brief wait signal
+     * @brief add write lock
+     */
+    void wrlock();
+
+    /**
+     * @brief unlock write lock
      */
-    void wait();    
+    void wrunlock();
+
 private:
-    /// condition variant
-    pthread_cond_t cond_;
-    /// mutex
-    pthread_mutex_t mutex_;
-    /// block state
-    bool blocked_;
+    /**
+     * @brief reader count of one cpu, own cache line
+     */
+    struct alignas(64) Slot {
+        std::atomic<int> readers {0};
+    };
+
+    /**
+     * @brief slot of current thread, taken from cpu on first use
+     */
+    static uint32_t get_slot() {
+        static thread_local uint32_t slot = init_slot();
+        return slot;
+    }
+
+    /**
+     * @brief pick slot of current thread
+     */
+    static uint32_t init_slot();
+
+    /**
+     * @brief back off and wait for writer
+     * @param[in] slot slot counted in
+     */
+    void rdlock_slow(Slot& slot);
+
+private:
+    /// reader slots
+    std::unique_ptr<Slot[]> slots_ {};
+    /// slot count - 1
+    uint32_t mask_ {0};
+    /// writer hold or drain, readers sleep on it
+    alignas(64) std::atomic<int> writer_ {0};
+    /// serialize writers
+    Mutex writer_mutex_ {};
 };
 
+/**
+ * @brief condition variable bound to a Mutex
+ * @details waiter sleep on sequence read with mutex hold, so signal after
+ *          condition is changed under mutex is never lost
+ */
+class ConditionBlock : Noncopyable {
+public:
+    typedef ConditionImpl<ConditionBlock> Block;
 
+    /**
+     * @brief Construct a new Condition Block object
+     * @param[in] mutex mutex guarding condition
+     */
+    ConditionBlock(Mutex& mutex) : mutex_(mutex) {}
 
+    /**
+     * @brief wake one waiter
+     */
+    void signal();
+
+    /**
+     * @brief wake all waiters
+     */
+    void broadcast();
+
+    /**
+     * @brief wait signal, mutex must be hold and is released while waiting
+     * @details could wake spuriously, check condition in loop
+     */
+    void wait();
+
+private:
+    /// bound mutex
+    Mutex& mutex_;
+    /// bumped by every signal
+    std::atomic<uint32_t> seq_ {0};
+};
 
 }
 
@@ -1,9 +1,12 @@
 #include "scheduler.h"
+#include "epoch.h"
 #include "fiber.h"
 #include "log.h"
 #include "mutex.h"
 #include "thread.h"
+#include "utils.h"
 
+#include <algorithm>
 #include <cctype>
 #include <cstddef>
 #include <memory>
@@ -20,6 +23,12 @@ static thread_local Fiber::ptr schedule_fiber = nullptr;
 static thread_local bool is_scheduler = false;
 /// scheduler
 static Scheduler::ptr main_scheduler;
+/// scheduler running on this thread
+static thread_local Scheduler* t_scheduler = nullptr;
+/// fiber of task running on this thread
+static thread_local Fiber* t_task_fiber = nullptr;
+/// virtual time a pick cost for each class, weights are 16:4:1
+static const uint64_t s_strides[Scheduler::INHERIT] = {1, 4, 16};
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name):
 thread_num_(threads) , use_caller_(use_caller), name_(name) {
@@ -34,7 +43,9 @@ thread_num_(threads) , use_caller_(use_caller), name_(name) {
 
     for (int index = 0; index < thread_num_; index++) {
         // create thread and run
-        Thread::ptr thread(new Thread(std::bind(&Scheduler::run, this), "thread_" + std::to_string(index)));
+        // named after scheduler, index is kept in 15 chars of kernel name
+        std::string suffix = "_" + std::to_string(index);
+        Thread::ptr thread(new Thread(std::bind(&Scheduler::run, this), name_.substr(0, 15 - suffix.size()) + suffix));
         // push thread into vec
         threads_.push_back(thread);
     }
@@ -83,6 +94,13 @@ void Scheduler::stop() {
     thread_ids_.clear();
 }
 
+void Scheduler::set_cpus(const std::vector<int>& cpus) {
+    if (cpus.empty())
+        return;
+    for (size_t i = 0; i < threads_.size(); i++)
+        threads_[i]->set_cpus({cpus[i % cpus.size()]});
+}
+
 bool Scheduler::is_scheduler_fiber() {
     return is_scheduler;
 }
@@ -91,68 +109,171 @@ Fiber::ptr Scheduler::get_schedule_fiber() {
     return schedule_fiber;
 }
 
-void Scheduler::schedule(std::function<void ()> cb, int thr) {
+Scheduler* Scheduler::get_this() {
+    return t_scheduler;
+}
+
+void Scheduler::set_this(Scheduler* scheduler) {
+    t_scheduler = scheduler;
+}
+
+Scheduler::Priority Scheduler::get_current_priority() {
+    return t_task_fiber ? (Priority)t_task_fiber->get_priority() : NORMAL;
+}
+
+void Scheduler::set_current_priority(Priority priority) {
+    if (t_task_fiber && priority != INHERIT)
+        t_task_fiber->set_priority(priority);
+}
+
+void Scheduler::schedule(Task cb, int thr, Priority priority) {
     // SYLAR_DEBUG("schedule add task");
-    task_push(ScheduleTask::ptr(new ScheduleTask(cb, use_caller_,thr)));
+    task_push(ScheduleTask(std::move(cb), thr), priority);
 }
 
-void Scheduler::schedule(Fiber::ptr fiber, int thr) {
+void Scheduler::schedule(Fiber::ptr fiber, int thr, Priority priority) {
     // SYLAR_DEBUG("schedule add task");
-    task_push(ScheduleTask::ptr(new ScheduleTask(fiber, thr)));
+    task_push(ScheduleTask(std::move(fiber), thr), priority);
 }
 
 // run scheduler
 void Scheduler::run() {
     SYLAR_INFO("scheduler run");
+    set_this(this);
+    // hooked io of tasks park fiber instead of blocking worker
+    SystemInfo::set_hook_enabled(hook_enabled_);
+    // worker read lock free tables without guard, quiescent between tasks
+    Epoch::online();
     // create idle fiber
     Fiber::get_this();
 
+    // fiber running callbacks, reused while they finish without parking
+    Fiber::ptr cb_fiber;
+    ScheduleTask task;
     while(true) {
         // check if is empty
-        ScheduleTask::ptr task = task_pop();
-        // std::weak_ptr<ScheduleTask> task_weak(task);
-        // SYLAR_FMT_DEBUG(">>>>>> schedule task, expired: %d, use count: %d", task_weak.expired(), task_weak.use_count());
-        if (task != nullptr)
-            task->execute();
+        if (task_pop(task)) {
+            Fiber::ptr fiber = std::move(task.fiber);
+            if (task.cb) {
+                if (cb_fiber)
+                    cb_fiber->reset(std::move(task.cb));
+                else
+                    cb_fiber.reset(new Fiber(std::move(task.cb), 0, use_caller_));
+                cb_fiber->set_priority(task.priority);
+                fiber = cb_fiber;
+            }
+            t_task_fiber = fiber.get();
+            Fiber::State state = fiber->resume();
+            t_task_fiber = nullptr;
+            // parked callback is owned by its waker now
+            if (fiber == cb_fiber && state != Fiber::State::Term)
+                cb_fiber.reset();
+        }
+        Epoch::quiescent();
     }
     SYLAR_INFO("scheduler stop");
 }
 
 void Scheduler::idle() {
     SYLAR_INFO("all tasks execute finished, idle scheduler");
-    // wait here
-    ConditionBlock::Block block(cond_);
-    block.wait();
+    // wait here, task pushed after check is signaled
+    Epoch::offline();
+    {
+        MutexType::Lock lock(mutex_);
+        while (task_count_ == 0)
+            cond_.wait();
+    }
+    Epoch::online();
     // SYLAR_DEBUG("at least one task is added, exit idle");
 }
 
 bool Scheduler::is_tasks_empty() {
     MutexType::Lock lock(mutex_);
-    return tasks_.empty();
+    return task_count_ == 0;
 }
 
-void Scheduler::task_push(ScheduleTask::ptr task) {
-    MutexType::Lock lock(mutex_);
-    tasks_.push_back(std::move(task));
+void Scheduler::tickle() {
     ConditionBlock::Block block(cond_);
     block.signal();
 }
 
-Scheduler::ScheduleTask::ptr Scheduler::task_pop() {
+void Scheduler::task_push(ScheduleTask&& task, Priority priority) {
+    size_t count = 0;
+    {
+        MutexType::Lock lock(mutex_);
+        count = std::min(task_push_locked(std::move(task), priority), idle_workers_);
+    }
+    wake(count);
+}
+
+size_t Scheduler::task_push_locked(ScheduleTask&& task, Priority priority) {
+    if (task.fiber) {
+        // woken fiber keep its own class
+        if (priority != INHERIT)
+            task.fiber->set_priority(priority);
+        task.priority = task.fiber->get_priority();
+    } else if (task.cb) {
+        // spawned task run in class of its parent, such as connection fiber
+        task.priority = priority == INHERIT ? get_current_priority() : priority;
+    } else {
+        return 0;
+    }
+    if (task.priority < HIGH || task.priority >= INHERIT)
+        task.priority = NORMAL;
+    auto& tasks = tasks_[task.priority];
+    // class idle for a while could not bank time and flood others
+    if (tasks.empty() && passes_[task.priority] < pass_)
+        passes_[task.priority] = pass_;
+    tasks.push_back(std::move(task));
+    task_count_++;
+    return 1;
+}
+
+void Scheduler::wake(size_t count) {
+    for (size_t i = 0; i < count; i++)
+        tickle();
+}
+
+bool Scheduler::task_pop(ScheduleTask& task) {
     // check if tasks is empty, if is should call idle to wait
-    if (is_tasks_empty()) {
-        Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this), 0, use_caller_, "idle"));
-        idle_fiber->resume();
+    bool empty = false;
+    {
+        MutexType::Lock lock(mutex_);
+        empty = task_count_ == 0;
+        // counted in lock, task pushed after check see it and tickle
+        if (empty)
+            idle_workers_++;
+    }
+    if (empty) {
+        // idle always return, its fiber is reused
+        static thread_local Fiber::ptr t_idle_fiber;
+        if (t_idle_fiber)
+            t_idle_fiber->reset(std::bind(&Scheduler::idle, this));
+        else
+            t_idle_fiber.reset(new Fiber(std::bind(&Scheduler::idle, this), 0, use_caller_, "idle"));
+        if (t_idle_fiber->resume() != Fiber::State::Term)
+            t_idle_fiber.reset();
     }
     // if is not empty， pop one elem
     MutexType::Lock lock(mutex_);
-    if (!tasks_.empty()) {
-        ScheduleTask::ptr task = tasks_.front();
-        tasks_.pop_front();
-        return task;
+    if (empty)
+        idle_workers_--;
+    // stride scheduling, class with least virtual time go first, tie to higher
+    int chosen = -1;
+    for (int i = HIGH; i < INHERIT; i++) {
+        if (!tasks_[i].empty() && (chosen < 0 || passes_[i] < passes_[chosen]))
+            chosen = i;
+    }
+    if (chosen >= 0) {
+        pass_ = passes_[chosen];
+        passes_[chosen] += s_strides[chosen];
+        task = std::move(tasks_[chosen].front());
+        tasks_[chosen].pop_front();
+        task_count_--;
+        return true;
     }
     SYLAR_WARN("non task is poped");
-    return nullptr;
+    return false;
 }
 
-}
\ No newline at end of file
+}
@@ -3,9 +3,12 @@
 
 #include "mutex.h"
 #include "fiber.h"
+#include "task.h"
 #include "thread.h"
 
-#include <list>
+#include <algorithm>
+#include <deque>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,6 +24,23 @@ public:
 
     typedef Mutex MutexType;
     typedef ConditionBlock ConditionType;
+
+    /**
+     * @brief scheduling class of task
+     * @details classes have own queues and are picked by weight, so high
+     *          task overtake queued batch work while background still get
+     *          its share
+     */
+    enum Priority {
+        /// latency sensitive, such as request fibers
+        HIGH = 0,
+        /// default
+        NORMAL = 1,
+        /// batch work, such as log shipping and cache refresh
+        BACKGROUND = 2,
+        /// class of running task, normal outside task. fiber keep own class
+        INHERIT = 3,
+    };
     /**
      * @brief Construct a new Scheduler object
      * @param threads thread numeber
@@ -44,19 +64,63 @@ public:
      */
     virtual void stop();
 
+    /**
+     * @brief Set the cpus object, pin workers, call before start
+     * @details worker i run on cpus[i % size], caller thread is not pinned.
+     *          worker memory touched first, such as fiber stacks, is then
+     *          placed on numa node of its cpu
+     * @param[in] cpus cpu list, see SystemInfo::parse_cpu_list
+     */
+    void set_cpus(const std::vector<int>& cpus);
+
+    /**
+     * @brief Get the threads object, worker threads
+     */
+    const std::vector<Thread::ptr>& get_threads() { return threads_; }
+
     /**
      * @brief schedule func
      * @param cb fiber func
      * @param thread thread id
+     * @param priority scheduling class, inherited from running task by default
      */
-    virtual void schedule(std::function<void()> cb, int thread = -1);
+    virtual void schedule(Task cb, int thread = -1, Priority priority = INHERIT);
 
     /**
      * @brief schedule func
      * @param fiber fiber
      * @param thread thread id
+     * @param priority scheduling class, class of fiber by default
+     */
+    virtual void schedule(Fiber::ptr fiber = nullptr, int thread = -1, Priority priority = INHERIT);
+
+    /**
+     * @brief schedule many tasks with one lock and at most one wake per idle worker
+     * @param[in] begin first item, callable or Fiber::ptr, moved out
+     * @param[in] end end of items
+     * @param[in] priority scheduling class of all items
+     */
+    template<typename Iterator>
+    void schedule_batch(Iterator begin, Iterator end, Priority priority = INHERIT) {
+        size_t count = 0;
+        {
+            MutexType::Lock lock(mutex_);
+            for (; begin != end; ++begin)
+                count += task_push_locked(ScheduleTask(std::move(*begin), -1), priority);
+            count = std::min(count, idle_workers_);
+        }
+        wake(count);
+    }
+
+    /**
+     * @brief schedule all items of range, see schedule_batch above
+     * @param[in] range container of callables or Fiber::ptr, moved out
+     * @param[in] priority scheduling class of all items
      */
-    virtual void schedule(Fiber::ptr fiber = nullptr, int thread = -1);
+    template<typename Range>
+    void schedule_batch(Range&& range, Priority priority = INHERIT) {
+        schedule_batch(std::begin(range), std::end(range), priority);
+    }
 
     /**
      * @brief check if current fiber is in main thread 
@@ -73,6 +137,32 @@ public:
      */
     static Scheduler::ptr get_scheduler();
 
+    /**
+     * @brief scheduler running on current thread
+     * @return nullptr if thread is not a worker
+     */
+    static Scheduler* get_this();
+
+    /**
+     * @brief Set the this object
+     * @param[in] scheduler scheduler running on current thread
+     */
+    static void set_this(Scheduler* scheduler);
+
+    /**
+     * @brief Get the current priority object, class of running task
+     * @return NORMAL outside task
+     */
+    static Priority get_current_priority();
+
+    /**
+     * @brief Set the current priority object, running task change class
+     * @details take effect when task is scheduled again, tasks it spawn
+     *          inherit it
+     * @param[in] priority scheduling class, not INHERIT
+     */
+    static void set_current_priority(Priority priority);
+
 protected:
     /**
      * @brief run scheduler
@@ -84,13 +174,24 @@ protected:
      */
     virtual void idle();
 
+    /**
+     * @brief wake idle thread, task is added
+     */
+    virtual void tickle();
+
+protected:
+    /// workers enable io hook, set by subclass before start
+    bool hook_enabled_ {false};
+
 private:
     /**
      * @brief schedule task item
      */
+    /**
+     * @details queued by value. callback get a fiber only when it run,
+     *          finished one is reused by next callback on that worker
+     */
     struct ScheduleTask {
-        typedef std::shared_ptr<ScheduleTask> ptr;
-
         /**
          * @brief Construct a new Schedule Task object
          */
@@ -101,55 +202,23 @@ private:
          * @param f fiber func
          * @param thr thread id
          */
-        ScheduleTask(Fiber::ptr f, int thr): fiber(f), thread(thr) {}
+        ScheduleTask(Fiber::ptr f, int thr): fiber(std::move(f)), thread(thr) {}
 
         /**
          * @brief Construct a new Schedule Task object
          * @param f execute func
          * @param thr thread id 
          */
-        ScheduleTask(std::function<void()> f, bool use_caller = true, int thr = -1) {
-            fiber = Fiber::ptr(new Fiber(f, 0, use_caller));
-            thread = thr;
-        }
-
-        ~ScheduleTask() {
-            SYLAR_FMT_DEBUG("schedule rask destoried, fiber id: %d", fiber->get_id());
-        }
-
-        /**
-         * @brief reset fiber
-         * @param f fiber 
-         * @param thr thread id
-         */
-        void reset(Fiber::ptr f, int thr) {
-            fiber->yield();
-            fiber.swap(f);
-            thread = thr;
-        }
-
-        /**
-         * @brief reset fiber
-         * @param f fiber 
-         * @param thr thread id
-         */
-        void reset(std::function<void()> f, int thr = -1) {
-            fiber->reset(f);
-            thread = thr;
-        }
-
-        /**
-         * @brief execute fiber
-         */
-        void execute() {
-            if (fiber != nullptr)
-                fiber->resume();
-        }
+        ScheduleTask(Task f, int thr): cb(std::move(f)), thread(thr) {}
 
         /// execute fiber
-        Fiber::ptr fiber;
+        Fiber::ptr fiber {};
+        /// execute func, run on a fiber of worker
+        Task cb {};
         /// thread id
-        int thread {0};
+        int thread {-1};
+        /// scheduling class
+        int priority {NORMAL};
     };
 
 private:
@@ -161,13 +230,28 @@ private:
     /**
      * @brief push task into list end
      * @param task append task
+     * @param priority scheduling class
+     */
+    void task_push(ScheduleTask&& task, Priority priority);
+
+    /**
+     * @brief push task into queue of its class, mutex must be hold
+     * @return 1 if pushed, 0 if task is empty
+     */
+    size_t task_push_locked(ScheduleTask&& task, Priority priority);
+
+    /**
+     * @brief wake idle workers for new tasks
+     * @param count tickles, min of tasks added and idle workers
      */
-    void task_push(ScheduleTask::ptr task);
+    void wake(size_t count);
 
     /**
-     * @brief pop task from end, if task is empty, call idle fiber
+     * @brief pop task from front, if task is empty, call idle fiber
+     * @param[out] task poped task
+     * @return false if nothing is poped
      */
-    ScheduleTask::ptr task_pop();
+    bool task_pop(ScheduleTask& task);
 
 private:
     /// scheduler name 
@@ -176,8 +260,16 @@ private:
     int thread_num_ {0};
     /// thread pool
     std::vector<Thread::ptr> threads_;
-    /// schedule task list
-    std::list<ScheduleTask::ptr> tasks_;
+    /// schedule task list of each class
+    std::deque<ScheduleTask> tasks_[INHERIT];
+    /// queued tasks of all classes
+    size_t task_count_ {0};
+    /// workers in idle, only they need tickle
+    size_t idle_workers_ {0};
+    /// virtual time of each class, least one with tasks is picked next
+    uint64_t passes_[INHERIT] {0, 0, 0};
+    /// virtual time of last pick, class becoming busy start from it
+    uint64_t pass_ {0};
     /// thread id vector
     std::vector<int> thread_ids_;
     /// use main thread as caller
@@ -6,6 +6,7 @@
 
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -40,11 +41,16 @@ Socket::ptr Socket::create_udp_socket6() {
     return Socket::ptr(new Socket(AF_INET6, Type::UDP, IPPROTO_UDP));
 }
 
-Socket::Socket(int family, int type, int protocol):
+Socket::Socket(int family, int type, int protocol, int fd):
 family_(family), type_(type), protocol_(protocol) {
-    // TODO: maybe dont need to call socket func here
+    // accepted fd is already connected
+    if (fd != -1) {
+        fd_ = fd;
+        connected_ = true;
+        return;
+    }
     // create socket
-    int fd_ = socket(family, family, protocol);
+    fd_ = socket(family, type, protocol);
     // should check if create success here
     if (fd_ == -1) {
         SYLAR_FMT_ERR("create socket failed, family: %d, type: %d, protocol: %d, err: %s",
@@ -60,19 +66,16 @@ Socket::~Socket() {
 
 // socket accept
 Socket::ptr Socket::accept() {
-    struct sockaddr addr;
-    socklen_t len;
-    int accept_fd = ::accept(fd_, &addr, &len);
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int accept_fd = ::accept(fd_, (sockaddr*)&addr, &len);
     if (accept_fd == -1) {
         SYLAR_FMT_ERR("accept socket failed, fd: %d, err: %s", fd_, strerror(errno));
         return nullptr;
     }
     // create socket obj
-    Socket::ptr sd;
-    sd->family_ = addr.sa_family;
-    sd->type_ = Type::TCP;
-    sd->protocol_ = IPPROTO_TCP;
-    sd->remote_addr_ = Address::create(&addr, len);
+    Socket::ptr sd(new Socket(addr.ss_family, Type::TCP, IPPROTO_TCP, accept_fd));
+    sd->remote_addr_ = Address::create((sockaddr*)&addr, len);
     SYLAR_FMT_DEBUG("accept from remote success, fd: %d, remote addr: %s",
         accept_fd, sd->remote_addr_->to_string().c_str());
     return sd;
@@ -105,13 +108,19 @@ bool Socket::listen(int count) {
 }
 
 // client try to connect to server
-bool Socket::connect(Address::ptr addr) {
-    // connect to server
-    if (::connect(fd_, addr->get_sockaddr(), addr->get_sockaddr_len()) == -1) {
+bool Socket::connect(Address::ptr addr, uint64_t timeout_ms) {
+    // blocking connect is bounded by send timeout on linux
+    if (timeout_ms > 0)
+        set_send_timeout(timeout_ms);
+    int rt = ::connect(fd_, addr->get_sockaddr(), addr->get_sockaddr_len());
+    if (timeout_ms > 0)
+        set_send_timeout(0);
+    if (rt == -1) {
         SYLAR_FMT_ERR("connect to server failed, fd: %d, server: %s, err: %s", 
             fd_, addr->to_string().c_str(), strerror(errno));
         return false;
     }
+    remote_addr_ = addr;
     connected_ = true;
     SYLAR_FMT_DEBUG("connect socket success, fd: %d, server: %s", fd_, addr->to_string().c_str());
     return true;
@@ -138,7 +147,12 @@ int Socket::send(const iovec *vec, size_t count, int flags) {
         SYLAR_FMT_ERR("send vec failed, fd: %d, err: %s", fd_, "not connected yet");
         return -1;
     }
-    ssize_t size = ::send(fd_, vec, count, flags);
+    // gather write
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec*)vec;
+    msg.msg_iovlen = count;
+    ssize_t size = ::sendmsg(fd_, &msg, flags);
     if (size == -1) {
         SYLAR_FMT_ERR("send vec failed, fd: %d, err: %s", fd_, strerror(errno));
         return -1;
@@ -218,33 +232,66 @@ int Socket::recv_from(iovec *buf, size_t count, Address::ptr addr, int flags) {
 }
 
 void Socket::cancel_read() {
-    // check if need to del
-    if (SystemInfo::get_hook_enabled()) 
-        IOMgr::get_instance()->del_fd_event(fd_, IOManager::Event::READ);
+    // parked reader retry and see closed or ready fd
+    IOManager* iom = dynamic_cast<IOManager*>(Scheduler::get_this());
+    if (iom)
+        iom->wake_fd_event(fd_, IOManager::Event::READ);
 }
 
 void Socket::cancel_write() {
-    // check if need to del
-    if (SystemInfo::get_hook_enabled()) 
-        IOMgr::get_instance()->del_fd_event(fd_, IOManager::Event::WRITE);
+    IOManager* iom = dynamic_cast<IOManager*>(Scheduler::get_this());
+    if (iom)
+        iom->wake_fd_event(fd_, IOManager::Event::WRITE);
 }
 
 void Socket::cancel_all() {
-    // check if need to del
-    if (SystemInfo::get_hook_enabled()) {
-        IOMgr::get_instance()->del_fd_event(fd_, IOManager::Event::READ);
-        IOMgr::get_instance()->del_fd_event(fd_, IOManager::Event::WRITE);
+    cancel_read();
+    cancel_write();
+}
+
+bool Socket::set_recv_timeout(uint64_t timeout_ms) {
+    struct timeval val = {
+        .tv_sec = (time_t)(timeout_ms / 1000),
+        .tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000),
+    };
+    if (setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &val, sizeof(val)) == -1) {
+        SYLAR_FMT_ERR("set socket recv timeout failed, fd: %d, err: %s", fd_, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool Socket::set_send_timeout(uint64_t timeout_ms) {
+    struct timeval val = {
+        .tv_sec = (time_t)(timeout_ms / 1000),
+        .tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000),
+    };
+    if (setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &val, sizeof(val)) == -1) {
+        SYLAR_FMT_ERR("set socket send timeout failed, fd: %d, err: %s", fd_, strerror(errno));
+        return false;
     }
+    return true;
+}
+
+bool Socket::shutdown(int how) {
+    if (fd_ == -1)
+        return false;
+    if (::shutdown(fd_, how) == -1) {
+        SYLAR_FMT_DEBUG("shutdown socket failed, fd: %d, err: %s", fd_, strerror(errno));
+        return false;
+    }
+    return true;
 }
 
 bool Socket::close() {
     // check if is valid
     SYLAR_FMT_DEBUG("close fd: %d", fd_);
-    if (!connected_ || fd_ == -1)
-        return true;
     connected_ = false;
-    if (fd_ != -1)
+    // socket never connected still own its fd
+    if (fd_ != -1) {
         ::close(fd_);
+        fd_ = -1;
+    }
     return true;
 }
 
@@ -4,6 +4,7 @@
 #include "address.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #include <sys/socket.h>
@@ -76,8 +77,9 @@ public:
      * @param[in] family family
      * @param[in] type socket tye
      * @param[in] protocol socket protocol
+     * @param[in] fd connected fd to take over, -1 to create new one
      */
-    Socket(int family, int type, int protocol = 0);
+    Socket(int family, int type, int protocol = 0, int fd = -1);
 
     /**
      * @brief Destroy the virtual Socket object
@@ -104,8 +106,21 @@ public:
     /**
      * @brief client try to connect remote
      * @param[in] addr server addr 
+     * @param[in] timeout_ms connect timeout in ms, 0 means system default
      */
-    bool connect(Address::ptr addr);
+    bool connect(Address::ptr addr, uint64_t timeout_ms = 0);
+
+    /**
+     * @brief Set the recv timeout object
+     * @param[in] timeout_ms timeout in ms, 0 means never
+     */
+    bool set_recv_timeout(uint64_t timeout_ms);
+
+    /**
+     * @brief Set the send timeout object
+     * @param[in] timeout_ms timeout in ms, 0 means never
+     */
+    bool set_send_timeout(uint64_t timeout_ms);
 
     /**
      * @brief send buffer to tcp type socket
@@ -176,17 +191,20 @@ public:
     int recv_from(iovec *buf, size_t count, Address::ptr addr, int flags = 0);
 
     /**
-     * @brief cancel read from fd, if read is overwrite by hook
+     * @brief cancel read from fd, fiber parked in hooked read retry it
+     * @details only io manager of calling thread is checked, do nothing
+     *          outside io manager
      */
     void cancel_read();
 
     /**
-     * @brief cancel write from fd, if read is overwrite by hook
+     * @brief cancel write from fd, fiber parked in hooked write retry it
+     * @details only io manager of calling thread is checked
      */
     void cancel_write();
 
     /**
-     * @brief cancel all from fd, if read is overwrite by hook
+     * @brief cancel all from fd, parked fibers retry their io
      */
     void cancel_all();
 
@@ -210,6 +228,12 @@ public:
      */
     bool close();
 
+    /**
+     * @brief shutdown socket, blocked recv return 0 after SHUT_RD
+     * @param[in] how SHUT_RD, SHUT_WR or SHUT_RDWR
+     */
+    bool shutdown(int how = SHUT_RDWR);
+
 public:
     /**
      * @brief Get the fd object
@@ -233,7 +257,7 @@ public:
 
 private:
     /// file descriptor
-    int fd_ {0};
+    int fd_ {-1};
     /// fd family
     int family_ {0};
     /// fd type
@@ -1,6 +1,10 @@
 #include "socket_stream.h"
 #include "../log.h"
+#include <cerrno>
 #include <cstddef>
+#include <cstring>
+
+#include <sys/sendfile.h>
 
 namespace sylar {
 
@@ -17,7 +21,7 @@ SocketStream::~SocketStream() {
 
 int SocketStream::read(void* buf, size_t length) {
     // check if already connected
-    if (is_connected()) 
+    if (!is_connected()) 
         return -1;
     return sock_->recv(buf, length);
 }
@@ -30,11 +34,55 @@ int SocketStream::read(ByteArray::ptr arr, size_t length) {
 }
 
 int SocketStream::write(const void* buf, size_t length) {
-    if (is_connected()) 
+    if (!is_connected()) 
         return -1;
     return sock_->send(buf, length);
 }
 
+int SocketStream::writev_fix_size(iovec* iov, size_t count) {
+    if (!is_connected()) 
+        return -1;
+    size_t total = 0;
+    while (count > 0) {
+        int size = sock_->send(iov, count);
+        if (size <= 0) 
+            return size;
+        total += size;
+        // skip iovec already sent
+        size_t left = size;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        // partial sent iovec
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return total;
+}
+
+int64_t SocketStream::sendfile_fix_size(int fd, off_t offset, size_t length) {
+    if (!is_connected()) 
+        return -1;
+    size_t left = length;
+    while (left > 0) {
+        // hooked sendfile on io manager worker park fiber while socket buffer is full
+        ssize_t size = ::sendfile(sock_->get_fd(), fd, &offset, left);
+        if (size == -1 && errno == EINTR)
+            continue;
+        if (size <= 0) {
+            SYLAR_FMT_ERR("sendfile failed, fd: %d, err: %s", sock_->get_fd(), 
+                size == 0 ? "file truncated" : strerror(errno));
+            return size;
+        }
+        left -= size;
+    }
+    return length;
+}
+
 int SocketStream::write(const ByteArray::ptr arr, size_t length) {
     if (is_connected()) 
         return -1;
@@ -6,6 +6,7 @@
 
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 
 
@@ -56,6 +57,22 @@ public:
      */
     virtual int write(const ByteArray::ptr arr, size_t length) override;
 
+    /**
+     * @brief gather write all iovec to socket
+     * @param[in] iov iovec array, modified when partial sent
+     * @param[in] count iovec count
+     */
+    int writev_fix_size(iovec* iov, size_t count);
+
+    /**
+     * @brief send file content to socket by sendfile, no user space copy
+     * @param[in] fd file fd
+     * @param[in] offset file offset
+     * @param[in] length send length
+     * @return bytes sent, or <= 0 when failed
+     */
+    int64_t sendfile_fix_size(int fd, off_t offset, size_t length);
+
     /**
      * @brief close stream
      */
@@ -66,6 +83,11 @@ public:
      */
     bool is_connected() { return sock_->is_connected(); }
 
+    /**
+     * @brief Get the socket object
+     */
+    Socket::ptr get_socket() { return sock_; }
+
     /**
      * @brief Get the remote addr object
      */
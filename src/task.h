@@ -0,0 +1,181 @@
+#ifndef __SYLAR_SRC_TASK_H__
+#define __SYLAR_SRC_TASK_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+/**
+ * @brief is std::function, which may be empty
+ */
+template<typename F>
+struct is_std_function : std::false_type {};
+
+template<typename R, typename... Args>
+struct is_std_function<std::function<R(Args...)>> : std::true_type {};
+
+/**
+ * @brief move only void() callable with inline storage
+ * @details replace std::function on task path. callable up to 48 bytes
+ *          which is nothrow movable, such as lambda capturing a few
+ *          pointers, shared_ptr or std::function, is kept inline without
+ *          allocation. bigger one is moved to heap. whole object is one
+ *          cache line
+ */
+class Task {
+public:
+    /**
+     * @brief Construct a new Task object, empty
+     */
+    Task() {}
+
+    /**
+     * @brief Construct a new Task object, empty
+     */
+    Task(std::nullptr_t) {}
+
+    /**
+     * @brief Construct a new Task object from callable
+     * @param[in] f callable, moved in if it is rvalue
+     */
+    template<typename F, typename Fn = std::decay_t<F>,
+        typename = std::enable_if_t<!std::is_same_v<Fn, Task> && std::is_invocable_v<Fn&>>>
+    Task(F&& f) {
+        // empty std::function or function pointer stay empty, function
+        // reference is never null
+        if constexpr (std::is_pointer_v<std::remove_reference_t<F>> || is_std_function<Fn>::value) {
+            if (!static_cast<bool>(f))
+                return;
+        }
+        if constexpr (s_inline<Fn>) {
+            new (&storage_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::ops;
+        } else {
+            *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+
+    /**
+     * @brief Construct a new Task object, take callable of other
+     */
+    Task(Task&& other) noexcept { take(other); }
+
+    /**
+     * @brief move assign, current callable is destroyed
+     */
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief destroy callable
+     */
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    /**
+     * @brief Destroy the Task object
+     */
+    ~Task() { reset(); }
+
+    /**
+     * @brief call, must not be empty
+     */
+    void operator()() { ops_->invoke(&storage_); }
+
+    /**
+     * @brief not empty
+     */
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    /**
+     * @brief destroy callable, become empty
+     */
+    void reset() {
+        if (!ops_)
+            return;
+        ops_->destroy(&storage_);
+        ops_ = nullptr;
+    }
+
+private:
+    /// inline storage size
+    static constexpr size_t s_size = 48;
+
+    /// callable kept inline, moving task move it
+    template<typename F>
+    static constexpr bool s_inline = sizeof(F) <= s_size && alignof(F) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<F>;
+
+    /**
+     * @brief operations of stored callable type
+     */
+    struct Ops {
+        /// call
+        void (*invoke)(void* storage);
+        /// move to empty storage, source is destroyed
+        void (*move)(void* dst, void* src);
+        /// destroy
+        void (*destroy)(void* storage);
+    };
+
+    /**
+     * @brief callable in storage
+     */
+    template<typename F>
+    struct InlineOps {
+        static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+        static inline const Ops ops {&invoke, &move, &destroy};
+    };
+
+    /**
+     * @brief pointer to callable in storage
+     */
+    template<typename F>
+    struct HeapOps {
+        static void invoke(void* storage) { (**static_cast<F**>(storage))(); }
+        static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+        static void destroy(void* storage) { delete *static_cast<F**>(storage); }
+        static inline const Ops ops {&invoke, &move, &destroy};
+    };
+
+    /**
+     * @brief take callable of other, current must be empty
+     */
+    void take(Task& other) {
+        if (!other.ops_)
+            return;
+        other.ops_->move(&storage_, &other.storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+    }
+
+private:
+    /// callable or pointer to it
+    alignas(std::max_align_t) unsigned char storage_[s_size];
+    /// operations, nullptr if empty
+    const Ops* ops_ {nullptr};
+};
+
+}
+
+#endif
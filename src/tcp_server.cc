@@ -61,7 +61,7 @@ bool TcpServer::start() {
     }
     running_ = true;
     for (auto sock : sockets_)
-        accept_worker_->schedule(std::bind(&TcpServer::start_accept, this, sock));
+        accept_worker_->schedule(std::bind(&TcpServer::start_accept, this, sock), -1, priority_);
     SYLAR_DEBUG("tcp server start");
     return true;
 }
@@ -71,9 +71,13 @@ bool TcpServer::stop() {
         SYLAR_WARN("tcp server is already stopped");
         return false;
     }
+    running_ = false;
     for (auto sock : sockets_) {
-        sock->cancel_all();
+        int fd = sock->get_fd();
         sock->close();
+        // accept fiber parked in accept worker retry and fail on closed fd
+        if (accept_worker_)
+            accept_worker_->wake_fd_event(fd, IOManager::Event::READ);
     }
     SYLAR_DEBUG("tcp server stop");
     return true;
@@ -88,7 +92,7 @@ void TcpServer::start_accept(Socket::ptr sock) {
         // accept
         Socket::ptr client = sock->accept();
         if (client) {
-            io_worker_->schedule(std::bind(&TcpServer::handle_client, this, client));
+            io_worker_->schedule(std::bind(&TcpServer::handle_client, this, client), -1, priority_);
         }
     }
 }
@@ -66,6 +66,19 @@ public:
      */
     virtual std::string get_name() { return name_; }
 
+    /**
+     * @brief Set the priority object, scheduling class of connections
+     * @details accept and client fibers run in it, fibers they spawn
+     *          inherit it. call before start
+     * @param[in] priority scheduling class
+     */
+    void set_priority(Scheduler::Priority priority) { priority_ = priority; }
+
+    /**
+     * @brief Get the priority object
+     */
+    Scheduler::Priority get_priority() { return priority_; }
+
 protected:
     /**
      * @brief handle connect socket
@@ -79,6 +92,11 @@ protected:
      */
     virtual void start_accept(Socket::ptr sock);
 
+    /**
+     * @brief Get the io worker object, client is handled on it
+     */
+    IOManager::ptr get_io_worker() { return io_worker_; }
+
 private:
     /// socket vec
     std::vector<Socket::ptr> sockets_;
@@ -92,6 +110,8 @@ private:
     int type_ {0};
     /// running state
     bool running_ {false};
+    /// scheduling class of connections
+    Scheduler::Priority priority_ {Scheduler::NORMAL};
 };
 
 
@@ -1,7 +1,12 @@
 #include "thread.h"
 #include "log.h"
+#include "utils.h"
 #include <cstring>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 namespace sylar {
 
@@ -19,10 +24,27 @@ void Thread::run() {
     // check if thread is already in running state
     if (running_) 
         return;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    // pinned before start, stack and thread locals are touched there first
+    if (!cpus_.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus_) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
     // create thread
-    int err = pthread_create(&thread_id_, nullptr, wrap, this);
+    int err = pthread_create(&thread_id_, &attr, wrap, this);
+    if (err == EINVAL && !cpus_.empty()) {
+        SYLAR_FMT_ERR("pin thread failed, thread name: %s, run unpinned", name_.c_str());
+        err = pthread_create(&thread_id_, nullptr, wrap, this);
+    }
+    pthread_attr_destroy(&attr);
     if (err != 0)
-        SYLAR_FMT_ERR("create failed, thread name: %s, err: %s", name_.c_str(), strerror(errno));
+        SYLAR_FMT_ERR("create failed, thread name: %s, err: %s", name_.c_str(), strerror(err));
     running_ = true;
     SYLAR_FMT_INFO("create thread id: %ld", thread_id_);
 }
@@ -54,6 +76,25 @@ void Thread::reset(std::function<void(void)>cb, const std::string & name) {
     name_ = name;
 }
 
+// prefer numa node of pinned cpus for memory touched later
+static void prefer_local_node(const std::vector<int>& cpus) {
+    int node = SystemInfo::get_cpu_node(cpus[0]);
+    for (int cpu : cpus) {
+        if (SystemInfo::get_cpu_node(cpu) != node)
+            return;
+    }
+    // unknown or single node, nothing to prefer
+    if (node < 0 || access("/sys/devices/system/node/node1", F_OK) != 0)
+        return;
+    unsigned long mask[16] = {0};
+    if (node >= (int)(sizeof(mask) * 8))
+        return;
+    mask[node / 64] |= 1ul << (node % 64);
+    // preferred, not bound, allocation fall back when node is full
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1) != 0)
+        SYLAR_FMT_ERR("set mempolicy failed, node: %d, error: %s", node, strerror(errno));
+}
+
 void *Thread::wrap(void *arg) {
     // convert 
     auto thread =  static_cast<Thread*>(arg);
@@ -61,10 +102,13 @@ void *Thread::wrap(void *arg) {
         SYLAR_FMT_ERR("convert thread failed, %s", "static cast");
         return (void*)1;
     }
-    // set thread name
-    int err = pthread_setname_np(thread->thread_id_, thread->name_.c_str());
+    thread->proc_id_.store(syscall(SYS_gettid));
+    // set thread name, kernel keep 15 chars
+    int err = pthread_setname_np(pthread_self(), thread->name_.substr(0, 15).c_str());
     if (err != 0) 
-        SYLAR_FMT_ERR("set thread name failed, thread id: %d, error: %s", thread->thread_id_, strerror(errno));
+        SYLAR_FMT_ERR("set thread name failed, thread name: %s, error: %s", thread->name_.c_str(), strerror(err));
+    if (!thread->cpus_.empty())
+        prefer_local_node(thread->cpus_);
     if (thread->cb_)
         thread->cb_();
     return (void*)1;
@@ -3,10 +3,14 @@
 
 #include "log.h"
 
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <string>
+#include <vector>
 
 #include <pthread.h>
+#include <sys/types.h>
 
 
 namespace sylar {
@@ -60,6 +64,25 @@ public:
      */
     const std::string get_thread_name() { return name_; }
 
+    /**
+     * @brief Get the proc id object, kernel thread id
+     * @return 0 if thread has not started yet
+     */
+    pid_t get_proc_id() { return proc_id_; }
+
+    /**
+     * @brief Set the cpus object, pin thread to cpus, call before run
+     * @details thread is created on these cpus, memory it touch first is
+     *          preferred on their numa node when they share one
+     * @param[in] cpus cpu list, empty for no pinning
+     */
+    void set_cpus(const std::vector<int>& cpus) { cpus_ = cpus; }
+
+    /**
+     * @brief Get the cpus object
+     */
+    const std::vector<int>& get_cpus() { return cpus_; }
+
     /**
      * @brief check if thread id is equal
      */
@@ -80,8 +103,10 @@ private:
     std::string name_ {""};
     /// thread id
     pthread_t thread_id_ {0};
-    /// proc id
-    pid_t proc_id {0};
+    /// kernel thread id
+    std::atomic<pid_t> proc_id_ {0};
+    /// cpus to pin, empty for no pinning
+    std::vector<int> cpus_ {};
     /// running state
     bool running_ {false};
 };
@@ -15,31 +15,48 @@ namespace sylar {
 
 
 Timer::Timer(uint64_t inter, bool recurring, std::function<void()> cb, TimerManager* mgr, std::string name): 
-    recurring_(recurring), cb_(cb), timer_mgr_(mgr), name_(name) {
+    recurring_(recurring), interval_(inter), cb_(cb), name_(name), timer_mgr_(mgr) {
     ms_ = SystemInfo::get_elapsed() + inter;
     SYLAR_FMT_DEBUG("create timer, name: %s, time: %ld", name_.c_str(), inter);
 }
 
-void Timer::cancel() {
+bool Timer::cancel() {
     SYLAR_FMT_DEBUG("cancel timer, name: %s", name_.c_str());
-    if (timer_mgr_)
-        timer_mgr_->del_timer(shared_from_this());
+    if (!timer_mgr_)
+        return false;
+    TimerManager::MutexType::Lock lock(timer_mgr_->mutex_);
+    if (!cb_)
+        return false;
+    cb_ = nullptr;
+    timer_mgr_->timers_.erase(shared_from_this());
+    return true;
 }
 
-void Timer::reset(uint64_t inter) {
-    ms_ = SystemInfo::get_elapsed() + inter;
+bool Timer::reset(uint64_t inter) {
     SYLAR_FMT_DEBUG("reset timer, name: %s, time: %ld", name_.c_str(), inter);
-    if (timer_mgr_) {
-        // TODO: could optimize here
-        timer_mgr_->del_timer(shared_from_this());
-        timer_mgr_->add_timer(shared_from_this());
+    if (!timer_mgr_)
+        return false;
+    bool at_front = false;
+    {
+        TimerManager::MutexType::Lock lock(timer_mgr_->mutex_);
+        if (!cb_)
+            return false;
+        // key must not change while timer is in set
+        auto it = timer_mgr_->timers_.find(shared_from_this());
+        if (it == timer_mgr_->timers_.end())
+            return false;
+        timer_mgr_->timers_.erase(it);
+        interval_ = inter;
+        ms_ = SystemInfo::get_elapsed() + inter;
+        at_front = timer_mgr_->insert_timer(shared_from_this());
     }
+    if (at_front)
+        timer_mgr_->on_timer_inserted_at_front();
+    return true;
 }
 
 TimerManager::TimerManager() {
     SYLAR_DEBUG("timer manager is created");
-    // clear all timers
-    timers_.clear();
 }
 
 TimerManager::~TimerManager() {
@@ -47,67 +64,85 @@ TimerManager::~TimerManager() {
 }
 
 bool TimerManager::empty() {
-    // read lock here
-    MutexType::ReadLock lock(mutex_);
+    MutexType::Lock lock(mutex_);
     return timers_.empty();
 }
 
-void TimerManager::add_timer(uint64_t ms, bool recurring, std::function<void()> cb, std::string name) {
-    // write lock 
-    MutexType::WriteLock lock(mutex_);
-    // add to set
-    timers_.emplace(new Timer(ms, recurring, cb, this, name));
+Timer::ptr TimerManager::add_timer(uint64_t ms, bool recurring, std::function<void()> cb, std::string name) {
+    Timer::ptr timer(new Timer(ms, recurring, cb, this, name));
+    add_timer(timer);
+    return timer;
 }
 
 void TimerManager::add_timer(Timer::ptr timer) {
-    // write lock 
-    MutexType::WriteLock lock(mutex_);
-    timers_.insert(timer);
+    bool at_front = false;
+    {
+        MutexType::Lock lock(mutex_);
+        at_front = insert_timer(timer);
+    }
+    // wake waiter outside lock, it will take timers
+    if (at_front)
+        on_timer_inserted_at_front();
+}
+
+bool TimerManager::insert_timer(Timer::ptr timer) {
+    auto it = timers_.insert(timer).first;
+    return it == timers_.begin();
 }
 
 void TimerManager::del_timer(Timer::ptr timer) {
-    // write lock
-    MutexType::WriteLock lock(mutex_);
+    MutexType::Lock lock(mutex_);
     timers_.erase(timer);
 }
 
 // condition execute
-static void OnTimer(std::shared_ptr<void> cond, std::function<void()> cb) {
+static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
+    std::shared_ptr<void> cond = weak_cond.lock();
     if (cond) 
         cb();
 }
 
+uint64_t TimerManager::get_next_timer() {
+    MutexType::Lock lock(mutex_);
+    if (timers_.empty())
+        return ~0ull;
+    uint64_t ms_now = SystemInfo::get_elapsed();
+    uint64_t next = (*timers_.begin())->ms_;
+    return next <= ms_now ? 0 : next - ms_now;
+}
+
 // list all expired cb
-void TimerManager::list_expired_cb(std::vector<std::function<void()>> cbs) {
+void TimerManager::list_expired_cb(std::vector<std::function<void()>>& cbs) {
     // get current time
     uint64_t ms_now = SystemInfo::get_elapsed();
-    if (empty()) {
-        cbs.clear();
+    MutexType::Lock lock(mutex_);
+    if (timers_.empty() || (*timers_.begin())->ms_ > ms_now)
         return;
+    std::vector<Timer::ptr> expired;
+    auto it = timers_.begin();
+    while (it != timers_.end() && (*it)->ms_ <= ms_now)
+        expired.push_back(*it++);
+    timers_.erase(timers_.begin(), it);
+    cbs.reserve(cbs.size() + expired.size());
+    for (auto& timer : expired) {
+        cbs.push_back(timer->cb_);
+        if (timer->recurring_) {
+            // next round is counted from now, missed rounds are not made up
+            timer->ms_ = ms_now + timer->interval_;
+            timers_.insert(timer);
+        } else {
+            // fired timer could not be cancelled or reset
+            timer->cb_ = nullptr;
+        }
     }
-    // lock 
-    std::vector<Timer::ptr> expired {};
-    MutexType::ReadLock lock(mutex_);
-    Timer::ptr now_timer(new Timer(ms_now));
-    // search for the last place
-    auto pos = timers_.upper_bound(now_timer);
-    std::copy(timers_.begin(), timers_.end(), std::back_inserter(expired));
-    cbs.reserve(expired.size());
-    // add to end
-    std::transform(expired.cbegin(), expired.cend(), std::back_inserter(cbs), 
-        [](Timer::ptr timer) { return timer->cb_; });
-    // check if need to repush to timer
-    // TODO: low speed algorithm here
-    timers_.erase(pos, timers_.end());
-    timers_.insert(expired.cbegin(), expired.cend());
 }
 
 // add condition
-void TimerManager::add_condition_timer(uint64_t ms, bool recurring, std::shared_ptr<void> cond, 
+Timer::ptr TimerManager::add_condition_timer(uint64_t ms, bool recurring, std::weak_ptr<void> cond, 
     std::function<void ()> cb, std::string name) {
     // use wrap func
     auto func_wrap = std::bind(&OnTimer, cond, cb);
-    add_timer(ms, recurring, func_wrap, name);
+    return add_timer(ms, recurring, func_wrap, name);
 }
 
 
@@ -25,14 +25,22 @@ public:
 
     /**
      * @brief cancel this timer
+     * @return false if timer already fired or cancelled
      */
-    void cancel();
+    bool cancel();
 
     /**
-     * @brief reset this timer to time
-     * @param inter time seconds
+     * @brief reset this timer to time from now
+     * @param inter time ms
+     * @return false if timer already fired or cancelled
      */
-    void reset(uint64_t inter);
+    bool reset(uint64_t inter);
+
+    /**
+     * @brief restart this timer with its interval from now
+     * @return false if timer already fired or cancelled
+     */
+    bool refresh() { return reset(interval_); }
 
 private:
     /**
@@ -46,13 +54,13 @@ private:
 
 private:
     /**
-     * @brief compare timer to set
+     * @brief compare timer to set, timers of same time ordered by address
      */
     struct Comparator {
-        bool operator() (const Timer::ptr first, const Timer::ptr second) const {
-            if (first->ms_ > second->ms_) 
-                return false;
-            return true;
+        bool operator() (const Timer::ptr& first, const Timer::ptr& second) const {
+            if (first->ms_ != second->ms_)
+                return first->ms_ < second->ms_;
+            return first.get() < second.get();
         }
     };
 
@@ -60,6 +68,8 @@ private:
     /// time recurring
     bool recurring_ {false};
     /// execute time interval
+    uint64_t interval_ {0};
+    /// next execute time, elapsed ms
     uint64_t ms_ {0};
     /// timeout callback
     std::function<void()> cb_ {nullptr};
@@ -71,11 +81,12 @@ private:
 
 
 // timer manager
-class TimerManager : virtual public std::enable_shared_from_this<TimerManager> {
+class TimerManager {
 public: 
+    friend class Timer;
     typedef std::shared_ptr<TimerManager> ptr;
     typedef std::weak_ptr<TimerManager> weak_ptr;
-    typedef RWMutex MutexType;
+    typedef Spinlock MutexType;
 
     /**
      * @brief Construct a new Timer Manager object
@@ -85,7 +96,7 @@ public:
     /**
      * @brief Destroy the Timer Manager object
      */
-    ~TimerManager();
+    virtual ~TimerManager();
 
     /**
      * @brief add timer to this manager
@@ -93,8 +104,9 @@ public:
      * @param[in] recurring if time need recurring 
      * @param[in] cb callback
      * @param[in] name timer name
+     * @return timer, could be cancelled
      */
-    void add_timer(uint64_t ms, bool recurring, std::function<void()> cb, std::string name);
+    Timer::ptr add_timer(uint64_t ms, bool recurring, std::function<void()> cb, std::string name = "");
 
     /**
      * @brief add timer to this manager
@@ -109,38 +121,55 @@ public:
     void del_timer(Timer::ptr timer);
 
     /**
-     * @brief 
-     * @param[in] ms 
-     * @param[in] recurring 
-     * @param[in] cond 
-     * @param[in] cb 
-     * @param[in] name 
+     * @brief add timer which only fire while condition is alive
+     * @param[in] ms time
+     * @param[in] recurring if time need recurring
+     * @param[in] cond condition, callback is skipped once it is released
+     * @param[in] cb callback
+     * @param[in] name timer name
+     * @return timer, could be cancelled
+     */
+    Timer::ptr add_condition_timer(uint64_t ms, bool recurring, std::weak_ptr<void> cond, 
+        std::function<void()> cb, std::string name = "");
+
+    /**
+     * @brief take callbacks of expired timers, recurring timers are added again
+     * @param[out] cbs expired callback appended to
      */
-    void add_condition_timer(uint64_t ms, bool recurring, std::shared_ptr<void> cond, 
-        std::function<void()> cb, std::string name);
+    void list_expired_cb(std::vector<std::function<void()>>& cbs);
 
     /**
-     * @brief list all expired callback
-     * @param[out] cbs expired callback
+     * @brief ms until next timer expire
+     * @return ~0ull if no timer, 0 if already expired
      */
-    void list_expired_cb(std::vector<std::function<void()>> cbs);
+    uint64_t get_next_timer();
 
     /**
      * @brief if current timer include elem
      */
     bool empty();
 
+protected:
+    /**
+     * @brief new timer is the earliest one, waiter should wake to rearm
+     */
+    virtual void on_timer_inserted_at_front() {}
+
+private:
+    /**
+     * @brief insert timer, lock must be hold
+     * @return true if timer become the earliest one
+     */
+    bool insert_timer(Timer::ptr timer);
+
 private:
     /// rwlock 
     MutexType mutex_ {};
     /// timer set
-    std::multiset<Timer::ptr, Timer::Comparator> timers_;
-    /// last timeout time
-    uint64_t prev_time_ {0};
+    std::set<Timer::ptr, Timer::Comparator> timers_;
 };
 
 
-
 }
 
 #endif
\ No newline at end of file
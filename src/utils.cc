@@ -2,15 +2,18 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <ios>
 #include <string>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
 
 namespace sylar {
 
-static bool is_hook_enabled = false;
+static thread_local bool is_hook_enabled = false;
 
 static const char uri_chars[256] = {
     /* 0 */
@@ -147,6 +150,93 @@ std::string StringUtils::time_format(time_t ts, const std::string& format) {
     return buf;
 }
 
+static inline uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// process one 64 bytes block
+static void sha1_block(uint32_t* state, const uint8_t* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16
+            | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    for (int i = 16; i < 80; i++)
+        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+std::string StringUtils::sha1(const std::string& data) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    const uint8_t* p = (const uint8_t*)data.data();
+    size_t left = data.size();
+    for (; left >= 64; left -= 64, p += 64)
+        sha1_block(state, p);
+    // padding with 0x80, zeros and 64 bits big endian bit length
+    uint8_t tail[128] = {0};
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_size = left < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)data.size() * 8;
+    for (int i = 0; i < 8; i++)
+        tail[tail_size - 1 - i] = (uint8_t)(bits >> (i * 8));
+    for (size_t i = 0; i < tail_size; i += 64)
+        sha1_block(state, tail + i);
+    std::string digest(20, '\0');
+    for (int i = 0; i < 20; i++)
+        digest[i] = (char)(state[i / 4] >> (24 - (i % 4) * 8));
+    return digest;
+}
+
+std::string StringUtils::base64_encode(const void* data, size_t length) {
+    static const char* s_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t* p = (const uint8_t*)data;
+    std::string out;
+    out.reserve((length + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t v = (uint32_t)p[i] << 16 | (uint32_t)p[i + 1] << 8 | p[i + 2];
+        out.push_back(s_table[v >> 18]);
+        out.push_back(s_table[(v >> 12) & 0x3F]);
+        out.push_back(s_table[(v >> 6) & 0x3F]);
+        out.push_back(s_table[v & 0x3F]);
+    }
+    if (i < length) {
+        uint32_t v = (uint32_t)p[i] << 16 | (i + 1 < length ? (uint32_t)p[i + 1] << 8 : 0);
+        out.push_back(s_table[v >> 18]);
+        out.push_back(s_table[(v >> 12) & 0x3F]);
+        out.push_back(i + 1 < length ? s_table[(v >> 6) & 0x3F] : '=');
+        out.push_back('=');
+    }
+    return out;
+}
+
 // save to file
 bool FileUtils::save_to_file(const std::string &msg, const std::string &filepath) {
     std::ofstream file(filepath, std::ios_base::out | std::ios_base::binary);
@@ -164,7 +254,15 @@ bool FileUtils::load_from_file(std::string &msg, const std::string &filepath) {
     // check if open successfully
     if (!file.is_open())
         return false;
-    file >> msg;
+    // read whole file, operator >> stop at whitespace
+    file.seekg(0, std::ios_base::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios_base::beg);
+    if (size < 0)
+        return false;
+    msg.resize(size);
+    file.read(&msg[0], size);
+    msg.resize(file.gcount());
     file.close();
     return true;
 }
@@ -209,4 +307,62 @@ void SystemInfo::set_hook_enabled(bool enabled) {
     is_hook_enabled = enabled;
 }
 
-}
\ No newline at end of file
+std::vector<int> SystemInfo::parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        item = StringUtils::trim(item);
+        if (item.empty())
+            continue;
+        char* end = nullptr;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (end == item.c_str() || first < 0)
+            return {};
+        if (*end == '-') {
+            const char* begin = end + 1;
+            last = strtol(begin, &end, 10);
+            if (end == begin || last < first)
+                return {};
+        }
+        if (*end != '\0')
+            return {};
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus.push_back((int)cpu);
+    }
+    return cpus;
+}
+
+int SystemInfo::get_cpu_node(int cpu) {
+    // cpu directory has a nodeN link on numa kernels
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        return -1;
+    int node = -1;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int64_t SystemInfo::get_thread_migrations(pid_t tid) {
+    if (tid == 0)
+        tid = syscall(SYS_gettid);
+    std::ifstream file("/proc/self/task/" + std::to_string(tid) + "/sched");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 16, "se.nr_migrations") != 0)
+            continue;
+        size_t pos = line.find(':');
+        return pos == std::string::npos ? -1 : strtoll(line.c_str() + pos + 1, nullptr, 10);
+    }
+    return -1;
+}
+
+}
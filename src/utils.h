@@ -12,6 +12,7 @@
 #include <sstream>
 #include <string>
 #include <fstream>
+#include <vector>
 #include <unistd.h>
 
 namespace sylar {
@@ -53,6 +54,20 @@ public:
      * @param[in] format time format
      */
     static std::string time_format(time_t ts = time(0), const std::string& format = "%Y-%m-%d %H:%M:%S");
+
+    /**
+     * @brief sha1 digest
+     * @param[in] data input data
+     * @return 20 bytes raw digest
+     */
+    static std::string sha1(const std::string& data);
+
+    /**
+     * @brief base64 encode with padding
+     * @param[in] data input data
+     * @param[in] length data length
+     */
+    static std::string base64_encode(const void* data, size_t length);
 };
 
 // FileUtils use to operate file
@@ -96,15 +111,37 @@ public:
     static const std::string process_name();
 
     /**
-     * @brief Get the hook enabled object
+     * @brief Get the hook enabled object, of current thread
      */
     static bool get_hook_enabled();
 
     /**
-     * @brief Set the hook enabled object
+     * @brief Set the hook enabled object, of current thread
+     * @details io manager workers enable it, other threads call libc directly
      * @param[in] enabled 
      */
     static void set_hook_enabled(bool enabled);
+
+    /**
+     * @brief parse cpu list such as "0-3,8,10-11"
+     * @param[in] list cpu list, same format as taskset -c
+     * @return cpus, empty if list is invalid
+     */
+    static std::vector<int> parse_cpu_list(const std::string& list);
+
+    /**
+     * @brief Get the cpu node object, numa node of cpu
+     * @param[in] cpu cpu
+     * @return node, -1 if unknown
+     */
+    static int get_cpu_node(int cpu);
+
+    /**
+     * @brief Get the thread migrations object, times thread moved between cpus
+     * @param[in] tid kernel thread id, 0 for current thread
+     * @return migrations from /proc sched stats, -1 if not available
+     */
+    static int64_t get_thread_migrations(pid_t tid = 0);
 };
 
 